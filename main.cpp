@@ -8,12 +8,16 @@
  */
 
 #include "sha204/atsha204_actions.h"
+#include "sha204/sha204_cache.h"
+#include "sha204/sha204_provision.h"
+#include "sha204/atsha204_i2c.h"
 
 #include <fcntl.h>
 #include <cstdlib>
 #include <cstring>
 #include <unistd.h>             // close/write/read
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <linux/i2c-dev.h>
 
 #include <sstream>  // std::ostringstream
@@ -22,6 +26,9 @@
 
 #define I2C_BUS       "/dev/i2c-c"
 #define ATSHA204_ADDR  0x64
+// 已锁定芯片的config区缓存, 进程重启时只需读一次SN块验证. 目录只有本用户可写, 不能放在/tmp
+#define SHA204_CACHE_DIR   "/var/lib/sha204"
+#define SHA204_CACHE_FILE  SHA204_CACHE_DIR "/config.cache"
 
 
 void dump_config(uint8_t data[88]) {
@@ -69,14 +76,12 @@ void dump_config(uint8_t data[88]) {
 
 
 //*
-void atsha204_init(int fd) {
+// lock_status: 启动时config快照中的锁定字节, 不再单独读芯片
+void atsha204_init(int fd, const uint8_t lock_status[4]) {
     uint8_t status = SHA204_SUCCESS;
 
 
     // 验证锁定状态
-    uint8_t lock_status[4];
-    if (SHA204_SUCCESS != atsha204_read_lock(fd, lock_status)) return;
-
     if ((lock_status[0x02] == 0x00) && (lock_status[0x03] == 00)) {
         printf("加密芯片已锁定!\n");
         return;
@@ -109,62 +114,32 @@ void atsha204_init(int fd) {
             0xff, 0xff, 0xff, 0xff   //LastKeyUse 12 -15
     };
 
-    status = atsha204_write_config(fd, defconfig);
-    if (status != SHA204_SUCCESS) {
-        printf("FAILED p_2!\n");
-        return;
-    }
-
-    // **** LOCK THE CONFIGURATION ZONE.
-    status = atsha204_lock_conf(fd);
-    if (status != SHA204_SUCCESS) {
-        printf("FAILED p_3!\n");
-        return;
-    }
-
-
-    // 锁定data区域前, 根据计划先写入密钥
-    uint8_t slot_content[0x20] = {0};
-    // Slot 0: Program Initial Content
+    // 锁定data区域前写入的密钥
+    uint8_t slot_content[3][0x20];
     memset(slot_content, 0, sizeof(slot_content));
-    memcpy(slot_content, "3wlink.cn", 9);
-    status = atsha204_write_data(fd, 0, slot_content);
-
-
-    memset(slot_content, 0, sizeof(slot_content));
-    memcpy(slot_content, "GgsDdu.2017", 11);
-    status = atsha204_write_data(fd, 4, slot_content);
-    if (status != SHA204_SUCCESS) {
-        printf("FAILED! p_4\n");
-        return;
-    }
-
+    memcpy(slot_content[0], "3wlink.cn", 9);
+    memcpy(slot_content[1], "GgsDdu.2017", 11);
+    memcpy(slot_content[2], "Admin_123", 9);
+    const struct sha204_prov_slot slots[] = {
+            {0, slot_content[0], nullptr, nullptr},
+            {4, slot_content[1], nullptr, nullptr},
+            {5, slot_content[2], nullptr, nullptr},
+    };
 
+    // 写config区 -> 读回校验并锁定 -> 写slot -> 锁定data区 -> 确认锁定字节
+    struct sha204_prov_profile profile;
+    memcpy(profile.config, defconfig, sizeof(profile.config));
+    profile.slots = slots;
+    profile.n_slots = 3;
+    profile.lock = SHA204_PROV_LOCK_ALL;
+    profile.data_crc = SHA204_PROV_CRC_NONE;
+
+    const struct sha204_prov_socket socket = {fd, 0};
+    struct sha204_prov_result result;
+    status = sha204_provision_run(&profile, &socket, 1, &result);
     memset(slot_content, 0, sizeof(slot_content));
-    memcpy(slot_content, "Admin_123", 9);
-    status = atsha204_write_data(fd, 5, slot_content);
     if (status != SHA204_SUCCESS) {
-        printf("FAILED! p_4\n");
-        return;
-    }
-
-
-    //
-    // **** LOCK THE DATA REGION. 锁定data区域
-    status = atsha204_lock_data(fd);
-    if (status != SHA204_SUCCESS) {
-        printf("FAILED! p_6\n");
-        return;
-    }
-
-    // 再次验证锁定状态
-    status = atsha204_read_lock(fd, lock_status);
-    if (status != SHA204_SUCCESS) {
-        printf("FAILED! p_7\n");
-        return;
-    }
-    if ((lock_status[0x02] != 0x00) || (lock_status[0x03] != 00)) {
-        printf("FAILED! p_8\n");
+        printf("FAILED! p_%s %02x\n", sha204_provision_step_name(result.step), status);
         return;
     }
 
@@ -193,6 +168,8 @@ int main(int argc, char *argv[]) {
             0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55
     };
 
+    sha204p_set_debug(1);      // 演示程序打印每一帧收发
+
     int fd = open(I2C_BUS, O_RDWR);
     if (fd < 0) {
         printf("Unable to open i2c control file");
@@ -203,26 +180,50 @@ int main(int argc, char *argv[]) {
         printf("Set chip address failed\n");
     }
 
-    atsha204_init(fd);
-
-
-    uint8_t config[88];
-    uint8_t status = atsha204_read_config(fd, config);
+    // config区, SN与锁定状态一次读出; 缓存过的芯片只读SN块. 缓存文件打不开时照常读芯片
+    mkdir(SHA204_CACHE_DIR, 0700);
+    struct sha204_cache *cache = sha204_cache_open(SHA204_CACHE_FILE);
+    struct atsha204_config config;
+    uint8_t status = atsha204_config_snapshot_cached(fd, cache, &config);
     //assert_param_return(SHA204_SUCCESS == status, -1);
-    dump_config(config);
 
-    uint8_t sn[9];
-    status = atsha204_read_sn(fd, sn);
+    if (status == SHA204_SUCCESS && (config.lock[2] != 0x00 || config.lock[3] != 0x00)) {
+        atsha204_init(fd, config.lock);
+        // 个人化改变了config区
+        status = atsha204_config_snapshot_cached(fd, cache, &config);
+    }
+    sha204_cache_close(cache);
+    dump_config(config.raw);
+
     printf("SN:");
-    for (int i = 0; i < 9; i++)printf(" %02x", sn[i]);
+    for (int i = 0; i < 9; i++)printf(" %02x", config.sn[i]);
     printf("\n");
 
 
+    // 一次唤醒读出所有可明文读的slot, 按已有的config快照跳过不可读的
+    uint8_t slots[16][32];
+    uint16_t read_mask;
+    memset(slots, 0, sizeof(slots));
+    status = atsha204_read_data_bulk(fd, &config, 0xFFFF, slots, &read_mask);
     for (int i = 0; i < 16; i++){
-        memset(tmp_key, 0, sizeof(tmp_key));
-        status = atsha204_read_data(fd, i, tmp_key);
-        printf("SLOT %d data: %s\n", i, tmp_key);
+        if (read_mask & (1u << i)) printf("SLOT %d data: %.32s\n", i, (const char *) slots[i]);
+        else printf("SLOT %d: not readable\n", i);
     }
+
+    // 开机认证: atsha204_init写入的slot 0/4/5密钥, 一次唤醒完成
+    uint8_t auth_keys[3][32];
+    memset(auth_keys, 0, sizeof(auth_keys));
+    memcpy(auth_keys[0], "3wlink.cn", 9);
+    memcpy(auth_keys[1], "GgsDdu.2017", 11);
+    memcpy(auth_keys[2], "Admin_123", 9);
+    struct atsha204_auth_check checks[3] = {
+            {0, auth_keys[0], AUTH_MODE_HOST_CHALLENGE, NULL},
+            {4, auth_keys[1], AUTH_MODE_HOST_CHALLENGE, NULL},
+            {5, auth_keys[2], AUTH_MODE_HOST_CHALLENGE, NULL},
+    };
+    uint32_t pass_mask;
+    status = atsha204_authenticate_batch(fd, checks, 3, &pass_mask);
+    printf("Authentication slot 0/4/5: status %02x, pass %x\n", status, pass_mask);
     return 0;
 
 
@@ -249,7 +250,7 @@ int main(int argc, char *argv[]) {
 
     //atsha204_personalization(fd);
 
-    //random_challenge_response_authentication(fd,15,key_15);
+    //random_challenge_response_authentication(fd,15,key_15,AUTH_MODE_HOST_CHALLENGE);
     close(fd);
 
     return 0;
@@ -5,14 +5,21 @@
 #include "atsha204_i2c.h"
 #include "sha204_helper.h"
 #include "sha204_comm_marshaling.h"
+#include "sha204_cache.h"
+#include "sha204_encio.h"
+#include "sha204_request.h"
+#include "sha204_clock.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/random.h>
 
-static struct sha204_command_parameters cmd_args;		// Global Generalized Command Parameter
-static uint8_t global_tx_buffer[SHA204_CMD_SIZE_MAX];	// Global Transmit Buffer
-static uint8_t global_rx_buffer[SHA204_RSP_SIZE_MAX];	// Global Receive Buffer
+// 线程局部: 调度器等会在多个线程上同时操作不同的器件
+static __thread struct sha204_command_parameters cmd_args;		// Global Generalized Command Parameter
+static __thread uint8_t global_tx_buffer[SHA204_CMD_SIZE_MAX];	// Global Transmit Buffer
+static __thread uint8_t global_rx_buffer[SHA204_RSP_SIZE_MAX];	// Global Receive Buffer
 
 
 // 读出加密芯片锁状态, 共4字节
@@ -119,102 +126,262 @@ uint8_t atsha204_read_devrev(int fd, uint8_t data[4]) {
 
 }
 
+// 明文Read命令, 调用者已唤醒芯片. param_1为区域与SHA204_ZONE_COUNT_FLAG, len为4或32字节
+static uint8_t atsha204_read_block(int fd, uint8_t param_1, uint16_t addr, uint8_t *data, uint8_t len) {
+    uint8_t status;
+
+    cmd_args.op_code = SHA204_READ;
+    cmd_args.param_1 = param_1;
+    cmd_args.param_2 = addr;
+    cmd_args.data_len_1 = 0;
+    cmd_args.data_1 = NULL;
+    cmd_args.data_len_2 = 0;
+    cmd_args.data_2 = NULL;
+    cmd_args.data_len_3 = 0;
+    cmd_args.data_3 = NULL;
+    cmd_args.tx_size = 0x10;
+    cmd_args.tx_buffer = global_tx_buffer;
+    cmd_args.rx_size = sizeof(global_rx_buffer);
+    cmd_args.rx_buffer = global_rx_buffer;
+    status = sha204m_execute(fd, &cmd_args);
+    if (status != SHA204_SUCCESS) return status;
+
+    memcpy(data, &global_rx_buffer[1], len);
+    return status;
+}
+
+// 读config区第0块之后的部分: 第1块32字节, 第2块不足32字节只能按字读6次. 调用者已唤醒芯片并读了第0块
+static uint8_t atsha204_read_config_rest(int fd, uint8_t data[88]) {
+    uint8_t status = atsha204_read_block(fd, SHA204_ZONE_CONFIG | SHA204_ZONE_COUNT_FLAG, 8,
+                                                data + 32, SHA204_ZONE_ACCESS_32);
+
+    // param_1不指定SHA204_ZONE_COUNT_FLAG
+    for (int i = 0; i < 6 && status == SHA204_SUCCESS; ++i)
+        status = atsha204_read_block(fd, SHA204_ZONE_CONFIG, 0x10 + i, data + 64 + i * 4, SHA204_ZONE_ACCESS_4);
+
+    return status;
+}
+
 /**********************************************************************
 *Function	:	atsha204_read_config
 *Arguments	:	int fd				---file description
 *				uint8_t *read_conf	---read out all
 *description	:	读出整个config zone, 共88字节
+*				只唤醒一次, 8次读(2x32字节 + 6x4字节)在同一个唤醒窗口内完成, 返回时芯片仍醒着
 **********************************************************************/
 uint8_t atsha204_read_config(int fd, uint8_t data[88]) {
-    uint8_t status = SHA204_SUCCESS;
+    uint8_t status;
 
-    // 先读两次, 每次32字节  param_1指定SHA204_ZONE_COUNT_FLAG
-    for (int i = 0; i < 2; ++i) {
-        // Write the configuration parameters to the slot
-        cmd_args.op_code = SHA204_READ;
-        cmd_args.param_1 = SHA204_ZONE_CONFIG | SHA204_ZONE_COUNT_FLAG;
-        cmd_args.param_2 = 8 * i;   // 第一次0x00开始读, 第二次0x08开始读
-        cmd_args.data_len_1 = 0;
-        cmd_args.data_1 = NULL;
-        cmd_args.data_len_2 = 0;
-        cmd_args.data_2 = NULL;
-        cmd_args.data_len_3 = 0;
-        cmd_args.data_3 = NULL;
-        cmd_args.tx_size = 0x10;
-        cmd_args.tx_buffer = global_tx_buffer;
-        cmd_args.rx_size = 0x10;
-        cmd_args.rx_buffer = global_rx_buffer;
-        sha204p_wakeup(fd);
-        status = sha204m_execute(fd, &cmd_args);
-        //sha204p_idle(fd);
-        if (status != SHA204_SUCCESS) {
-            printf("FAILED! atsha204_read_config\n");
-            return status;
-        }
+    sha204p_wakeup(fd);
+    status = atsha204_read_block(fd, SHA204_ZONE_CONFIG | SHA204_ZONE_COUNT_FLAG, 0, data, SHA204_ZONE_ACCESS_32);
+    if (status == SHA204_SUCCESS) status = atsha204_read_config_rest(fd, data);
+
+    if (status != SHA204_SUCCESS) printf("FAILED! atsha204_read_config\n");
+    return status;
+}
 
-        memcpy(data + 32 * i, &global_rx_buffer[1], 32);
+/**********************************************************************
+*Function	:	atsha204_config_parse
+*Arguments	:	const uint8_t data[88]			---config zone
+*				struct atsha204_config *conf	---output
+*description	:	从config区原始内容解析出各字段, 不访问芯片
+**********************************************************************/
+void atsha204_config_parse(const uint8_t data[88], struct atsha204_config *conf) {
+    if (conf->raw != data) memcpy(conf->raw, data, sizeof(conf->raw));
+
+    // SN[0:3]在0~3, SN[4:8]在8~12, RevNum在4~7
+    memcpy(conf->sn, data, 4);
+    memcpy(conf->sn + 4, data + 8, 5);
+    memcpy(conf->rev_num, data + 4, 4);
+
+    for (int i = 0; i < 16; ++i)
+        conf->slot_config[i] = (uint16_t) (data[20 + 2 * i] | (data[21 + 2 * i] << 8));
+
+    for (int i = 0; i < 8; ++i) {
+        conf->use_flag[i] = data[52 + 2 * i];
+        conf->update_count[i] = data[53 + 2 * i];
     }
 
-    // 接着读6次, 每次4字节, param_1不指定SHA204_ZONE_COUNT_FLAG
-    for (int i = 0; i < 6; ++i) {
-        // Write the configuration parameters to the slot
-        cmd_args.op_code = SHA204_READ;
-        cmd_args.param_1 = SHA204_ZONE_CONFIG;
-        cmd_args.param_2 = 0x10 + i;
-        cmd_args.data_len_1 = 0;
-        cmd_args.data_1 = NULL;
-        cmd_args.data_len_2 = 0;
-        cmd_args.data_2 = NULL;
-        cmd_args.data_len_3 = 0;
-        cmd_args.data_3 = NULL;
-        cmd_args.tx_size = 0x10;
-        cmd_args.tx_buffer = global_tx_buffer;
-        cmd_args.rx_size = 0x10;
-        cmd_args.rx_buffer = global_rx_buffer;
-        sha204p_wakeup(fd);
-        status = sha204m_execute(fd, &cmd_args);
-        //sha204p_idle(fd);
-        if (status != SHA204_SUCCESS) {
-            printf("FAILED! atsha204_read_config\n");
+    memcpy(conf->last_key_use, data + 68, 16);
+    memcpy(conf->lock, data + 84, 4);
+}
+
+/**********************************************************************
+*Function	:	atsha204_config_snapshot
+*Arguments	:	int fd							---file description
+*				struct atsha204_config *conf	---output
+*description	:	一个唤醒窗口内读出整个config区并解析, 代替分别调用
+*				atsha204_read_config/atsha204_read_sn/atsha204_read_lock
+**********************************************************************/
+uint8_t atsha204_config_snapshot(int fd, struct atsha204_config *conf) {
+    uint8_t status = atsha204_read_config(fd, conf->raw);
+    if (status != SHA204_SUCCESS) return status;
+
+    atsha204_config_parse(conf->raw, conf);
+    return status;
+}
+
+// 锁定后仍会变化的使用计数所在的字(0x0D~0x14), 由SlotConfig决定, 位i对应字0x0D + i:
+// slot 0~7为SingleUse(消耗UseFlag)或允许DeriveKey(累加UpdateCount)时其UseFlag/UpdateCount所在的字,
+// slot 15为SingleUse时LastKeyUse(字0x11~0x14)
+static uint16_t atsha204_config_live_words(const uint8_t data[88]) {
+    uint16_t words = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        uint16_t sc = (uint16_t) (data[20 + 2 * i] | (data[21 + 2 * i] << 8));
+        if (sc & (0x0020 | 0x2000)) words |= 1u << (i / 2);
+    }
+    if (data[20 + 2 * 15] & 0x20) words |= 0x0F << 4;
+    return words;
+}
+
+/**********************************************************************
+*Function	:	atsha204_config_snapshot_cached
+*Arguments	:	int fd							---file description
+*				struct sha204_cache *cache		---sha204_cache_open, 可以为NULL
+*				struct atsha204_config *conf	---output
+*description	:	同atsha204_config_snapshot, 但先只读第0块(含SN)到缓存中查找:
+*				已锁定且缓存过的芯片只需再读字0x15与会变化的使用计数; 未命中时在同一唤醒窗口内读完并记入缓存.
+*				字0x15(UserExtra, Selector, 锁定字节)总是从芯片读: UserExtra/Selector在锁定之后
+*				仍可由UpdateExtra修改, 锁定字节决定是否个人化, 不取缓存中的值.
+*				UseFlag/UpdateCount/LastKeyUse随SingleUse, DeriveKey与slot 15的使用变化,
+*				按SlotConfig判断哪些字可能变化并从芯片重读, 其余取缓存
+**********************************************************************/
+uint8_t atsha204_config_snapshot_cached(int fd, struct sha204_cache *cache, struct atsha204_config *conf) {
+    uint8_t status;
+    uint8_t word_15[4];
+
+    sha204p_wakeup(fd);
+    status = atsha204_read_block(fd, SHA204_ZONE_CONFIG | SHA204_ZONE_COUNT_FLAG, 0, conf->raw, SHA204_ZONE_ACCESS_32);
+    if (status == SHA204_SUCCESS && sha204_cache_lookup(cache, conf->raw, conf->raw) == 0) {
+        status = atsha204_read_block(fd, SHA204_ZONE_CONFIG, 0x15, word_15, SHA204_ZONE_ACCESS_4);
+        // 芯片实际未锁定(缓存项不可信)时按未命中读完整个config区
+        if (status == SHA204_SUCCESS && word_15[2] == 0x00 && word_15[3] == 0x00) {
+            uint16_t live = atsha204_config_live_words(conf->raw);
+            for (int i = 0; i < 8 && status == SHA204_SUCCESS; ++i)
+                if (live & (1u << i))
+                    status = atsha204_read_block(fd, SHA204_ZONE_CONFIG, 0x0D + i, conf->raw + 4 * (0x0D + i),
+                                                 SHA204_ZONE_ACCESS_4);
+            if (status == SHA204_SUCCESS) {
+                memcpy(conf->raw + 84, word_15, sizeof(word_15));
+                atsha204_config_parse(conf->raw, conf);
+                return status;
+            }
+            printf("FAILED! atsha204_config_snapshot_cached\n");
             return status;
         }
+    }
 
-        memcpy(data + 64 + i * 4, &global_rx_buffer[1], 4);
+    if (status == SHA204_SUCCESS) status = atsha204_read_config_rest(fd, conf->raw);
+    if (status != SHA204_SUCCESS) {
+        printf("FAILED! atsha204_config_snapshot_cached\n");
+        return status;
     }
 
+    atsha204_config_parse(conf->raw, conf);
+    sha204_cache_store(cache, conf->raw);
     return status;
 }
 
 /**********************************************************************
-*Function	:	atsha204_write_config
-*Arguments	:	int fd				---file description
-*				uint8_t data[88], 				---atsha204a  config
-*description	:	can write config before locking the config zone
+*Function	:	atsha204_config_plan
+*Arguments	:	const uint8_t current[88]			---当前config区, 如atsha204_read_config读出
+*				const uint8_t data[68]				---目标内容, 字0x04~0x14
+*				struct atsha204_config_plan *plan	---output
+*description	:	比较当前与目标内容, 只写不同的字. 第1块(字8~15)可整块写,
+*				其中有两个以上的字不同时以一条32字节写代替, 其余为4字节写; 不访问芯片
 **********************************************************************/
-uint8_t atsha204_write_config(int fd, uint8_t data[68]) {
+void atsha204_config_plan(const uint8_t current[88], const uint8_t data[68], struct atsha204_config_plan *plan) {
+    // 第1块在data中从字8开始
+    const uint32_t block_1 = 0xFFu << (8 - ATSHA204_CONFIG_WORD_FIRST);
+    uint32_t changed = 0;
+
+    for (int i = 0; i < ATSHA204_CONFIG_WORDS; ++i)
+        if (memcmp(current + 4 * (ATSHA204_CONFIG_WORD_FIRST + i), data + 4 * i, 4) != 0) changed |= 1u << i;
+
+    plan->n = 0;
+    for (int i = 0; i < ATSHA204_CONFIG_WORDS; ++i) {
+        if (!(changed & (1u << i))) continue;
+
+        struct atsha204_config_write *w = &plan->writes[plan->n++];
+        if ((block_1 & (1u << i)) && __builtin_popcount(changed & block_1) >= 2) {
+            w->addr = 1 << 3;
+            w->size = SHA204_ZONE_ACCESS_32;
+            w->offset = 4 * (8 - ATSHA204_CONFIG_WORD_FIRST);
+            changed &= ~block_1;
+        } else {
+            w->addr = (uint8_t) (ATSHA204_CONFIG_WORD_FIRST + i);
+            w->size = SHA204_ZONE_ACCESS_4;
+            w->offset = (uint8_t) (4 * i);
+        }
+    }
+}
 
+// 按计划写config区. 计划最多10条写(字0x04~0x07, 块1即字0x08~0x0F合并为一条, 字0x10~0x14), 10 x WRITE_EXEC_MAX = 420ms,
+// 加上之前的读与总线传输可能接近看门狗超时, 因此每条写之前由sha204_request_wake判断, 必要时idle后重新唤醒
+static uint8_t atsha204_config_writes(int fd, const struct atsha204_config_plan *plan, const uint8_t data[68],
+                                      struct sha204_awake *st) {
     uint8_t status = SHA204_SUCCESS;
 
-    sha204p_wakeup(fd);
-    // 4字节写17次
-    for (int i = 0; i < 17; ++i) {
-        // Write the configuration parameters to the slot
+    for (int i = 0; i < plan->n && status == SHA204_SUCCESS; ++i) {
+        const struct atsha204_config_write *w = &plan->writes[i];
+
+        sha204_request_wake(fd, st, WRITE_EXEC_MAX);
+
         cmd_args.op_code = SHA204_WRITE;
-        cmd_args.param_1 = SHA204_ZONE_CONFIG;
-        cmd_args.param_2 = 0x04 + i;   // 从0x04开始写
-        cmd_args.data_len_1 = SHA204_ZONE_ACCESS_4;
-        cmd_args.data_1 = data + 4 * i;
+        cmd_args.param_1 = SHA204_ZONE_CONFIG | (w->size == SHA204_ZONE_ACCESS_32 ? SHA204_ZONE_COUNT_FLAG : 0);
+        cmd_args.param_2 = w->addr;
+        cmd_args.data_len_1 = w->size;
+        cmd_args.data_1 = (uint8_t *) data + w->offset;
         cmd_args.data_len_2 = 0;
         cmd_args.data_2 = NULL;
         cmd_args.data_len_3 = 0;
         cmd_args.data_3 = NULL;
-        cmd_args.tx_size = 0x10;
+        cmd_args.tx_size = sizeof(global_tx_buffer);
         cmd_args.tx_buffer = global_tx_buffer;
-        cmd_args.rx_size = 0x10;
+        cmd_args.rx_size = sizeof(global_rx_buffer);
         cmd_args.rx_buffer = global_rx_buffer;
         status = sha204m_execute(fd, &cmd_args);
-        sha204p_idle(fd);
-        if (status != SHA204_SUCCESS) break;
+    }
+
+    return status;
+}
+
+/**********************************************************************
+*Function	:	atsha204_write_config_plan
+*Arguments	:	int fd									---file description
+*				const struct atsha204_config_plan *plan	---atsha204_config_plan的结果
+*				const uint8_t data[68]					---目标内容
+*description	:	一个唤醒窗口内执行计划, 计划为空时不访问芯片
+**********************************************************************/
+uint8_t atsha204_write_config_plan(int fd, const struct atsha204_config_plan *plan, const uint8_t data[68]) {
+    struct sha204_awake st = {0, 0};
+    uint8_t status;
+
+    if (plan->n == 0) return SHA204_SUCCESS;
+
+    status = atsha204_config_writes(fd, plan, data, &st);
+    sha204_request_sleep(fd, &st);
+    return status;
+}
+
+/**********************************************************************
+*Function	:	atsha204_write_config
+*Arguments	:	int fd				---file description
+*				uint8_t data[68], 				---atsha204a  config, 字0x04~0x14
+*description	:	can write config before locking the config zone
+*				先读出config区, 只写与data不同的字(atsha204_config_plan), 读与写在同一个唤醒窗口内
+**********************************************************************/
+uint8_t atsha204_write_config(int fd, uint8_t data[68]) {
+    struct atsha204_config_plan plan;
+    struct sha204_awake st = {1, sha204_clock_now_us()};
+    uint8_t current[88];
+
+    // 返回时芯片仍醒着; since_us取读之前的时间, 不晚于实际唤醒时间, 看门狗估算偏保守
+    uint8_t status = atsha204_read_config(fd, current);
+    if (status == SHA204_SUCCESS) {
+        atsha204_config_plan(current, data, &plan);
+        status = atsha204_config_writes(fd, &plan, data, &st);
     }
 
     sha204p_sleep(fd);
@@ -255,6 +422,51 @@ uint8_t atsha204_read_data(int fd, int slot, uint8_t *readdata) {
     return status;
 }
 
+/**********************************************************************
+*Function	:	atsha204_read_data_bulk
+*Arguments	:	int fd								---file description
+*				const struct atsha204_config *conf	---config快照, NULL时在同一唤醒窗口内先读
+*				uint16_t slot_mask					---要读的slot, bit n对应slot n
+*				uint8_t data[16][32]				---按slot编号存放, 没有读出的slot不修改
+*				uint16_t *read_mask					---output, 读出的slot
+*description	:	一次唤醒读出slot_mask中所有可以明文读的slot, 最后sleep.
+*				SlotConfig的IsSecret置位的slot不发命令直接跳过;
+*				data区未锁定时不能读, 返回SHA204_FUNC_FAIL. 芯片拒绝某个slot时继续读其余的,
+*				返回第一个错误; 通信失败时停止
+**********************************************************************/
+uint8_t atsha204_read_data_bulk(int fd, const struct atsha204_config *conf, uint16_t slot_mask,
+                                uint8_t data[16][32], uint16_t *read_mask) {
+    struct atsha204_config snapshot;
+    uint8_t status = SHA204_SUCCESS, first_error = SHA204_SUCCESS;
+
+    *read_mask = 0;
+    if (conf) sha204p_wakeup(fd);
+    else {
+        status = atsha204_config_snapshot(fd, &snapshot);
+        conf = &snapshot;
+    }
+
+    if (status == SHA204_SUCCESS && conf->lock[2] != 0x00) {
+        printf("FAILED! atsha204_read_data_bulk: data zone not locked\n");
+        status = SHA204_FUNC_FAIL;
+    }
+
+    for (int slot = 0; slot < 16 && status == SHA204_SUCCESS; ++slot) {
+        // SlotConfig低字节bit7 IsSecret; EncryptRead(bit6)只在IsSecret置位时生效, 单独置位时仍可明文读
+        if (!(slot_mask & (1u << slot)) || (conf->slot_config[slot] & 0x80)) continue;
+
+        uint8_t ret = atsha204_read_block(fd, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, (uint16_t) (slot * 8),
+                                          data[slot], SHA204_ZONE_ACCESS_32);
+        if (ret == SHA204_SUCCESS) *read_mask |= (uint16_t) (1u << slot);
+        else if (ret == SHA204_CMD_FAIL || ret == SHA204_PARSE_ERROR) {
+            if (first_error == SHA204_SUCCESS) first_error = ret;
+        } else status = ret;
+    }
+    sha204p_sleep(fd);
+
+    return status != SHA204_SUCCESS ? status : first_error;
+}
+
 /**********************************************************************
 *Function	:	atsha204_lock_conf
 *Arguments	:	int fd				---file description
@@ -353,102 +565,20 @@ uint8_t read_num_in[20] = {
         0x10, 0x11, 0x12, 0x13
 };
 
+// 加密读: Nonce/GenDig/Read在一次唤醒内完成, 主机侧计算与器件执行重叠, 见sha204_encio.h
 uint8_t atsha204_encrypted_read(int fd, uint16_t key_id, uint8_t *key_value,uint16_t slot, uint8_t *readdata) {
-    int i;
-    static uint8_t status = SHA204_SUCCESS;
-    static uint8_t tmpdata[0x20] = {0};
-    static uint8_t random_number[0x20] = {0};		// Random number returned by Random NONCE command
-    static uint8_t computed_response[0x20] = {0};	// Host computed expected response
-
-    struct sha204h_decrypt_in_out decrypt_param;	// Parameter for decrypt helper function
-    struct sha204h_nonce_in_out nonce_param;		// Parameter for nonce helper function
-    struct sha204h_gen_dig_in_out gendig_param;	// Parameter for gen_dig helper function
-    struct sha204h_temp_key computed_tempkey;		// TempKey parameter for nonce and gen_dig helper function
-
-    //add by jli :That before every executing  cmd sent to ATSHA204 chip  should have waked it up once!
-    sha204p_wakeup(fd);
+    struct sha204_encio_op op;
 
     printf("ATSHA204A encrypted read  !\n");
-    //nonce operation
-    cmd_args.op_code = SHA204_NONCE;
-    cmd_args.param_1 = NONCE_MODE_SEED_UPDATE;
-    cmd_args.param_2 = NONCE_PARAM2;
-    cmd_args.data_len_1 = NONCE_NUMIN_SIZE;
-    cmd_args.data_1 = read_num_in;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = NONCE_COUNT_SHORT;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = NONCE_RSP_SIZE_LONG;
-    cmd_args.rx_buffer = global_rx_buffer;
-    status = sha204m_execute(fd,&cmd_args);
-    //sha204p_idle(fd);
-    if(status != SHA204_SUCCESS) { printf(" Mathine NONCE  FAILED! \n"); return status; }
-    // Capture the random number from the NONCE command if it were successful
-    memcpy(random_number,&global_rx_buffer[1],0x20);
-
-    //host nonce operation
-    nonce_param.mode = NONCE_MODE_SEED_UPDATE;
-    nonce_param.num_in = read_num_in;
-    nonce_param.rand_out = random_number;
-    nonce_param.temp_key = &computed_tempkey;
-    status = sha204h_nonce(nonce_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   NONCE  FAILED! \n"); return status; }
-
-    //gendig operation
-    cmd_args.op_code = SHA204_GENDIG;
-    cmd_args.param_1 = GENDIG_ZONE_DATA;
-    cmd_args.param_2 = key_id;
-    cmd_args.data_len_1 = 0;
-    cmd_args.data_1 = NULL;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = SHA204_CMD_SIZE_MIN;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = GENDIG_RSP_SIZE;
-    cmd_args.rx_buffer = global_rx_buffer;
-    status = sha204m_execute(fd,&cmd_args);
-    sha204p_sleep(fd);
-    if(status != SHA204_SUCCESS) { printf("Mathine  GENGID  FAILED! \n"); return status; }
-
-    //Host gengid operation
-    memcpy(tmpdata,key_value,0x20);
-    gendig_param.zone = GENDIG_ZONE_DATA;
-    gendig_param.key_id = key_id;
-    gendig_param.stored_value = tmpdata;
-    gendig_param.temp_key = &computed_tempkey;
-    status = sha204h_gen_dig(gendig_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   GENDIG  FAILED! \n"); return status; }
-
-    //Read operation
-    cmd_args.op_code = SHA204_READ;
-    cmd_args.param_1 = SHA204_ZONE_DATA|SHA204_ZONE_COUNT_FLAG;
-    cmd_args.param_2 =  (uint16_t)(slot * 8);
-    cmd_args.data_len_1 = 0;
-    cmd_args.data_1 = NULL;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = 0x30;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = 0x30;
-    cmd_args.rx_buffer = global_rx_buffer;
-    sha204p_wakeup(fd);
-    status = sha204m_execute(fd,&cmd_args);
-    sha204p_sleep(fd);
-    memcpy(tmpdata,&global_rx_buffer[1],0x20);
-    if(status != SHA204_SUCCESS) { printf("FAILED! e_read_data\n"); return status ; }
-
-    decrypt_param.data = tmpdata;
-    decrypt_param.temp_key = &computed_tempkey;
-    status = sha204h_decrypt(decrypt_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   DECRYPT  FAILED! \n"); return status; }
-    memcpy(readdata,tmpdata,0x20);
+    memset(&op, 0, sizeof(op));
+    op.slot = slot;
+    op.key_id = key_id;
+    op.key = key_value;
+    uint8_t status = sha204_encio_run(fd, NULL, NONCE_MODE_SEED_UPDATE, read_num_in, &op, 1);
+    if (status != SHA204_SUCCESS) { printf("FAILED! e_read_data\n"); return status; }
+
+    memcpy(readdata, op.data, 0x20);
+    memset(&op, 0, sizeof(op));
     return status;
 }
 
@@ -460,108 +590,21 @@ uint8_t write_num_in[20] = {
         0x10, 0x11, 0x12, 0x13
 };
 
+// 加密写, 同atsha204_encrypted_read
 uint8_t atsha204_encrypted_write(int fd, uint16_t key_id, uint8_t *key_value, uint16_t slot, uint8_t *writedata) {
-    int i;
-    static uint8_t status = SHA204_SUCCESS;
-    static uint8_t tmpdata[0x20] = {0};
-    static uint8_t random_number[0x20] = {0};		// Random number returned by Random NONCE command
-    static uint8_t computed_response[0x20] = {0};	// Host computed expected response
-    static uint8_t host_mac[0x20] = {0};
-    struct sha204h_encrypt_in_out encrypt_param;	//Parameter for encrypt helper function
-    struct sha204h_nonce_in_out nonce_param;		// Parameter for nonce helper function
-    struct sha204h_gen_dig_in_out gendig_param;	// Parameter for gen_dig helper function
-    struct sha204h_temp_key computed_tempkey;		// TempKey parameter for nonce and gen_dig helper function
-
-    //add by jli :That before every executing  cmd sent to ATSHA204 chip  should have waked it up once!
-    sha204p_wakeup(fd);
+    struct sha204_encio_op op;
 
     printf("ATSHA204A encrypted write  !\n");
-    //nonce operation
-    cmd_args.op_code = SHA204_NONCE;
-    cmd_args.param_1 = NONCE_MODE_SEED_UPDATE;
-    cmd_args.param_2 = NONCE_PARAM2;
-    cmd_args.data_len_1 = NONCE_NUMIN_SIZE;
-    cmd_args.data_1 = write_num_in;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = NONCE_COUNT_SHORT;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = NONCE_RSP_SIZE_LONG;
-    cmd_args.rx_buffer = global_rx_buffer;
-    status = sha204m_execute(fd,&cmd_args);
-    //sha204p_idle(fd);
-    if(status != SHA204_SUCCESS) { printf(" Mathine NONCE  FAILED! \n"); return status; }
-    // Capture the random number from the NONCE command if it were successful
-    memcpy(random_number,&global_rx_buffer[1],0x20);
-
-    //host nonce operation
-    nonce_param.mode = NONCE_MODE_SEED_UPDATE;
-    nonce_param.num_in = write_num_in;
-    nonce_param.rand_out = random_number;
-    nonce_param.temp_key = &computed_tempkey;
-    status = sha204h_nonce(nonce_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   NONCE  FAILED! \n");  return status; }
-
-    //Host gengid operation
-    memcpy(tmpdata,key_value,0x20);
-    gendig_param.zone = GENDIG_ZONE_DATA;
-    gendig_param.key_id = key_id;
-    gendig_param.stored_value = tmpdata;
-    gendig_param.temp_key = &computed_tempkey;
-    status = sha204h_gen_dig(gendig_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   GENDIG  FAILED! \n");  return status; }
-
-    //gendig operation
-    cmd_args.op_code = SHA204_GENDIG;
-    cmd_args.param_1 = GENDIG_ZONE_DATA;
-    cmd_args.param_2 = key_id;
-    cmd_args.data_len_1 = 0;
-    cmd_args.data_1 = NULL;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = SHA204_CMD_SIZE_MIN;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = GENDIG_RSP_SIZE;
-    cmd_args.rx_buffer = global_rx_buffer;
-    status = sha204m_execute(fd,&cmd_args);
-    sha204p_sleep(fd);
-    if(status != SHA204_SUCCESS) { printf("Mathine  GENGID  FAILED! \n");  return status; }
-
-    //Host XOR operation
-    memcpy(tmpdata,writedata,0x20);
-    encrypt_param.temp_key = &computed_tempkey;
-    encrypt_param.zone = SHA204_ZONE_DATA|SHA204_ZONE_COUNT_FLAG;
-    encrypt_param.address = (uint16_t)(slot * 8);
-    encrypt_param.data = tmpdata;
-    encrypt_param.mac = host_mac;
-    status = sha204h_encrypt(encrypt_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   ENCRYPT  FAILED! \n");  return status; }
-
-    //Write operation
-    cmd_args.op_code = SHA204_WRITE;
-    cmd_args.param_1 = SHA204_ZONE_DATA|SHA204_ZONE_COUNT_FLAG;
-    cmd_args.param_2 =  (uint16_t)(slot * 8);
-    cmd_args.data_len_1 = SHA204_ZONE_ACCESS_32;
-    cmd_args.data_1 = tmpdata;
-    cmd_args.data_len_2 = SHA204_ZONE_ACCESS_32;
-    cmd_args.data_2 = encrypt_param.mac;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = 0x30;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = 0x30;
-    cmd_args.rx_buffer = global_rx_buffer;
-    sha204p_wakeup(fd);
-    status = sha204m_execute(fd,&cmd_args);
-    sha204p_sleep(fd);
-    if(status != SHA204_SUCCESS) { printf("FAILED! e_write_data\n");  return status ; }
+    memset(&op, 0, sizeof(op));
+    op.write = 1;
+    op.slot = slot;
+    op.key_id = key_id;
+    op.key = key_value;
+    memcpy(op.data, writedata, 0x20);
+    uint8_t status = sha204_encio_run(fd, NULL, NONCE_MODE_SEED_UPDATE, write_num_in, &op, 1);
+    if (status != SHA204_SUCCESS) { printf("FAILED! e_write_data\n"); return status; }
 
     return status;
-
 }
 
 //======================================================================================================================
@@ -578,16 +621,53 @@ uint8_t Secrect_key_value[0x20] = {
         0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
         0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55
 };
-uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_t *secret_key_value) {
 
-    static uint8_t status = SHA204_SUCCESS;
-    static uint8_t random_number[0x20] = {0};		// 随机 NONCE 命令返回的随机数 Random number returned by Random NONCE command
-    static uint8_t computed_response[0x20] = {0};	// 主机计算的预期响应 Host computed expected response
-    static uint8_t atsha204_response[0x20] = {0};	// 从ATSHA204设备收到的实际响应 Actual response received from the ATSHA204 device
+// 主机随机数(内核CSPRNG), 用作MAC的挑战
+static uint8_t host_random(uint8_t *buf, size_t len) {
+    while (len) {
+        ssize_t n = getrandom(buf, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return SHA204_FUNC_FAIL;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return SHA204_SUCCESS;
+}
+
+/** \brief 随机挑战-响应认证
+ *
+ * AUTH_MODE_DEVICE_NONCE:   Nonce(器件随机数) + MAC(TempKey), 不依赖主机随机数源
+ * AUTH_MODE_HOST_CHALLENGE: 主机getrandom生成挑战, 随MAC命令发送(MAC_MODE_NO_TEMPKEY),
+ *                           省去最慢的Nonce命令与主机侧的Nonce计算
+ * \param[in] fd               file description
+ * \param[in] key_id           MAC使用的密钥slot
+ * \param[in] secret_key_value 该slot的密钥, 32字节
+ * \param[in] auth_mode        AUTH_MODE_DEVICE_NONCE或AUTH_MODE_HOST_CHALLENGE
+ * \return 认证通过为SHA204_SUCCESS
+ */
+uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_t *secret_key_value, uint8_t auth_mode) {
+
+    static __thread uint8_t status = SHA204_SUCCESS;
+    static __thread uint8_t random_number[0x20] = {0};		// 随机 NONCE 命令返回的随机数, 或主机生成的挑战 Random number returned by Random NONCE command
+    static __thread uint8_t computed_response[0x20] = {0};	// 主机计算的预期响应 Host computed expected response
+    static __thread uint8_t atsha204_response[0x20] = {0};	// 从ATSHA204设备收到的实际响应 Actual response received from the ATSHA204 device
     struct sha204h_nonce_in_out nonce_param;		// nonce辅助函数参数 Parameter for nonce helper function
     struct sha204h_mac_in_out mac_param;			// mac辅助函数参数 Parameter for mac helper function
     struct sha204h_temp_key computed_tempkey;		// 用于 nonce 和 mac 辅助函数的 TempKey 参数 TempKey parameter for nonce and mac helper function
 
+    uint8_t mac_mode = MAC_MODE_BLOCK2_TEMPKEY;
+
+    if (auth_mode != AUTH_MODE_DEVICE_NONCE && auth_mode != AUTH_MODE_HOST_CHALLENGE) return SHA204_BAD_PARAM;
+
+    // 主机挑战在唤醒之前取得, 失败时不必再让芯片sleep
+    if (auth_mode == AUTH_MODE_HOST_CHALLENGE) {
+        status = host_random(random_number, sizeof(random_number));
+        if(status != SHA204_SUCCESS) { printf("FAILED! host random challenge\n"); return status; }
+        mac_mode = MAC_MODE_NO_TEMPKEY;
+    }
+
     //在每次向 ATSHA204 芯片发送执行命令之前，都应该唤醒它一次！
     sha204p_wakeup(fd);
 
@@ -599,40 +679,43 @@ uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_
     // 3. 没有良好随机数生成器并希望避免上述注意事项#2中描述的中间人攻击的主机系统可以使用涉及 ATSHA204 在随机模式下的 NONCE 命令的认证过程。NONCE 命令保证了 ATSHA204 设备内部的随机状态，这几乎是不可能伪造的。在此练习中示例的就是这种过程。
 
 
-    // *** 第一步：发出一个没有 EEPROM 种子更新的 NONCE ***
-    //				NONCE 命令在 ATSHA204 设备中生成一个内部随机状态。请注意，实际的随机 NONCE 是使用内部生成的随机数和其他设备参数计算得出的值。
-    //				NONCE 命令发出这个随机值供主机在主机端计算等效的 NONCE。捕获这个随机数并保留，以便在主机端计算等效的 NONCE。
-    cmd_args.op_code = SHA204_NONCE;
-    cmd_args.param_1 = NONCE_MODE_NO_SEED_UPDATE;
-    cmd_args.param_2 = NONCE_PARAM2;
-    cmd_args.data_len_1 = NONCE_NUMIN_SIZE;
-    cmd_args.data_1 = num_in;
-    cmd_args.data_len_2 = 0;
-    cmd_args.data_2 = NULL;
-    cmd_args.data_len_3 = 0;
-    cmd_args.data_3 = NULL;
-    cmd_args.tx_size = NONCE_COUNT_SHORT;
-    cmd_args.tx_buffer = global_tx_buffer;
-    cmd_args.rx_size = NONCE_RSP_SIZE_LONG;
-    cmd_args.rx_buffer = global_rx_buffer;
-    status = sha204m_execute(fd,&cmd_args);
-    //sha204p_idle(fd);
-    if(status != SHA204_SUCCESS) { printf(" Mathine NONCE  FAILED! \n"); return status; }
-
-    // Capture the random number from the NONCE command if it were successful
-    memcpy(random_number,&global_rx_buffer[1],0x20);
-
-    // *** STEP 2:	COMPUTE THE EQUIVALENT NONCE ON THE HOST SIDE
-    //
-    //				Go the easy way using the host helper functions provided with
-    //				the ATSHA204 library.
-
-    nonce_param.mode = NONCE_MODE_NO_SEED_UPDATE;
-    nonce_param.num_in = num_in;
-    nonce_param.rand_out = random_number;
-    nonce_param.temp_key = &computed_tempkey;
-    status = sha204h_nonce(nonce_param);
-    if(status != SHA204_SUCCESS) { printf("HOST   NONCE  FAILED! \n"); return status; }
+    // *** 第一步与第二步只用于AUTH_MODE_DEVICE_NONCE; 主机挑战模式的随机性来自上面的getrandom
+    if (auth_mode == AUTH_MODE_DEVICE_NONCE) {
+        // *** 第一步：发出一个没有 EEPROM 种子更新的 NONCE ***
+        //				NONCE 命令在 ATSHA204 设备中生成一个内部随机状态。请注意，实际的随机 NONCE 是使用内部生成的随机数和其他设备参数计算得出的值。
+        //				NONCE 命令发出这个随机值供主机在主机端计算等效的 NONCE。捕获这个随机数并保留，以便在主机端计算等效的 NONCE。
+        cmd_args.op_code = SHA204_NONCE;
+        cmd_args.param_1 = NONCE_MODE_NO_SEED_UPDATE;
+        cmd_args.param_2 = NONCE_PARAM2;
+        cmd_args.data_len_1 = NONCE_NUMIN_SIZE;
+        cmd_args.data_1 = num_in;
+        cmd_args.data_len_2 = 0;
+        cmd_args.data_2 = NULL;
+        cmd_args.data_len_3 = 0;
+        cmd_args.data_3 = NULL;
+        cmd_args.tx_size = NONCE_COUNT_SHORT;
+        cmd_args.tx_buffer = global_tx_buffer;
+        cmd_args.rx_size = NONCE_RSP_SIZE_LONG;
+        cmd_args.rx_buffer = global_rx_buffer;
+        status = sha204m_execute(fd,&cmd_args);
+        //sha204p_idle(fd);
+        if(status != SHA204_SUCCESS) { printf(" Mathine NONCE  FAILED! \n"); return status; }
+
+        // Capture the random number from the NONCE command if it were successful
+        memcpy(random_number,&global_rx_buffer[1],0x20);
+
+        // *** STEP 2:	COMPUTE THE EQUIVALENT NONCE ON THE HOST SIDE
+        //
+        //				Go the easy way using the host helper functions provided with
+        //				the ATSHA204 library.
+
+        nonce_param.mode = NONCE_MODE_NO_SEED_UPDATE;
+        nonce_param.num_in = num_in;
+        nonce_param.rand_out = random_number;
+        nonce_param.temp_key = &computed_tempkey;
+        status = sha204h_nonce(nonce_param);
+        if(status != SHA204_SUCCESS) { printf("HOST   NONCE  FAILED! \n"); return status; }
+    }
 
 
     // *** STEP 3:	ISSUE THE MAC COMMAND
@@ -643,15 +726,15 @@ uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_
 
     // Issue the MAC command
     cmd_args.op_code = SHA204_MAC;
-    cmd_args.param_1 = MAC_MODE_BLOCK2_TEMPKEY;
+    cmd_args.param_1 = mac_mode;
     cmd_args.param_2 = key_id;
-    cmd_args.data_len_1 = 0;
-    cmd_args.data_1 = NULL;
+    cmd_args.data_len_1 = auth_mode == AUTH_MODE_HOST_CHALLENGE ? MAC_CHALLENGE_SIZE : 0;
+    cmd_args.data_1 = auth_mode == AUTH_MODE_HOST_CHALLENGE ? random_number : NULL;
     cmd_args.data_len_2 = 0;
     cmd_args.data_2 = NULL;
     cmd_args.data_len_3 = 0;
     cmd_args.data_3 = NULL;
-    cmd_args.tx_size = MAC_COUNT_SHORT;
+    cmd_args.tx_size = auth_mode == AUTH_MODE_HOST_CHALLENGE ? MAC_COUNT_LONG : MAC_COUNT_SHORT;
     cmd_args.tx_buffer = global_tx_buffer;
     cmd_args.rx_size = MAC_RSP_SIZE;
     cmd_args.rx_buffer = global_rx_buffer;
@@ -668,14 +751,14 @@ uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_
     //				Note that this requires knowledge of the actual secret key
     //				value.
 
-    mac_param.mode = MAC_MODE_BLOCK2_TEMPKEY;
+    mac_param.mode = mac_mode;
     mac_param.key_id = key_id;
-    mac_param.challenge = NULL;
+    mac_param.challenge = auth_mode == AUTH_MODE_HOST_CHALLENGE ? random_number : NULL;
     mac_param.key = secret_key_value;
     mac_param.otp = NULL;
     mac_param.sn = NULL;
     mac_param.response = computed_response;
-    mac_param.temp_key = &computed_tempkey;
+    mac_param.temp_key = auth_mode == AUTH_MODE_DEVICE_NONCE ? &computed_tempkey : NULL;
     status = sha204h_mac(mac_param);
     if(status != SHA204_SUCCESS) { printf("HOST   MAC  FAILED! \n"); return status; }
 
@@ -689,3 +772,128 @@ uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_
         return -1;
     }
 }
+
+/** \brief 在一次唤醒内完成多项挑战-响应认证, 器件响应全部取回后再一起做主机侧的MAC计算(sha204h_mac_many)
+ *
+ * 各项之间不sleep, 按看门狗在项之间idle并重新唤醒; DEVICE_NONCE项的Nonce与MAC之间不能idle(TempKey).
+ * 器件拒绝某项(执行错误)时继续后面的项, 该项不通过.
+ * \param[in]  fd        file description
+ * \param[in]  checks    认证项
+ * \param[in]  n         checks的个数, 最多ATSHA204_AUTH_BATCH_MAX
+ * \param[out] pass_mask 第i位为1表示第i项认证通过
+ * \return 通信失败或参数错误时为对应的错误码, 否则SHA204_SUCCESS(是否通过看pass_mask)
+ */
+uint8_t atsha204_authenticate_batch(int fd, const struct atsha204_auth_check *checks, uint32_t n, uint32_t *pass_mask) {
+    uint8_t challenge[ATSHA204_AUTH_BATCH_MAX][0x20];      // 主机挑战, 或Nonce返回的随机数
+    uint8_t response[ATSHA204_AUTH_BATCH_MAX][0x20];       // 器件的MAC响应
+    uint8_t expected[ATSHA204_AUTH_BATCH_MAX][0x20];       // 主机计算的MAC
+    struct sha204h_temp_key temp_key[ATSHA204_AUTH_BATCH_MAX];
+    struct sha204h_mac_in_out mac_param[ATSHA204_AUTH_BATCH_MAX];
+    uint16_t mac_index[ATSHA204_AUTH_BATCH_MAX];
+    uint32_t answered = 0;
+    uint16_t n_mac = 0;
+    struct sha204_awake awake = {0, 0};
+    uint8_t status = SHA204_SUCCESS;
+    uint32_t i;
+
+    *pass_mask = 0;
+    if (n > ATSHA204_AUTH_BATCH_MAX) return SHA204_BAD_PARAM;
+    for (i = 0; i < n; ++i) {
+        if (!checks[i].key || checks[i].key_id > 15
+            || (checks[i].mode != AUTH_MODE_DEVICE_NONCE && checks[i].mode != AUTH_MODE_HOST_CHALLENGE))
+            return SHA204_BAD_PARAM;
+        if (checks[i].mode != AUTH_MODE_HOST_CHALLENGE) continue;
+        if (checks[i].challenge) memcpy(challenge[i], checks[i].challenge, 0x20);
+        else if (host_random(challenge[i], 0x20) != SHA204_SUCCESS) {
+            printf("FAILED! host random challenge\n");
+            return SHA204_FUNC_FAIL;
+        }
+    }
+
+    // 器件侧: 一次唤醒内发出全部Nonce/MAC, 只收集响应
+    for (i = 0; i < n && status == SHA204_SUCCESS; ++i) {
+        uint8_t host_challenge = checks[i].mode == AUTH_MODE_HOST_CHALLENGE;
+        uint8_t ret;
+
+        sha204_request_wake(fd, &awake, (uint16_t) (MAC_EXEC_MAX + (host_challenge ? 0 : NONCE_EXEC_MAX)));
+
+        if (!host_challenge) {
+            cmd_args.op_code = SHA204_NONCE;
+            cmd_args.param_1 = NONCE_MODE_NO_SEED_UPDATE;
+            cmd_args.param_2 = NONCE_PARAM2;
+            cmd_args.data_len_1 = NONCE_NUMIN_SIZE;
+            cmd_args.data_1 = (uint8_t *) (checks[i].challenge ? checks[i].challenge : num_in);
+            cmd_args.data_len_2 = 0;
+            cmd_args.data_2 = NULL;
+            cmd_args.data_len_3 = 0;
+            cmd_args.data_3 = NULL;
+            cmd_args.tx_size = NONCE_COUNT_SHORT;
+            cmd_args.tx_buffer = global_tx_buffer;
+            cmd_args.rx_size = NONCE_RSP_SIZE_LONG;
+            cmd_args.rx_buffer = global_rx_buffer;
+            ret = sha204m_execute(fd, &cmd_args);
+            if (ret != SHA204_SUCCESS) {
+                if (ret != SHA204_CMD_FAIL && ret != SHA204_PARSE_ERROR) status = ret;
+                continue;
+            }
+            memcpy(challenge[i], &global_rx_buffer[SHA204_BUFFER_POS_DATA], 0x20);
+        }
+
+        cmd_args.op_code = SHA204_MAC;
+        cmd_args.param_1 = host_challenge ? MAC_MODE_NO_TEMPKEY : MAC_MODE_BLOCK2_TEMPKEY;
+        cmd_args.param_2 = checks[i].key_id;
+        cmd_args.data_len_1 = host_challenge ? MAC_CHALLENGE_SIZE : 0;
+        cmd_args.data_1 = host_challenge ? challenge[i] : NULL;
+        cmd_args.data_len_2 = 0;
+        cmd_args.data_2 = NULL;
+        cmd_args.data_len_3 = 0;
+        cmd_args.data_3 = NULL;
+        cmd_args.tx_size = host_challenge ? MAC_COUNT_LONG : MAC_COUNT_SHORT;
+        cmd_args.tx_buffer = global_tx_buffer;
+        cmd_args.rx_size = MAC_RSP_SIZE;
+        cmd_args.rx_buffer = global_rx_buffer;
+        ret = sha204m_execute(fd, &cmd_args);
+        if (ret == SHA204_SUCCESS) {
+            memcpy(response[i], &global_rx_buffer[SHA204_BUFFER_POS_DATA], 0x20);
+            answered |= 1u << i;
+        } else if (ret != SHA204_CMD_FAIL && ret != SHA204_PARSE_ERROR) status = ret;
+    }
+    sha204_request_sleep(fd, &awake);
+    if (status != SHA204_SUCCESS) { printf("FAILED! atsha204_authenticate_batch: %02x\n", status); return status; }
+
+    // 主机侧: 先算各DEVICE_NONCE项的TempKey, 再一起算全部MAC
+    for (i = 0; i < n; ++i) {
+        uint8_t host_challenge = checks[i].mode == AUTH_MODE_HOST_CHALLENGE;
+
+        if (!(answered & (1u << i))) continue;
+        if (!host_challenge) {
+            struct sha204h_nonce_in_out nonce_param;
+
+            nonce_param.mode = NONCE_MODE_NO_SEED_UPDATE;
+            nonce_param.num_in = (uint8_t *) (checks[i].challenge ? checks[i].challenge : num_in);
+            nonce_param.rand_out = challenge[i];
+            nonce_param.temp_key = &temp_key[i];
+            if (sha204h_nonce(nonce_param) != SHA204_SUCCESS) continue;
+        }
+
+        mac_param[n_mac].mode = host_challenge ? MAC_MODE_NO_TEMPKEY : MAC_MODE_BLOCK2_TEMPKEY;
+        mac_param[n_mac].key_id = checks[i].key_id;
+        mac_param[n_mac].challenge = host_challenge ? challenge[i] : NULL;
+        mac_param[n_mac].key = (uint8_t *) checks[i].key;
+        mac_param[n_mac].otp = NULL;
+        mac_param[n_mac].sn = NULL;
+        mac_param[n_mac].response = expected[i];
+        mac_param[n_mac].temp_key = host_challenge ? NULL : &temp_key[i];
+        mac_index[n_mac++] = (uint16_t) i;
+    }
+    status = sha204h_mac_many(mac_param, n_mac);
+    if (status != SHA204_SUCCESS) { printf("HOST   MAC  FAILED! \n"); return status; }
+
+    for (i = 0; i < n_mac; ++i) {
+        uint16_t k = mac_index[i];
+        if (memcmp(expected[k], response[k], 0x20) == 0) *pass_mask |= 1u << k;
+    }
+    memset(temp_key, 0, sizeof(temp_key));
+
+    return SHA204_SUCCESS;
+}
@@ -17,6 +17,50 @@
 #define MAC_MODE_NO_TEMPKEY				((uint8_t) 0x00)		//MAC mode using internal key and challenge to get MAC result
 #define LOCK_PARAM2_NO_CRC				((uint16_t) 0x0000)		//Lock mode : not using checksum to validate the data written
 #define CHECKMAC_PASSWORD_MODE			((uint8_t) 0X01)		//CheckMac mode : password check operation
+#define AUTH_MODE_DEVICE_NONCE			((uint8_t) 0x00)		//挑战响应认证: 器件Nonce生成TempKey, MAC基于TempKey
+#define AUTH_MODE_HOST_CHALLENGE		((uint8_t) 0x01)		//挑战响应认证: 主机getrandom生成挑战, 随MAC命令发送
+
+struct sha204_cache;
+
+//! config区快照, 由atsha204_config_snapshot一次读出, 各字段不再访问芯片
+struct atsha204_config {
+	uint8_t raw[88];				//!< config区原始内容
+	uint8_t sn[9];					//!< 同atsha204_read_sn
+	uint8_t rev_num[4];
+	uint8_t lock[4];				//!< 同atsha204_read_lock: UserExtra, Selector, LockValue(data/OTP), LockConfig; 0x00为已锁定
+	uint16_t slot_config[16];
+	uint8_t use_flag[8];			//!< slot 0~7
+	uint8_t update_count[8];		//!< slot 0~7
+	uint8_t last_key_use[16];		//!< slot 15的使用次数位图
+};
+
+//! atsha204_authenticate_batch的一项挑战-响应认证
+struct atsha204_auth_check {
+	uint16_t key_id;				//!< MAC使用的密钥slot
+	const uint8_t *key;				//!< 该slot的密钥, 32字节
+	uint8_t mode;					//!< AUTH_MODE_DEVICE_NONCE或AUTH_MODE_HOST_CHALLENGE
+	const uint8_t *challenge;		//!< HOST_CHALLENGE: 32字节挑战, NULL时用getrandom生成; DEVICE_NONCE: 20字节NumIn, NULL时用默认值
+};
+
+//! atsha204_authenticate_batch一次最多的项数(结果位图的宽度)
+#define ATSHA204_AUTH_BATCH_MAX			(32)
+
+//! config区可写的字: 0x04~0x14, 共17个
+#define ATSHA204_CONFIG_WORD_FIRST		(0x04)
+#define ATSHA204_CONFIG_WORDS			(17)
+
+//! 写config区计划中的一条Write
+struct atsha204_config_write {
+	uint8_t addr;					//!< Write的param_2: 4字节写为字地址, 32字节写为块号<<3
+	uint8_t size;					//!< SHA204_ZONE_ACCESS_4或SHA204_ZONE_ACCESS_32
+	uint8_t offset;					//!< 内容在data[68]中的偏移
+};
+
+//! 由atsha204_config_plan得出的写config区计划, 没有不同的字时n为0
+struct atsha204_config_plan {
+	uint8_t n;
+	struct atsha204_config_write writes[ATSHA204_CONFIG_WORDS];
+};
 
 
 
@@ -27,7 +71,8 @@ extern "C" {
 
 //! Topics
 extern void atsha204_personalization(int fd);
-uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_t *secret_key_value);
+uint8_t random_challenge_response_authentication(int fd, uint16_t key_id, uint8_t *secret_key_value, uint8_t auth_mode);
+uint8_t atsha204_authenticate_batch(int fd, const struct atsha204_auth_check *checks, uint32_t n, uint32_t *pass_mask);
 
 //atsha204_actions
 uint8_t atsha204_read_sn(int fd, uint8_t data[9]);
@@ -35,12 +80,19 @@ uint8_t atsha204_read_lock(int fd, uint8_t data[4]);
 uint8_t atsha204_read_devrev(int fd, uint8_t data[4]);
 
 uint8_t atsha204_read_config(int fd, uint8_t data[88]);
+uint8_t atsha204_config_snapshot(int fd, struct atsha204_config *conf);
+void atsha204_config_parse(const uint8_t data[88], struct atsha204_config *conf);
+uint8_t atsha204_config_snapshot_cached(int fd, struct sha204_cache *cache, struct atsha204_config *conf);
 uint8_t atsha204_write_config(int fd, uint8_t data[68]);
+void atsha204_config_plan(const uint8_t current[88], const uint8_t data[68], struct atsha204_config_plan *plan);
+uint8_t atsha204_write_config_plan(int fd, const struct atsha204_config_plan *plan, const uint8_t data[68]);
 
 uint8_t atsha204_lock_conf(int fd);
 uint8_t atsha204_lock_data(int fd);
 
 uint8_t atsha204_read_data(int fd, int slot, uint8_t *read_data);
+uint8_t atsha204_read_data_bulk(int fd, const struct atsha204_config *conf, uint16_t slot_mask,
+                                uint8_t data[16][32], uint16_t *read_mask);
 uint8_t atsha204_write_data(int fd, int slot,  uint8_t *write_data);
 
 uint8_t atsha204_encrypted_read(int fd, uint16_t key_id, uint8_t *key_value, uint16_t slot, uint8_t *readdata);
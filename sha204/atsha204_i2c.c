@@ -9,12 +9,14 @@
 #include "atsha204_i2c.h"
 #include "sha204_comm.h"
 #include "sha204_lib_return_codes.h"
+#include "sha204_clock.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>          // errno
 #include <string.h>         // strerror
+#include <pthread.h>
 
 enum i2c_word_address {
     SHA204_I2C_PACKET_FUNCTION_RESET,  //!< Reset device.
@@ -23,10 +25,125 @@ enum i2c_word_address {
     SHA204_I2C_PACKET_FUNCTION_NORMAL  //!< Write / evaluate data that follow this word address byte.
 };
 
-uint8_t sha204p_wakeup(int fd) {
+
+// 挂接的软件传输. 读写路径不加锁: 只在没有I/O进行时对某个fd挂接/摘除
+struct sha204p_transport_slot {
+    int fd;                                 // -1: 空闲
+    const struct sha204p_transport *ops;
+    void *ctx;
+};
+
+static struct sha204p_transport_slot sha204p_transports[SHA204P_TRANSPORT_MAX] = {
+    [0 ... SHA204P_TRANSPORT_MAX - 1] = { .fd = -1 }
+};
+static int sha204p_transport_count;         // 没有挂接时读写直接走系统调用
+static pthread_mutex_t sha204p_transport_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** \brief 将fd上的读写转交给软件传输, 替代i2c-dev. fd仍由调用者打开和关闭.
+ *  \return 0成功, -1表示表已满或fd已挂接
+ */
+int sha204p_attach(int fd, const struct sha204p_transport *ops, void *ctx) {
+    int free_slot = -1;
+
+    pthread_mutex_lock(&sha204p_transport_lock);
+    for (int i = 0; i < SHA204P_TRANSPORT_MAX; ++i) {
+        if (sha204p_transports[i].fd == fd) {
+            pthread_mutex_unlock(&sha204p_transport_lock);
+            return -1;
+        }
+        if (sha204p_transports[i].fd < 0 && free_slot < 0) free_slot = i;
+    }
+    if (free_slot < 0) {
+        pthread_mutex_unlock(&sha204p_transport_lock);
+        return -1;
+    }
+
+    sha204p_transports[free_slot].ops = ops;
+    sha204p_transports[free_slot].ctx = ctx;
+    __atomic_store_n(&sha204p_transports[free_slot].fd, fd, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&sha204p_transport_count, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sha204p_transport_lock);
+
+    return 0;
+}
+
+
+void sha204p_detach(int fd) {
+    pthread_mutex_lock(&sha204p_transport_lock);
+    for (int i = 0; i < SHA204P_TRANSPORT_MAX; ++i) {
+        if (sha204p_transports[i].fd == fd) {
+            __atomic_store_n(&sha204p_transports[i].fd, -1, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&sha204p_transport_count, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sha204p_transport_lock);
+}
+
+
+static const struct sha204p_transport_slot *sha204p_transport_find(int fd) {
+    if (__atomic_load_n(&sha204p_transport_count, __ATOMIC_ACQUIRE) == 0) return NULL;
+
+    for (int i = 0; i < SHA204P_TRANSPORT_MAX; ++i) {
+        if (__atomic_load_n(&sha204p_transports[i].fd, __ATOMIC_ACQUIRE) == fd) return &sha204p_transports[i];
+    }
+    return NULL;
+}
+
+
+/** \brief 查询fd上挂接的软件传输, 用于在其外面再包一层(例如I2C trace录制)
+ *  \return 0已挂接, -1未挂接(读写直接走i2c-dev)
+ */
+int sha204p_transport_get(int fd, const struct sha204p_transport **ops, void **ctx) {
+    const struct sha204p_transport_slot *t = sha204p_transport_find(fd);
+    if (!t) return -1;
+
+    *ops = t->ops;
+    *ctx = t->ctx;
+    return 0;
+}
+
+
+/** \brief fd上的一次总线写: 交给挂接的软件传输, 否则write()到i2c-dev
+ */
+int sha204p_write(int fd, const uint8_t *buf, size_t len) {
+    const struct sha204p_transport_slot *t = sha204p_transport_find(fd);
+    return t ? t->ops->write(t->ctx, buf, len) : (int) write(fd, buf, len);
+}
+
+
+/** \brief fd上的一次总线读, 同sha204p_write
+ */
+int sha204p_read(int fd, uint8_t *buf, size_t len) {
+    const struct sha204p_transport_slot *t = sha204p_transport_find(fd);
+    return t ? t->ops->read(t->ctx, buf, len) : (int) read(fd, buf, len);
+}
+
+
+// 逐帧打印收发内容, 见sha204p_set_debug
+static volatile uint8_t sha204p_debug;
+
+
+/** \brief 打开或关闭逐帧打印("iic send/recv"), 默认关闭.
+ *
+ *  打印在调用线程上同步进行且含写入的密钥明文, 只用于调试.
+ */
+void sha204p_set_debug(uint8_t on) {
+    sha204p_debug = on;
+}
+
+
+uint8_t sha204p_wakeup_pulse(int fd) {
     unsigned char wakeup = 0;
-    write(fd, &wakeup, 1);
-    usleep(3 * 1000);   // 唤醒后至少等待2.5ms
+    sha204p_write(fd, &wakeup, 1);
+
+    return SHA204_SUCCESS;
+}
+
+uint8_t sha204p_wakeup(int fd) {
+    sha204p_wakeup_pulse(fd);
+    sha204_clock_sleep_us(SHA204_WAKEUP_DELAY_MS * 1000);   // 唤醒后至少等待2.5ms
 
     return SHA204_SUCCESS;
 }
@@ -39,11 +156,13 @@ static uint8_t sha204p_send(int fd, uint8_t word_address, uint8_t count, uint8_t
     array[0] = word_address;
     memcpy(array + 1, buffer, count);
 
-    int ret = write(fd, array, count + 1);
+    int ret = sha204p_write(fd, array, count + 1);
 
-    printf("iic send [");
-    for (int i = 0; i < count + 1; ++i) printf("%02x ", array[i]);
-    ret == count + 1 ? printf("] => %d \n", ret) : printf("] => %s \n", strerror(errno));
+    if (sha204p_debug) {
+        printf("iic send [");
+        for (int i = 0; i < count + 1; ++i) printf("%02x ", array[i]);
+        ret == count + 1 ? printf("] => %d \n", ret) : printf("] => %s \n", strerror(errno));
+    }
 
     free(array);
     return (ret == count + 1) ? SHA204_SUCCESS : ret;
@@ -74,23 +193,25 @@ uint8_t sha204p_receive_response(int fd, uint8_t size, uint8_t *response) {
     unsigned char count;
     unsigned char *p;
 
-    read(fd, &response[0], 1);
+    sha204p_read(fd, &response[0], 1);
 
     count = response[0];
     if ((count < SHA204_RSP_SIZE_MIN) || (count > SHA204_RSP_SIZE_MAX))
         return SHA204_INVALID_SIZE;
 
-    int ret = read(fd, response + 1, count - 1);
+    int ret = sha204p_read(fd, response + 1, count - 1);
 
-    printf("iic recv [   ");
-    for (int i = 0; i < count; ++i) printf("%02x ", response[i]);
-    ret == count - 1 ? printf("] => %d \n", count) : printf("] => %s \n", strerror(errno));
+    if (sha204p_debug) {
+        printf("iic recv [   ");
+        for (int i = 0; i < count; ++i) printf("%02x ", response[i]);
+        ret == count - 1 ? printf("] => %d \n", count) : printf("] => %s \n", strerror(errno));
+    }
 
     return (ret > count - 1) ? SHA204_SUCCESS : ret;
 }
 
 uint8_t sha204p_resync(int fd, uint8_t size, uint8_t *response) {
-    usleep(100 * 1000);
+    sha204_clock_sleep_us(100 * 1000);
     return SHA204_SUCCESS;
 }
 
@@ -11,6 +11,7 @@
 
 
 #include <stdint.h>                                  // data type definitions
+#include <stddef.h>                                  // size_t
 
 #define SHA204_BUFFER_POS_COUNT      (0)             //!< buffer index of count byte in command or response
 #define SHA204_BUFFER_POS_DATA       (1)             //!< buffer index of data in response
@@ -21,17 +22,49 @@
 //! delay between Wakeup pulse and communication in ms
 #define SHA204_WAKEUP_DELAY          (uint8_t) (3.0 * CPU_CLOCK_DEVIATION_POSITIVE + 0.5)
 
+//! delay between Wakeup pulse and communication in ms (at least 2.5 ms)
+#define SHA204_WAKEUP_DELAY_MS       (3)
+
+
+//! 可同时挂接的软件传输数量
+#define SHA204P_TRANSPORT_MAX        (16)
+
+/**
+ * \brief 替代i2c-dev读写的软件传输, 例如器件模拟器或I2C trace回放.
+ *
+ * 语义与对i2c-dev的read()/write()相同: 成功返回字节数, 器件不应答(NACK)时返回-1并设置errno.
+ */
+struct sha204p_transport {
+    int (*write)(void *ctx, const uint8_t *buf, size_t len);
+    int (*read)(void *ctx, uint8_t *buf, size_t len);
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int     sha204p_attach(int fd, const struct sha204p_transport *ops, void *ctx);
+void    sha204p_detach(int fd);
+int     sha204p_transport_get(int fd, const struct sha204p_transport **ops, void **ctx);
+int     sha204p_write(int fd, const uint8_t *buf, size_t len);
+int     sha204p_read(int fd, uint8_t *buf, size_t len);
 
 uint8_t sha204p_send_command(int fd,uint8_t count, uint8_t *command);
 uint8_t sha204p_receive_response(int fd,uint8_t size, uint8_t *response);
 void    sha204p_init(void);
 void    sha204p_set_device_id(uint8_t id);
+void    sha204p_set_debug(uint8_t on);
 uint8_t sha204p_wakeup(int fd);
+uint8_t sha204p_wakeup_pulse(int fd);
 uint8_t sha204p_idle(int fd);
 uint8_t sha204p_sleep(int fd);
 uint8_t sha204p_reset_io(int fd);
 uint8_t sha204p_resync(int fd,uint8_t size, uint8_t *response);
 
+#ifdef __cplusplus
+}
+#endif
+
 
 
 #endif /* ATSHA204_I2C_H_ */
@@ -0,0 +1,173 @@
+/*
+ * sha204_admit.c
+ *
+ * 令牌桶准入控制
+ */
+
+#include "sha204_admit.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_comm_marshaling.h"
+
+#include <string.h>
+
+#define SHA204_ADMIT_SECOND_US      (1000000ULL)
+#define SHA204_ADMIT_HOUR_US        (3600ULL * SHA204_ADMIT_SECOND_US)
+
+
+static void bucket_init(struct sha204_bucket *b, uint32_t rate, uint32_t burst, uint64_t now_us) {
+    b->rate = rate;
+    b->burst = burst;
+    b->milli_tokens = (uint64_t) burst * 1000;
+    b->last_us = now_us;
+}
+
+
+// 按经过的时间补充令牌, period_us为rate对应的时间单位
+static void bucket_refill(struct sha204_bucket *b, uint64_t now_us, uint64_t period_us) {
+    if (now_us <= b->last_us) return;
+
+    uint64_t elapsed = now_us - b->last_us;
+    b->last_us = now_us;
+    if (b->rate == 0) return;
+
+    // 经过时间不超过从空桶补满所需的时间, elapsed * rate 不超过 burst * period_us + rate, 不会溢出
+    uint64_t fill_us = (uint64_t) b->burst * period_us / b->rate + 1;
+    if (elapsed > fill_us) elapsed = fill_us;
+
+    uint64_t scaled = elapsed * b->rate;
+    b->milli_tokens += scaled / period_us * 1000 + scaled % period_us * 1000 / period_us;
+    if (b->milli_tokens > (uint64_t) b->burst * 1000)
+        b->milli_tokens = (uint64_t) b->burst * 1000;
+}
+
+
+static int bucket_has(const struct sha204_bucket *b, uint32_t cost) {
+    return b->rate == 0 || b->milli_tokens >= (uint64_t) cost * 1000;
+}
+
+
+static void bucket_take(struct sha204_bucket *b, uint32_t cost) {
+    if (b->rate) b->milli_tokens -= (uint64_t) cost * 1000;
+}
+
+
+static void bucket_give(struct sha204_bucket *b, uint32_t cost) {
+    if (!b->rate) return;
+
+    b->milli_tokens += (uint64_t) cost * 1000;
+    if (b->milli_tokens > (uint64_t) b->burst * 1000)
+        b->milli_tokens = (uint64_t) b->burst * 1000;
+}
+
+
+/** \brief 缺省策略: 单个客户端最多占用一半芯片时间, 每小时最多3600次EEPROM写
+ */
+void sha204_admit_default_policy(struct sha204_admit_policy *policy) {
+    memset(policy, 0, sizeof(*policy));
+
+    policy->client_ms_per_s = 500;
+    policy->client_burst_ms = 1000;
+    policy->class_ms_per_s[SHA204_ADMIT_CRYPTO] = 400;
+    policy->class_burst_ms[SHA204_ADMIT_CRYPTO] = 800;
+    policy->class_ms_per_s[SHA204_ADMIT_EEPROM] = 200;
+    policy->class_burst_ms[SHA204_ADMIT_EEPROM] = 400;
+    policy->eeprom_per_hour = 3600;
+    policy->eeprom_burst = 64;
+    policy->max_queued = 32;
+}
+
+
+/** \brief 按策略初始化一个客户端的准入状态, 各桶初始为满
+ */
+void sha204_admit_init(struct sha204_admit *a, const struct sha204_admit_policy *policy, uint64_t now_us) {
+    memset(a, 0, sizeof(*a));
+
+    bucket_init(&a->client, policy->client_ms_per_s, policy->client_burst_ms, now_us);
+    for (int i = 0; i < SHA204_ADMIT_CLASS_COUNT; ++i)
+        bucket_init(&a->classes[i], policy->class_ms_per_s[i], policy->class_burst_ms[i], now_us);
+    bucket_init(&a->eeprom, policy->eeprom_per_hour, policy->eeprom_burst, now_us);
+    a->max_queued = policy->max_queued;
+}
+
+
+/** \brief 命令所属的分类
+ */
+uint8_t sha204_admit_class_of(uint8_t op_code) {
+    switch (op_code) {
+    case SHA204_WRITE:
+    case SHA204_LOCK:
+    case SHA204_UPDATE_EXTRA:
+    case SHA204_DERIVE_KEY:
+        return SHA204_ADMIT_EEPROM;
+
+    case SHA204_READ:
+    case SHA204_DEVREV:
+    case SHA204_PAUSE:
+        return SHA204_ADMIT_READ;
+
+    default:
+        return SHA204_ADMIT_CRYPTO;
+    }
+}
+
+
+/** \brief 判断是否准入一条请求, 准入时扣除令牌并计入在途数
+ *
+ * \param[in,out] a      客户端的准入状态
+ * \param[in]     req    请求
+ * \param[in]     now_us 当前时间(sha204_clock_now_us时基, us)
+ * \return SHA204_SUCCESS准入; SHA204_QUEUE_FULL在途请求过多; SHA204_RATE_LIMITED超出预算
+ */
+uint8_t sha204_admit_request(struct sha204_admit *a, const struct sha204_request *req, uint64_t now_us) {
+    uint8_t cls = sha204_admit_class_of(req->op_code);
+    uint32_t cost = sha204_request_cost_ms(req);
+
+    if (a->max_queued && a->queued >= a->max_queued) {
+        a->rejected++;
+        return SHA204_QUEUE_FULL;
+    }
+
+    bucket_refill(&a->client, now_us, SHA204_ADMIT_SECOND_US);
+    bucket_refill(&a->classes[cls], now_us, SHA204_ADMIT_SECOND_US);
+    if (cls == SHA204_ADMIT_EEPROM)
+        bucket_refill(&a->eeprom, now_us, SHA204_ADMIT_HOUR_US);
+
+    if (!bucket_has(&a->client, cost) || !bucket_has(&a->classes[cls], cost)
+        || (cls == SHA204_ADMIT_EEPROM && !bucket_has(&a->eeprom, 1))) {
+        a->rejected++;
+        return SHA204_RATE_LIMITED;
+    }
+
+    bucket_take(&a->client, cost);
+    bucket_take(&a->classes[cls], cost);
+    if (cls == SHA204_ADMIT_EEPROM)
+        bucket_take(&a->eeprom, 1);
+    a->queued++;
+
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 退还已准入但未能执行的请求(例如调度器以SHA204_QUEUE_FULL拒绝)扣除的令牌.
+ *
+ *  只退还令牌, 在途数仍由sha204_admit_done扣减.
+ *
+ * \param[in,out] a   客户端的准入状态
+ * \param[in]     req 此前sha204_admit_request准入的请求
+ */
+void sha204_admit_refund(struct sha204_admit *a, const struct sha204_request *req) {
+    uint8_t cls = sha204_admit_class_of(req->op_code);
+    uint32_t cost = sha204_request_cost_ms(req);
+
+    bucket_give(&a->client, cost);
+    bucket_give(&a->classes[cls], cost);
+    if (cls == SHA204_ADMIT_EEPROM)
+        bucket_give(&a->eeprom, 1);
+}
+
+
+/** \brief 已准入的请求完成或被取消
+ */
+void sha204_admit_done(struct sha204_admit *a) {
+    if (a->queued) a->queued--;
+}
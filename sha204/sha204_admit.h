@@ -0,0 +1,77 @@
+/*
+ * sha204_admit.h
+ *
+ * 请求准入控制: 每个客户端一组令牌桶与排队深度上限.
+ * broker按连接进程的uid(SO_PEERCRED)保存准入状态, 同一用户的所有连接共用一组令牌桶, 断开重连不会补满预算.
+ *
+ * 令牌按芯片时间计: 一条命令消耗其 *_EXEC_MAX 毫秒, 循环调用Random或Write的客户端很快耗尽自己的预算,
+ * 而不会占满器件让其他客户端排队. 写EEPROM的命令(Write/Lock/UpdateExtra/DeriveKey)另有按次数计的预算,
+ * 同时保护EEPROM寿命. 超出预算或排队过深的请求在入队前直接拒绝, 不占用器件.
+ */
+
+#ifndef SHA204_ADMIT_H
+#   define SHA204_ADMIT_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+
+//! 命令分类
+enum sha204_admit_class {
+    SHA204_ADMIT_READ = 0,          //!< Read, DevRev, Pause
+    SHA204_ADMIT_CRYPTO,            //!< MAC, HMAC, CheckMac, GenDig, Nonce, Random
+    SHA204_ADMIT_EEPROM,            //!< Write, Lock, UpdateExtra, DeriveKey
+    SHA204_ADMIT_CLASS_COUNT
+};
+
+/**
+ * \brief 令牌桶, 令牌以千分之一为单位累计, 避免低速率下的取整误差
+ */
+struct sha204_bucket {
+    uint32_t rate;                  //!< 每秒补充的令牌数, 0表示不限
+    uint32_t burst;                 //!< 桶容量
+    uint64_t milli_tokens;          //!< 当前令牌数 * 1000
+    uint64_t last_us;               //!< 上次补充的时间
+};
+
+/**
+ * \brief 准入策略. 速率为0表示不限制该项
+ */
+struct sha204_admit_policy {
+    uint32_t client_ms_per_s;                           //!< 每客户端每秒可占用的芯片时间(ms)
+    uint32_t client_burst_ms;                           //!< 每客户端的突发芯片时间(ms)
+    uint32_t class_ms_per_s[SHA204_ADMIT_CLASS_COUNT];  //!< 每客户端每类命令每秒可占用的芯片时间(ms)
+    uint32_t class_burst_ms[SHA204_ADMIT_CLASS_COUNT];  //!< 每客户端每类命令的突发芯片时间(ms)
+    uint32_t eeprom_per_hour;                           //!< 每客户端每小时可执行的EEPROM写命令数
+    uint32_t eeprom_burst;                              //!< EEPROM写命令的突发次数
+    uint32_t max_queued;                                //!< 每客户端最多在途的请求数, 0表示不限
+};
+
+/**
+ * \brief 单个客户端的准入状态. 非线程安全, 由调用者加锁
+ */
+struct sha204_admit {
+    struct sha204_bucket client;
+    struct sha204_bucket classes[SHA204_ADMIT_CLASS_COUNT];
+    struct sha204_bucket eeprom;    //!< rate为每小时次数
+    uint32_t max_queued;
+    uint32_t queued;                //!< 已准入未完成的请求数
+    uint32_t rejected;              //!< 累计拒绝数
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sha204_admit_default_policy(struct sha204_admit_policy *policy);
+void sha204_admit_init(struct sha204_admit *a, const struct sha204_admit_policy *policy, uint64_t now_us);
+uint8_t sha204_admit_class_of(uint8_t op_code);
+uint8_t sha204_admit_request(struct sha204_admit *a, const struct sha204_request *req, uint64_t now_us);
+void sha204_admit_refund(struct sha204_admit *a, const struct sha204_request *req);
+void sha204_admit_done(struct sha204_admit *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ * sha204_async.c
+ *
+ * 非阻塞命令执行: 定时器最小堆 + 每器件命令状态机
+ *
+ * 命令的状态: 排队 -> (唤醒 ->) 执行 -> 完成.
+ * 唤醒后等待SHA204_WAKEUP_DELAY_MS, 发送后等待命令的典型执行时间再开始轮询响应,
+ * 超过最长执行时间仍未收到有效响应则重新唤醒并重发一次, 与sha204c_send_and_receive的重试次数一致.
+ */
+
+#include "sha204_async.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_comm_marshaling.h"
+#include "atsha204_i2c.h"
+#include "sha204_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//! 响应未就绪时的轮询间隔(ms)
+#define SHA204_ASYNC_POLL_MS         (1)
+
+//! 最多发送次数
+#define SHA204_ASYNC_SEND_MAX        (2)
+
+enum sha204_async_state {
+    SHA204_ASYNC_IDLE,
+    SHA204_ASYNC_QUEUED,
+    SHA204_ASYNC_WAKE,                      // 已发出唤醒脉冲, 等待唤醒延时
+    SHA204_ASYNC_EXEC,                      // 已发送命令, 等待响应
+};
+
+struct sha204_reactor {
+    struct sha204_async_op **heap;          // 按due_us排列的最小堆
+    uint32_t count;
+    uint32_t capacity;                      // 不小于未完成的命令数, 入堆不会失败
+    uint32_t n_ops;                         // 已提交未完成的命令数
+
+    sha204_reactor_timer_hook hook;
+    void *hook_ctx;
+    uint64_t hook_due_us;                   // 最近一次通知的到期时间
+};
+
+struct sha204_async_dev {
+    struct sha204_reactor *reactor;
+    int fd;
+    struct sha204_awake awake;
+    struct sha204_async_op *cur;            // 正在器件上执行的命令
+    struct sha204_async_op *head;           // 排队的命令
+    struct sha204_async_op *tail;
+    uint8_t in_callback;                    // 正在调用完成回调
+    uint8_t destroyed;                      // 回调中释放了器件, 回调返回后再释放
+};
+
+
+static uint8_t heap_reserve(struct sha204_reactor *r, uint32_t n) {
+    if (n <= r->capacity)
+        return SHA204_SUCCESS;
+
+    uint32_t capacity = r->capacity ? r->capacity : 16;
+    while (capacity < n) capacity *= 2;
+
+    struct sha204_async_op **heap = (struct sha204_async_op **) realloc(r->heap, capacity * sizeof(*heap));
+    if (!heap) return SHA204_FUNC_FAIL;
+    r->heap = heap;
+    r->capacity = capacity;
+
+    return SHA204_SUCCESS;
+}
+
+
+// 每条未完成的命令最多在堆中出现一次, 提交时已预留空间
+static void heap_push(struct sha204_reactor *r, struct sha204_async_op *op) {
+    uint32_t i = r->count++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (r->heap[parent]->due_us <= op->due_us) break;
+        r->heap[i] = r->heap[parent];
+        i = parent;
+    }
+    r->heap[i] = op;
+}
+
+
+static struct sha204_async_op *heap_pop(struct sha204_reactor *r) {
+    struct sha204_async_op *top = r->heap[0];
+    struct sha204_async_op *last = r->heap[--r->count];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= r->count) break;
+        if (child + 1 < r->count && r->heap[child + 1]->due_us < r->heap[child]->due_us) child++;
+        if (last->due_us <= r->heap[child]->due_us) break;
+        r->heap[i] = r->heap[child];
+        i = child;
+    }
+    if (r->count) r->heap[i] = last;
+
+    return top;
+}
+
+
+static void reactor_notify(struct sha204_reactor *r) {
+    uint64_t due_us = sha204_reactor_next_us(r);
+
+    if (r->hook && due_us != r->hook_due_us) {
+        r->hook_due_us = due_us;
+        r->hook(r->hook_ctx, due_us);
+    }
+}
+
+
+// 让op在due_us时执行下一步
+static void op_arm(struct sha204_async_op *op, uint64_t due_us) {
+    op->due_us = due_us;
+    heap_push(op->dev->reactor, op);
+}
+
+
+static void dev_start(struct sha204_async_dev *dev);
+
+
+static void op_complete(struct sha204_async_op *op, uint8_t status) {
+    struct sha204_async_dev *dev = op->dev;
+
+    op->req.status = status;
+    op->state = SHA204_ASYNC_IDLE;
+    dev->cur = NULL;
+    dev->reactor->n_ops--;
+
+    // 回调中可能提交同一器件的下一条命令, 此时器件保持唤醒
+    if (op->on_complete) {
+        dev->in_callback = 1;
+        op->on_complete(op, op->complete_arg);
+        dev->in_callback = 0;
+        if (dev->destroyed) {
+            free(dev);
+            return;
+        }
+    }
+
+    dev_start(dev);
+    if (!dev->cur)
+        sha204_request_sleep(dev->fd, &dev->awake);
+}
+
+
+static void op_send(struct sha204_async_op *op) {
+    struct sha204_async_dev *dev = op->dev;
+    uint64_t now = sha204_clock_now_us();
+
+    op->n_send++;
+    uint8_t ret_code = sha204c_send(dev->fd, &op->comm);
+    if (ret_code != SHA204_SUCCESS) {
+        // 发送失败, 由下一步决定重发还是失败
+        op->req.status = ret_code;
+        op->expire_us = 0;
+    } else {
+        op->expire_us = now + (op->comm.poll_delay + op->comm.poll_timeout) * 1000ULL;
+    }
+
+    op->state = SHA204_ASYNC_EXEC;
+    op_arm(op, now + op->comm.poll_delay * 1000ULL);
+}
+
+
+// 器件空闲时取出下一条排队的命令开始执行
+static void dev_start(struct sha204_async_dev *dev) {
+    struct sha204_async_op *op = dev->head;
+    if (dev->cur || !op) return;
+
+    dev->head = op->next;
+    if (!dev->head) dev->tail = NULL;
+    op->next = NULL;
+    dev->cur = op;
+
+    uint64_t now = sha204_clock_now_us();
+    uint16_t cost_ms = sha204_request_cost_ms(&op->req);
+    if (dev->awake.awake && now + cost_ms * 1000ULL > dev->awake.since_us + SHA204_WATCHDOG_MIN_MS * 1000ULL) {
+        sha204p_idle(dev->fd);
+        dev->awake.awake = 0;
+    }
+
+    if (dev->awake.awake) {
+        op_send(op);
+        return;
+    }
+
+    sha204p_wakeup_pulse(dev->fd);
+    dev->awake.awake = 1;
+    dev->awake.since_us = now;
+    op->state = SHA204_ASYNC_WAKE;
+    op_arm(op, now + SHA204_WAKEUP_DELAY_MS * 1000ULL);
+}
+
+
+// 定时器到期, 推进op的状态
+static void op_step(struct sha204_async_op *op) {
+    struct sha204_async_dev *dev = op->dev;
+
+    if (op->state == SHA204_ASYNC_WAKE) {
+        op_send(op);
+        return;
+    }
+
+    uint8_t ret_code = op->req.status;
+    uint64_t now = sha204_clock_now_us();
+    if (op->expire_us) {
+        // 执行器轮询晚了也至少尝试接收一次
+        ret_code = sha204c_receive(dev->fd, &op->comm);
+        if (ret_code == SHA204_SUCCESS || ret_code == SHA204_PARSE_ERROR || ret_code == SHA204_CMD_FAIL) {
+            op_complete(op, ret_code);
+            return;
+        }
+        if (ret_code != SHA204_STATUS_CRC && now < op->expire_us) {
+            // 器件仍在执行
+            op->req.status = ret_code;
+            op_arm(op, now + SHA204_ASYNC_POLL_MS * 1000ULL);
+            return;
+        }
+    }
+
+    if (op->n_send >= SHA204_ASYNC_SEND_MAX) {
+        op_complete(op, ret_code);
+        return;
+    }
+
+    // 失去同步, 让器件休眠后重新唤醒再发送; 器件可能因此丢失TempKey
+    sha204p_sleep(dev->fd);
+    dev->awake.awake = 0;
+    sha204p_wakeup_pulse(dev->fd);
+    dev->awake.awake = 1;
+    dev->awake.since_us = now;
+    op->state = SHA204_ASYNC_WAKE;
+    op_arm(op, now + SHA204_WAKEUP_DELAY_MS * 1000ULL);
+}
+
+
+struct sha204_reactor *sha204_reactor_create(void) {
+    return (struct sha204_reactor *) calloc(1, sizeof(struct sha204_reactor));
+}
+
+
+/** \brief 释放reactor, 调用前须先释放其上的所有器件
+ */
+void sha204_reactor_destroy(struct sha204_reactor *r) {
+    if (!r) return;
+
+    free(r->heap);
+    free(r);
+}
+
+
+/** \brief 设置外部执行器的定时通知, 之后由执行器在到期后调用sha204_reactor_poll
+ */
+void sha204_reactor_set_timer_hook(struct sha204_reactor *r, sha204_reactor_timer_hook hook, void *ctx) {
+    r->hook = hook;
+    r->hook_ctx = ctx;
+    r->hook_due_us = 0;
+    reactor_notify(r);
+}
+
+
+/** \brief 最近一个定时器的到期时间(sha204_clock_now_us时基, us), 没有挂起的命令时返回0
+ */
+uint64_t sha204_reactor_next_us(const struct sha204_reactor *r) {
+    return r->count ? r->heap[0]->due_us : 0;
+}
+
+
+/** \brief 执行所有已到期的步骤, 不阻塞
+ *
+ * \return 本次推进的步骤数
+ */
+uint32_t sha204_reactor_poll(struct sha204_reactor *r) {
+    uint32_t n = 0;
+    uint64_t now = sha204_clock_now_us();
+
+    while (r->count && r->heap[0]->due_us <= now) {
+        op_step(heap_pop(r));
+        n++;
+        // 步骤中有I2C收发, 重新取时间避免把新定时器当作已到期
+        now = sha204_clock_now_us();
+    }
+
+    reactor_notify(r);
+    return n;
+}
+
+
+/** \brief 驱动reactor直到所有命令完成
+ */
+void sha204_reactor_run(struct sha204_reactor *r) {
+    while (r->count) {
+        sha204_reactor_poll(r);
+
+        uint64_t due_us = sha204_reactor_next_us(r);
+        if (!due_us) break;
+
+        sha204_clock_sleep_until_us(due_us);
+    }
+}
+
+
+/** \brief 在reactor上登记一个器件
+ *
+ * \param[in] r  reactor
+ * \param[in] fd file description
+ * \return 器件句柄, 失败返回NULL
+ */
+struct sha204_async_dev *sha204_async_dev_create(struct sha204_reactor *r, int fd) {
+    struct sha204_async_dev *dev = (struct sha204_async_dev *) calloc(1, sizeof(*dev));
+    if (!dev) return NULL;
+
+    dev->reactor = r;
+    dev->fd = fd;
+    return dev;
+}
+
+
+/** \brief 释放器件, 调用前其上的命令须已全部完成
+ */
+void sha204_async_dev_destroy(struct sha204_async_dev *dev) {
+    if (!dev) return;
+
+    if (dev->cur || dev->head)
+        printf("FAILED! sha204_async_dev_destroy: commands in flight\n");
+
+    sha204_request_sleep(dev->fd, &dev->awake);
+    if (dev->in_callback)
+        dev->destroyed = 1;
+    else
+        free(dev);
+}
+
+
+void sha204_async_op_init(struct sha204_async_op *op, sha204_async_done on_complete, void *complete_arg) {
+    memset(op, 0, sizeof(*op));
+    op->on_complete = on_complete;
+    op->complete_arg = complete_arg;
+}
+
+
+/** \brief 提交一条命令, 立即返回. 结果通过完成回调通知
+ *
+ * \param[in] dev 器件
+ * \param[in] op  命令, op->req已用sha204_request_init填充
+ * \return SHA204_SUCCESS已入队; SHA204_BAD_PARAM参数错误或命令尚未完成; SHA204_FUNC_FAIL内存不足
+ */
+uint8_t sha204_async_submit(struct sha204_async_dev *dev, struct sha204_async_op *op) {
+    struct sha204_command_parameters cmd_args;
+
+    if (!dev || !op || op->state != SHA204_ASYNC_IDLE || sha204_request_check(&op->req) != SHA204_SUCCESS)
+        return SHA204_BAD_PARAM;
+
+    cmd_args.op_code = op->req.op_code;
+    cmd_args.param_1 = op->req.param_1;
+    cmd_args.param_2 = op->req.param_2;
+    cmd_args.data_len_1 = op->req.data_len;
+    cmd_args.data_1 = op->req.data_len ? op->req.data : NULL;
+    cmd_args.data_len_2 = 0;
+    cmd_args.data_2 = NULL;
+    cmd_args.data_len_3 = 0;
+    cmd_args.data_3 = NULL;
+    cmd_args.tx_size = sizeof(op->tx_buffer);
+    cmd_args.tx_buffer = op->tx_buffer;
+    cmd_args.rx_size = sizeof(op->req.rsp);
+    cmd_args.rx_buffer = op->req.rsp;
+
+    uint8_t ret_code = sha204m_prepare(dev->fd, &cmd_args, &op->comm);
+    if (ret_code != SHA204_SUCCESS)
+        return ret_code;
+    if (heap_reserve(dev->reactor, dev->reactor->n_ops + 1) != SHA204_SUCCESS)
+        return SHA204_FUNC_FAIL;
+    dev->reactor->n_ops++;
+
+    op->dev = dev;
+    op->next = NULL;
+    op->n_send = 0;
+    op->req.status = SHA204_FUNC_FAIL;
+    op->state = SHA204_ASYNC_QUEUED;
+
+    if (dev->tail) dev->tail->next = op;
+    else dev->head = op;
+    dev->tail = op;
+
+    dev_start(dev);
+    reactor_notify(dev->reactor);
+
+    return SHA204_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ * sha204_async.h
+ *
+ * 非阻塞的命令执行: 命令的执行延时与唤醒延时变为reactor上的定时器, 不再usleep阻塞调用线程.
+ *
+ * 每个器件一条FIFO, 同一器件上的命令依次执行, 不同器件上的命令交错进行.
+ * 一个线程驱动一个reactor, 可以同时挂起任意多个命令. reactor及其上的器件只能在驱动它的线程上访问.
+ * 完成回调里提交同一器件的下一条命令时器件保持唤醒(TempKey不丢失), 队列空了才让器件休眠.
+ *
+ * 驱动方式二选一:
+ *  - sha204_reactor_run: 内置循环, 睡到最近的定时器到期, 直到没有未完成的命令
+ *  - sha204_reactor_set_timer_hook + sha204_reactor_poll: 最近的到期时间变化时通知外部执行器,
+ *    由执行器在到期后调用sha204_reactor_poll
+ *
+ * C++20协程接口见sha204_async.hpp.
+ */
+
+#ifndef SHA204_ASYNC_H
+#   define SHA204_ASYNC_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+
+struct sha204_reactor;
+struct sha204_async_dev;
+struct sha204_async_op;
+
+//! 命令完成回调, 在驱动reactor的线程上调用, 回调返回后reactor不再访问op
+typedef void (*sha204_async_done)(struct sha204_async_op *op, void *arg);
+
+//! 最近到期时间变化时的通知, due_us为0表示没有挂起的定时器
+typedef void (*sha204_reactor_timer_hook)(void *ctx, uint64_t due_us);
+
+/**
+ * \brief 一条异步命令. 由调用者分配, 从提交到完成回调之前不能释放或修改.
+ */
+struct sha204_async_op {
+    struct sha204_request req;              //!< 命令与结果, 用sha204_request_init填充
+    sha204_async_done on_complete;          //!< 完成回调
+    void *complete_arg;                     //!< 完成回调参数
+
+    // 以下由reactor维护
+    struct sha204_async_dev *dev;
+    struct sha204_async_op *next;
+    uint8_t state;
+    uint8_t n_send;                         //!< 已发送次数
+    uint64_t due_us;                        //!< 下一步的到期时间
+    uint64_t expire_us;                     //!< 超过该时间仍未收到响应则重发或失败
+    uint8_t tx_buffer[SHA204_CMD_SIZE_MAX];
+    struct sha204_send_and_receive_parameters comm;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_reactor *sha204_reactor_create(void);
+void sha204_reactor_destroy(struct sha204_reactor *r);
+void sha204_reactor_set_timer_hook(struct sha204_reactor *r, sha204_reactor_timer_hook hook, void *ctx);
+uint64_t sha204_reactor_next_us(const struct sha204_reactor *r);
+uint32_t sha204_reactor_poll(struct sha204_reactor *r);
+void sha204_reactor_run(struct sha204_reactor *r);
+
+struct sha204_async_dev *sha204_async_dev_create(struct sha204_reactor *r, int fd);
+void sha204_async_dev_destroy(struct sha204_async_dev *dev);
+
+void sha204_async_op_init(struct sha204_async_op *op, sha204_async_done on_complete, void *complete_arg);
+uint8_t sha204_async_submit(struct sha204_async_dev *dev, struct sha204_async_op *op);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * sha204_async.hpp
+ *
+ * sha204_async.h的C++20协程接口:
+ *
+ *     sha204::async_device dev(reactor, fd);
+ *     sha204_request rsp = co_await dev.read_slot(3);
+ *     sha204_request mac = co_await dev.mac(challenge, key_id);
+ *
+ * 每个co_await返回执行完成的请求记录(status与响应包). 协程在驱动reactor的线程上恢复,
+ * 恢复后立即提交同一器件的下一条命令时器件保持唤醒, 因此Nonce/GenDig之后的MAC仍能使用TempKey.
+ * 协程类型(task)由调用方的框架提供, 这里只提供可等待对象.
+ *
+ * 需要C++20(-std=c++20); 以C++17编译时本文件为空.
+ */
+
+#ifndef SHA204_ASYNC_HPP
+#   define SHA204_ASYNC_HPP
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <cstring>
+
+#include "sha204_async.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_comm_marshaling.h"
+
+namespace sha204 {
+
+/**
+ * \brief 一条命令的可等待对象, 挂起期间位于协程帧内, 不能拷贝或移动
+ */
+class command {
+public:
+    command(sha204_async_dev *dev, uint8_t op_code, uint8_t param_1, uint16_t param_2,
+            const uint8_t *data = nullptr, uint8_t data_len = 0) : dev_(dev) {
+        sha204_async_op_init(&op_, &command::on_complete, this);
+        status_ = sha204_request_init(&op_.req, op_code, param_1, param_2, data, data_len);
+    }
+
+    command(const command &) = delete;
+    command &operator=(const command &) = delete;
+
+    bool await_ready() const noexcept { return status_ != SHA204_SUCCESS; }
+
+    // 提交失败时不挂起, 直接返回带错误码的请求记录
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        handle_ = handle;
+        status_ = sha204_async_submit(dev_, &op_);
+        return status_ == SHA204_SUCCESS;
+    }
+
+    sha204_request await_resume() noexcept {
+        if (status_ != SHA204_SUCCESS)
+            op_.req.status = status_;
+        return op_.req;
+    }
+
+private:
+    static void on_complete(sha204_async_op *, void *arg) {
+        static_cast<command *>(arg)->handle_.resume();
+    }
+
+    sha204_async_dev *dev_;
+    sha204_async_op op_;
+    uint8_t status_;
+    std::coroutine_handle<> handle_;
+};
+
+/**
+ * \brief reactor上的一个器件
+ */
+class async_device {
+public:
+    async_device(sha204_reactor *reactor, int fd) : dev_(sha204_async_dev_create(reactor, fd)) {}
+    ~async_device() { sha204_async_dev_destroy(dev_); }
+
+    async_device(const async_device &) = delete;
+    async_device &operator=(const async_device &) = delete;
+
+    //! 任意命令, 数据字段合并为一段
+    command execute(uint8_t op_code, uint8_t param_1, uint16_t param_2,
+                    const uint8_t *data = nullptr, uint8_t data_len = 0) {
+        return command(dev_, op_code, param_1, param_2, data, data_len);
+    }
+
+    //! 读取数据区一个slot的32字节, 数据在rsp[1..32]
+    command read_slot(uint8_t slot) {
+        return command(dev_, SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, (uint16_t) (slot * 8));
+    }
+
+    //! 读取配置区/OTP区/数据区的4或32字节, address为字地址
+    command read(uint8_t zone, uint16_t address) {
+        return command(dev_, SHA204_READ, zone, address);
+    }
+
+    //! 用slot key_id中的密钥对32字节挑战计算MAC(mode 0), 摘要在rsp[1..32]
+    command mac(const uint8_t challenge[MAC_CHALLENGE_SIZE], uint16_t key_id) {
+        return command(dev_, SHA204_MAC, MAC_MODE_CHALLENGE, key_id, challenge, MAC_CHALLENGE_SIZE);
+    }
+
+    //! 32字节随机数, 在rsp[1..32]
+    command random(uint8_t mode = RANDOM_SEED_UPDATE) {
+        return command(dev_, SHA204_RANDOM, mode, 0);
+    }
+
+    //! Nonce命令, num_in为20字节(随机模式)或32字节(直通模式)
+    command nonce(uint8_t mode, const uint8_t *num_in) {
+        return command(dev_, SHA204_NONCE, mode, 0, num_in,
+                       mode == NONCE_MODE_PASSTHROUGH ? NONCE_NUMIN_SIZE_PASSTHROUGH : NONCE_NUMIN_SIZE);
+    }
+
+    sha204_async_dev *handle() const { return dev_; }
+
+private:
+    sha204_async_dev *dev_;
+};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,818 @@
+/*
+ * sha204_broker.c
+ *
+ * broker与客户端库. broker主线程用epoll监听连接与各客户端的提交门铃,
+ * 把提交队列中的记录转为调度请求; 结果在器件的派发线程上写回完成队列.
+ */
+
+#define _GNU_SOURCE                     // accept4, POLLRDHUP, struct ucred
+
+#include "sha204_broker.h"
+#include "sha204_sched.h"
+#include "sha204_admit.h"
+#include "sha204_lib_return_codes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/memfd.h>
+
+//! broker最多登记的器件数
+#define SHA204_BROKER_DEVICE_MAX    (16)
+
+//! 每个器件的排队上限, 超过后非紧急请求直接拒绝
+#define SHA204_BROKER_QUEUE_MAX     (64)
+
+//! 握手的接收超时(ms), 防止半开连接阻塞主线程
+#define SHA204_BROKER_HELLO_MS      (1000)
+
+enum broker_watch_kind {
+    BROKER_WATCH_LISTEN,
+    BROKER_WATCH_STOP,
+    BROKER_WATCH_SOCK,
+    BROKER_WATCH_SQ,
+};
+
+struct broker_client;
+
+// 一个用户(连接进程的uid)的准入状态, 该用户的所有连接共用, 断开后保留到broker销毁
+struct broker_account {
+    uid_t uid;
+    struct sha204_admit admit;      // 由sha204_broker.admit_lock保护
+    struct broker_account *next;
+};
+
+struct broker_watch {
+    enum broker_watch_kind kind;
+    struct broker_client *c;
+};
+
+// 一条已转交调度器的命令
+struct broker_slot {
+    struct sha204_sched_req r;
+    struct broker_client *c;
+    uint64_t tag;
+    uint8_t device;
+    uint8_t in_use;
+};
+
+struct broker_client {
+    struct sha204_broker *b;
+    int sock;
+    int sq_efd;                     // 提交门铃, 客户端写
+    int cq_efd;                     // 完成门铃, broker写
+    struct sha204_broker_shm *shm;
+    size_t shm_size;
+    uint32_t mask;
+
+    // 以下由lock保护: 完成队列的生产者在各器件的派发线程上
+    pthread_mutex_t lock;
+    struct broker_slot *slots;
+    uint32_t *free_slots;
+    uint32_t n_free;
+    uint32_t outstanding;           // 已交给调度器未完成的命令数
+    struct broker_account *account; // 按uid共用的准入状态
+    uint8_t sq_blocked;             // 因无空闲slot停止读取提交队列
+    uint8_t closing;
+
+    struct broker_watch w_sock;
+    struct broker_watch w_sq;
+    struct broker_client *next;
+};
+
+struct sha204_broker {
+    int listen_fd;
+    int stop_efd;
+    int epfd;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+    struct sha204_sched *sched[SHA204_BROKER_DEVICE_MAX];
+    uint32_t n_devices;
+    struct sha204_admit_policy policy;  // 新用户使用的准入策略
+
+    // 准入状态按uid保存, 完成回调在各器件的派发线程上更新, 由admit_lock保护; 在c->lock之内加锁
+    pthread_mutex_t admit_lock;
+    struct broker_account *accounts;
+
+    struct broker_client *clients;
+    struct broker_watch w_listen;
+    struct broker_watch w_stop;
+};
+
+
+static size_t broker_shm_size(uint32_t ring_size) {
+    return sizeof(struct sha204_broker_shm) + 2 * (size_t) ring_size * sizeof(struct sha204_broker_msg);
+}
+
+
+// 单生产者入队, 满则返回0
+static int ring_push(struct sha204_broker_ring *ring, struct sha204_broker_msg *msgs, uint32_t mask,
+                     const struct sha204_broker_msg *msg) {
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > mask)
+        return 0;
+
+    memcpy(&msgs[tail & mask], msg, sizeof(*msg));
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+// 单消费者出队, 空则返回0
+static int ring_pop(struct sha204_broker_ring *ring, struct sha204_broker_msg *msgs, uint32_t mask,
+                    struct sha204_broker_msg *msg) {
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    memcpy(msg, &msgs[head & mask], sizeof(*msg));
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+static void efd_signal(int efd) {
+    uint64_t one = 1;
+    write(efd, &one, sizeof(one));
+}
+
+
+static void efd_drain(int efd) {
+    uint64_t value;
+    read(efd, &value, sizeof(value));
+}
+
+
+/************************************************************************************************
+ * broker端
+ ************************************************************************************************/
+
+static void broker_client_free(struct broker_client *c) {
+    munmap(c->shm, c->shm_size);
+    close(c->sq_efd);
+    close(c->cq_efd);
+    close(c->sock);
+    pthread_mutex_destroy(&c->lock);
+    free(c->free_slots);
+    free(c->slots);
+    free(c);
+}
+
+
+// 写入完成队列并通知客户端, 调用时持有c->lock
+static void broker_post(struct broker_client *c, uint64_t tag, uint8_t device, const struct sha204_request *req) {
+    struct sha204_broker_msg msg;
+    uint32_t ring_size = c->mask + 1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.tag = tag;
+    msg.device = device;
+    memcpy(&msg.req, req, sizeof(msg.req));
+
+    // 客户端库保证在途命令不超过队列长度; 不守规矩的客户端拿不到多出来的结果
+    if (ring_push(&c->shm->cq, c->shm->msgs + ring_size, c->mask, &msg))
+        efd_signal(c->cq_efd);
+}
+
+
+// 在器件的派发线程上调用
+static void broker_complete(struct sha204_sched_req *r, void *arg) {
+    struct broker_slot *slot = (struct broker_slot *) arg;
+    struct broker_client *c = slot->c;
+    int poke, last;
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->closing)
+        broker_post(c, slot->tag, slot->device, &r->req);
+    slot->in_use = 0;
+    c->free_slots[c->n_free++] = (uint32_t) (slot - c->slots);
+    c->outstanding--;
+    pthread_mutex_lock(&c->b->admit_lock);
+    sha204_admit_done(&c->account->admit);
+    pthread_mutex_unlock(&c->b->admit_lock);
+    poke = c->sq_blocked && !c->closing;
+    c->sq_blocked = 0;
+    last = c->closing && c->outstanding == 0;
+    pthread_mutex_unlock(&c->lock);
+
+    // 主线程因无空闲slot停止了读取, 借提交门铃让它继续
+    if (poke)
+        efd_signal(c->sq_efd);
+    if (last)
+        broker_client_free(c);
+}
+
+
+// 读取客户端的提交队列并转交调度器. 队列指针在客户端可写的内存中: 一次最多读一圈,
+// 其余的借门铃下次再读, 不让一个客户端占住主线程; 指针超出队列长度返回-1, 由调用者断开
+static int broker_drain(struct sha204_broker *b, struct broker_client *c) {
+    struct sha204_broker_msg msg;
+    uint32_t ring_size = c->mask + 1;
+
+    efd_drain(c->sq_efd);
+
+    for (uint32_t n = 0; ; ++n) {
+        pthread_mutex_lock(&c->lock);
+        if (__atomic_load_n(&c->shm->sq.tail, __ATOMIC_ACQUIRE) - c->shm->sq.head > ring_size) {
+            pthread_mutex_unlock(&c->lock);
+            return -1;
+        }
+        if (n == ring_size) {
+            pthread_mutex_unlock(&c->lock);
+            efd_signal(c->sq_efd);
+            return 0;
+        }
+        if (c->n_free == 0) {
+            c->sq_blocked = 1;
+            pthread_mutex_unlock(&c->lock);
+            return 0;
+        }
+        if (!ring_pop(&c->shm->sq, c->shm->msgs, c->mask, &msg)) {
+            pthread_mutex_unlock(&c->lock);
+            return 0;
+        }
+
+        uint8_t status = SHA204_BAD_PARAM;
+        // 请求来自客户端的共享内存, 长度与命令码须先检查
+        if (msg.device < b->n_devices && msg.prio < SHA204_PRIO_COUNT && sha204_request_check(&msg.req) == SHA204_SUCCESS) {
+            pthread_mutex_lock(&b->admit_lock);
+            status = sha204_admit_request(&c->account->admit, &msg.req, sha204_sched_now_us());
+            pthread_mutex_unlock(&b->admit_lock);
+        }
+        if (status != SHA204_SUCCESS) {
+            // 拒绝的请求不占用slot与器件, 立即回复
+            msg.req.status = status;
+            broker_post(c, msg.tag, msg.device, &msg.req);
+            pthread_mutex_unlock(&c->lock);
+            continue;
+        }
+
+        struct broker_slot *slot = &c->slots[c->free_slots[--c->n_free]];
+        slot->in_use = 1;
+        c->outstanding++;
+        pthread_mutex_unlock(&c->lock);
+
+        slot->tag = msg.tag;
+        slot->device = msg.device;
+        sha204_sched_req_init(&slot->r, msg.prio, msg.timeout_ms);
+        memcpy(&slot->r.req, &msg.req, sizeof(slot->r.req));
+        slot->r.owner = c;
+        slot->r.hold = (msg.flags & SHA204_BROKER_HOLD) ? 1 : 0;
+        slot->r.on_complete = broker_complete;
+        slot->r.complete_arg = slot;
+
+        status = sha204_sched_submit(b->sched[msg.device], &slot->r);
+        if (status != SHA204_SUCCESS) {
+            // 调度器拒绝(SHA204_QUEUE_FULL)的命令没有占用芯片, 退还令牌
+            pthread_mutex_lock(&b->admit_lock);
+            sha204_admit_refund(&c->account->admit, &slot->r.req);
+            pthread_mutex_unlock(&b->admit_lock);
+            slot->r.req.status = status;
+            broker_complete(&slot->r, slot);
+        }
+    }
+}
+
+
+static void broker_disconnect(struct sha204_broker *b, struct broker_client *c) {
+    struct broker_client **pp;
+    int last;
+
+    for (pp = &b->clients; *pp; pp = &(*pp)->next) {
+        if (*pp == c) {
+            *pp = c->next;
+            break;
+        }
+    }
+    epoll_ctl(b->epfd, EPOLL_CTL_DEL, c->sock, NULL);
+    epoll_ctl(b->epfd, EPOLL_CTL_DEL, c->sq_efd, NULL);
+
+    // 主线程也持有一个引用, 避免遍历期间被完成回调释放
+    pthread_mutex_lock(&c->lock);
+    c->closing = 1;
+    c->outstanding++;
+    pthread_mutex_unlock(&c->lock);
+
+    // 取消仍在排队的命令; 正在执行的命令完成后由broker_complete回收
+    for (uint32_t i = 0; i <= c->mask; ++i) {
+        struct broker_slot *slot = &c->slots[i];
+        if (slot->in_use && sha204_sched_cancel(b->sched[slot->device], &slot->r) == SHA204_SUCCESS) {
+            pthread_mutex_lock(&c->lock);
+            slot->in_use = 0;
+            c->outstanding--;
+            pthread_mutex_lock(&b->admit_lock);
+            sha204_admit_done(&c->account->admit);
+            pthread_mutex_unlock(&b->admit_lock);
+            pthread_mutex_unlock(&c->lock);
+        }
+    }
+    for (uint32_t i = 0; i < b->n_devices; ++i)
+        sha204_sched_release(b->sched[i], c);
+
+    pthread_mutex_lock(&c->lock);
+    last = --c->outstanding == 0;
+    pthread_mutex_unlock(&c->lock);
+    if (last)
+        broker_client_free(c);
+}
+
+
+// 查找或创建uid的准入状态, 只在主线程上调用
+static struct broker_account *broker_account_get(struct sha204_broker *b, uid_t uid) {
+    struct broker_account *a;
+
+    for (a = b->accounts; a; a = a->next)
+        if (a->uid == uid)
+            return a;
+
+    a = (struct broker_account *) calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    a->uid = uid;
+    sha204_admit_init(&a->admit, &b->policy, sha204_sched_now_us());
+
+    pthread_mutex_lock(&b->admit_lock);
+    a->next = b->accounts;
+    b->accounts = a;
+    pthread_mutex_unlock(&b->admit_lock);
+    return a;
+}
+
+
+// 接收握手与三个fd, 校验共享内存后登记客户端
+static void broker_accept(struct sha204_broker *b) {
+    struct sha204_broker_hello hello;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr mh;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = SHA204_BROKER_HELLO_MS * 1000 };
+    int fds[3] = { -1, -1, -1 };
+    struct broker_client *c = NULL;
+    struct broker_account *account;
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+
+    int sock = accept4(b->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) return;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) != sizeof(hello))
+        goto reject;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        goto reject;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    uint32_t ring_size = hello.ring_size;
+    if (hello.magic != SHA204_BROKER_MAGIC || hello.version != SHA204_BROKER_VERSION
+        || hello.msg_size != sizeof(struct sha204_broker_msg)
+        || ring_size == 0 || ring_size > SHA204_BROKER_RING_MAX || (ring_size & (ring_size - 1)))
+        goto reject;
+
+    // 准入按对端进程的uid计, 重连不会得到新的预算
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0
+        || !(account = broker_account_get(b, cred.uid)))
+        goto reject;
+
+    // 共享内存须已封住大小: 否则客户端事后ftruncate缩小, broker访问队列时收到SIGBUS
+    struct stat st;
+    size_t shm_size = broker_shm_size(ring_size);
+    int seals = fcntl(fds[0], F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fds[0], &st) != 0 || (size_t) st.st_size < shm_size)
+        goto reject;
+
+    c = (struct broker_client *) calloc(1, sizeof(*c));
+    if (!c) goto reject;
+    c->shm = (struct sha204_broker_shm *) mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    c->slots = (struct broker_slot *) calloc(ring_size, sizeof(struct broker_slot));
+    c->free_slots = (uint32_t *) calloc(ring_size, sizeof(uint32_t));
+    if (c->shm == MAP_FAILED || !c->slots || !c->free_slots) {
+        if (c->shm != MAP_FAILED) munmap(c->shm, shm_size);
+        free(c->free_slots);
+        free(c->slots);
+        free(c);
+        goto reject;
+    }
+    close(fds[0]);
+
+    c->b = b;
+    c->sock = sock;
+    c->sq_efd = fds[1];
+    c->cq_efd = fds[2];
+    c->shm_size = shm_size;
+    c->mask = ring_size - 1;
+    pthread_mutex_init(&c->lock, NULL);
+    for (uint32_t i = 0; i < ring_size; ++i) {
+        c->slots[i].c = c;
+        c->free_slots[i] = ring_size - 1 - i;
+    }
+    c->n_free = ring_size;
+    c->account = account;
+
+    c->w_sock.kind = BROKER_WATCH_SOCK;
+    c->w_sock.c = c;
+    c->w_sq.kind = BROKER_WATCH_SQ;
+    c->w_sq.c = c;
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP };
+    ev.data.ptr = &c->w_sock;
+    epoll_ctl(b->epfd, EPOLL_CTL_ADD, c->sock, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &c->w_sq;
+    epoll_ctl(b->epfd, EPOLL_CTL_ADD, c->sq_efd, &ev);
+
+    c->next = b->clients;
+    b->clients = c;
+
+    hello.n_devices = b->n_devices;
+    send(sock, &hello, sizeof(hello), MSG_NOSIGNAL);
+
+    // 握手之前客户端可能已经提交
+    if (broker_drain(b, c) != 0)
+        broker_disconnect(b, c);
+    return;
+
+reject:
+    for (int i = 0; i < 3; ++i)
+        if (fds[i] >= 0) close(fds[i]);
+    memset(&hello, 0, sizeof(hello));
+    send(sock, &hello, sizeof(hello), MSG_NOSIGNAL);
+    close(sock);
+}
+
+
+/** \brief 创建broker并监听Unix域套接字
+ *
+ * \param[in] socket_path 套接字路径, 已存在的同名文件会被删除
+ * \return broker, 失败返回NULL
+ */
+struct sha204_broker *sha204_broker_create(const char *socket_path) {
+    struct sockaddr_un addr;
+    struct sha204_broker *b;
+
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path))
+        return NULL;
+
+    b = (struct sha204_broker *) calloc(1, sizeof(*b));
+    if (!b) return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    strcpy(b->path, socket_path);
+    unlink(socket_path);
+
+    b->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    b->stop_efd = eventfd(0, EFD_CLOEXEC);
+    b->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (b->listen_fd < 0 || b->stop_efd < 0 || b->epfd < 0
+        || bind(b->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(b->listen_fd, 16) != 0) {
+        printf("FAILED! sha204_broker_create: %s\n", strerror(errno));
+        if (b->listen_fd >= 0) close(b->listen_fd);
+        if (b->stop_efd >= 0) close(b->stop_efd);
+        if (b->epfd >= 0) close(b->epfd);
+        free(b);
+        return NULL;
+    }
+
+    sha204_admit_default_policy(&b->policy);
+    pthread_mutex_init(&b->admit_lock, NULL);
+    b->w_listen.kind = BROKER_WATCH_LISTEN;
+    b->w_stop.kind = BROKER_WATCH_STOP;
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.ptr = &b->w_listen;
+    epoll_ctl(b->epfd, EPOLL_CTL_ADD, b->listen_fd, &ev);
+    ev.data.ptr = &b->w_stop;
+    epoll_ctl(b->epfd, EPOLL_CTL_ADD, b->stop_efd, &ev);
+
+    return b;
+}
+
+
+/** \brief 断开所有客户端, 停止各器件的调度器并释放broker. 器件fd由调用者关闭
+ */
+void sha204_broker_destroy(struct sha204_broker *b) {
+    if (!b) return;
+
+    while (b->clients)
+        broker_disconnect(b, b->clients);
+    // 调度器销毁时等待正在执行的命令, 其完成回调释放剩余的客户端
+    for (uint32_t i = 0; i < b->n_devices; ++i)
+        sha204_sched_destroy(b->sched[i]);
+
+    while (b->accounts) {
+        struct broker_account *a = b->accounts;
+        b->accounts = a->next;
+        free(a);
+    }
+    pthread_mutex_destroy(&b->admit_lock);
+
+    close(b->epfd);
+    close(b->stop_efd);
+    close(b->listen_fd);
+    unlink(b->path);
+    free(b);
+}
+
+
+/** \brief 登记一个器件, 须在sha204_broker_run之前调用
+ *
+ * \param[in] fd 已设置好从机地址的I2C文件描述符
+ * \return 器件编号, 失败返回-1
+ */
+int sha204_broker_add_device(struct sha204_broker *b, int fd) {
+    if (b->n_devices >= SHA204_BROKER_DEVICE_MAX)
+        return -1;
+
+    struct sha204_sched *s = sha204_sched_create(fd);
+    if (!s) return -1;
+    sha204_sched_set_limit(s, SHA204_BROKER_QUEUE_MAX);
+
+    b->sched[b->n_devices] = s;
+    return (int) b->n_devices++;
+}
+
+
+/** \brief 设置准入策略, 对之后首次连接的用户(uid)生效
+ */
+void sha204_broker_set_policy(struct sha204_broker *b, const struct sha204_admit_policy *policy) {
+    memcpy(&b->policy, policy, sizeof(b->policy));
+}
+
+
+/** \brief 运行broker主循环, 直到sha204_broker_stop
+ */
+void sha204_broker_run(struct sha204_broker *b) {
+    struct epoll_event events[32];
+
+    for (;;) {
+        int n = epoll_wait(b->epfd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            struct broker_watch *w = (struct broker_watch *) events[i].data.ptr;
+
+            switch (w->kind) {
+            case BROKER_WATCH_LISTEN:
+                broker_accept(b);
+                break;
+            case BROKER_WATCH_STOP:
+                efd_drain(b->stop_efd);
+                return;
+            case BROKER_WATCH_SOCK:
+                // 握手之后客户端不再发送数据, 可读即为断开
+                broker_disconnect(b, w->c);
+                // 同一批事件中可能还有该客户端的门铃, 重新等待
+                i = n;
+                break;
+            case BROKER_WATCH_SQ:
+                if (broker_drain(b, w->c) != 0) {
+                    // 提交队列的指针被改乱
+                    broker_disconnect(b, w->c);
+                    i = n;
+                }
+                break;
+            }
+        }
+    }
+}
+
+
+/** \brief 让sha204_broker_run返回, 可在信号处理函数中调用
+ */
+void sha204_broker_stop(struct sha204_broker *b) {
+    efd_signal(b->stop_efd);
+}
+
+
+/************************************************************************************************
+ * 客户端
+ ************************************************************************************************/
+
+struct sha204_client {
+    int sock;
+    int sq_efd;
+    int cq_efd;
+    struct sha204_broker_shm *shm;
+    size_t shm_size;
+    uint32_t mask;
+    uint32_t in_flight;             // 已提交未取回的命令数, 不超过队列长度
+    uint32_t n_devices;
+    uint64_t next_tag;
+};
+
+
+/** \brief 连接broker
+ *
+ * \param[in] socket_path broker的套接字路径
+ * \param[in] ring_size   队列长度, 即最多在途的命令数, 向上取整为2的幂
+ * \return 客户端句柄, 失败返回NULL. 句柄不是线程安全的, 每个线程各自连接
+ */
+struct sha204_client *sha204_client_connect(const char *socket_path, uint32_t ring_size) {
+    struct sockaddr_un addr;
+    struct sha204_broker_hello hello;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr mh;
+    uint32_t size = 1;
+    int memfd = -1;
+
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path) || ring_size > SHA204_BROKER_RING_MAX)
+        return NULL;
+    while (size < ring_size) size <<= 1;
+
+    struct sha204_client *c = (struct sha204_client *) calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->sock = c->sq_efd = c->cq_efd = -1;
+    c->shm = (struct sha204_broker_shm *) MAP_FAILED;
+    c->shm_size = broker_shm_size(size);
+    c->mask = size - 1;
+
+    // 封住大小后交给broker, broker拒绝没有F_SEAL_SHRINK的共享内存
+    memfd = (int) syscall(SYS_memfd_create, "sha204-broker", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, (off_t) c->shm_size) != 0
+        || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+        goto fail;
+    c->shm = (struct sha204_broker_shm *) mmap(NULL, c->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (c->shm == MAP_FAILED)
+        goto fail;
+    c->shm->magic = SHA204_BROKER_MAGIC;
+    c->shm->version = SHA204_BROKER_VERSION;
+    c->shm->ring_size = size;
+    c->shm->msg_size = sizeof(struct sha204_broker_msg);
+
+    c->sq_efd = eventfd(0, EFD_CLOEXEC);
+    c->cq_efd = eventfd(0, EFD_CLOEXEC);
+    c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->sq_efd < 0 || c->cq_efd < 0 || c->sock < 0)
+        goto fail;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(c->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        goto fail;
+
+    hello.magic = SHA204_BROKER_MAGIC;
+    hello.version = SHA204_BROKER_VERSION;
+    hello.ring_size = size;
+    hello.msg_size = sizeof(struct sha204_broker_msg);
+    hello.n_devices = 0;
+
+    memset(&mh, 0, sizeof(mh));
+    memset(&control, 0, sizeof(control));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = { memfd, c->sq_efd, c->cq_efd };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(c->sock, &mh, MSG_NOSIGNAL) != sizeof(hello)
+        || recv(c->sock, &hello, sizeof(hello), 0) != sizeof(hello)
+        || hello.magic != SHA204_BROKER_MAGIC || hello.n_devices == 0)
+        goto fail;
+
+    close(memfd);
+    c->n_devices = hello.n_devices;
+    return c;
+
+fail:
+    printf("FAILED! sha204_client_connect: %s\n", strerror(errno));
+    if (memfd >= 0) close(memfd);
+    sha204_client_close(c);
+    return NULL;
+}
+
+
+/** \brief 断开连接. broker取消尚在排队的命令
+ */
+void sha204_client_close(struct sha204_client *c) {
+    if (!c) return;
+
+    if (c->sock >= 0) close(c->sock);
+    if (c->sq_efd >= 0) close(c->sq_efd);
+    if (c->cq_efd >= 0) close(c->cq_efd);
+    if (c->shm != MAP_FAILED) munmap(c->shm, c->shm_size);
+    free(c);
+}
+
+
+/** \brief 完成门铃, 可读表示完成队列中有结果, 可加入调用方的poll/epoll
+ */
+int sha204_client_fd(const struct sha204_client *c) {
+    return c->cq_efd;
+}
+
+
+uint32_t sha204_client_devices(const struct sha204_client *c) {
+    return c->n_devices;
+}
+
+
+/** \brief 提交一条命令, 不阻塞
+ *
+ * \return SHA204_SUCCESS已提交; SHA204_QUEUE_FULL在途命令已达队列长度
+ */
+uint8_t sha204_client_submit(struct sha204_client *c, const struct sha204_broker_msg *msg) {
+    if (c->in_flight > c->mask)
+        return SHA204_QUEUE_FULL;
+    if (!ring_push(&c->shm->sq, c->shm->msgs, c->mask, msg))
+        return SHA204_QUEUE_FULL;
+
+    c->in_flight++;
+    efd_signal(c->sq_efd);
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 取回一条结果, 不阻塞
+ *
+ * \return 1取到结果; 0暂无结果
+ */
+int sha204_client_reap(struct sha204_client *c, struct sha204_broker_msg *msg) {
+    uint32_t ring_size = c->mask + 1;
+
+    if (!ring_pop(&c->shm->cq, c->shm->msgs + ring_size, c->mask, msg))
+        return 0;
+
+    c->in_flight--;
+    return 1;
+}
+
+
+/** \brief 提交一条命令并等待其结果, 结果写回req. 不能与未取回结果的异步提交混用
+ *
+ * \return 命令的执行结果; 与broker断开时为SHA204_COMM_FAIL
+ */
+uint8_t sha204_client_execute(struct sha204_client *c, uint8_t device, uint8_t prio, uint8_t flags,
+                              uint32_t timeout_ms, struct sha204_request *req) {
+    struct sha204_broker_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.tag = ++c->next_tag;
+    msg.device = device;
+    msg.prio = prio;
+    msg.flags = flags;
+    msg.timeout_ms = timeout_ms;
+    memcpy(&msg.req, req, sizeof(msg.req));
+
+    uint8_t status = sha204_client_submit(c, &msg);
+    if (status != SHA204_SUCCESS)
+        return status;
+
+    for (;;) {
+        while (sha204_client_reap(c, &msg)) {
+            if (msg.tag == c->next_tag) {
+                memcpy(req, &msg.req, sizeof(*req));
+                return req->status;
+            }
+        }
+
+        // 同时等待套接字, broker退出时不会永远阻塞
+        struct pollfd pfd[2] = {
+            { .fd = c->cq_efd, .events = POLLIN },
+            { .fd = c->sock, .events = POLLIN | POLLRDHUP }
+        };
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+            return SHA204_COMM_FAIL;
+        if (pfd[1].revents)
+            return SHA204_COMM_FAIL;
+        if (pfd[0].revents)
+            efd_drain(c->cq_efd);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * sha204_broker.h
+ *
+ * 多进程共享芯片: 由一个broker进程独占I2C总线, 其他进程通过共享内存提交命令.
+ *
+ * 客户端创建一块memfd共享内存并封住大小(F_SEAL_SHRINK|F_SEAL_GROW), 内含两条单生产者单消费者环形队列:
+ * 提交队列(客户端 -> broker)与完成队列(broker -> 客户端), 各配一个eventfd作门铃.
+ * 连接时通过Unix域套接字以SCM_RIGHTS把memfd与两个eventfd交给broker, 之后命令与结果都不再经过套接字.
+ * broker为每个器件创建一个调度器(sha204_sched), 所有进程的命令在同一处排队, 总线上不再交错.
+ * 依赖TempKey的多步序列在除最后一步之外的命令上带SHA204_BROKER_HOLD, 期间器件不会派发其他进程的命令.
+ * 按连接进程的uid(SO_PEERCRED)以sha204_admit_policy准入, 同一用户的连接共用预算;
+ * 被拒绝的命令立即以SHA204_RATE_LIMITED/SHA204_QUEUE_FULL完成.
+ */
+
+#ifndef SHA204_BROKER_H
+#   define SHA204_BROKER_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+#include "sha204_admit.h"
+
+#define SHA204_BROKER_MAGIC         (0x53484252)    //!< "SHBR"
+#define SHA204_BROKER_VERSION       (1)
+#define SHA204_BROKER_RING_MAX      (1024)          //!< 单条环形队列的最大长度
+
+//! 命令标记: 完成后继续为本客户端保留器件, 见sha204_sched_req.hold
+#define SHA204_BROKER_HOLD          (0x01)
+
+/**
+ * \brief 提交队列与完成队列中的一条记录
+ */
+struct sha204_broker_msg {
+    uint64_t tag;                   //!< 客户端自定义, 完成时原样带回
+    uint8_t device;                 //!< 器件编号, 即broker登记器件的顺序
+    uint8_t prio;                   //!< enum sha204_sched_class
+    uint8_t flags;                  //!< SHA204_BROKER_HOLD
+    uint32_t timeout_ms;            //!< 相对提交时间的截止时间, 0表示不限
+    struct sha204_request req;      //!< 命令; 完成队列中为结果
+};
+
+/**
+ * \brief 单生产者单消费者环形队列的读写位置, 各占一个cache line
+ */
+struct sha204_broker_ring {
+    uint32_t head __attribute__((aligned(64)));     //!< 消费者位置
+    uint32_t tail __attribute__((aligned(64)));     //!< 生产者位置
+};
+
+/**
+ * \brief 共享内存布局. msgs[0, ring_size)为提交队列, msgs[ring_size, 2 * ring_size)为完成队列
+ */
+struct sha204_broker_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;             //!< 2的幂
+    uint32_t msg_size;              //!< sizeof(struct sha204_broker_msg), 双方须一致
+    struct sha204_broker_ring sq;
+    struct sha204_broker_ring cq;
+    struct sha204_broker_msg msgs[];
+};
+
+/**
+ * \brief 连接握手, 客户端发送时附带memfd/提交门铃/完成门铃三个fd, broker回复时填写n_devices
+ */
+struct sha204_broker_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint32_t msg_size;
+    uint32_t n_devices;             //!< broker回复: 器件数量; 0表示拒绝连接
+};
+
+struct sha204_broker;
+struct sha204_client;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// broker端
+struct sha204_broker *sha204_broker_create(const char *socket_path);
+void sha204_broker_destroy(struct sha204_broker *b);
+int sha204_broker_add_device(struct sha204_broker *b, int fd);
+void sha204_broker_set_policy(struct sha204_broker *b, const struct sha204_admit_policy *policy);
+void sha204_broker_run(struct sha204_broker *b);
+void sha204_broker_stop(struct sha204_broker *b);
+
+// 客户端
+struct sha204_client *sha204_client_connect(const char *socket_path, uint32_t ring_size);
+void sha204_client_close(struct sha204_client *c);
+int sha204_client_fd(const struct sha204_client *c);
+uint32_t sha204_client_devices(const struct sha204_client *c);
+uint8_t sha204_client_submit(struct sha204_client *c, const struct sha204_broker_msg *msg);
+int sha204_client_reap(struct sha204_client *c, struct sha204_broker_msg *msg);
+uint8_t sha204_client_execute(struct sha204_client *c, uint8_t device, uint8_t prio, uint8_t flags,
+                              uint32_t timeout_ms, struct sha204_request *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * sha204_cache.c
+ *
+ * 按SN索引的config区持久缓存
+ */
+
+#include "sha204_cache.h"
+#include "sha204_comm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHA204_CACHE_MAGIC          "S204CCH1"
+
+struct sha204_cache_entry {
+    uint8_t config[88];
+    uint32_t seq;                           // 写入序号, 满了替换最小的
+    uint8_t crc[2];                         // config与seq的CRC
+    uint8_t valid;
+    uint8_t reserved;
+};
+
+// 缓存文件, mmap到各进程
+struct sha204_cache_file {
+    char magic[8];
+    uint32_t seq;
+    uint32_t reserved;
+    struct sha204_cache_entry entries[SHA204_CACHE_ENTRIES];
+};
+
+struct sha204_cache {
+    int fd;
+    struct sha204_cache_file *file;
+    pthread_mutex_t lock;                   // 进程内; 进程间用flock
+};
+
+
+// 缓存文件所在目录须由当前用户或root所有, 且其他用户不可写, 否则可以被替换为伪造的文件
+static int cache_dir_trusted(const char *path) {
+    char dir[256];
+    const char *slash = strrchr(path, '/');
+    struct stat st;
+
+    if (!slash) strcpy(dir, ".");
+    else if (slash == path) strcpy(dir, "/");
+    else if ((size_t) (slash - path) < sizeof(dir)) {
+        memcpy(dir, path, (size_t) (slash - path));
+        dir[slash - path] = 0;
+    } else {
+        return 0;
+    }
+
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) return 0;
+    if (st.st_uid != geteuid() && st.st_uid != 0) return 0;
+    return (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+
+static void cache_entry_crc(struct sha204_cache_entry *entry, uint8_t crc[2]) {
+    // config与seq在结构中连续
+    sha204c_calculate_crc(sizeof(entry->config) + sizeof(entry->seq), entry->config, crc);
+}
+
+
+/** \brief 打开或创建缓存文件
+ *
+ *  缓存内容决定是否跳过读芯片, 只信任当前用户自己的文件: 所在目录其他用户不可写,
+ *  文件不是符号链接(O_NOFOLLOW), 是当前用户所有的普通文件, 权限不超过0600.
+ *  \return 缓存, 失败返回NULL(调用者可以照常以NULL缓存工作)
+ */
+struct sha204_cache *sha204_cache_open(const char *path) {
+    struct sha204_cache *cache = (struct sha204_cache *) calloc(1, sizeof(*cache));
+    struct stat st;
+    void *map;
+
+    if (!cache) return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->fd = -1;
+    if (!cache_dir_trusted(path)) {
+        printf("FAILED! cache %s: directory is writable by other users\n", path);
+        goto fail;
+    }
+    cache->fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (cache->fd < 0) {
+        printf("FAILED! open cache %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    if (fstat(cache->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0 || st.st_nlink != 1) {
+        printf("FAILED! cache %s: not a private regular file\n", path);
+        goto fail;
+    }
+
+    // 新文件由第一个打开者在锁内初始化
+    flock(cache->fd, LOCK_EX);
+    if (fstat(cache->fd, &st) < 0) st.st_size = -1;
+    else if (st.st_size == 0 && ftruncate(cache->fd, sizeof(struct sha204_cache_file)) == 0)
+        st.st_size = sizeof(struct sha204_cache_file);
+    if (st.st_size != sizeof(struct sha204_cache_file)) {
+        flock(cache->fd, LOCK_UN);
+        printf("FAILED! %s is not a sha204 cache\n", path);
+        goto fail;
+    }
+
+    map = mmap(NULL, sizeof(struct sha204_cache_file), PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) {
+        flock(cache->fd, LOCK_UN);
+        printf("FAILED! mmap cache: %s\n", strerror(errno));
+        goto fail;
+    }
+    cache->file = (struct sha204_cache_file *) map;
+
+    if (memcmp(cache->file->magic, SHA204_CACHE_MAGIC, sizeof(cache->file->magic)) != 0) {
+        // 新文件, 或格式不认识: 整个清空
+        memset(cache->file, 0, sizeof(*cache->file));
+        memcpy(cache->file->magic, SHA204_CACHE_MAGIC, sizeof(cache->file->magic));
+    }
+    flock(cache->fd, LOCK_UN);
+
+    return cache;
+
+fail:
+    sha204_cache_close(cache);
+    return NULL;
+}
+
+
+void sha204_cache_close(struct sha204_cache *cache) {
+    if (!cache) return;
+
+    if (cache->file) {
+        msync(cache->file, sizeof(*cache->file), MS_ASYNC);
+        munmap(cache->file, sizeof(*cache->file));
+    }
+    if (cache->fd >= 0) close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+
+/** \brief 按config区第0块(32字节)查找
+ *  \param[in]  block0 刚从芯片读出的第0块
+ *  \param[out] config 命中时为完整的config区(88字节)
+ *  \return 0命中, -1未命中
+ */
+int sha204_cache_lookup(struct sha204_cache *cache, const uint8_t block0[32], uint8_t config[88]) {
+    if (!cache) return -1;
+
+    int ret = -1;
+    pthread_mutex_lock(&cache->lock);
+    flock(cache->fd, LOCK_SH);
+    for (int i = 0; i < SHA204_CACHE_ENTRIES; ++i) {
+        struct sha204_cache_entry *entry = &cache->file->entries[i];
+        uint8_t crc[2];
+
+        if (!entry->valid || memcmp(entry->config, block0, 32) != 0) continue;
+        cache_entry_crc(entry, crc);
+        if (memcmp(crc, entry->crc, sizeof(crc)) != 0) continue;
+
+        memcpy(config, entry->config, sizeof(entry->config));
+        ret = 0;
+        break;
+    }
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+
+/** \brief 记下已锁定芯片的config区. 同一颗芯片的旧项被覆盖, 否则替换最早写入的项
+ */
+void sha204_cache_store(struct sha204_cache *cache, const uint8_t config[88]) {
+    if (!cache) return;
+
+    // 两个区都锁定之后才不再改变
+    if (config[86] != 0x00 || config[87] != 0x00) return;
+
+    pthread_mutex_lock(&cache->lock);
+    flock(cache->fd, LOCK_EX);
+
+    struct sha204_cache_entry *victim = NULL;
+    for (int i = 0; i < SHA204_CACHE_ENTRIES; ++i) {
+        struct sha204_cache_entry *entry = &cache->file->entries[i];
+        if (entry->valid && memcmp(entry->config, config, 32) == 0) {
+            victim = entry;
+            break;
+        }
+        if (!victim || (victim->valid && (!entry->valid || entry->seq < victim->seq)))
+            victim = entry;
+    }
+
+    victim->valid = 0;
+    memcpy(victim->config, config, sizeof(victim->config));
+    victim->seq = ++cache->file->seq;
+    cache_entry_crc(victim, victim->crc);
+    victim->valid = 1;
+
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->lock);
+}
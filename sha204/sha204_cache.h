@@ -0,0 +1,44 @@
+/*
+ * sha204_cache.h
+ *
+ * 芯片不变状态的持久缓存: config区与LockConfig/LockValue都锁定之后, SN, config区和锁定字节不再改变,
+ * 进程重启时只需一次读(config区第0块, 含SN, RevNum与SlotConfig 0~5)验证是同一颗芯片, 其余从缓存取.
+ *
+ * 缓存文件mmap后在多个进程间共享, 按第0块内容(即SN)查找, 满了替换最早写入的项.
+ * 每项带CRC, 写了一半(进程崩溃)的项不会命中. 只缓存两个区都已锁定的芯片.
+ * UseFlag/UpdateCount/LastKeyUse会随限次密钥的使用变化, 缓存中的是写入时的值; atsha204_config_snapshot_cached
+ * 命中时按SlotConfig(SingleUse, DeriveKey, slot 15的SingleUse)重读可能变化的字, 直接用sha204_cache_lookup时须自行重读.
+ * 字节84~87(UserExtra, Selector, 锁定字节)不取缓存: UserExtra/Selector锁定后仍可由UpdateExtra修改,
+ * atsha204_config_snapshot_cached命中时在同一唤醒窗口内重读字0x15.
+ *
+ * 缓存文件应放在只有当前用户可写的目录(例如root所有的/var/lib/sha204), 打开时检查目录与文件的所有者和权限,
+ * 不跟随符号链接, 检查不通过时不使用缓存.
+ *
+ * 缓存不做芯片I/O, 由atsha204_config_snapshot_cached使用. 所有函数都接受NULL缓存(相当于总是未命中).
+ */
+
+#ifndef SHA204_CACHE_H
+#   define SHA204_CACHE_H
+
+#include <stdint.h>
+
+//! 缓存的芯片数
+#define SHA204_CACHE_ENTRIES        (8)
+
+struct sha204_cache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_cache *sha204_cache_open(const char *path);
+void sha204_cache_close(struct sha204_cache *cache);
+
+int sha204_cache_lookup(struct sha204_cache *cache, const uint8_t block0[32], uint8_t config[88]);
+void sha204_cache_store(struct sha204_cache *cache, const uint8_t config[88]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_CACHE_H
@@ -0,0 +1,237 @@
+/*
+ * sha204_clock.c
+ *
+ * 真实时间与离散事件虚拟时间
+ */
+
+#include "sha204_clock.h"
+
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+// 一个睡眠中的线程, 节点在睡眠者的栈上
+struct clock_waiter {
+    uint64_t due_us;
+    uint8_t joined;                 // 睡眠者是参与者
+    uint8_t done;                   // 已到期或被唤醒, 由推进者或通知者摘除
+    uint8_t woken;                  // 被sha204_clock_notify提前唤醒
+    const uint8_t *wake;            // 唤醒标志, 可以为NULL
+    struct clock_waiter *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            // 时间推进后唤醒睡眠者
+    uint8_t virt;
+    uint64_t now_us;                // 虚拟时间
+    uint32_t n_joined;              // 参与者数
+    uint32_t n_joined_waiting;      // 睡眠中的参与者数
+    struct clock_waiter *waiters;
+} clock_state = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread uint8_t clock_joined;
+
+
+static uint64_t clock_real_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// 所有参与者都在睡眠时, 逐个跳到最早的到期时间, 直到有参与者被唤醒. 调用时持有lock
+static void clock_advance(void) {
+    uint8_t woken = 0;
+
+    while (clock_state.waiters && clock_state.n_joined_waiting == clock_state.n_joined) {
+        uint64_t due_us = clock_state.waiters->due_us;
+        for (struct clock_waiter *w = clock_state.waiters->next; w; w = w->next)
+            if (w->due_us < due_us) due_us = w->due_us;
+        if (due_us > clock_state.now_us)
+            __atomic_store_n(&clock_state.now_us, due_us, __ATOMIC_RELEASE);
+
+        struct clock_waiter **pp = &clock_state.waiters;
+        while (*pp) {
+            struct clock_waiter *w = *pp;
+            if (w->due_us > clock_state.now_us) {
+                pp = &w->next;
+                continue;
+            }
+            *pp = w->next;
+            w->done = 1;
+            if (w->joined) clock_state.n_joined_waiting--;
+        }
+        woken = 1;
+    }
+
+    if (woken) pthread_cond_broadcast(&clock_state.cond);
+}
+
+
+/** \brief 切换到虚拟时间(enable=1)或真实时间(enable=0)
+ */
+void sha204_clock_set_virtual(uint8_t enable) {
+    pthread_mutex_lock(&clock_state.lock);
+    if (enable && !clock_state.virt)
+        __atomic_store_n(&clock_state.now_us, clock_real_now_us(), __ATOMIC_RELEASE);
+    __atomic_store_n(&clock_state.virt, enable ? 1 : 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&clock_state.lock);
+}
+
+
+uint8_t sha204_clock_is_virtual(void) {
+    return __atomic_load_n(&clock_state.virt, __ATOMIC_ACQUIRE);
+}
+
+
+/** \brief 当前时间(us), 真实时间模式下为CLOCK_MONOTONIC
+ */
+uint64_t sha204_clock_now_us(void) {
+    if (!sha204_clock_is_virtual())
+        return clock_real_now_us();
+    return __atomic_load_n(&clock_state.now_us, __ATOMIC_ACQUIRE);
+}
+
+
+// 虚拟时间下睡眠到due_us; wake不为NULL时, 它变为非0并且有人调用sha204_clock_notify时提前返回.
+// 到期返回0, 提前返回1
+static uint8_t clock_virtual_wait(uint64_t due_us, const uint8_t *wake) {
+    struct clock_waiter w = { .due_us = due_us, .joined = clock_joined, .wake = wake };
+
+    pthread_mutex_lock(&clock_state.lock);
+    if (wake && __atomic_load_n(wake, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&clock_state.lock);
+        return 1;
+    }
+    if (due_us <= clock_state.now_us) {
+        pthread_mutex_unlock(&clock_state.lock);
+        return 0;
+    }
+    w.next = clock_state.waiters;
+    clock_state.waiters = &w;
+    if (w.joined) clock_state.n_joined_waiting++;
+
+    clock_advance();
+    while (!w.done)
+        pthread_cond_wait(&clock_state.cond, &clock_state.lock);
+    pthread_mutex_unlock(&clock_state.lock);
+    return w.woken;
+}
+
+
+/** \brief 睡眠到due_us(sha204_clock_now_us时基)
+ */
+void sha204_clock_sleep_until_us(uint64_t due_us) {
+    if (!sha204_clock_is_virtual()) {
+        struct timespec ts = {
+            .tv_sec = (time_t) (due_us / 1000000),
+            .tv_nsec = (long) (due_us % 1000000) * 1000
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        return;
+    }
+
+    clock_virtual_wait(due_us, NULL);
+}
+
+
+/** \brief 虚拟时间下睡眠到due_us, 期间*wake变为非0并调用sha204_clock_notify时提前返回
+ *
+ *  用于睡眠时还要响应其他线程的场合(调度器等待owner的下一步). 真实时间模式下立即返回1,
+ *  调用者改在CLOCK_MONOTONIC的条件变量上等待.
+ *
+ * \param[in] due_us 到期时间(sha204_clock_now_us时基)
+ * \param[in] wake   唤醒标志, 由通知方在调用sha204_clock_notify之前置位
+ * \return 0到期, 1被唤醒
+ */
+uint8_t sha204_clock_wait_until_us(uint64_t due_us, const uint8_t *wake) {
+    if (!sha204_clock_is_virtual()) return 1;
+    return clock_virtual_wait(due_us, wake);
+}
+
+
+/** \brief 让sha204_clock_wait_until_us中的线程重新检查唤醒标志. 真实时间模式下无作用
+ */
+void sha204_clock_notify(void) {
+    if (!sha204_clock_is_virtual()) return;
+
+    // 被唤醒者立即摘除: 它真正运行之前, 时间不能按它原来的到期时间推进
+    pthread_mutex_lock(&clock_state.lock);
+    struct clock_waiter **pp = &clock_state.waiters;
+    while (*pp) {
+        struct clock_waiter *w = *pp;
+        if (!w->wake || !__atomic_load_n(w->wake, __ATOMIC_ACQUIRE)) {
+            pp = &w->next;
+            continue;
+        }
+        *pp = w->next;
+        w->done = 1;
+        w->woken = 1;
+        if (w->joined) clock_state.n_joined_waiting--;
+    }
+    pthread_cond_broadcast(&clock_state.cond);
+    pthread_mutex_unlock(&clock_state.lock);
+}
+
+
+void sha204_clock_sleep_us(uint64_t us) {
+    sha204_clock_sleep_until_us(sha204_clock_now_us() + us);
+}
+
+
+/** \brief 当前线程成为虚拟时间的参与者: 它不睡眠时时间不推进. 真实时间模式下无作用
+ */
+void sha204_clock_join(void) {
+    if (clock_joined || !sha204_clock_is_virtual()) return;
+
+    pthread_mutex_lock(&clock_state.lock);
+    clock_state.n_joined++;
+    clock_joined = 1;
+    pthread_mutex_unlock(&clock_state.lock);
+}
+
+
+/** \brief 当前线程是否为虚拟时间的参与者
+ */
+uint8_t sha204_clock_joined(void) {
+    return clock_joined;
+}
+
+
+void sha204_clock_leave(void) {
+    if (!clock_joined) return;
+
+    pthread_mutex_lock(&clock_state.lock);
+    clock_state.n_joined--;
+    clock_joined = 0;
+    // 可能只剩它未睡眠
+    clock_advance();
+    pthread_mutex_unlock(&clock_state.lock);
+}
+
+
+/** \brief 增加一个不属于任何线程的参与者, 直到sha204_clock_release. 真实时间模式下无作用
+ */
+void sha204_clock_hold(void) {
+    if (!sha204_clock_is_virtual()) return;
+
+    pthread_mutex_lock(&clock_state.lock);
+    clock_state.n_joined++;
+    pthread_mutex_unlock(&clock_state.lock);
+}
+
+
+/** \brief 释放sha204_clock_hold, 每次hold对应一次release
+ */
+void sha204_clock_release(void) {
+    if (!sha204_clock_is_virtual()) return;
+
+    pthread_mutex_lock(&clock_state.lock);
+    clock_state.n_joined--;
+    clock_advance();
+    pthread_mutex_unlock(&clock_state.lock);
+}
@@ -0,0 +1,47 @@
+/*
+ * sha204_clock.h
+ *
+ * 协议栈的时基: 唤醒延时, 命令执行等待, 看门狗估算, 调度时间戳和器件模型都经过这里.
+ *
+ * 默认为CLOCK_MONOTONIC与真实睡眠. 切换到虚拟时间后, 睡眠不再阻塞真实时间, 而是离散事件推进:
+ *   - 调用sha204_clock_join的线程为参与者, 所有参与者都在睡眠时, 时间跳到最早的到期时间并唤醒到期者
+ *   - 未join的线程睡眠时不等待其他线程, 直接推进到自己的到期时间(仍会等待正在运行的参与者)
+ * 单线程驱动多个器件(sha204_reactor_run)时结果精确. sha204_sched的派发线程在队列非空时自动join;
+ * 提交请求的线程应在提交期间join, 提交完再leave, 否则先提交的器件可能在其他请求到达前就把时间推进完.
+ * 参与者不能在时钟以外的地方阻塞(条件变量, 管道), 否则时间停止推进.
+ * sha204_clock_hold是不属于任何线程的参与者, 用于把"已交给另一个线程, 对方还没开始处理"的工作计入:
+ * 调度器在请求入队时hold, 派发线程join之后release.
+ * 睡眠期间还要等其他线程通知时用sha204_clock_wait_until_us, 通知方置位唤醒标志后调用sha204_clock_notify.
+ *
+ * 虚拟时间从切换时刻的CLOCK_MONOTONIC开始, 只应在程序开始, 没有线程睡眠时切换.
+ */
+
+#ifndef SHA204_CLOCK_H
+#   define SHA204_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sha204_clock_set_virtual(uint8_t enable);
+uint8_t sha204_clock_is_virtual(void);
+
+uint64_t sha204_clock_now_us(void);
+void sha204_clock_sleep_us(uint64_t us);
+void sha204_clock_sleep_until_us(uint64_t due_us);
+uint8_t sha204_clock_wait_until_us(uint64_t due_us, const uint8_t *wake);
+void sha204_clock_notify(void);
+
+void sha204_clock_join(void);
+uint8_t sha204_clock_joined(void);
+void sha204_clock_leave(void);
+void sha204_clock_hold(void);
+void sha204_clock_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_CLOCK_H
@@ -1,7 +1,7 @@
 #include "sha204_comm.h"                //!< definitions and declarations for the Communication module
 #include "sha204_lib_return_codes.h"    //!< declarations of function return codes
 #include "atsha204_i2c.h"    //!< declarations of function return codes
-#include <unistd.h>                     // usleep
+#include "sha204_clock.h"              // sha204_clock_sleep_us
 
 uint8_t sha204c_check_crc(uint8_t *response);
 uint8_t sha204c_resync(int fd,uint8_t size, uint8_t *response);
@@ -80,7 +80,7 @@ uint8_t sha204c_wakeup(int fd,uint8_t *response)
 	}
 	if (ret_code != SHA204_SUCCESS)
 		//sha204h_delay_ms(SHA204_COMMAND_EXEC_MAX);
-		usleep(SHA204_COMMAND_EXEC_MAX*1000);
+		sha204_clock_sleep_us(SHA204_COMMAND_EXEC_MAX*1000);
 
 	return ret_code;
 }
@@ -175,7 +175,7 @@ uint8_t sha204c_send_and_receive(int fd,struct sha204_send_and_receive_parameter
 
 		// Wait typical command execution time and then start polling for a response.
 		//sha204h_delay_ms(args->poll_delay);
-		usleep(args->poll_delay * 1000);
+		sha204_clock_sleep_us(args->poll_delay * 1000);
 
 		// Retry loop for receiving a response.
 		n_retries_receive = 2;
@@ -269,3 +269,63 @@ uint8_t sha204c_send_and_receive(int fd,struct sha204_send_and_receive_parameter
 
 	return ret_code;
 }
+
+
+/** \brief This function appends the CRC to a command packet and sends it, without waiting for the response.
+ *
+ * Together with \ref sha204c_receive it lets a caller replace the execution delay of
+ * \ref sha204c_send_and_receive with its own timer.
+ *
+ * \param[in, out]  args pointer to parameter structure
+ * \return status of the operation
+ */
+uint8_t sha204c_send(int fd, struct sha204_send_and_receive_parameters *args)
+{
+	uint8_t count = args->tx_buffer[SHA204_BUFFER_POS_COUNT];
+	uint8_t count_minus_crc = count - SHA204_CRC_SIZE;
+
+	sha204c_calculate_crc(count_minus_crc, args->tx_buffer, args->tx_buffer + count_minus_crc);
+
+	return sha204p_send_command(fd, count, args->tx_buffer);
+}
+
+
+/** \brief This function tries once to receive and verify the response to a command sent by \ref sha204c_send.
+ *
+ * \param[in, out]  args pointer to parameter structure
+ * \return SHA204_SUCCESS, a device status error translated into a library return code,
+ *         SHA204_STATUS_CRC if the command has to be re-sent, or the receive error
+ *         (the device may still be busy) otherwise
+ */
+uint8_t sha204c_receive(int fd, struct sha204_send_and_receive_parameters *args)
+{
+	uint8_t ret_code;
+	uint8_t i;
+	uint8_t status_byte;
+
+	// Reset response buffer.
+	for (i = 0; i < args->rx_size; i++)
+		args->rx_buffer[i] = 0;
+
+	ret_code = sha204p_receive_response(fd, args->rx_size, args->rx_buffer);
+	if (ret_code == SHA204_RX_NO_RESPONSE || ret_code == SHA204_INVALID_SIZE)
+		return ret_code;
+
+	ret_code = sha204c_check_crc(args->rx_buffer);
+	if (ret_code != SHA204_SUCCESS)
+		return ret_code;
+
+	if (args->rx_buffer[SHA204_BUFFER_POS_COUNT] > SHA204_RSP_SIZE_MIN)
+		// Received non-status response.
+		return ret_code;
+
+	status_byte = args->rx_buffer[SHA204_BUFFER_POS_STATUS];
+	if (status_byte == SHA204_STATUS_BYTE_PARSE)
+		return SHA204_PARSE_ERROR;
+	if (status_byte == SHA204_STATUS_BYTE_EXEC)
+		return SHA204_CMD_FAIL;
+	if (status_byte == SHA204_STATUS_BYTE_COMM)
+		return SHA204_STATUS_CRC;
+
+	return ret_code;
+}
@@ -54,6 +54,8 @@ struct sha204_send_and_receive_parameters {
 void sha204c_calculate_crc(uint8_t length, uint8_t *data, uint8_t *crc);
 uint8_t sha204c_wakeup(int fd,uint8_t *response);
 uint8_t sha204c_send_and_receive(int fd,struct sha204_send_and_receive_parameters *args);
+uint8_t sha204c_send(int fd,struct sha204_send_and_receive_parameters *args);
+uint8_t sha204c_receive(int fd,struct sha204_send_and_receive_parameters *args);
 //! @}
 
 #endif
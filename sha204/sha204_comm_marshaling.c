@@ -151,109 +151,114 @@ static uint8_t sha204m_check_parameters(int fd,struct sha204_command_parameters
 }
 
 
-/** \brief This function creates a command packet, sends it, and receives its response.
+/** \brief This function checks the parameters and creates a command packet without sending it.
+ *
+ *         It also supplies the delays and the response size for the send and receive functions
+ *         of the communication layer, so that callers can send the packet and poll for the
+ *         response without blocking the calling thread.
  * \param[in, out]  args pointer to parameter structure
+ * \param[out]      comm_parameters pointer to parameter structure for the communication layer
  * \return status of the operation
  */
-uint8_t sha204m_execute(int fd, struct sha204_command_parameters *args)
+uint8_t sha204m_prepare(int fd, struct sha204_command_parameters *args,
+			struct sha204_send_and_receive_parameters *comm_parameters)
 {
 	uint8_t *p_buffer;
 	uint8_t len;
-	struct sha204_send_and_receive_parameters comm_parameters = {
-		.tx_buffer = args->tx_buffer,
-		.rx_buffer = args->rx_buffer
-	};
 
 	uint8_t ret_code = sha204m_check_parameters(fd,args);
 	if (ret_code != SHA204_SUCCESS)
 		return ret_code;
 
+	comm_parameters->tx_buffer = args->tx_buffer;
+	comm_parameters->rx_buffer = args->rx_buffer;
+
 	// Supply delays and response size.
 	switch (args->op_code) {
 	case SHA204_CHECKMAC:
-		comm_parameters.poll_delay = CHECKMAC_DELAY;
-		comm_parameters.poll_timeout = CHECKMAC_EXEC_MAX - CHECKMAC_DELAY;
-		comm_parameters.rx_size = CHECKMAC_RSP_SIZE;
+		comm_parameters->poll_delay = CHECKMAC_DELAY;
+		comm_parameters->poll_timeout = CHECKMAC_EXEC_MAX - CHECKMAC_DELAY;
+		comm_parameters->rx_size = CHECKMAC_RSP_SIZE;
 		break;
 
 	case SHA204_DERIVE_KEY:
-		comm_parameters.poll_delay = DERIVE_KEY_DELAY;
-		comm_parameters.poll_timeout = DERIVE_KEY_EXEC_MAX - DERIVE_KEY_DELAY;
-		comm_parameters.rx_size = DERIVE_KEY_RSP_SIZE;
+		comm_parameters->poll_delay = DERIVE_KEY_DELAY;
+		comm_parameters->poll_timeout = DERIVE_KEY_EXEC_MAX - DERIVE_KEY_DELAY;
+		comm_parameters->rx_size = DERIVE_KEY_RSP_SIZE;
 		break;
 
 	case SHA204_DEVREV:
-		comm_parameters.poll_delay = DEVREV_DELAY;
-		comm_parameters.poll_timeout = DEVREV_EXEC_MAX - DEVREV_DELAY;
-		comm_parameters.rx_size = DEVREV_RSP_SIZE;
+		comm_parameters->poll_delay = DEVREV_DELAY;
+		comm_parameters->poll_timeout = DEVREV_EXEC_MAX - DEVREV_DELAY;
+		comm_parameters->rx_size = DEVREV_RSP_SIZE;
 		break;
 
 	case SHA204_GENDIG:
-		comm_parameters.poll_delay = GENDIG_DELAY;
-		comm_parameters.poll_timeout = GENDIG_EXEC_MAX - GENDIG_DELAY;
-		comm_parameters.rx_size = GENDIG_RSP_SIZE;
+		comm_parameters->poll_delay = GENDIG_DELAY;
+		comm_parameters->poll_timeout = GENDIG_EXEC_MAX - GENDIG_DELAY;
+		comm_parameters->rx_size = GENDIG_RSP_SIZE;
 		break;
 
 	case SHA204_HMAC:
-		comm_parameters.poll_delay = HMAC_DELAY;
-		comm_parameters.poll_timeout = HMAC_EXEC_MAX - HMAC_DELAY;
-		comm_parameters.rx_size = HMAC_RSP_SIZE;
+		comm_parameters->poll_delay = HMAC_DELAY;
+		comm_parameters->poll_timeout = HMAC_EXEC_MAX - HMAC_DELAY;
+		comm_parameters->rx_size = HMAC_RSP_SIZE;
 		break;
 
 	case SHA204_LOCK:
-		comm_parameters.poll_delay = LOCK_DELAY;
-		comm_parameters.poll_timeout = LOCK_EXEC_MAX - LOCK_DELAY;
-		comm_parameters.rx_size = LOCK_RSP_SIZE;
+		comm_parameters->poll_delay = LOCK_DELAY;
+		comm_parameters->poll_timeout = LOCK_EXEC_MAX - LOCK_DELAY;
+		comm_parameters->rx_size = LOCK_RSP_SIZE;
 		break;
 
 	case SHA204_MAC:
-		comm_parameters.poll_delay = MAC_DELAY;
-		comm_parameters.poll_timeout = MAC_EXEC_MAX - MAC_DELAY;
-		comm_parameters.rx_size = MAC_RSP_SIZE;
+		comm_parameters->poll_delay = MAC_DELAY;
+		comm_parameters->poll_timeout = MAC_EXEC_MAX - MAC_DELAY;
+		comm_parameters->rx_size = MAC_RSP_SIZE;
 		break;
 
 	case SHA204_NONCE:
-		comm_parameters.poll_delay = NONCE_DELAY;
-		comm_parameters.poll_timeout = NONCE_EXEC_MAX - NONCE_DELAY;
-		comm_parameters.rx_size = args->param_1 == NONCE_MODE_PASSTHROUGH
+		comm_parameters->poll_delay = NONCE_DELAY;
+		comm_parameters->poll_timeout = NONCE_EXEC_MAX - NONCE_DELAY;
+		comm_parameters->rx_size = args->param_1 == NONCE_MODE_PASSTHROUGH
 							? NONCE_RSP_SIZE_SHORT : NONCE_RSP_SIZE_LONG;
 		break;
 
 	case SHA204_PAUSE:
-		comm_parameters.poll_delay = PAUSE_DELAY;
-		comm_parameters.poll_timeout = PAUSE_EXEC_MAX - PAUSE_DELAY;
-		comm_parameters.rx_size = PAUSE_RSP_SIZE;
+		comm_parameters->poll_delay = PAUSE_DELAY;
+		comm_parameters->poll_timeout = PAUSE_EXEC_MAX - PAUSE_DELAY;
+		comm_parameters->rx_size = PAUSE_RSP_SIZE;
 		break;
 
 	case SHA204_RANDOM:
-		comm_parameters.poll_delay = RANDOM_DELAY;
-		comm_parameters.poll_timeout = RANDOM_EXEC_MAX - RANDOM_DELAY;
-		comm_parameters.rx_size = RANDOM_RSP_SIZE;
+		comm_parameters->poll_delay = RANDOM_DELAY;
+		comm_parameters->poll_timeout = RANDOM_EXEC_MAX - RANDOM_DELAY;
+		comm_parameters->rx_size = RANDOM_RSP_SIZE;
 		break;
 
 	case SHA204_READ:
-		comm_parameters.poll_delay = READ_DELAY;
-		comm_parameters.poll_timeout = READ_EXEC_MAX - READ_DELAY;
-		comm_parameters.rx_size = (args->param_1 & SHA204_ZONE_COUNT_FLAG)
+		comm_parameters->poll_delay = READ_DELAY;
+		comm_parameters->poll_timeout = READ_EXEC_MAX - READ_DELAY;
+		comm_parameters->rx_size = (args->param_1 & SHA204_ZONE_COUNT_FLAG)
 							? READ_32_RSP_SIZE : READ_4_RSP_SIZE;
 		break;
 
 	case SHA204_UPDATE_EXTRA:
-		comm_parameters.poll_delay = UPDATE_DELAY;
-		comm_parameters.poll_timeout = UPDATE_EXEC_MAX - UPDATE_DELAY;
-		comm_parameters.rx_size = UPDATE_RSP_SIZE;
+		comm_parameters->poll_delay = UPDATE_DELAY;
+		comm_parameters->poll_timeout = UPDATE_EXEC_MAX - UPDATE_DELAY;
+		comm_parameters->rx_size = UPDATE_RSP_SIZE;
 		break;
 
 	case SHA204_WRITE:
-		comm_parameters.poll_delay = WRITE_DELAY;
-		comm_parameters.poll_timeout = WRITE_EXEC_MAX - WRITE_DELAY;
-		comm_parameters.rx_size = WRITE_RSP_SIZE;
+		comm_parameters->poll_delay = WRITE_DELAY;
+		comm_parameters->poll_timeout = WRITE_EXEC_MAX - WRITE_DELAY;
+		comm_parameters->rx_size = WRITE_RSP_SIZE;
 		break;
 
 	default:
-		comm_parameters.poll_delay = 0;
-		comm_parameters.poll_timeout = SHA204_COMMAND_EXEC_MAX;
-		comm_parameters.rx_size = args->rx_size;
+		comm_parameters->poll_delay = 0;
+		comm_parameters->poll_timeout = SHA204_COMMAND_EXEC_MAX;
+		comm_parameters->rx_size = args->rx_size;
 	}
 
 	// Assemble command.
@@ -280,11 +285,54 @@ uint8_t sha204m_execute(int fd, struct sha204_command_parameters *args)
 
 	sha204c_calculate_crc(len - SHA204_CRC_SIZE, args->tx_buffer, p_buffer);
 
+	return SHA204_SUCCESS;
+}
+
+
+/** \brief This function creates a command packet, sends it, and receives its response.
+ * \param[in, out]  args pointer to parameter structure
+ * \return status of the operation
+ */
+uint8_t sha204m_execute(int fd, struct sha204_command_parameters *args)
+{
+	struct sha204_send_and_receive_parameters comm_parameters;
+
+	uint8_t ret_code = sha204m_prepare(fd, args, &comm_parameters);
+	if (ret_code != SHA204_SUCCESS)
+		return ret_code;
+
 	// Send command and receive response.
 	return sha204c_send_and_receive(fd,&comm_parameters);
 }
 
 
+/** \brief This function returns the maximum execution time of a command.
+ *
+ *         Schedulers use it as the worst-case time the device is busy with a command.
+ * \param[in] op_code command op-code
+ * \return maximum execution time in ms
+ */
+uint8_t sha204m_get_exec_max(uint8_t op_code)
+{
+	switch (op_code) {
+	case SHA204_CHECKMAC:     return CHECKMAC_EXEC_MAX;
+	case SHA204_DERIVE_KEY:   return DERIVE_KEY_EXEC_MAX;
+	case SHA204_DEVREV:       return DEVREV_EXEC_MAX;
+	case SHA204_GENDIG:       return GENDIG_EXEC_MAX;
+	case SHA204_HMAC:         return HMAC_EXEC_MAX;
+	case SHA204_LOCK:         return LOCK_EXEC_MAX;
+	case SHA204_MAC:          return MAC_EXEC_MAX;
+	case SHA204_NONCE:        return NONCE_EXEC_MAX;
+	case SHA204_PAUSE:        return PAUSE_EXEC_MAX;
+	case SHA204_RANDOM:       return RANDOM_EXEC_MAX;
+	case SHA204_READ:         return READ_EXEC_MAX;
+	case SHA204_UPDATE_EXTRA: return UPDATE_EXEC_MAX;
+	case SHA204_WRITE:        return WRITE_EXEC_MAX;
+	default:                  return SHA204_COMMAND_EXEC_MAX;
+	}
+}
+
+
 /** \brief This function sends a CheckMAC command to the device and receives its response.
  * \param[in, out]  args pointer to parameter structure
  * \return status of the operation
@@ -538,6 +538,9 @@ uint8_t sha204m_read(int fd,struct sha204_read_parameters *args);
 uint8_t sha204m_update_extra(int fd,struct sha204_update_extra_parameters *args);
 uint8_t sha204m_write(int fd,struct sha204_write_parameters *args);
 uint8_t sha204m_execute(int fd,struct sha204_command_parameters *args);
+uint8_t sha204m_prepare(int fd,struct sha204_command_parameters *args,
+			struct sha204_send_and_receive_parameters *comm_parameters);
+uint8_t sha204m_get_exec_max(uint8_t op_code);
 //! @}
 
 #endif
@@ -0,0 +1,286 @@
+/*
+ * sha204_drbg.c
+ *
+ * 芯片播种的HMAC-DRBG
+ */
+
+#include "sha204_drbg.h"
+#include "sha204_entropy.h"
+#include "sha204_clock.h"
+#include "sha204_lib_return_codes.h"
+#include "sha256.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+
+//! 首次播种: entropy_input 32字节 + nonce 16字节
+#define DRBG_SEED_SIZE          (48)
+//! 重新播种的entropy_input
+#define DRBG_RESEED_SIZE        (32)
+
+struct drbg_state {
+    uint8_t key[32];
+    uint8_t v[32];
+    uint32_t inner[8];                      // HMAC(key, .)的内外层midstate
+    uint32_t outer[8];
+    uint32_t requests;                      // 上次播种之后的generate次数
+    uint64_t seeded_us;
+    uint32_t generation;                    // 播种时的fork代数
+    uint8_t seeded;
+};
+
+static __thread struct drbg_state drbg;
+
+static struct sha204_entropy *drbg_source;
+static pid_t drbg_source_pid;
+static uint32_t drbg_generation;            // 每次fork在子进程中加一
+static uint32_t drbg_instances;
+static pthread_once_t drbg_once = PTHREAD_ONCE_INIT;
+static pthread_key_t drbg_key;
+static uint8_t drbg_self_test_status;       // 第一次播种前的已知答案测试结果
+
+
+static void drbg_atfork_child(void) {
+    __atomic_add_fetch(&drbg_generation, 1, __ATOMIC_RELAXED);
+}
+
+
+// 线程退出时清零实例
+static void drbg_thread_exit(void *state) {
+    memset(state, 0, sizeof(struct drbg_state));
+}
+
+
+static void drbg_init_once(void) {
+    pthread_atfork(NULL, NULL, drbg_atfork_child);
+    pthread_key_create(&drbg_key, drbg_thread_exit);
+    drbg_self_test_status = sha204_drbg_self_test();
+    if (drbg_self_test_status != SHA204_SUCCESS)
+        printf("FAILED! sha204_drbg: known-answer self-test\n");
+}
+
+
+static void drbg_set_key(struct drbg_state *d) {
+    uint8_t block[64];
+    uint8_t i;
+
+    memset(block, 0, sizeof(block));
+    for (i = 0; i < 32; ++i) block[i] = d->key[i] ^ 0x36;
+    for (i = 32; i < 64; ++i) block[i] = 0x36;
+    sha256_midstate(block, d->inner);
+    for (i = 0; i < 64; ++i) block[i] ^= 0x36 ^ 0x5c;
+    sha256_midstate(block, d->outer);
+    memset(block, 0, sizeof(block));
+}
+
+
+// V = HMAC(K, V), 内外层各一次压缩
+static void drbg_next_v(struct drbg_state *d) {
+    uint8_t inner[32];
+
+    sha256_resume_32(d->inner, d->v, inner);
+    sha256_resume_32(d->outer, inner, d->v);
+}
+
+
+// SP 800-90A HMAC_DRBG_Update
+static void drbg_update(struct drbg_state *d, const struct iovec *data, int n_data) {
+    uint8_t inner[32];
+    uint8_t sep;
+    sha256_ctx ctx;
+    int i;
+
+    for (sep = 0; sep < 2; ++sep) {
+        size_t data_len = 0;
+        for (i = 0; i < n_data; ++i) data_len += data[i].iov_len;
+        if (sep && !data_len) break;
+
+        // K = HMAC(K, V || sep || data), 内层从midstate继续
+        memcpy(ctx.h, d->inner, sizeof(ctx.h));
+        ctx.tot_len = 64;
+        ctx.len = 0;
+        sha256_update(&ctx, d->v, sizeof(d->v));
+        sha256_update(&ctx, &sep, 1);
+        sha256_updatev(&ctx, data, n_data);
+        sha256_final(&ctx, inner);
+        sha256_resume_32(d->outer, inner, d->key);
+        drbg_set_key(d);
+
+        drbg_next_v(d);
+    }
+    memset(&ctx, 0, sizeof(ctx));
+    memset(inner, 0, sizeof(inner));
+}
+
+
+// SP 800-90A HMAC_DRBG_Generate的输出部分(不带additional_input), len不超过SHA204_DRBG_MAX_REQUEST
+static void drbg_output(struct drbg_state *d, uint8_t *buf, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        size_t n = len - done < sizeof(d->v) ? len - done : sizeof(d->v);
+        drbg_next_v(d);
+        memcpy(buf + done, d->v, n);
+        done += n;
+    }
+    drbg_update(d, NULL, 0);
+}
+
+
+// 从芯片(子进程中为getrandom)取得种子, 首次为instantiate, 之后为reseed
+static uint8_t drbg_seed(struct drbg_state *d) {
+    uint8_t seed[DRBG_SEED_SIZE];
+    struct {
+        pid_t pid;
+        pthread_t thread;
+        uint32_t instance;
+        uint64_t now_us;
+    } personal;
+    struct sha204_entropy *source = __atomic_load_n(&drbg_source, __ATOMIC_ACQUIRE);
+    size_t seed_len = d->seeded ? DRBG_RESEED_SIZE : DRBG_SEED_SIZE;
+    uint8_t status = SHA204_SUCCESS;
+
+    pthread_once(&drbg_once, drbg_init_once);
+    if (drbg_self_test_status != SHA204_SUCCESS)
+        return SHA204_FUNC_FAIL;
+
+    memset(&personal, 0, sizeof(personal));
+    personal.pid = getpid();
+    personal.thread = pthread_self();
+    personal.now_us = sha204_clock_now_us();
+
+    if (source && personal.pid == drbg_source_pid) {
+        status = sha204_entropy_read(source, seed, seed_len);
+    } else if (d->seeded && personal.pid != drbg_source_pid) {
+        // fork出的子进程: 状态来自芯片, 以内核随机数区分父子进程
+        size_t got = 0;
+        while (got < seed_len) {
+            ssize_t n = getrandom(seed + got, seed_len - got, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) { status = SHA204_FUNC_FAIL; break; }
+            got += (size_t) n;
+        }
+    } else {
+        status = SHA204_FUNC_FAIL;
+    }
+    if (status != SHA204_SUCCESS) {
+        memset(seed, 0, sizeof(seed));
+        return status;
+    }
+
+    if (!d->seeded) {
+        pthread_setspecific(drbg_key, d);
+        personal.instance = __atomic_add_fetch(&drbg_instances, 1, __ATOMIC_RELAXED);
+
+        memset(d->key, 0x00, sizeof(d->key));
+        memset(d->v, 0x01, sizeof(d->v));
+        drbg_set_key(d);
+    }
+    struct iovec iov[2] = {{seed, seed_len}, {&personal, sizeof(personal)}};
+    drbg_update(d, iov, 2);
+    memset(seed, 0, sizeof(seed));
+
+    d->requests = 0;
+    d->seeded_us = personal.now_us;
+    d->generation = __atomic_load_n(&drbg_generation, __ATOMIC_RELAXED);
+    d->seeded = 1;
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 设置播种使用的随机数池, 对所有线程生效. NULL表示不再播种(需要播种的generate将失败)
+ */
+void sha204_drbg_set_source(struct sha204_entropy *e) {
+    pthread_once(&drbg_once, drbg_init_once);
+    drbg_source_pid = getpid();
+    __atomic_store_n(&drbg_source, e, __ATOMIC_RELEASE);
+}
+
+
+/** \brief 立即为调用线程的实例重新播种
+ */
+uint8_t sha204_drbg_reseed(void) {
+    return drbg_seed(&drbg);
+}
+
+
+/** \brief 生成随机数
+ *
+ * \param[out] buf 输出
+ * \param[in]  len 字节数, 任意长度
+ * \return SHA204_SUCCESS; 需要播种而池不可用时返回池的错误码, buf被清零
+ */
+uint8_t sha204_drbg_generate(uint8_t *buf, size_t len) {
+    struct drbg_state *d = &drbg;
+    size_t done = 0;
+
+    if (!buf && len) return SHA204_BAD_PARAM;
+
+    while (done < len || !d->seeded) {
+        if (!d->seeded || d->requests >= SHA204_DRBG_RESEED_REQUESTS
+            || d->generation != __atomic_load_n(&drbg_generation, __ATOMIC_RELAXED)
+            || sha204_clock_now_us() - d->seeded_us >= SHA204_DRBG_RESEED_MS * 1000ULL) {
+            uint8_t status = drbg_seed(d);
+            if (status != SHA204_SUCCESS) {
+                if (buf) memset(buf, 0, len);
+                return status;
+            }
+        }
+
+        size_t n = len - done > SHA204_DRBG_MAX_REQUEST ? SHA204_DRBG_MAX_REQUEST : len - done;
+        drbg_output(d, buf + done, n);
+        done += n;
+        d->requests++;
+    }
+
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 已知答案测试: NIST CAVP HMAC_DRBG.rsp, SHA-256, 无预测抗性, 无personalization与additional_input, COUNT = 0.
+ *
+ * 在独立的状态上执行instantiate, 两次generate(1024 bit), 比较第二次的输出, 不影响任何线程的实例.
+ * 第一次播种前自动执行一次; 也可由自检程序直接调用.
+ * \return SHA204_SUCCESS; 输出与向量不一致返回SHA204_FUNC_FAIL
+ */
+uint8_t sha204_drbg_self_test(void) {
+    static const uint8_t seed[DRBG_SEED_SIZE] = {
+            // EntropyInput
+            0xca, 0x85, 0x19, 0x11, 0x34, 0x93, 0x84, 0xbf, 0xfe, 0x89, 0xde, 0x1c, 0xbd, 0xc4, 0x6e, 0x68,
+            0x31, 0xe4, 0x4d, 0x34, 0xa4, 0xfb, 0x93, 0x5e, 0xe2, 0x85, 0xdd, 0x14, 0xb7, 0x1a, 0x74, 0x88,
+            // Nonce
+            0x65, 0x9b, 0xa9, 0x6c, 0x60, 0x1d, 0xc6, 0x9f, 0xc9, 0x02, 0x94, 0x08, 0x05, 0xec, 0x0c, 0xa8,
+    };
+    static const uint8_t expected[128] = {
+            // ReturnedBits
+            0xe5, 0x28, 0xe9, 0xab, 0xf2, 0xde, 0xce, 0x54, 0xd4, 0x7c, 0x7e, 0x75, 0xe5, 0xfe, 0x30, 0x21,
+            0x49, 0xf8, 0x17, 0xea, 0x9f, 0xb4, 0xbe, 0xe6, 0xf4, 0x19, 0x96, 0x97, 0xd0, 0x4d, 0x5b, 0x89,
+            0xd5, 0x4f, 0xbb, 0x97, 0x8a, 0x15, 0xb5, 0xc4, 0x43, 0xc9, 0xec, 0x21, 0x03, 0x6d, 0x24, 0x60,
+            0xb6, 0xf7, 0x3e, 0xba, 0xd0, 0xdc, 0x2a, 0xba, 0x6e, 0x62, 0x4a, 0xbf, 0x07, 0x74, 0x5b, 0xc1,
+            0x07, 0x69, 0x4b, 0xb7, 0x54, 0x7b, 0xb0, 0x99, 0x5f, 0x70, 0xde, 0x25, 0xd6, 0xb2, 0x9e, 0x2d,
+            0x30, 0x11, 0xbb, 0x19, 0xd2, 0x76, 0x76, 0xc0, 0x71, 0x62, 0xc8, 0xb5, 0xcc, 0xde, 0x06, 0x68,
+            0x96, 0x1d, 0xf8, 0x68, 0x03, 0x48, 0x2c, 0xb3, 0x7e, 0xd6, 0xd5, 0xc0, 0xbb, 0x8d, 0x50, 0xcf,
+            0x1f, 0x50, 0xd4, 0x76, 0xaa, 0x04, 0x58, 0xbd, 0xab, 0xa8, 0x06, 0xf4, 0x8b, 0xe9, 0xdc, 0xb8,
+    };
+    struct drbg_state d;
+    uint8_t out[sizeof(expected)];
+    struct iovec iov = {(void *) seed, sizeof(seed)};
+
+    memset(&d, 0, sizeof(d));
+    memset(d.v, 0x01, sizeof(d.v));
+    drbg_set_key(&d);
+    drbg_update(&d, &iov, 1);
+
+    drbg_output(&d, out, sizeof(out));
+    drbg_output(&d, out, sizeof(out));
+    uint8_t status = memcmp(out, expected, sizeof(out)) == 0 ? SHA204_SUCCESS : SHA204_FUNC_FAIL;
+
+    memset(&d, 0, sizeof(d));
+    memset(out, 0, sizeof(out));
+    return status;
+}
@@ -0,0 +1,45 @@
+/*
+ * sha204_drbg.h
+ *
+ * 以芯片随机数播种的主机侧随机数发生器: HMAC-DRBG (NIST SP 800-90A, HMAC-SHA256), 输出速度只受主机SHA-256限制.
+ *   - 每个线程一个实例(线程局部), 互不加锁; 线程第一次使用时从随机数池(sha204_entropy)取48字节播种
+ *   - 每SHA204_DRBG_RESEED_REQUESTS次generate或SHA204_DRBG_RESEED_MS之后从池中取32字节重新播种
+ *   - 单次generate超过SHA204_DRBG_MAX_REQUEST字节时分段, 每段计为一次
+ *   - fork之后子进程的每个实例在下一次generate前重新播种. 子进程中没有调度器的派发线程, 不能访问芯片,
+ *     此时以getrandom与pid作为reseed输入, 原有状态仍来自芯片
+ *   - 线程退出时清零该线程的实例
+ *   - 进程内第一次播种之前执行一次已知答案测试(SP 800-90A 11.3), 不通过时所有generate失败
+ *
+ * 需要播种而池不可用(未设置, 芯片出错, config区未锁定)时generate失败, 不输出未经芯片播种的随机数.
+ * 销毁池之前先以NULL调用sha204_drbg_set_source.
+ */
+
+#ifndef SHA204_DRBG_H
+#   define SHA204_DRBG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! 两次播种之间最多的generate次数
+#define SHA204_DRBG_RESEED_REQUESTS     (1024)
+//! 两次播种之间最长的时间(ms)
+#define SHA204_DRBG_RESEED_MS           (60000)
+//! 单次generate的最大字节数(SP 800-90A: 2^19 bit)
+#define SHA204_DRBG_MAX_REQUEST         (65536)
+
+struct sha204_entropy;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sha204_drbg_set_source(struct sha204_entropy *e);
+uint8_t sha204_drbg_generate(uint8_t *buf, size_t len);
+uint8_t sha204_drbg_reseed(void);
+uint8_t sha204_drbg_self_test(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_DRBG_H
@@ -0,0 +1,209 @@
+/*
+ * sha204_encio.c
+ *
+ * 流水线化的加密读写
+ */
+
+#include "sha204_encio.h"
+#include "sha204_comm.h"
+#include "sha204_comm_marshaling.h"
+#include "sha204_helper.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_request.h"
+#include "sha204_clock.h"
+#include "atsha204_i2c.h"
+
+#include <string.h>
+
+// 一条已发出, 尚未取回响应的命令
+struct encio_cmd {
+    struct sha204_command_parameters args;
+    struct sha204_send_and_receive_parameters comm;
+    uint8_t tx[SHA204_CMD_SIZE_MAX];
+    uint8_t rx[SHA204_RSP_SIZE_MAX];
+    uint8_t sent;
+    uint64_t due_us;                        // 典型执行时间之后开始轮询
+    uint64_t expire_us;                     // 超过最长执行时间仍无响应则重发
+};
+
+
+static uint8_t encio_send(int fd, struct encio_cmd *c, uint8_t op_code, uint8_t param_1, uint16_t param_2,
+                          uint8_t len_1, const uint8_t *data_1, uint8_t len_2, const uint8_t *data_2) {
+    memset(&c->args, 0, sizeof(c->args));
+    c->args.op_code = op_code;
+    c->args.param_1 = param_1;
+    c->args.param_2 = param_2;
+    c->args.data_len_1 = len_1;
+    c->args.data_1 = (uint8_t *) data_1;
+    c->args.data_len_2 = len_2;
+    c->args.data_2 = (uint8_t *) data_2;
+    c->args.tx_size = sizeof(c->tx);
+    c->args.tx_buffer = c->tx;
+    c->args.rx_size = sizeof(c->rx);
+    c->args.rx_buffer = c->rx;
+    c->sent = 0;
+
+    uint8_t ret_code = sha204m_prepare(fd, &c->args, &c->comm);
+    if (ret_code != SHA204_SUCCESS) return ret_code;
+
+    uint64_t now = sha204_clock_now_us();
+    c->due_us = now + c->comm.poll_delay * 1000ULL;
+    c->expire_us = c->due_us + c->comm.poll_timeout * 1000ULL;
+    // 发送失败留给encio_receive重发
+    c->sent = sha204c_send(fd, &c->comm) == SHA204_SUCCESS;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t encio_receive(int fd, struct encio_cmd *c) {
+    if (c->sent) {
+        sha204_clock_sleep_until_us(c->due_us);
+        for (;;) {
+            uint8_t ret_code = sha204c_receive(fd, &c->comm);
+            if (ret_code == SHA204_SUCCESS || ret_code == SHA204_PARSE_ERROR || ret_code == SHA204_CMD_FAIL)
+                return ret_code;
+            if (ret_code == SHA204_STATUS_CRC || sha204_clock_now_us() >= c->expire_us) break;
+            sha204_clock_sleep_us(SHA204_ENCIO_POLL_MS * 1000);
+        }
+    }
+
+    // 失去同步, 按同步方式重发
+    return sha204c_send_and_receive(fd, &c->comm);
+}
+
+
+// 器件拒绝了命令(不影响同步), 后续slot可以继续
+static uint8_t encio_device_error(uint8_t status) {
+    return status == SHA204_PARSE_ERROR || status == SHA204_CMD_FAIL;
+}
+
+
+static void encio_decrypt(struct sha204_encio_op *op, struct sha204h_temp_key *temp_key) {
+    struct sha204h_decrypt_in_out decrypt;
+
+    decrypt.data = op->data;
+    decrypt.temp_key = temp_key;
+    op->status = sha204h_decrypt(decrypt);
+    memset(temp_key, 0, sizeof(*temp_key));
+}
+
+
+// GenDig执行期间的主机计算: Nonce与GenDig摘要, 写操作的加密与输入MAC
+static uint8_t encio_host_digest(struct sha204_encio_op *op, uint8_t nonce_mode, const uint8_t *num_in,
+                                 const uint8_t *rand_out, struct sha204h_temp_key *temp_key, uint8_t mac[32]) {
+    struct sha204h_nonce_in_out nonce;
+    struct sha204h_gen_dig_in_out gen_dig;
+    uint8_t key[32];
+
+    nonce.mode = nonce_mode;
+    nonce.num_in = (uint8_t *) num_in;
+    nonce.rand_out = (uint8_t *) rand_out;
+    nonce.temp_key = temp_key;
+    uint8_t status = sha204h_nonce(nonce);
+    if (status != SHA204_SUCCESS) return status;
+
+    memcpy(key, op->key, sizeof(key));
+    gen_dig.zone = GENDIG_ZONE_DATA;
+    gen_dig.key_id = op->key_id;
+    gen_dig.stored_value = key;
+    gen_dig.temp_key = temp_key;
+    status = sha204h_gen_dig(gen_dig);
+    memset(key, 0, sizeof(key));
+    if (status != SHA204_SUCCESS || !op->write) return status;
+
+    struct sha204h_encrypt_in_out encrypt;
+    encrypt.zone = SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG;
+    encrypt.address = (uint16_t) (op->slot * 8);
+    encrypt.data = op->data;
+    encrypt.mac = mac;
+    encrypt.temp_key = temp_key;
+    return sha204h_encrypt(encrypt);
+}
+
+
+/** \brief 在一次唤醒内依次完成ops中的加密读写
+ *
+ * 器件拒绝某个slot(执行错误, 例如SlotConfig不允许)时继续后面的slot; 通信失败时停止,
+ * 未执行的slot的status为SHA204_FUNC_FAIL. 写操作的data在返回后为密文.
+ * \param[in]     fd         file description
+ * \param[in,out] awake      调用者记录的唤醒状态(例如调度器已唤醒器件), 返回时器件仍醒着;
+ *                           NULL时自行唤醒, 结束后sleep
+ * \param[in]     nonce_mode NONCE_MODE_SEED_UPDATE或NONCE_MODE_NO_SEED_UPDATE
+ * \param[in]     num_in     Nonce的20字节输入
+ * \param[in,out] ops        加密读写, 结果在各自的data/status中
+ * \param[in]     n          ops的个数
+ * \return 第一个失败的slot的status, 全部成功为SHA204_SUCCESS
+ */
+uint8_t sha204_encio_run(int fd, struct sha204_awake *awake, uint8_t nonce_mode, const uint8_t num_in[20],
+                         struct sha204_encio_op *ops, uint32_t n) {
+    struct encio_cmd cmd;
+    struct sha204_awake own_awake = {0, 0};
+    struct sha204h_temp_key temp_key, pending_key;
+    struct sha204_encio_op *pending = NULL;     // 已读出密文, 等下一条命令执行时解密
+    uint8_t mac[32], rand_out[32];
+    uint8_t ret = SHA204_SUCCESS;
+    uint32_t i;
+
+    if (nonce_mode != NONCE_MODE_SEED_UPDATE && nonce_mode != NONCE_MODE_NO_SEED_UPDATE) return SHA204_BAD_PARAM;
+    for (i = 0; i < n; ++i) ops[i].status = SHA204_FUNC_FAIL;
+
+    for (i = 0; i < n; ++i) {
+        struct sha204_encio_op *op = &ops[i];
+        uint8_t status;
+
+        if (!op->key || op->slot > 15 || op->key_id > 15) {
+            op->status = SHA204_BAD_PARAM;
+            if (ret == SHA204_SUCCESS) ret = op->status;
+            continue;
+        }
+
+        // 一个slot的三条命令必须在同一个看门狗周期内
+        sha204_request_wake(fd, awake ? awake : &own_awake, (uint16_t) (NONCE_EXEC_MAX + GENDIG_EXEC_MAX
+                                                    + (op->write ? WRITE_EXEC_MAX : READ_EXEC_MAX)));
+
+        status = encio_send(fd, &cmd, SHA204_NONCE, nonce_mode, 0, NONCE_NUMIN_SIZE, num_in, 0, NULL);
+        if (pending) {
+            encio_decrypt(pending, &pending_key);
+            pending = NULL;
+        }
+        if (status == SHA204_SUCCESS) status = encio_receive(fd, &cmd);
+        if (status == SHA204_SUCCESS) {
+            memcpy(rand_out, &cmd.rx[SHA204_BUFFER_POS_DATA], sizeof(rand_out));
+            status = encio_send(fd, &cmd, SHA204_GENDIG, GENDIG_ZONE_DATA, op->key_id, 0, NULL, 0, NULL);
+        }
+        if (status == SHA204_SUCCESS) {
+            uint8_t host_status = encio_host_digest(op, nonce_mode, num_in, rand_out, &temp_key, mac);
+            status = encio_receive(fd, &cmd);
+            if (status == SHA204_SUCCESS) status = host_status;
+        }
+        if (status == SHA204_SUCCESS) {
+            if (op->write)
+                status = encio_send(fd, &cmd, SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG,
+                                    (uint16_t) (op->slot * 8), SHA204_ZONE_ACCESS_32, op->data,
+                                    SHA204_ZONE_ACCESS_32, mac);
+            else
+                status = encio_send(fd, &cmd, SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG,
+                                    (uint16_t) (op->slot * 8), 0, NULL, 0, NULL);
+        }
+        if (status == SHA204_SUCCESS) status = encio_receive(fd, &cmd);
+
+        if (status == SHA204_SUCCESS && !op->write) {
+            memcpy(op->data, &cmd.rx[SHA204_BUFFER_POS_DATA], sizeof(op->data));
+            pending_key = temp_key;
+            pending = op;
+        } else {
+            op->status = status;
+        }
+        memset(&temp_key, 0, sizeof(temp_key));
+
+        if (status != SHA204_SUCCESS && ret == SHA204_SUCCESS) ret = status;
+        if (status != SHA204_SUCCESS && !encio_device_error(status) && status != SHA204_BAD_PARAM) break;
+    }
+
+    if (!awake) sha204_request_sleep(fd, &own_awake);
+    if (pending) encio_decrypt(pending, &pending_key);
+    memset(mac, 0, sizeof(mac));
+
+    for (i = 0; i < n && ret == SHA204_SUCCESS; ++i) ret = ops[i].status;
+    return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ * sha204_encio.h
+ *
+ * 流水线化的加密读写: 一次唤醒内依次完成多个slot的 Nonce -> GenDig -> Read/Write,
+ * 主机侧的计算放在器件执行下一条命令的等待时间里:
+ *   - GenDig执行期间: 主机Nonce摘要, GenDig摘要, 写操作的加密与输入MAC
+ *   - 下一个slot的Nonce执行期间: 上一个读操作的解密
+ * 命令之间不sleep(sleep清除TempKey), 按看门狗在slot之间idle并重新唤醒(sha204_request_wake).
+ * 总耗时接近各命令在器件上的执行时间之和.
+ *
+ * 命令用sha204c_send/sha204c_receive分开收发, 响应未就绪时按1ms轮询;
+ * 失去同步时退回sha204c_send_and_receive重发, 若因此重新唤醒则TempKey丢失, 该slot的后续命令报错.
+ */
+
+#ifndef SHA204_ENCIO_H
+#   define SHA204_ENCIO_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+
+//! 响应未就绪时的轮询间隔(ms)
+#define SHA204_ENCIO_POLL_MS         (1)
+
+//! 一次加密读或写
+struct sha204_encio_op {
+    uint8_t write;                  //!< 0读, 1写
+    uint16_t slot;                  //!< 读写的slot
+    uint16_t key_id;                //!< GenDig使用的密钥slot(SlotConfig的ReadKey/WriteKey)
+    const uint8_t *key;             //!< 密钥slot的内容, 32字节
+    uint8_t data[32];               //!< 写: 明文输入; 读: 明文输出
+    uint8_t status;                 //!< 该slot的结果
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t sha204_encio_run(int fd, struct sha204_awake *awake, uint8_t nonce_mode, const uint8_t num_in[20],
+                         struct sha204_encio_op *ops, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_ENCIO_H
@@ -0,0 +1,254 @@
+/*
+ * sha204_entropy.c
+ *
+ * 硬件随机数预取池
+ */
+
+#include "sha204_entropy.h"
+#include "sha204_sched.h"
+#include "sha204_comm_marshaling.h"
+#include "sha204_lib_return_codes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct sha204_entropy {
+    struct sha204_sched *sched;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;                    // 补充请求结束, 销毁时等待
+
+    uint8_t *pool;                          // 环形缓冲, 未占用的部分保持为0
+    uint32_t capacity;
+    uint32_t low_water;
+    uint32_t head;                          // 最早的未读字节
+    uint32_t level;
+
+    struct sha204_sched_req refill;
+    uint8_t inflight;                       // refill已提交, 尚未完成
+    uint8_t refilling;                      // 低于低水位后补充, 直到补满
+    uint8_t seeded;                         // 已执行过更新种子的Random
+    uint8_t broken;                         // 芯片输出固定图样(config区未锁定)
+    uint8_t stop;
+
+    struct sha204_entropy_stats stats;
+};
+
+
+// config区未锁定时芯片不产生随机数, Random输出固定为 FF FF 00 00 重复
+static uint8_t entropy_unlocked_pattern(const uint8_t *rnd) {
+    for (uint8_t i = 0; i < SHA204_ENTROPY_BLOCK; ++i)
+        if (rnd[i] != ((i & 2) ? 0x00 : 0xFF)) return 0;
+    return 1;
+}
+
+
+// 放入池尾. 调用时持有lock, len不超过剩余空间
+static void entropy_append(struct sha204_entropy *e, const uint8_t *data, uint32_t len) {
+    uint32_t tail = (e->head + e->level) % e->capacity;
+
+    for (uint32_t i = 0; i < len; ++i) {
+        e->pool[tail] = data[i];
+        if (++tail == e->capacity) tail = 0;
+    }
+    e->level += len;
+}
+
+
+// 从池头取出并清零. 调用时持有lock
+static uint32_t entropy_take(struct sha204_entropy *e, uint8_t *buf, uint32_t len) {
+    if (len > e->level) len = e->level;
+
+    for (uint32_t i = 0; i < len; ++i) {
+        buf[i] = e->pool[e->head];
+        e->pool[e->head] = 0;
+        if (++e->head == e->capacity) e->head = 0;
+    }
+    e->level -= len;
+    return len;
+}
+
+
+static uint8_t entropy_random_mode(struct sha204_entropy *e) {
+    if (e->seeded) return RANDOM_NO_SEED_UPDATE;
+    e->seeded = 1;
+    return RANDOM_SEED_UPDATE;
+}
+
+
+static void entropy_refilled(struct sha204_sched_req *r, void *arg);
+
+// 需要时提交一条后台Random. 调用时持有lock
+static void entropy_kick(struct sha204_entropy *e) {
+    if (e->inflight || e->stop || e->broken) return;
+
+    if (e->level < e->low_water) e->refilling = 1;
+    if (!e->refilling) return;
+    if (e->level + SHA204_ENTROPY_BLOCK > e->capacity) {
+        e->refilling = 0;
+        return;
+    }
+
+    struct sha204_sched_req *r = &e->refill;
+    sha204_sched_req_init(r, SHA204_PRIO_BACKGROUND, 0);
+    sha204_request_init(&r->req, SHA204_RANDOM, entropy_random_mode(e), 0, NULL, 0);
+    r->on_complete = entropy_refilled;
+    r->complete_arg = e;
+    if (sha204_sched_submit(e->sched, r) == SHA204_SUCCESS) e->inflight = 1;
+    else e->refilling = 0;                  // 排队已满, 下次读取时再试
+}
+
+
+// 完成回调, 在派发线程上执行
+static void entropy_refilled(struct sha204_sched_req *r, void *arg) {
+    struct sha204_entropy *e = (struct sha204_entropy *) arg;
+    const uint8_t *rnd = &r->req.rsp[SHA204_BUFFER_POS_DATA];
+
+    pthread_mutex_lock(&e->lock);
+    e->inflight = 0;
+    if (r->req.status != SHA204_SUCCESS) {
+        // 芯片出错时不连续重试, 由下一次读取重新触发
+        e->refilling = 0;
+    } else if (entropy_unlocked_pattern(rnd)) {
+        printf("FAILED! sha204_entropy: config zone not locked, Random is not random\n");
+        e->broken = 1;
+    } else {
+        entropy_append(e, rnd, SHA204_ENTROPY_BLOCK);
+        e->stats.refills++;
+        entropy_kick(e);
+    }
+    memset(r->req.rsp, 0, sizeof(r->req.rsp));
+
+    if (!e->inflight) pthread_cond_broadcast(&e->idle);
+    pthread_mutex_unlock(&e->lock);
+}
+
+
+/** \brief 创建随机数池并开始预取
+ *
+ * \param[in] s         器件的调度器
+ * \param[in] capacity  池的字节数, 向上取整到SHA204_ENTROPY_BLOCK的倍数
+ * \param[in] low_water 池中字节数低于此值时开始补充
+ * \return 池, 失败返回NULL
+ */
+struct sha204_entropy *sha204_entropy_create(struct sha204_sched *s, uint32_t capacity, uint32_t low_water) {
+    if (!s || capacity == 0) return NULL;
+
+    struct sha204_entropy *e = (struct sha204_entropy *) calloc(1, sizeof(*e));
+    if (!e) return NULL;
+
+    e->capacity = (capacity + SHA204_ENTROPY_BLOCK - 1) / SHA204_ENTROPY_BLOCK * SHA204_ENTROPY_BLOCK;
+    e->low_water = low_water < e->capacity ? low_water : e->capacity;
+    e->pool = (uint8_t *) calloc(1, e->capacity);
+    if (!e->pool) {
+        free(e);
+        return NULL;
+    }
+    e->sched = s;
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->idle, NULL);
+
+    // 创建时补满
+    pthread_mutex_lock(&e->lock);
+    e->refilling = 1;
+    entropy_kick(e);
+    pthread_mutex_unlock(&e->lock);
+
+    return e;
+}
+
+
+/** \brief 停止预取, 清零并释放池. 等待正在执行的补充请求结束
+ */
+void sha204_entropy_destroy(struct sha204_entropy *e) {
+    if (!e) return;
+
+    pthread_mutex_lock(&e->lock);
+    e->stop = 1;
+    pthread_mutex_unlock(&e->lock);
+
+    // 未派发的直接取消, 已派发的等完成回调
+    if (sha204_sched_cancel(e->sched, &e->refill) == SHA204_SUCCESS) {
+        pthread_mutex_lock(&e->lock);
+        e->inflight = 0;
+        pthread_mutex_unlock(&e->lock);
+    }
+    pthread_mutex_lock(&e->lock);
+    while (e->inflight) pthread_cond_wait(&e->idle, &e->lock);
+    pthread_mutex_unlock(&e->lock);
+
+    memset(e->pool, 0, e->capacity);
+    free(e->pool);
+    pthread_cond_destroy(&e->idle);
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+
+/** \brief 读取硬件随机数
+ *
+ * 池中足够时只做一次拷贝; 不够时剩余部分以紧急优先级同步执行Random(每条最长RANDOM_EXEC_MAX).
+ * \param[out] buf 输出
+ * \param[in]  len 字节数, 任意长度
+ * \return SHA204_SUCCESS; 失败时buf被清零
+ */
+uint8_t sha204_entropy_read(struct sha204_entropy *e, uint8_t *buf, size_t len) {
+    uint8_t status = SHA204_SUCCESS;
+    size_t done;
+
+    if (!e || (!buf && len)) return SHA204_BAD_PARAM;
+
+    pthread_mutex_lock(&e->lock);
+    if (e->broken) status = SHA204_FUNC_FAIL;
+    done = status == SHA204_SUCCESS ? entropy_take(e, buf, len > UINT32_MAX ? UINT32_MAX : (uint32_t) len) : 0;
+    e->stats.from_pool += done;
+    entropy_kick(e);
+    pthread_mutex_unlock(&e->lock);
+
+    while (status == SHA204_SUCCESS && done < len) {
+        struct sha204_sched_req r;
+        const uint8_t *rnd = &r.req.rsp[SHA204_BUFFER_POS_DATA];
+
+        sha204_sched_req_init(&r, SHA204_PRIO_URGENT, 0);
+        pthread_mutex_lock(&e->lock);
+        sha204_request_init(&r.req, SHA204_RANDOM, entropy_random_mode(e), 0, NULL, 0);
+        pthread_mutex_unlock(&e->lock);
+        status = sha204_sched_execute(e->sched, &r);
+        if (status != SHA204_SUCCESS) break;
+
+        pthread_mutex_lock(&e->lock);
+        e->stats.inline_randoms++;
+        if (entropy_unlocked_pattern(rnd)) {
+            printf("FAILED! sha204_entropy: config zone not locked, Random is not random\n");
+            e->broken = 1;
+            status = SHA204_FUNC_FAIL;
+        } else {
+            uint32_t n = len - done < SHA204_ENTROPY_BLOCK ? (uint32_t) (len - done) : SHA204_ENTROPY_BLOCK;
+            uint32_t spare = SHA204_ENTROPY_BLOCK - n;
+
+            memcpy(buf + done, rnd, n);
+            done += n;
+            // 多出的字节没有交给任何人, 放回池中
+            if (spare > e->capacity - e->level) spare = e->capacity - e->level;
+            entropy_append(e, rnd + n, spare);
+        }
+        pthread_mutex_unlock(&e->lock);
+        memset(r.req.rsp, 0, sizeof(r.req.rsp));
+    }
+
+    pthread_mutex_lock(&e->lock);
+    if (status == SHA204_SUCCESS) e->stats.served += len;
+    pthread_mutex_unlock(&e->lock);
+    if (status != SHA204_SUCCESS && buf) memset(buf, 0, len);
+
+    return status;
+}
+
+
+void sha204_entropy_get_stats(struct sha204_entropy *e, struct sha204_entropy_stats *stats) {
+    pthread_mutex_lock(&e->lock);
+    *stats = e->stats;
+    stats->level = e->level;
+    pthread_mutex_unlock(&e->lock);
+}
@@ -0,0 +1,50 @@
+/*
+ * sha204_entropy.h
+ *
+ * 每个器件一个硬件随机数池: 通过sha204_sched以后台优先级预取Random输出(每条32字节, 最长RANDOM_EXEC_MAX),
+ * 读取时从池中直接拷贝, 不等待芯片.
+ *   - 池中字节低于低水位时开始补充, 补满为止; 同一时刻最多一条补充请求在排队
+ *   - 读出的字节立即从池中移除并清零, 同一字节不会交给两个调用者
+ *   - 池不够时剩余部分以紧急优先级同步执行Random, 多出的字节放回池中
+ *   - 创建后第一条Random更新EEPROM种子, 之后不更新, 避免频繁擦写
+ *   - config区未锁定时芯片的Random输出固定为FF FF 00 00..., 此时池停止工作, 读取返回SHA204_FUNC_FAIL
+ *
+ * 池应在调度器之前销毁.
+ */
+
+#ifndef SHA204_ENTROPY_H
+#   define SHA204_ENTROPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! 一条Random命令输出的字节数
+#define SHA204_ENTROPY_BLOCK        (32)
+
+struct sha204_sched;
+struct sha204_entropy;
+
+//! 统计
+struct sha204_entropy_stats {
+    uint64_t served;                //!< 交给调用者的字节数
+    uint64_t from_pool;             //!< 其中直接从池中取得的字节数
+    uint64_t refills;               //!< 后台补充的Random条数
+    uint64_t inline_randoms;        //!< 池不够时同步执行的Random条数
+    uint32_t level;                 //!< 当前池中的字节数
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_entropy *sha204_entropy_create(struct sha204_sched *s, uint32_t capacity, uint32_t low_water);
+void sha204_entropy_destroy(struct sha204_entropy *e);
+
+uint8_t sha204_entropy_read(struct sha204_entropy *e, uint8_t *buf, size_t len);
+void sha204_entropy_get_stats(struct sha204_entropy *e, struct sha204_entropy_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_ENTROPY_H
@@ -20,6 +20,7 @@
 
 #include <string.h>                    // needed for memcpy()
 #include <stdint.h>
+#include <pthread.h>                   // HMAC key cache cleanup at thread exit
 
 #include "sha204_helper.h"
 #include "sha256.h"                    // SHA-256 algorithm (taken from SA102 library)
@@ -68,7 +69,7 @@ uint8_t sha204h_nonce(struct sha204h_nonce_in_out param)
 		*p_temp++ = param.mode;
 		*p_temp++ = 0x00;
 			
-		sha256(temporary, SHA204_MSG_SIZE_NONCE, param.temp_key->value);
+		sha256_fixed(temporary, SHA204_MSG_SIZE_NONCE, param.temp_key->value);
 		
 		// Update TempKey.SourceFlag to 0 (random)
 		param.temp_key->source_flag = 0;
@@ -90,18 +91,17 @@ uint8_t sha204h_nonce(struct sha204h_nonce_in_out param)
 }
 
 
-/** \brief This function generates an SHA-256 digest (MAC) of a key, challenge, and other informations.
+/** \brief This function checks the MAC parameters and assembles the message the Device hashes for the MAC opcode.
  *
- *         The resulting digest will match with those generated in the Device by MAC opcode.
- *         The TempKey (if used) should be valid (temp_key.valid = 1) before executing this function.
+ *         Shared by sha204h_mac() and sha204h_mac_many(); the TempKey is neither hashed nor invalidated here.
  *
- * \param [in,out] param Structure for input/output parameters. Refer to sha204h_mac_in_out.
+ * \param [in] param Structure for input parameters. Refer to sha204h_mac_in_out.
+ * \param [out] temporary Buffer of SHA204_MSG_SIZE_MAC bytes receiving the message.
  * \return status of the operation.
- */ 
-uint8_t sha204h_mac(struct sha204h_mac_in_out param)
+ */
+static uint8_t sha204h_mac_message(struct sha204h_mac_in_out param, uint8_t *temporary)
 {
 	// Local Variables
-	uint8_t temporary[SHA204_MSG_SIZE_MAC];
 	uint8_t i;
 	uint8_t *p_temp;
 	
@@ -203,64 +203,94 @@ uint8_t sha204h_mac(struct sha204h_mac_in_out param)
 		}       
 	}
 	
-	// This is the resulting MAC digest
-	sha256(temporary, SHA204_MSG_SIZE_MAC, param.response);
-	
-	// Update TempKey fields
-	param.temp_key->valid = 0;
-	
 	return SHA204_SUCCESS;
 }
 
 
-/** \brief This function generates an HMAC/SHA-256 digest of a key and other informations.
+/** \brief This function generates an SHA-256 digest (MAC) of a key, challenge, and other informations.
  *
- *         The resulting digest will match with those generated in the Device by HMAC opcode.
- *         The TempKey should be valid (temp_key.valid = 1) before executing this function.
+ *         The resulting digest will match with those generated in the Device by MAC opcode.
+ *         The TempKey (if used) should be valid (temp_key.valid = 1) before executing this function.
  *
- * \param [in,out] param Structure for input/output parameters. Refer to sha204h_hmac_in_out.
+ * \param [in,out] param Structure for input/output parameters. Refer to sha204h_mac_in_out.
  * \return status of the operation.
  */ 
-uint8_t sha204h_hmac(struct sha204h_hmac_in_out param)
+uint8_t sha204h_mac(struct sha204h_mac_in_out param)
 {
 	// Local Variables
-	uint8_t temporary[SHA204_MSG_SIZE_HMAC_INNER];
-	uint8_t i;
-	uint8_t *p_temp;
+	uint8_t temporary[SHA204_MSG_SIZE_MAC];
+	uint8_t ret_code = sha204h_mac_message(param, temporary);
 	
-	// Check parameters
-	if (	!param.response || !param.key || !param.temp_key
-			|| ((param.mode & ~HMAC_MODE_MASK) != 0)
-			|| (((param.mode & MAC_MODE_INCLUDE_OTP_64) != 0) && !param.otp)
-			|| (((param.mode & MAC_MODE_INCLUDE_OTP_88) != 0) && !param.otp)
-			|| (((param.mode & MAC_MODE_INCLUDE_SN) != 0) && !param.sn) )
-		return SHA204_BAD_PARAM;
+	if (ret_code != SHA204_SUCCESS)
+		return ret_code;
 	
-	// Check TempKey fields validity (TempKey is always used)
-	if (	// TempKey.CheckFlag must be 0 and TempKey.Valid must be 1
-			   (param.temp_key->check_flag != 0)
-			|| (param.temp_key->valid != 1) 
-			// The mode parameter bit 2 must match temp_key.source_flag
-			// Logical not (!) are used to evaluate the expression to TRUE/FALSE first before comparison (!=)
-			|| (!(param.mode & MAC_MODE_SOURCE_FLAG_MATCH) != !(param.temp_key->source_flag)) )
-		return SHA204_CMD_FAIL;
-		
-	// Start first calculation (inner)
-	p_temp = temporary;
+	// This is the resulting MAC digest
+	sha256_fixed(temporary, SHA204_MSG_SIZE_MAC, param.response);
+	
+	// Update TempKey fields (not needed when the challenge comes with the command)
+	if (param.temp_key)
+		param.temp_key->valid = 0;
+	
+	return SHA204_SUCCESS;
+}
 
-	// Refer to fips-198a.pdf, length Key = 32 bytes, Blocksize = 512 bits = 64 bytes,
-	//   so the Key must be padded with zeros	
-	// XOR K0 with ipad, then append
-	for (i = 0; i < 32; i++) {
-		*p_temp++ = param.key[i] ^ 0x36;
-	}
 
-	// XOR the remaining zeros and append
-	for (i = 0; i < 32; i++) {
-		*p_temp++ = 0 ^ 0x36;
+/** \brief This function generates the MAC digests of several independent MAC commands at once.
+ *
+ *         Same as calling sha204h_mac() for each entry, but the 88-byte messages are hashed together
+ *         with sha256_many(), one message per SIMD lane. All entries are checked before any is hashed.
+ *
+ * \param [in,out] params Array of input/output parameters. Refer to sha204h_mac_in_out.
+ * \param [in]     count  Number of entries in params.
+ * \return status of the operation; on a bad entry nothing is computed.
+ */
+uint8_t sha204h_mac_many(struct sha204h_mac_in_out *params, uint16_t count)
+{
+	// Local Variables
+	uint8_t temporary[SHA204_MAC_MANY_CHUNK][SHA204_MSG_SIZE_MAC];
+	const uint8_t *msgs[SHA204_MAC_MANY_CHUNK];
+	uint32_t lens[SHA204_MAC_MANY_CHUNK];
+	uint8_t *digests[SHA204_MAC_MANY_CHUNK];
+	uint16_t i, j, n;
+	uint8_t ret_code;
+	
+	// Check every entry first so that a bad one leaves all responses untouched
+	for (i = 0; i < count; i++) {
+		ret_code = sha204h_mac_message(params[i], temporary[0]);
+		if (ret_code != SHA204_SUCCESS)
+			return ret_code;
 	}
 	
-	// Next append the stream of data 'text'
+	for (i = 0; i < count; i += n) {
+		n = (uint16_t) (count - i < SHA204_MAC_MANY_CHUNK ? count - i : SHA204_MAC_MANY_CHUNK);
+		for (j = 0; j < n; j++) {
+			sha204h_mac_message(params[i + j], temporary[j]);
+			msgs[j] = temporary[j];
+			lens[j] = SHA204_MSG_SIZE_MAC;
+			digests[j] = params[i + j].response;
+		}
+		sha256_many(msgs, lens, digests, n);
+		
+		for (j = 0; j < n; j++) {
+			if (params[i + j].temp_key)
+				params[i + j].temp_key->valid = 0;
+		}
+	}
+	
+	return SHA204_SUCCESS;
+}
+
+
+/** \brief This function builds the HMAC 'text' that follows the padded key block.
+ *
+ * \param [in] param Structure for input parameters. Refer to sha204h_hmac_in_out.
+ * \param [out] p_temp Pointer to SHA204_MSG_SIZE_HMAC_INNER - 64 bytes.
+ */
+static void sha204h_hmac_text(struct sha204h_hmac_in_out *p, uint8_t *p_temp)
+{
+	struct sha204h_hmac_in_out param = *p;
+	uint8_t i;
+	
 	// (1) first 32 bytes: zeros
 	for (i = 0; i < 32; i++) {
 		*p_temp++ = 0;
@@ -325,31 +355,119 @@ uint8_t sha204h_hmac(struct sha204h_hmac_in_out param)
 			*p_temp++ = 0x00;
 		}
 	}
+}
+
+
+/** \brief This function checks the HMAC parameters and TempKey state.
+ *
+ * \param [in] param Structure for input parameters. Refer to sha204h_hmac_in_out.
+ * \param [in] need_key Whether param.key is used.
+ * \return status of the operation.
+ */
+static uint8_t sha204h_hmac_check(struct sha204h_hmac_in_out *p, uint8_t need_key)
+{
+	struct sha204h_hmac_in_out param = *p;
 	
-	// This is now H((K0^ipad):text), use param.response for temporary storage
-	sha256(temporary, SHA204_MSG_SIZE_HMAC_INNER, param.response);
-	
+	// Check parameters
+	if (	!param.response || (need_key && !param.key) || !param.temp_key
+			|| ((param.mode & ~HMAC_MODE_MASK) != 0)
+			|| (((param.mode & MAC_MODE_INCLUDE_OTP_64) != 0) && !param.otp)
+			|| (((param.mode & MAC_MODE_INCLUDE_OTP_88) != 0) && !param.otp)
+			|| (((param.mode & MAC_MODE_INCLUDE_SN) != 0) && !param.sn) )
+		return SHA204_BAD_PARAM;
 	
-	// Start second calculation (outer)
-	p_temp = temporary;
+	// Check TempKey fields validity (TempKey is always used)
+	if (	// TempKey.CheckFlag must be 0 and TempKey.Valid must be 1
+			   (param.temp_key->check_flag != 0)
+			|| (param.temp_key->valid != 1) 
+			// The mode parameter bit 2 must match temp_key.source_flag
+			// Logical not (!) are used to evaluate the expression to TRUE/FALSE first before comparison (!=)
+			|| (!(param.mode & MAC_MODE_SOURCE_FLAG_MATCH) != !(param.temp_key->source_flag)) )
+		return SHA204_CMD_FAIL;
 	
-	// XOR K0 with opad, then append
-	for (i = 0; i < 32; i++) {
-		*p_temp++ = param.key[i] ^ 0x5C;
-	}
+	return SHA204_SUCCESS;
+}
+
+
+/** \brief Overwrite memory holding key material, not optimized away.
+ */
+static void sha204h_zeroize(void *p, size_t size)
+{
+	explicit_bzero(p, size);
+}
+
+
+// SHA-256 state after the block (K0 ^ pad), K0 being the key padded with zeros
+static void sha204h_hmac_pad_midstate(const uint8_t *key, uint8_t pad, uint32_t state[8])
+{
+	uint8_t block[SHA256_BLOCK_SIZE];
+	uint8_t i;
 	
-	// XOR the remaining zeros and append
-	for (i = 0; i < 32; i++) {
-		*p_temp++ = 0 ^ 0x5C;
-	}	
+	memset(block, pad, sizeof(block));
+	for (i = 0; i < 32; i++)
+		block[i] = key[i] ^ pad;
+	sha256_midstate(block, state);
 	
-	// Append result from last calculation H((K0^ipad):text)
-	memcpy(p_temp, param.response, 32);
-	p_temp += 32;
+	sha204h_zeroize(block, sizeof(block));
+}
+
+
+/** \brief This function precomputes the HMAC inner and outer midstates of a 32-byte key.
+ *
+ *         Refer to fips-198a.pdf, length Key = 32 bytes, Blocksize = 512 bits = 64 bytes,
+ *         so the Key is padded with zeros. H(K0^ipad) and H(K0^opad) after one block
+ *         depend only on the key, every HMAC with that key resumes from them.
+ *
+ * \param [out] hkey Midstates. Release with sha204h_hmac_key_clear().
+ * \param [in] key Pointer to 32-byte key.
+ */
+void sha204h_hmac_key_init(struct sha204h_hmac_key *hkey, const uint8_t *key)
+{
+	// XOR K0 with ipad, the remaining zeros become ipad
+	sha204h_hmac_pad_midstate(key, 0x36, hkey->inner);
 	
-	// This is the resulting HMAC	
-	sha256(temporary, SHA204_MSG_SIZE_HMAC_OUTER, param.response);	
+	// XOR K0 with opad
+	sha204h_hmac_pad_midstate(key, 0x5C, hkey->outer);
+}
+
+
+/** \brief This function erases precomputed HMAC midstates.
+ */
+void sha204h_hmac_key_clear(struct sha204h_hmac_key *hkey)
+{
+	sha204h_zeroize(hkey, sizeof(*hkey));
+}
+
 
+/** \brief This function generates an HMAC/SHA-256 digest from precomputed key midstates.
+ *
+ *         Same result as sha204h_hmac() with the key hkey was built from; param.key is not used.
+ *
+ * \param [in,out] param Structure for input/output parameters. Refer to sha204h_hmac_in_out.
+ * \param [in] hkey Midstates from sha204h_hmac_key_init().
+ * \return status of the operation.
+ */
+uint8_t sha204h_hmac_with_key(struct sha204h_hmac_in_out param, const struct sha204h_hmac_key *hkey)
+{
+	// Local Variables
+	uint8_t temporary[SHA204_MSG_SIZE_HMAC_INNER - SHA256_BLOCK_SIZE];
+	uint8_t inner[32];
+	uint8_t ret_code;
+	
+	if (!hkey)
+		return SHA204_BAD_PARAM;
+	
+	ret_code = sha204h_hmac_check(&param, 0);
+	if (ret_code != SHA204_SUCCESS)
+		return ret_code;
+	
+	// H((K0^ipad):text), resumed after the key block
+	sha204h_hmac_text(&param, temporary);
+	sha256_resume_88(hkey->inner, temporary, inner);
+	
+	// H((K0^opad):H((K0^ipad):text)), the resulting HMAC
+	sha256_resume_32(hkey->outer, inner, param.response);
+	
 	// Update TempKey fields
 	param.temp_key->valid = 0;
 	
@@ -357,6 +475,138 @@ uint8_t sha204h_hmac(struct sha204h_hmac_in_out param)
 }
 
 
+//! Midstates of recently used keys, see sha204h_hmac(). No copy of the key itself is kept.
+struct sha204h_hmac_cache_entry {
+	struct sha204h_hmac_key hkey;      //!< inner doubles as the lookup key, a one-way hash of the key
+	uint32_t last_use;                 //!< 0: empty
+};
+
+// Each thread has its own cache, so lookups take no lock
+static __thread struct sha204h_hmac_cache_entry sha204h_hmac_cache[SHA204H_HMAC_CACHE_SIZE];
+static __thread uint32_t sha204h_hmac_cache_clock;
+static __thread uint32_t sha204h_hmac_cache_generation;
+
+// Bumped by sha204h_hmac_cache_clear(), other threads drop their caches on their next lookup
+static uint32_t sha204h_hmac_cache_epoch;
+
+// Zeroizes a thread's cache when the thread exits
+static pthread_key_t sha204h_hmac_cache_key;
+static pthread_once_t sha204h_hmac_cache_once = PTHREAD_ONCE_INIT;
+
+
+static void sha204h_hmac_cache_drop(void *unused)
+{
+	(void) unused;
+	sha204h_zeroize(sha204h_hmac_cache, sizeof(sha204h_hmac_cache));
+	sha204h_hmac_cache_clock = 0;
+}
+
+
+static void sha204h_hmac_cache_key_create(void)
+{
+	pthread_key_create(&sha204h_hmac_cache_key, sha204h_hmac_cache_drop);
+}
+
+
+// State compare without an early exit
+static uint8_t sha204h_state_equal(const uint32_t *a, const uint32_t *b)
+{
+	uint32_t diff = 0;
+	uint8_t i;
+	
+	for (i = 0; i < 8; i++)
+		diff |= a[i] ^ b[i];
+	
+	return diff == 0;
+}
+
+
+/** \brief This function looks up (or computes and inserts) the midstates of a key.
+ *
+ *         The ipad midstate is always computed and serves as the lookup key; a hit saves the opad block.
+ *         Each thread holds SHA204H_HMAC_CACHE_SIZE keys, the least recently used is evicted and zeroized.
+ *
+ * \param [in] key Pointer to 32-byte key.
+ * \param [out] hkey Copy of the midstates; the caller clears it after use.
+ */
+static void sha204h_hmac_cache_get(const uint8_t *key, struct sha204h_hmac_key *hkey)
+{
+	struct sha204h_hmac_cache_entry *e, *victim = &sha204h_hmac_cache[0];
+	uint32_t epoch = __atomic_load_n(&sha204h_hmac_cache_epoch, __ATOMIC_ACQUIRE);
+	uint8_t i;
+	
+	if (sha204h_hmac_cache_generation != epoch) {
+		sha204h_hmac_cache_drop(NULL);
+		sha204h_hmac_cache_generation = epoch;
+	}
+	
+	sha204h_hmac_pad_midstate(key, 0x36, hkey->inner);
+	
+	for (i = 0; i < SHA204H_HMAC_CACHE_SIZE; i++) {
+		e = &sha204h_hmac_cache[i];
+		if (e->last_use && sha204h_state_equal(e->hkey.inner, hkey->inner)) {
+			e->last_use = ++sha204h_hmac_cache_clock;
+			memcpy(hkey->outer, e->hkey.outer, sizeof(hkey->outer));
+			return;
+		}
+		if (e->last_use < victim->last_use)
+			victim = e;
+	}
+	
+	sha204h_hmac_pad_midstate(key, 0x5C, hkey->outer);
+	
+	if (sha204h_hmac_cache_clock == 0) {
+		pthread_once(&sha204h_hmac_cache_once, sha204h_hmac_cache_key_create);
+		pthread_setspecific(sha204h_hmac_cache_key, sha204h_hmac_cache);
+	}
+	sha204h_zeroize(victim, sizeof(*victim));
+	victim->hkey = *hkey;
+	victim->last_use = ++sha204h_hmac_cache_clock;
+}
+
+
+/** \brief This function zeroizes all cached HMAC key midstates.
+ *
+ *         The calling thread's cache is cleared at once, other threads clear theirs on their next HMAC.
+ *         Call when keys are rotated or before the process drops its privileges.
+ */
+void sha204h_hmac_cache_clear(void)
+{
+	__atomic_add_fetch(&sha204h_hmac_cache_epoch, 1, __ATOMIC_RELEASE);
+	sha204h_hmac_cache_drop(NULL);
+	sha204h_hmac_cache_generation = __atomic_load_n(&sha204h_hmac_cache_epoch, __ATOMIC_ACQUIRE);
+}
+
+
+/** \brief This function generates an HMAC/SHA-256 digest of a key and other informations.
+ *
+ *         The resulting digest will match with those generated in the Device by HMAC opcode.
+ *         The TempKey should be valid (temp_key.valid = 1) before executing this function.
+ *         The key's inner/outer midstates are kept in a small per-thread cache (see sha204h_hmac_cache_clear()).
+ *         The ipad midstate is the lookup key and is computed on every call, so a hit saves only the opad
+ *         key-block compression (one of two). Callers that reuse a key should build it once with
+ *         sha204h_hmac_key_init() and call sha204h_hmac_with_key(), which skips both.
+ *
+ * \param [in,out] param Structure for input/output parameters. Refer to sha204h_hmac_in_out.
+ * \return status of the operation.
+ */ 
+uint8_t sha204h_hmac(struct sha204h_hmac_in_out param)
+{
+	struct sha204h_hmac_key hkey;
+	uint8_t ret_code;
+	
+	ret_code = sha204h_hmac_check(&param, 1);
+	if (ret_code != SHA204_SUCCESS)
+		return ret_code;
+	
+	sha204h_hmac_cache_get(param.key, &hkey);
+	ret_code = sha204h_hmac_with_key(param, &hkey);
+	sha204h_hmac_key_clear(&hkey);
+	
+	return ret_code;
+}
+
+
 /** \brief This function combines current TempKey with a stored value.
  *
  *         The stored value can be a data slot, OTP page, configuration zone, or hardware transport key.
@@ -424,7 +674,7 @@ uint8_t sha204h_gen_dig(struct sha204h_gen_dig_in_out param)
 	memcpy(p_temp, param.temp_key->value, 32);
 	
 	// This is the new TempKey
-	sha256(temporary, SHA204_MSG_SIZE_GEN_DIG, param.temp_key->value);
+	sha256_fixed(temporary, SHA204_MSG_SIZE_GEN_DIG, param.temp_key->value);
 
 	
 	// Update TempKey fields
@@ -511,7 +761,7 @@ uint8_t sha204h_derive_key(struct sha204h_derive_key_in_out param)
 	p_temp += 32;
 	
 	// This is the derived key
-	sha256(temporary, SHA204_MSG_SIZE_DERIVE_KEY, param.target_key);	
+	sha256_fixed(temporary, SHA204_MSG_SIZE_DERIVE_KEY, param.target_key);	
 
 	
 	// Update TempKey fields
@@ -565,7 +815,7 @@ uint8_t sha204h_derive_key_mac(struct sha204h_derive_key_mac_in_out param)
 	*p_temp++ = SHA204_SN_1;
 	
 	// This is the input MAC for DeriveKey command
-	sha256(temporary, SHA204_MSG_SIZE_DERIVE_KEY_MAC, param.mac);
+	sha256_fixed(temporary, SHA204_MSG_SIZE_DERIVE_KEY_MAC, param.mac);
 
 	return SHA204_SUCCESS;
 }
@@ -646,7 +896,7 @@ uint8_t sha204h_encrypt(struct sha204h_encrypt_in_out param)
 		memcpy(p_temp, param.data, 32);	
 		
 		// This is the input MAC
-		sha256(temporary, SHA204_MSG_SIZE_ENCRYPT_MAC, param.mac);
+		sha256_fixed(temporary, SHA204_MSG_SIZE_ENCRYPT_MAC, param.mac);
 	}
 	
 	
@@ -53,6 +53,12 @@
 #define SHA204_MSG_SIZE_DERIVE_KEY_MAC   (39)  // (32+1+1+2+1+2)
 #define SHA204_MSG_SIZE_ENCRYPT_MAC      (96)  // (32+1+1+2+1+2+25+32)
 
+// Number of keys whose HMAC midstates sha204h_hmac() keeps per thread; a hit saves the opad block only
+#define SHA204H_HMAC_CACHE_SIZE          (16)
+
+// Number of MAC messages sha204h_mac_many() hashes per sha256_many() call
+#define SHA204_MAC_MANY_CHUNK            (16)
+
 // SN[0:1] and SN[8]
 #define SHA204_SN_0               (0x01)
 #define SHA204_SN_1               (0x23)
@@ -174,6 +180,19 @@ struct sha204h_hmac_in_out {
 };
 
 
+/** \struct sha204h_hmac_key
+ *  \brief Precomputed HMAC midstates of one key, see sha204h_hmac_key_init().
+ *  \var sha204h_hmac_key::inner
+ *       \brief SHA-256 state after the block K0 ^ ipad.
+ *  \var sha204h_hmac_key::outer
+ *       \brief SHA-256 state after the block K0 ^ opad.
+ */
+struct sha204h_hmac_key {
+	uint32_t inner[8];
+	uint32_t outer[8];
+};
+
+
 /** \struct sha204h_gen_dig_in_out
  *  \brief Input/output parameters for function sha204h_gen_dig().
  *  \var sha204h_gen_dig_in_out::zone
@@ -274,7 +293,12 @@ struct sha204h_decrypt_in_out {
 //---------------------
 uint8_t sha204h_nonce(struct sha204h_nonce_in_out param);
 uint8_t sha204h_mac(struct sha204h_mac_in_out param);
+uint8_t sha204h_mac_many(struct sha204h_mac_in_out *params, uint16_t count);
 uint8_t sha204h_hmac(struct sha204h_hmac_in_out param);
+void sha204h_hmac_key_init(struct sha204h_hmac_key *hkey, const uint8_t *key);
+void sha204h_hmac_key_clear(struct sha204h_hmac_key *hkey);
+uint8_t sha204h_hmac_with_key(struct sha204h_hmac_in_out param, const struct sha204h_hmac_key *hkey);
+void sha204h_hmac_cache_clear(void);
 uint8_t sha204h_gen_dig(struct sha204h_gen_dig_in_out param);
 uint8_t sha204h_derive_key(struct sha204h_derive_key_in_out param);
 uint8_t sha204h_derive_key_mac(struct sha204h_derive_key_mac_in_out param);
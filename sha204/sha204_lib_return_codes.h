@@ -44,5 +44,7 @@
 
 #define SHA204_COMM_FAIL            ((uint8_t)  0xF0) //!< Communication with device failed. Same as in hardware dependent modules.
 #define SHA204_TIMEOUT              ((uint8_t)  0xF1) //!< Timed out while waiting for response. Number of bytes received is 0.
+#define SHA204_QUEUE_FULL           ((uint8_t)  0xF2) //!< Request queue is full, request rejected.
+#define SHA204_RATE_LIMITED         ((uint8_t)  0xF3) //!< Client exceeded its rate budget, request rejected.
 
 #endif
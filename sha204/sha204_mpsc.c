@@ -0,0 +1,283 @@
+/*
+ * sha204_mpsc.c
+ *
+ * 有界MPSC环形队列与器件工作线程
+ *
+ * 生产者先在count上预留一个位置(fetch_add, 超出容量则撤销并拒绝), 再用fetch_add在tail上领取槽位.
+ * 预留成功保证该槽位上一轮的记录已被消费, 生产者写入记录后以release语义发布槽位序号.
+ * 消费者只有一个, 按head顺序等待槽位发布, 读取后以release语义归还count.
+ * head槽位尚未发布时(生产者正在写记录)工作线程在门铃上阻塞, 由该生产者发布后唤醒, 不忙等.
+ *
+ * producers记录正在submit中的生产者, 销毁时先拒绝新的提交, 等这些生产者发布完再停止工作线程.
+ * 完成时用FUTEX_WAKE_OP由内核写入DONE并唤醒: 提交者看到DONE后可能立即释放future,
+ * 先store再FUTEX_WAKE会在已释放的内存上唤醒, 先唤醒再store又会丢失唤醒.
+ */
+
+#include "sha204_mpsc.h"
+#include "sha204_lib_return_codes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+struct mpsc_cell {
+    uint64_t seq;                   // 已发布的轮次序号: 槽位pos发布后为pos + 1
+    struct sha204_request req;
+    struct sha204_future *future;
+};
+
+struct sha204_worker {
+    int fd;
+    uint32_t capacity;              // 2的幂
+    uint32_t mask;
+    struct mpsc_cell *cells;
+
+    uint64_t tail __attribute__((aligned(64)));    // 生产者领取位置
+    uint32_t count;                                // 已预留未消费的记录数
+    uint32_t producers;                            // 正在sha204_worker_submit中的生产者数
+    uint32_t sleeping;                             // 工作线程是否在门铃上阻塞
+    uint64_t head __attribute__((aligned(64)));    // 消费位置, 只由工作线程访问
+
+    int doorbell;                   // eventfd, 唤醒工作线程
+    uint32_t closing;               // 销毁中, 不再接受提交
+    uint32_t stop;                  // 生产者都已退出, 队列取空后工作线程结束
+    pthread_t thread;
+    struct sha204_awake awake;
+};
+
+
+static long futex(uint32_t *uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+
+static void future_complete(struct sha204_future *f, const struct sha204_request *req) {
+    memcpy(&f->result, req, sizeof(f->result));
+    int efd = f->efd;
+
+    // 内核原子地写入DONE并唤醒f->state上的等待者, 之后不再访问f: 提交者看到DONE即可释放future
+    // 第二组唤醒的条件 oldval != PENDING 不成立, 不会发生
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (syscall(SYS_futex, &f->state, FUTEX_WAKE_OP_PRIVATE, INT32_MAX, 0, &f->state,
+                FUTEX_OP(FUTEX_OP_SET, SHA204_FUTURE_DONE, FUTEX_OP_CMP_NE, SHA204_FUTURE_PENDING)) < 0) {
+        // 不支持FUTEX_WAKE_OP的内核: 退回先store再唤醒
+        __atomic_store_n(&f->state, SHA204_FUTURE_DONE, __ATOMIC_RELEASE);
+        futex(&f->state, FUTEX_WAKE_PRIVATE, INT32_MAX);
+    }
+
+    if (efd >= 0) {
+        uint64_t one = 1;
+        write(efd, &one, sizeof(one));
+    }
+}
+
+
+// 取出下一条已发布的记录, 没有则返回NULL. 与worker_ring中对sleeping的读配对, 用seq_cst
+static struct mpsc_cell *worker_peek(struct sha204_worker *w) {
+    struct mpsc_cell *cell = &w->cells[w->head & w->mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) != w->head + 1)
+        return NULL;
+    return cell;
+}
+
+
+static void worker_release(struct sha204_worker *w) {
+    w->head++;
+    __atomic_fetch_sub(&w->count, 1, __ATOMIC_RELEASE);
+}
+
+
+static void *worker_thread(void *arg) {
+    struct sha204_worker *w = (struct sha204_worker *) arg;
+    uint64_t value;
+
+    for (;;) {
+        struct mpsc_cell *cell = worker_peek(w);
+        if (cell) {
+            struct sha204_request req;
+            struct sha204_future *f = cell->future;
+
+            memcpy(&req, &cell->req, sizeof(req));
+            worker_release(w);
+
+            sha204_request_wake(w->fd, &w->awake, sha204_request_cost_ms(&req));
+            sha204_request_execute(w->fd, &req);
+            future_complete(f, &req);
+            continue;
+        }
+
+        // stop在所有生产者发布完之后才置位, 此时head未发布即队列已空
+        if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+            break;
+
+        // 队列已空或head槽位的生产者还在写记录: 让器件休眠后在门铃上阻塞, 发布后由生产者唤醒
+        sha204_request_sleep(w->fd, &w->awake);
+
+        __atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!worker_peek(w) && !__atomic_load_n(&w->stop, __ATOMIC_SEQ_CST))
+            read(w->doorbell, &value, sizeof(value));
+        __atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    sha204_request_sleep(w->fd, &w->awake);
+    return NULL;
+}
+
+
+static void worker_ring(struct sha204_worker *w) {
+    if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        write(w->doorbell, &one, sizeof(one));
+    }
+}
+
+
+/** \brief 创建器件的提交队列与工作线程
+ *
+ * \param[in] fd       file description
+ * \param[in] capacity 队列容量, 向上取整为2的幂
+ * \return 工作线程句柄, 失败返回NULL
+ */
+struct sha204_worker *sha204_worker_create(int fd, uint32_t capacity) {
+    struct sha204_worker *w;
+    uint32_t cap = 1;
+
+    while (cap < capacity) cap <<= 1;
+
+    if (posix_memalign((void **) &w, 64, sizeof(*w)) != 0)
+        return NULL;
+    memset(w, 0, sizeof(*w));
+
+    w->fd = fd;
+    w->capacity = cap;
+    w->mask = cap - 1;
+    w->cells = (struct mpsc_cell *) calloc(cap, sizeof(struct mpsc_cell));
+    w->doorbell = eventfd(0, EFD_CLOEXEC);
+    if (!w->cells || w->doorbell < 0)
+        goto fail;
+
+    if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+        goto fail;
+
+    return w;
+
+fail:
+    printf("FAILED! sha204_worker_create\n");
+    if (w->doorbell >= 0) close(w->doorbell);
+    free(w->cells);
+    free(w);
+    return NULL;
+}
+
+
+/** \brief 处理完队列中已提交的请求后停止工作线程并释放
+ *
+ *  与sha204_worker_submit并发调用时, 已进入submit的生产者发布完成后才停止, 之后的提交返回SHA204_FUNC_FAIL.
+ *  销毁之后不能再调用submit.
+ */
+void sha204_worker_destroy(struct sha204_worker *w) {
+    uint64_t one = 1;
+
+    if (!w) return;
+
+    // submit中的生产者离发布只差几条指令, 让出CPU等它们完成; 之后不会再有新的预留
+    __atomic_store_n(&w->closing, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&w->producers, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    __atomic_store_n(&w->stop, 1, __ATOMIC_SEQ_CST);
+    write(w->doorbell, &one, sizeof(one));
+    pthread_join(w->thread, NULL);
+
+    close(w->doorbell);
+    free(w->cells);
+    free(w);
+}
+
+
+/** \brief 提交请求, 不加锁也不阻塞
+ *
+ * \param[in] w   工作线程句柄
+ * \param[in] req 请求记录, 拷贝进队列
+ * \param[in] f   完成通知, 须先用sha204_future_init初始化
+ * \return SHA204_SUCCESS已入队; SHA204_QUEUE_FULL队列已满; SHA204_FUNC_FAIL正在销毁
+ */
+uint8_t sha204_worker_submit(struct sha204_worker *w, const struct sha204_request *req, struct sha204_future *f) {
+    uint8_t status = SHA204_SUCCESS;
+
+    if (!w || !req || !f)
+        return SHA204_BAD_PARAM;
+
+    // 先登记再检查closing, 与sha204_worker_destroy先置closing再等producers归零配对
+    __atomic_fetch_add(&w->producers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->closing, __ATOMIC_SEQ_CST)) {
+        status = SHA204_FUNC_FAIL;
+    } else if (__atomic_fetch_add(&w->count, 1, __ATOMIC_SEQ_CST) >= w->capacity) {
+        __atomic_fetch_sub(&w->count, 1, __ATOMIC_RELAXED);
+        status = SHA204_QUEUE_FULL;
+    } else {
+        uint64_t pos = __atomic_fetch_add(&w->tail, 1, __ATOMIC_RELAXED);
+        struct mpsc_cell *cell = &w->cells[pos & w->mask];
+
+        memcpy(&cell->req, req, sizeof(cell->req));
+        cell->future = f;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+        worker_ring(w);
+    }
+    // 此后不再访问w
+    __atomic_fetch_sub(&w->producers, 1, __ATOMIC_RELEASE);
+
+    return status;
+}
+
+
+/** \brief 提交请求并等待完成, 结果写回req
+ */
+uint8_t sha204_worker_execute(struct sha204_worker *w, struct sha204_request *req) {
+    struct sha204_future f;
+
+    sha204_future_init(&f, -1);
+    uint8_t status = sha204_worker_submit(w, req, &f);
+    if (status != SHA204_SUCCESS)
+        return status;
+
+    sha204_future_wait(&f);
+    memcpy(req, &f.result, sizeof(*req));
+    return req->status;
+}
+
+
+/** \brief 初始化完成通知
+ *
+ * \param[out] f   完成通知
+ * \param[in]  efd 完成时写入1的eventfd, 传-1则只能用sha204_future_wait/sha204_future_done
+ */
+void sha204_future_init(struct sha204_future *f, int efd) {
+    f->state = SHA204_FUTURE_PENDING;
+    f->efd = efd;
+    f->result.status = SHA204_FUNC_FAIL;
+}
+
+
+int sha204_future_done(const struct sha204_future *f) {
+    return __atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == SHA204_FUTURE_DONE;
+}
+
+
+/** \brief 阻塞等待请求完成
+ *
+ * \return 请求的执行结果, 响应在f->result中
+ */
+uint8_t sha204_future_wait(struct sha204_future *f) {
+    while (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == SHA204_FUTURE_PENDING)
+        futex(&f->state, FUTEX_WAIT_PRIVATE, SHA204_FUTURE_PENDING);
+
+    return f->result.status;
+}
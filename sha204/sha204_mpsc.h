@@ -0,0 +1,51 @@
+/*
+ * sha204_mpsc.h
+ *
+ * 多生产者单消费者的无锁提交队列 + 每器件一个工作线程.
+ *
+ * 应用线程把定长请求记录拷贝进有界环形队列, 提交只需几次原子操作, 不会因其他线程阻塞(wait-free).
+ * 工作线程按顺序取出请求, 通过sha204m_execute执行, 再通过future(futex)或eventfd通知结果.
+ * 几十个服务线程同时访问芯片时不再在一把大锁上排队.
+ */
+
+#ifndef SHA204_MPSC_H
+#   define SHA204_MPSC_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+
+//! future状态
+#define SHA204_FUTURE_PENDING       (0)
+#define SHA204_FUTURE_DONE          (1)
+
+/**
+ * \brief 单个请求的完成通知. 由提交者持有, 完成之前不能释放.
+ */
+struct sha204_future {
+    uint32_t state;                 //!< SHA204_FUTURE_PENDING / SHA204_FUTURE_DONE, futex等待的字
+    int efd;                        //!< 完成时写入的eventfd, <0表示不使用
+    struct sha204_request result;   //!< 执行完成后的请求记录(含status与响应)
+};
+
+struct sha204_worker;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_worker *sha204_worker_create(int fd, uint32_t capacity);
+void sha204_worker_destroy(struct sha204_worker *w);
+
+uint8_t sha204_worker_submit(struct sha204_worker *w, const struct sha204_request *req, struct sha204_future *f);
+uint8_t sha204_worker_execute(struct sha204_worker *w, struct sha204_request *req);
+
+void sha204_future_init(struct sha204_future *f, int efd);
+int sha204_future_done(const struct sha204_future *f);
+uint8_t sha204_future_wait(struct sha204_future *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
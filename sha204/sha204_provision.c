@@ -0,0 +1,399 @@
+/*
+ * sha204_provision.c
+ *
+ * 生产线个人化
+ */
+
+#include "sha204_provision.h"
+#include "atsha204_actions.h"
+#include "sha204_async.h"
+#include "sha204_clock.h"
+#include "sha204_comm.h"
+#include "sha204_comm_marshaling.h"
+#include "sha204_helper.h"
+#include "sha204_lib_return_codes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+//! 读config区的次数: 2x32字节 + 6x4字节
+#define PROV_CONFIG_READS           (8)
+//! 锁定前比较的字节: I2C_Addr ~ SlotConfig
+#define PROV_VERIFY_FIRST           (16)
+#define PROV_VERIFY_LAST            (51)
+
+// 一颗芯片的状态机
+struct prov_chip {
+    const struct sha204_prov_profile *profile;
+    struct sha204_async_dev *dev;
+    struct sha204_async_op op;
+    struct sha204_prov_result *res;
+    uint8_t config[88];
+    struct atsha204_config_plan plan;       // config区与profile不同的字
+    uint8_t data[16][32];                   // 锁定data区时期望的data区内容, 用于计算Lock的CRC
+    uint8_t index;                          // 当前步骤内的第几条命令
+};
+
+// 一条总线的线程
+struct prov_bus {
+    pthread_t thread;
+    const struct sha204_prov_profile *profile;
+    const struct sha204_prov_socket *sockets;
+    struct sha204_prov_result *results;
+    uint32_t n;
+    uint32_t bus;
+};
+
+
+static const char *prov_step_names[] = {
+    "read_config", "write_config", "verify_config", "lock_config", "write_data", "lock_data", "read_lock", "done"
+};
+
+
+const char *sha204_provision_step_name(uint8_t step) {
+    return step <= SHA204_PROV_STEP_DONE ? prov_step_names[step] : "unknown";
+}
+
+
+static void prov_done(struct sha204_async_op *op, void *arg);
+
+
+static void prov_finish(struct prov_chip *c, uint8_t status) {
+    c->res->status = status;
+    if (status == SHA204_SUCCESS) c->res->step = SHA204_PROV_STEP_DONE;
+    c->res->finish_us = sha204_clock_now_us();
+}
+
+
+static void prov_submit(struct prov_chip *c, uint8_t op_code, uint8_t param_1, uint16_t param_2,
+                        const uint8_t *data, uint8_t data_len) {
+    uint8_t status = sha204_request_init(&c->op.req, op_code, param_1, param_2, data, data_len);
+    if (status == SHA204_SUCCESS) status = sha204_async_submit(c->dev, &c->op);
+    if (status != SHA204_SUCCESS) prov_finish(c, status);
+    else c->res->commands++;
+}
+
+
+// 第i次读config区的位置
+static void prov_config_read(struct prov_chip *c, uint8_t i) {
+    if (i < 2) prov_submit(c, SHA204_READ, SHA204_ZONE_CONFIG | SHA204_ZONE_COUNT_FLAG, (uint16_t) (i * 8), NULL, 0);
+    else prov_submit(c, SHA204_READ, SHA204_ZONE_CONFIG, (uint16_t) (0x10 + i - 2), NULL, 0);
+}
+
+
+static uint8_t prov_config_offset(uint8_t i) {
+    return (uint8_t) (i < 2 ? i * 32 : 64 + (i - 2) * 4);
+}
+
+
+// 执行写config区计划的第index条
+static void prov_write_config(struct prov_chip *c) {
+    const struct atsha204_config_write *w = &c->plan.writes[c->index];
+    uint8_t param_1 = SHA204_ZONE_CONFIG | (w->size == SHA204_ZONE_ACCESS_32 ? SHA204_ZONE_COUNT_FLAG : 0);
+
+    prov_submit(c, SHA204_WRITE, param_1, w->addr, c->profile->config + w->offset, w->size);
+}
+
+
+// 写profile中第index个slot
+static void prov_write_slot(struct prov_chip *c) {
+    const struct sha204_prov_slot *s = &c->profile->slots[c->index];
+    uint8_t content[32];
+    uint8_t status = SHA204_SUCCESS;
+
+    if (s->slot > 15) status = SHA204_BAD_PARAM;
+    else if (s->content) memcpy(content, s->content, sizeof(content));
+    else if (s->secret) status = s->secret(s->secret_ctx, c->res->sn, s->slot, content);
+    else status = SHA204_BAD_PARAM;
+
+    if (status == SHA204_SUCCESS) {
+        memcpy(c->data[s->slot], content, sizeof(content));
+        prov_submit(c, SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, (uint16_t) (s->slot * 8),
+                    content, SHA204_ZONE_ACCESS_32);
+    } else {
+        prov_finish(c, status);
+    }
+    explicit_bzero(content, sizeof(content));
+}
+
+
+// 锁定data区的CRC(SHA204_PROV_CRC_BLANK): 依次覆盖16个slot与OTP区. 写过的slot为写入的内容, 其余与OTP区为出厂内容
+static uint16_t prov_data_crc(struct prov_chip *c) {
+    uint8_t otp[64];
+    uint8_t crc[2] = {0, 0};
+
+    for (uint8_t slot = 0; slot < 16; ++slot)
+        sha204h_calculate_crc_chain(sizeof(c->data[slot]), c->data[slot], crc);
+    memset(otp, SHA204_PROV_BLANK, sizeof(otp));
+    sha204h_calculate_crc_chain(sizeof(otp), otp, crc);
+
+    return (uint16_t) (crc[0] | (crc[1] << 8));
+}
+
+
+// 进入一个步骤, 提交它的第一条命令; 不需要的步骤直接跳过
+static void prov_enter(struct prov_chip *c, uint8_t step) {
+    const struct sha204_prov_profile *p = c->profile;
+    const uint8_t *lock = &c->config[84];
+
+    c->res->step = step;
+    c->index = 0;
+
+    switch (step) {
+    case SHA204_PROV_STEP_READ_CONFIG:
+    case SHA204_PROV_STEP_VERIFY_CONFIG:
+        prov_config_read(c, 0);
+        return;
+
+    case SHA204_PROV_STEP_WRITE_CONFIG:
+        if (lock[3] == 0x00) {
+            // 已锁定, 只比较
+            if (memcmp(c->config + PROV_VERIFY_FIRST, p->config,
+                       PROV_VERIFY_LAST - PROV_VERIFY_FIRST + 1) != 0) {
+                c->res->step = SHA204_PROV_STEP_VERIFY_CONFIG;
+                prov_finish(c, SHA204_CMD_FAIL);
+            } else {
+                prov_enter(c, SHA204_PROV_STEP_WRITE_DATA);
+            }
+            return;
+        }
+        // 只写不同的字; 都相同时读出的内容就是当前内容, 不必再读回
+        atsha204_config_plan(c->config, p->config, &c->plan);
+        if (c->plan.n == 0) {
+            prov_enter(c, SHA204_PROV_STEP_LOCK_CONFIG);
+            return;
+        }
+        c->res->provisioned = 1;
+        prov_write_config(c);
+        return;
+
+    case SHA204_PROV_STEP_LOCK_CONFIG: {
+        uint8_t crc[2];
+        if (p->lock == SHA204_PROV_LOCK_NONE) {
+            prov_enter(c, SHA204_PROV_STEP_READ_LOCK);
+            return;
+        }
+        c->res->provisioned = 1;
+        // 以读回内容的CRC锁定, 读回之后config区若有变化Lock失败
+        sha204c_calculate_crc(sizeof(c->config), c->config, crc);
+        prov_submit(c, SHA204_LOCK, 0, (uint16_t) (crc[0] | (crc[1] << 8)), NULL, 0);
+        return;
+    }
+
+    case SHA204_PROV_STEP_WRITE_DATA:
+        if (lock[2] == 0x00 || lock[3] != 0x00 || p->n_slots == 0) {
+            // data区已锁定, 或config区未锁定(不能写data区)
+            prov_enter(c, SHA204_PROV_STEP_LOCK_DATA);
+            return;
+        }
+        c->res->provisioned = 1;
+        prov_write_slot(c);
+        return;
+
+    case SHA204_PROV_STEP_LOCK_DATA:
+        if (p->lock != SHA204_PROV_LOCK_ALL || lock[2] == 0x00 || lock[3] != 0x00) {
+            prov_enter(c, SHA204_PROV_STEP_READ_LOCK);
+            return;
+        }
+        c->res->provisioned = 1;
+        if (p->data_crc == SHA204_PROV_CRC_BLANK) {
+            // 以期望内容的CRC锁定, 任何一个slot写坏时Lock失败, 不会把错误的密钥永久锁进芯片
+            prov_submit(c, SHA204_LOCK, LOCK_ZONE_NO_CONFIG, prov_data_crc(c), NULL, 0);
+        } else {
+            prov_submit(c, SHA204_LOCK, LOCK_ZONE_NO_CONFIG | LOCK_ZONE_NO_CRC, 0, NULL, 0);
+        }
+        explicit_bzero(c->data, sizeof(c->data));
+        return;
+
+    case SHA204_PROV_STEP_READ_LOCK:
+        prov_submit(c, SHA204_READ, SHA204_ZONE_CONFIG, 0x15, NULL, 0);
+        return;
+
+    default:
+        prov_finish(c, SHA204_SUCCESS);
+        return;
+    }
+
+}
+
+
+// 命令完成, 在总线线程上调用: 记录结果, 提交下一条或进入下一步
+static void prov_done(struct sha204_async_op *op, void *arg) {
+    struct prov_chip *c = (struct prov_chip *) arg;
+    const struct sha204_prov_profile *p = c->profile;
+    const uint8_t *data = &op->req.rsp[SHA204_BUFFER_POS_DATA];
+    uint8_t status = op->req.status;
+
+    if (status != SHA204_SUCCESS) {
+        prov_finish(c, status);
+        return;
+    }
+
+    switch (c->res->step) {
+    case SHA204_PROV_STEP_READ_CONFIG:
+    case SHA204_PROV_STEP_VERIFY_CONFIG:
+        memcpy(c->config + prov_config_offset(c->index), data, c->index < 2 ? 32 : 4);
+        if (++c->index < PROV_CONFIG_READS) {
+            prov_config_read(c, c->index);
+            return;
+        }
+        if (c->res->step == SHA204_PROV_STEP_READ_CONFIG) {
+            memcpy(c->res->sn, c->config, 4);
+            memcpy(c->res->sn + 4, c->config + 8, 5);
+            memcpy(c->res->lock, c->config + 84, 4);
+            prov_enter(c, SHA204_PROV_STEP_WRITE_CONFIG);
+        } else if (memcmp(c->config + 16, p->config, sizeof(p->config)) != 0) {
+            prov_finish(c, SHA204_CMD_FAIL);
+        } else {
+            prov_enter(c, SHA204_PROV_STEP_LOCK_CONFIG);
+        }
+        return;
+
+    case SHA204_PROV_STEP_WRITE_CONFIG:
+        if (++c->index < c->plan.n) {
+            prov_write_config(c);
+            return;
+        }
+        prov_enter(c, SHA204_PROV_STEP_VERIFY_CONFIG);
+        return;
+
+    case SHA204_PROV_STEP_LOCK_CONFIG:
+        c->config[87] = 0x00;
+        prov_enter(c, SHA204_PROV_STEP_WRITE_DATA);
+        return;
+
+    case SHA204_PROV_STEP_WRITE_DATA:
+        if (++c->index < p->n_slots) {
+            prov_write_slot(c);
+            return;
+        }
+        prov_enter(c, SHA204_PROV_STEP_LOCK_DATA);
+        return;
+
+    case SHA204_PROV_STEP_LOCK_DATA:
+        c->config[86] = 0x00;
+        prov_enter(c, SHA204_PROV_STEP_READ_LOCK);
+        return;
+
+    case SHA204_PROV_STEP_READ_LOCK:
+        memcpy(c->res->lock, data, 4);
+        if ((p->lock >= SHA204_PROV_LOCK_CONFIG && data[3] != 0x00)
+            || (p->lock == SHA204_PROV_LOCK_ALL && data[2] != 0x00)) {
+            prov_finish(c, SHA204_FUNC_FAIL);
+            return;
+        }
+        prov_finish(c, SHA204_SUCCESS);
+        return;
+    }
+}
+
+
+static void *prov_bus_thread(void *arg) {
+    struct prov_bus *b = (struct prov_bus *) arg;
+    struct sha204_reactor *r = sha204_reactor_create();
+    struct prov_chip *chips = (struct prov_chip *) calloc(b->n, sizeof(*chips));
+    uint32_t i;
+
+    sha204_clock_join();
+    sha204_clock_release();
+
+    for (i = 0; i < b->n; ++i) {
+        struct sha204_prov_result *res = &b->results[i];
+        if (b->sockets[i].bus != b->bus) continue;
+
+        res->start_us = sha204_clock_now_us();
+        if (!r || !chips || !(chips[i].dev = sha204_async_dev_create(r, b->sockets[i].fd))) {
+            res->status = SHA204_FUNC_FAIL;
+            res->finish_us = res->start_us;
+            continue;
+        }
+        chips[i].profile = b->profile;
+        memset(chips[i].data, SHA204_PROV_BLANK, sizeof(chips[i].data));
+        chips[i].res = res;
+        sha204_async_op_init(&chips[i].op, prov_done, &chips[i]);
+        prov_enter(&chips[i], SHA204_PROV_STEP_READ_CONFIG);
+    }
+    if (r) sha204_reactor_run(r);
+
+    for (i = 0; chips && i < b->n; ++i) {
+        sha204_async_dev_destroy(chips[i].dev);
+        memset(chips[i].config, 0, sizeof(chips[i].config));
+        explicit_bzero(chips[i].data, sizeof(chips[i].data));
+    }
+    free(chips);
+    if (r) sha204_reactor_destroy(r);
+    sha204_clock_leave();
+
+    return NULL;
+}
+
+
+/** \brief 按profile个人化所有插座上的芯片, 每条总线一个线程, 全部结束后返回
+ *
+ * \param[in]  profile 个人化内容
+ * \param[in]  sockets 插座
+ * \param[in]  n       插座数
+ * \param[out] results 每个插座的结果, 与sockets一一对应
+ * \return 全部成功为SHA204_SUCCESS, 否则为第一个失败插座的status
+ */
+uint8_t sha204_provision_run(const struct sha204_prov_profile *profile, const struct sha204_prov_socket *sockets,
+                             uint32_t n, struct sha204_prov_result *results) {
+    struct prov_bus *buses = (struct prov_bus *) calloc(n ? n : 1, sizeof(*buses));
+    uint32_t n_bus = 0, i, j;
+    uint8_t ret = SHA204_SUCCESS;
+
+    if (profile->lock > SHA204_PROV_LOCK_ALL || profile->data_crc > SHA204_PROV_CRC_BLANK) {
+        free(buses);
+        return SHA204_BAD_PARAM;
+    }
+    if (!buses) return SHA204_FUNC_FAIL;
+    memset(results, 0, n * sizeof(*results));
+    for (i = 0; i < n; ++i) {
+        results[i].status = SHA204_FUNC_FAIL;
+        for (j = 0; j < n_bus && buses[j].bus != sockets[i].bus; ++j);
+        if (j == n_bus) {
+            buses[n_bus].profile = profile;
+            buses[n_bus].sockets = sockets;
+            buses[n_bus].results = results;
+            buses[n_bus].n = n;
+            buses[n_bus].bus = sockets[i].bus;
+            n_bus++;
+        }
+    }
+
+    // 虚拟时间下先hold, 各总线线程都join之后时间才开始推进
+    for (i = 0; i < n_bus; ++i) sha204_clock_hold();
+    for (i = 0; i < n_bus; ++i) {
+        if (pthread_create(&buses[i].thread, NULL, prov_bus_thread, &buses[i]) != 0) {
+            sha204_clock_release();
+            buses[i].n = 0;
+        }
+    }
+    for (i = 0; i < n_bus; ++i)
+        if (buses[i].n) pthread_join(buses[i].thread, NULL);
+    free(buses);
+
+    for (i = 0; i < n && ret == SHA204_SUCCESS; ++i) ret = results[i].status;
+    return ret;
+}
+
+
+/** \brief 以JSON输出结果, 每个插座一项
+ */
+void sha204_provision_report(FILE *out, const struct sha204_prov_socket *sockets,
+                             const struct sha204_prov_result *results, uint32_t n) {
+    fprintf(out, "[\n");
+    for (uint32_t i = 0; i < n; ++i) {
+        const struct sha204_prov_result *r = &results[i];
+
+        fprintf(out, "  {\"socket\": %u, \"bus\": %u, \"sn\": \"", i, sockets[i].bus);
+        for (int k = 0; k < 9; ++k) fprintf(out, "%02x", r->sn[k]);
+        fprintf(out, "\", \"status\": %u, \"step\": \"%s\", \"provisioned\": %s, \"lock\": \"%02x%02x%02x%02x\", "
+                     "\"commands\": %u, \"ms\": %.1f}%s\n",
+                r->status, sha204_provision_step_name(r->step), r->provisioned ? "true" : "false",
+                r->lock[0], r->lock[1], r->lock[2], r->lock[3], r->commands,
+                (double) (r->finish_us - r->start_us) / 1000.0, i + 1 < n ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
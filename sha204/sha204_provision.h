@@ -0,0 +1,113 @@
+/*
+ * sha204_provision.h
+ *
+ * 生产线个人化: 按声明式的profile(config区内容, 各slot的内容或按芯片生成的密钥, 锁定策略)
+ * 同时个人化夹具上的多颗芯片.
+ *
+ * 每条I2C总线一个线程, 线程内用sha204_async的reactor驱动该总线上的所有芯片: 一颗芯片执行命令
+ * (写EEPROM最长WRITE_EXEC_MAX, Lock最长LOCK_EXEC_MAX)期间总线空闲, 其他芯片的命令在这段时间里收发,
+ * 各芯片的执行窗口交错进行. 不同总线之间完全并行.
+ *
+ * 每颗芯片的步骤:
+ *   1. 读config区(8次读), 取得SN与锁定状态
+ *   2. config区未锁定: 只写与profile不同的字(atsha204_config_plan, 0x04~0x14中), 读回config区与profile比较,
+ *      一致时以读回内容的CRC锁定config区(写入有误时Lock失败, 不会锁定错误的配置). 没有不同的字时直接锁定;
+ *      已锁定: 比较I2C_Addr~SlotConfig(字节16~51)与profile, 不一致报错
+ *   3. data区未锁定: 写profile中的slot, 按锁定策略锁定data区. 是否带CRC由profile的data_crc决定:
+ *      不带CRC时同atsha204_lock_data; 带CRC时由写入的内容(含按芯片生成的密钥)计算, 写入有误时Lock失败,
+ *      但profile中没有的slot与OTP区按出厂内容(全SHA204_PROV_BLANK)计入, 这些区域不是出厂内容的芯片无法锁定
+ *   4. 读锁定字节确认
+ * 已完全锁定且配置一致的芯片不做任何写入(provisioned为0).
+ */
+
+#ifndef SHA204_PROVISION_H
+#   define SHA204_PROVISION_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+//! data区与OTP区的出厂内容, 计算锁定data区的CRC时用于profile未写入的部分
+#define SHA204_PROV_BLANK               (0xFF)
+
+//! 锁定策略
+enum sha204_prov_lock {
+    SHA204_PROV_LOCK_NONE = 0,      //!< 只写config区, 不锁定(调试夹具; config区锁定前不能写data区)
+    SHA204_PROV_LOCK_CONFIG,        //!< 只锁定config区, data区保持可明文写
+    SHA204_PROV_LOCK_ALL            //!< config区与data区都锁定
+};
+
+//! 锁定data区时的CRC
+enum sha204_prov_crc {
+    SHA204_PROV_CRC_NONE = 0,       //!< 不带CRC(LOCK_ZONE_NO_CRC), 同atsha204_lock_data, 不依赖profile以外的内容
+    SHA204_PROV_CRC_BLANK           //!< 带CRC, 假定profile以外的slot与整个OTP区为SHA204_PROV_BLANK;
+                                    //!< 只用于出厂状态的芯片, 返修或其他出厂映像的芯片上Lock总是失败
+};
+
+//! 步骤, 用于报告失败的位置
+enum sha204_prov_step {
+    SHA204_PROV_STEP_READ_CONFIG = 0,
+    SHA204_PROV_STEP_WRITE_CONFIG,
+    SHA204_PROV_STEP_VERIFY_CONFIG,
+    SHA204_PROV_STEP_LOCK_CONFIG,
+    SHA204_PROV_STEP_WRITE_DATA,
+    SHA204_PROV_STEP_LOCK_DATA,
+    SHA204_PROV_STEP_READ_LOCK,
+    SHA204_PROV_STEP_DONE
+};
+
+/**
+ * \brief 按芯片生成slot内容(例如由主密钥与SN派生的密钥). 在总线线程上调用, 可能并发
+ * \return SHA204_SUCCESS, 否则该芯片以此错误码结束
+ */
+typedef uint8_t (*sha204_prov_secret)(void *ctx, const uint8_t sn[9], uint8_t slot, uint8_t out[32]);
+
+//! 一个slot的内容
+struct sha204_prov_slot {
+    uint8_t slot;                   //!< 0~15
+    const uint8_t *content;         //!< 32字节固定内容; NULL时调用secret
+    sha204_prov_secret secret;
+    void *secret_ctx;
+};
+
+//! 个人化profile
+struct sha204_prov_profile {
+    uint8_t config[68];             //!< config区字节16~83(字0x04~0x14), 同atsha204_write_config
+    const struct sha204_prov_slot *slots;
+    uint8_t n_slots;
+    uint8_t lock;                   //!< enum sha204_prov_lock
+    uint8_t data_crc;               //!< enum sha204_prov_crc, SHA204_PROV_LOCK_ALL时锁定data区的方式
+};
+
+//! 一个插座
+struct sha204_prov_socket {
+    int fd;                         //!< 已设置从机地址的I2C设备
+    uint32_t bus;                   //!< 所在总线, 同一总线上的插座由同一个线程驱动
+};
+
+//! 每颗芯片的结果
+struct sha204_prov_result {
+    uint8_t status;                 //!< SHA204_xxx
+    uint8_t step;                   //!< enum sha204_prov_step, 成功时为SHA204_PROV_STEP_DONE
+    uint8_t provisioned;            //!< 本次写入了芯片
+    uint8_t sn[9];
+    uint8_t lock[4];                //!< 结束时的锁定字节, 同atsha204_read_lock
+    uint32_t commands;              //!< 执行的命令数
+    uint64_t start_us;
+    uint64_t finish_us;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t sha204_provision_run(const struct sha204_prov_profile *profile, const struct sha204_prov_socket *sockets,
+                             uint32_t n, struct sha204_prov_result *results);
+const char *sha204_provision_step_name(uint8_t step);
+void sha204_provision_report(FILE *out, const struct sha204_prov_socket *sockets,
+                             const struct sha204_prov_result *results, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_PROVISION_H
@@ -0,0 +1,162 @@
+/*
+ * sha204_request.c
+ *
+ * 定长命令请求记录的填充与执行
+ */
+
+#include "sha204_request.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_comm_marshaling.h"
+#include "atsha204_i2c.h"
+#include "sha204_clock.h"
+
+#include <string.h>
+
+
+/** \brief 检查请求记录是否可以执行: 数据字段不超过SHA204_REQ_DATA_MAX, 命令码为已知命令.
+ *
+ *  请求记录可能来自其他进程(broker的共享内存), 执行前必须检查, 否则组帧会写出发送缓冲区.
+ *
+ * \param[in] req 请求记录
+ * \return SHA204_SUCCESS或SHA204_BAD_PARAM
+ */
+uint8_t sha204_request_check(const struct sha204_request *req) {
+    if (!req || req->data_len > SHA204_REQ_DATA_MAX)
+        return SHA204_BAD_PARAM;
+
+    switch (req->op_code) {
+    case SHA204_CHECKMAC:
+    case SHA204_DERIVE_KEY:
+    case SHA204_DEVREV:
+    case SHA204_GENDIG:
+    case SHA204_HMAC:
+    case SHA204_LOCK:
+    case SHA204_MAC:
+    case SHA204_NONCE:
+    case SHA204_PAUSE:
+    case SHA204_RANDOM:
+    case SHA204_READ:
+    case SHA204_UPDATE_EXTRA:
+    case SHA204_WRITE:
+        return SHA204_SUCCESS;
+    default:
+        return SHA204_BAD_PARAM;
+    }
+}
+
+
+/** \brief 填充一条请求记录
+ *
+ * \param[out] req      请求记录
+ * \param[in]  op_code  命令码
+ * \param[in]  param_1  参数1
+ * \param[in]  param_2  参数2
+ * \param[in]  data     数据字段, 可以为NULL
+ * \param[in]  data_len 数据字段长度
+ * \return status of the operation
+ */
+uint8_t sha204_request_init(struct sha204_request *req, uint8_t op_code, uint8_t param_1, uint16_t param_2,
+                            const uint8_t *data, uint8_t data_len) {
+    if (!req || data_len > SHA204_REQ_DATA_MAX || (data_len && !data))
+        return SHA204_BAD_PARAM;
+
+    req->op_code = op_code;
+    req->data_len = data_len;
+    if (sha204_request_check(req) != SHA204_SUCCESS)
+        return SHA204_BAD_PARAM;
+
+    req->param_1 = param_1;
+    req->param_2 = param_2;
+    if (data_len)
+        memcpy(req->data, data, data_len);
+    req->status = SHA204_FUNC_FAIL;
+    req->rsp[SHA204_COUNT_IDX] = 0;
+
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 在调用线程上执行一条请求, 结果写回req->status与req->rsp
+ *
+ *  调用前器件须已唤醒. 收发缓冲区在栈上, 可被多个线程针对不同器件并发调用.
+ *
+ * \param[in]     fd  file description
+ * \param[in,out] req 请求记录
+ * \return status of the operation
+ */
+uint8_t sha204_request_execute(int fd, struct sha204_request *req) {
+    uint8_t tx_buffer[SHA204_CMD_SIZE_MAX];
+    struct sha204_command_parameters cmd_args;
+
+    // sha204m_prepare只在定义SHA204_CHECK_PARAMETERS时检查长度
+    if (sha204_request_check(req) != SHA204_SUCCESS) {
+        req->rsp[SHA204_COUNT_IDX] = 0;
+        req->status = SHA204_BAD_PARAM;
+        return req->status;
+    }
+
+    cmd_args.op_code = req->op_code;
+    cmd_args.param_1 = req->param_1;
+    cmd_args.param_2 = req->param_2;
+    cmd_args.data_len_1 = req->data_len;
+    cmd_args.data_1 = req->data_len ? req->data : NULL;
+    cmd_args.data_len_2 = 0;
+    cmd_args.data_2 = NULL;
+    cmd_args.data_len_3 = 0;
+    cmd_args.data_3 = NULL;
+    cmd_args.tx_size = sizeof(tx_buffer);
+    cmd_args.tx_buffer = tx_buffer;
+    cmd_args.rx_size = sizeof(req->rsp);
+    cmd_args.rx_buffer = req->rsp;
+
+    req->status = sha204m_execute(fd, &cmd_args);
+    return req->status;
+}
+
+
+/** \brief 请求在器件上的最坏执行时间(ms), 即对应命令的 *_EXEC_MAX
+ */
+uint16_t sha204_request_cost_ms(const struct sha204_request *req) {
+    return sha204m_get_exec_max(req->op_code);
+}
+
+
+/** \brief 执行一条最坏耗时cost_ms的命令之前确保器件处于唤醒状态
+ *
+ *  器件已唤醒时不重复唤醒; 若命令可能跨过看门狗超时, 先idle再重新唤醒.
+ *
+ * \param[in]     fd      file description
+ * \param[in,out] st      唤醒状态
+ * \param[in]     cost_ms 即将执行的命令的最坏耗时
+ */
+void sha204_request_wake(int fd, struct sha204_awake *st, uint16_t cost_ms) {
+    if (st->awake && sha204_clock_now_us() + cost_ms * 1000ULL > st->since_us + SHA204_WATCHDOG_MIN_MS * 1000ULL) {
+        sha204p_idle(fd);
+        st->awake = 0;
+    }
+    if (!st->awake) {
+        sha204p_wakeup(fd);
+        st->awake = 1;
+        st->since_us = sha204_clock_now_us();
+    }
+}
+
+
+/** \brief 若器件处于唤醒状态则让其休眠
+ */
+void sha204_request_sleep(int fd, struct sha204_awake *st) {
+    if (st->awake) {
+        sha204p_sleep(fd);
+        st->awake = 0;
+    }
+}
+
+
+/** \brief 若器件处于唤醒状态则让其进入idle, 与sleep不同idle保留TempKey
+ */
+void sha204_request_idle(int fd, struct sha204_awake *st) {
+    if (st->awake) {
+        sha204p_idle(fd);
+        st->awake = 0;
+    }
+}
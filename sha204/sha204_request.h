@@ -0,0 +1,60 @@
+/*
+ * sha204_request.h
+ *
+ * 定长的命令请求记录, 供调度器/提交队列等在线程或进程之间传递单条命令.
+ * 记录内不含指针, 可以直接拷贝进环形队列或共享内存.
+ */
+
+#ifndef SHA204_REQUEST_H
+#   define SHA204_REQUEST_H
+
+#include <stdint.h>
+
+#include "sha204_comm.h"
+
+//! 看门狗最短超时(ms), 器件唤醒后超过该时间未进入idle/sleep可能自行休眠并丢失TempKey
+#define SHA204_WATCHDOG_MIN_MS       (700)
+
+//! 单条命令的数据字段最大长度 (命令包去掉count/opcode/param1/param2/CRC)
+#define SHA204_REQ_DATA_MAX          (SHA204_CMD_SIZE_MAX - SHA204_CMD_SIZE_MIN)
+
+/**
+ * \brief 一条命令及其响应. 数据字段已合并为一段, 对应sha204_command_parameters的data_1.
+ */
+struct sha204_request {
+    uint8_t op_code;                        //!< command code
+    uint8_t param_1;                        //!< parameter 1
+    uint16_t param_2;                       //!< parameter 2
+    uint8_t data_len;                       //!< length of data field
+    uint8_t data[SHA204_REQ_DATA_MAX];      //!< data field
+    uint8_t status;                         //!< 执行结果, SHA204_xxx返回码
+    uint8_t rsp[SHA204_RSP_SIZE_MAX];       //!< 响应包, rsp[0]为count
+};
+
+/**
+ * \brief 执行请求的线程记录的器件唤醒状态, 用于批量执行时避免重复唤醒并躲开看门狗
+ */
+struct sha204_awake {
+    uint8_t awake;                          //!< 器件是否处于唤醒状态
+    uint64_t since_us;                      //!< 最近一次唤醒的时间
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t sha204_request_init(struct sha204_request *req, uint8_t op_code, uint8_t param_1, uint16_t param_2,
+                            const uint8_t *data, uint8_t data_len);
+uint8_t sha204_request_check(const struct sha204_request *req);
+uint8_t sha204_request_execute(int fd, struct sha204_request *req);
+uint16_t sha204_request_cost_ms(const struct sha204_request *req);
+
+void sha204_request_wake(int fd, struct sha204_awake *st, uint16_t cost_ms);
+void sha204_request_sleep(int fd, struct sha204_awake *st);
+void sha204_request_idle(int fd, struct sha204_awake *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
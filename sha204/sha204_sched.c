@@ -0,0 +1,479 @@
+/*
+ * sha204_sched.c
+ *
+ * 单个加密芯片的请求调度器: 优先级分类 + 类内EDF + 非抢占派发
+ */
+
+#include "sha204_sched.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+struct sha204_sched {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            // 派发线程等待新请求, CLOCK_MONOTONIC计时
+    pthread_cond_t done;            // 调用者等待请求完成
+    struct sha204_sched_req *head[SHA204_PRIO_COUNT];
+    struct sha204_sched_req *tail[SHA204_PRIO_COUNT];
+    uint32_t n_queued;              // 排队中的请求数
+    uint32_t max_queued;            // 非紧急请求的排队上限, 0表示不限
+    int stop;
+
+    const void *owner;              // 正在为其保留器件的提交者, NULL表示未保留
+    uint8_t owner_prio;             // 建立保留的请求的优先级
+    uint64_t hold_until_us;         // 保留的到期时间
+
+    struct sha204_awake awake;      // 器件唤醒状态, 只在派发线程上访问
+
+    uint8_t clock_joined;           // 派发线程已是虚拟时间的参与者
+    uint8_t clock_hold;             // 请求已入队但派发线程尚未join, 替它hold住虚拟时间
+    uint8_t clock_wake;             // 虚拟时间下派发线程睡在时钟上等待hold到期, 置位后唤醒它
+};
+
+
+uint64_t sha204_sched_now_us(void) {
+    return sha204_clock_now_us();
+}
+
+
+static uint16_t sched_cost_ms(const struct sha204_sched_req *r) {
+    return r->job ? r->job_cost_ms : sha204_request_cost_ms(&r->req);
+}
+
+
+// 从链表中摘除r, prev为r的前驱(r为表头时为NULL)
+static void sched_unlink(struct sha204_sched *s, uint8_t prio,
+                         struct sha204_sched_req *prev, struct sha204_sched_req *r) {
+    if (prev) prev->next = r->next;
+    else s->head[prio] = r->next;
+    if (s->tail[prio] == r) s->tail[prio] = prev;
+    r->next = NULL;
+    s->n_queued--;
+}
+
+
+// 取出下一条要派发的请求: 最高优先级类中截止时间最早的一条, 同截止时间按提交顺序
+// 器件为某个owner保留时只考虑该owner的请求; 比保留更优先的其他请求到达时放弃保留
+static struct sha204_sched_req *sched_pick(struct sha204_sched *s) {
+    for (uint8_t prio = 0; prio < SHA204_PRIO_COUNT; ++prio) {
+        struct sha204_sched_req *best = NULL, *best_prev = NULL, *prev = NULL;
+
+        if (s->owner && prio < s->owner_prio) {
+            for (struct sha204_sched_req *r = s->head[prio]; r && s->owner; r = r->next)
+                if (r->owner != s->owner) s->owner = NULL;
+        }
+        for (struct sha204_sched_req *r = s->head[prio]; r; prev = r, r = r->next) {
+            if (s->owner && r->owner != s->owner)
+                continue;
+            if (!best || (r->deadline_us && (!best->deadline_us || r->deadline_us < best->deadline_us))) {
+                best = r;
+                best_prev = prev;
+            }
+        }
+        if (best) {
+            sched_unlink(s, prio, best_prev, best);
+            return best;
+        }
+    }
+    return NULL;
+}
+
+
+// 请求结束, 在sha204_sched_wait中等待它的参与者醒来并重新join之前替它hold住虚拟时间. 调用时持有lock
+static void sched_finish(struct sha204_sched_req *r, uint8_t state) {
+    if (r->clock_wait == 1) {
+        r->clock_wait = 2;
+        sha204_clock_hold();
+    }
+    r->state = state;
+}
+
+
+static void sched_complete(struct sha204_sched *s, struct sha204_sched_req *r, uint8_t status) {
+    sha204_sched_done on_complete = r->on_complete;
+    void *complete_arg = r->complete_arg;
+
+    r->req.status = status;
+    r->finish_us = sha204_sched_now_us();
+
+    pthread_mutex_lock(&s->lock);
+    if (r->owner && r->hold && status == SHA204_SUCCESS) {
+        s->owner = r->owner;
+        s->owner_prio = r->prio;
+        s->hold_until_us = r->finish_us + SHA204_SCHED_HOLD_MS * 1000ULL;
+    } else if (s->owner == r->owner) {
+        s->owner = NULL;
+    }
+    sched_finish(r, SHA204_REQ_DONE);
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+
+    // 使用完成回调时调用者不会wait, 回调之后不再访问r
+    if (on_complete)
+        on_complete(r, complete_arg);
+}
+
+
+// 派发线程有请求要执行: 参与虚拟时间推进, 替代入队时的hold. 调用时持有lock
+static void sched_clock_join(struct sha204_sched *s) {
+    if (!s->clock_joined) {
+        sha204_clock_join();
+        s->clock_joined = 1;
+    }
+    if (s->clock_hold) {
+        s->clock_hold = 0;
+        sha204_clock_release();
+    }
+}
+
+
+// 派发线程将要等待新请求, 不再阻止虚拟时间推进. 调用时持有lock
+static void sched_clock_leave(struct sha204_sched *s) {
+    if (s->clock_joined) {
+        s->clock_joined = 0;
+        sha204_clock_leave();
+    }
+    if (s->clock_hold && !s->n_queued) {
+        s->clock_hold = 0;
+        sha204_clock_release();
+    }
+}
+
+
+// 唤醒派发线程: 等待新请求时在cond上, 虚拟时间下等待hold到期时在时钟上. 调用时持有lock
+static void sched_signal(struct sha204_sched *s) {
+    pthread_cond_signal(&s->cond);
+    if (sha204_clock_is_virtual()) {
+        __atomic_store_n(&s->clock_wake, 1, __ATOMIC_RELEASE);
+        sha204_clock_notify();
+    }
+}
+
+
+// 等待owner的下一步直到hold_until_us. 调用时持有lock
+static void sched_hold_wait(struct sha204_sched *s) {
+    uint64_t due_us = s->hold_until_us;
+
+    sched_clock_leave(s);
+    if (!sha204_clock_is_virtual()) {
+        // hold_until_us与cond同为CLOCK_MONOTONIC时基
+        struct timespec ts = {
+            .tv_sec = (time_t) (due_us / 1000000),
+            .tv_nsec = (long) (due_us % 1000000) * 1000
+        };
+        pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+        return;
+    }
+
+    // 虚拟时间下到期只能由时钟判断. 排队的其他请求在等保留结束, 不再替它们阻止时间推进
+    if (s->clock_hold) {
+        s->clock_hold = 0;
+        sha204_clock_release();
+    }
+    __atomic_store_n(&s->clock_wake, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s->lock);
+    sha204_clock_wait_until_us(due_us, &s->clock_wake);
+    pthread_mutex_lock(&s->lock);
+}
+
+
+// 在派发线程上执行一条请求, 期间独占器件
+static uint8_t sched_run(struct sha204_sched *s, struct sha204_sched_req *r, uint16_t cost_ms) {
+    sha204_request_wake(s->fd, &s->awake, cost_ms);
+
+    if (r->job) {
+        uint8_t status = r->job(s->fd, r->job_arg);
+        // 命令序列自行管理唤醒与休眠, 结束后器件状态未知
+        s->awake.awake = 0;
+        return status;
+    }
+
+    return sha204_request_execute(s->fd, &r->req);
+}
+
+
+static void *sched_thread(void *arg) {
+    struct sha204_sched *s = (struct sha204_sched *) arg;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->stop) {
+        struct sha204_sched_req *r = sched_pick(s);
+        if (!r && s->owner) {
+            uint64_t now = sha204_sched_now_us();
+            if (now < s->hold_until_us) {
+                // 等待owner的下一步, 器件idle以保留TempKey并停止看门狗
+                if (s->awake.awake) {
+                    pthread_mutex_unlock(&s->lock);
+                    sha204_request_idle(s->fd, &s->awake);
+                    pthread_mutex_lock(&s->lock);
+                    continue;
+                }
+                sched_hold_wait(s);
+                continue;
+            }
+            // owner超时未提交, 释放器件
+            s->owner = NULL;
+            continue;
+        }
+        if (!r) {
+            // 队列已空, 让器件休眠
+            if (s->awake.awake) {
+                pthread_mutex_unlock(&s->lock);
+                sha204_request_sleep(s->fd, &s->awake);
+                pthread_mutex_lock(&s->lock);
+                continue;
+            }
+            sched_clock_leave(s);
+            pthread_cond_wait(&s->cond, &s->lock);
+            continue;
+        }
+
+        // 虚拟时间下有请求时参与推进, 多个器件的执行时间相互重叠; 队列空时才退出
+        sched_clock_join(s);
+        r->state = SHA204_REQ_RUNNING;
+        pthread_mutex_unlock(&s->lock);
+
+        uint16_t cost_ms = sched_cost_ms(r);
+        r->start_us = sha204_sched_now_us();
+        if (r->deadline_us && r->start_us + cost_ms * 1000ULL > r->deadline_us) {
+            // 按最坏执行时间已赶不上截止时间, 不再占用器件
+            sched_complete(s, r, SHA204_TIMEOUT);
+        } else {
+            sched_complete(s, r, sched_run(s, r, cost_ms));
+        }
+
+        pthread_mutex_lock(&s->lock);
+    }
+    sched_clock_leave(s);
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+
+/** \brief 创建器件的调度器并启动派发线程
+ *
+ * \param[in] fd file description
+ * \return 调度器, 失败返回NULL
+ */
+struct sha204_sched *sha204_sched_create(int fd) {
+    struct sha204_sched *s = (struct sha204_sched *) calloc(1, sizeof(*s));
+    if (!s) return NULL;
+
+    s->fd = fd;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&s->done, NULL);
+
+    if (pthread_create(&s->thread, NULL, sched_thread, s) != 0) {
+        printf("FAILED! sha204_sched_create\n");
+        pthread_cond_destroy(&s->done);
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+
+/** \brief 停止派发线程并释放调度器. 仍在排队的请求以取消状态、SHA204_FUNC_FAIL结束,
+ *         设置了完成回调的请求照常回调, 调用者借此回收请求
+ */
+void sha204_sched_destroy(struct sha204_sched *s) {
+    struct sha204_sched_req *cancelled = NULL, **tail = &cancelled;
+
+    if (!s) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    sched_signal(s);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < SHA204_PRIO_COUNT; ++i) {
+        while (s->head[i]) {
+            struct sha204_sched_req *r = s->head[i];
+            sched_unlink(s, i, NULL, r);
+            r->req.status = SHA204_FUNC_FAIL;
+            r->finish_us = sha204_sched_now_us();
+            if (r->on_complete) {
+                *tail = r;
+                tail = &r->next;
+            }
+            sched_finish(r, SHA204_REQ_CANCELLED);
+        }
+    }
+    sched_clock_leave(s);
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+
+    // 回调可能释放请求, 先取出next; 不持有lock, 与派发线程上的回调一致
+    while (cancelled) {
+        struct sha204_sched_req *r = cancelled;
+        cancelled = r->next;
+        r->next = NULL;
+        r->on_complete(r, r->complete_arg);
+    }
+
+    sha204_request_sleep(s->fd, &s->awake);
+
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+
+/** \brief 初始化调度请求的公共字段, 命令本身用sha204_request_init填充或设置job
+ *
+ * \param[out] r          调度请求
+ * \param[in]  prio       enum sha204_sched_class
+ * \param[in]  timeout_ms 相对当前时间的截止时间, 0表示不限
+ */
+void sha204_sched_req_init(struct sha204_sched_req *r, uint8_t prio, uint32_t timeout_ms) {
+    memset(r, 0, sizeof(*r));
+    r->prio = prio;
+    r->deadline_us = timeout_ms ? sha204_sched_now_us() + timeout_ms * 1000ULL : 0;
+    r->state = SHA204_REQ_IDLE;
+}
+
+
+/** \brief 设置排队上限. 达到上限后非紧急请求在提交时直接拒绝, 紧急请求不受限制
+ *
+ * \param[in] max_queued 排队上限, 0表示不限
+ */
+void sha204_sched_set_limit(struct sha204_sched *s, uint32_t max_queued) {
+    pthread_mutex_lock(&s->lock);
+    s->max_queued = max_queued;
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/** \brief 提交请求, 立即返回
+ *
+ * \return SHA204_SUCCESS已入队; SHA204_BAD_PARAM参数错误或请求尚未结束; SHA204_QUEUE_FULL排队已达上限
+ */
+uint8_t sha204_sched_submit(struct sha204_sched *s, struct sha204_sched_req *r) {
+    if (!s || !r || r->prio >= SHA204_PRIO_COUNT
+        || r->state == SHA204_REQ_QUEUED || r->state == SHA204_REQ_RUNNING)
+        return SHA204_BAD_PARAM;
+
+    r->next = NULL;
+    r->clock_wait = 0;
+    r->req.status = SHA204_FUNC_FAIL;
+    r->submit_us = sha204_sched_now_us();
+    r->start_us = r->finish_us = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->max_queued && s->n_queued >= s->max_queued && r->prio != SHA204_PRIO_URGENT) {
+        pthread_mutex_unlock(&s->lock);
+        r->req.status = SHA204_QUEUE_FULL;
+        return SHA204_QUEUE_FULL;
+    }
+    s->n_queued++;
+    r->state = SHA204_REQ_QUEUED;
+    if (!s->clock_joined && !s->clock_hold && sha204_clock_is_virtual()) {
+        // 派发线程被唤醒之前虚拟时间不能推进, 否则请求的开始时间被推后
+        s->clock_hold = 1;
+        sha204_clock_hold();
+    }
+    if (s->tail[r->prio]) s->tail[r->prio]->next = r;
+    else s->head[r->prio] = r;
+    s->tail[r->prio] = r;
+    sched_signal(s);
+    pthread_mutex_unlock(&s->lock);
+
+    return SHA204_SUCCESS;
+}
+
+
+/** \brief 取消仍在排队的请求. 已开始执行的命令无法中止
+ *
+ * \return SHA204_SUCCESS已取消; SHA204_FUNC_FAIL请求不在队列中
+ */
+uint8_t sha204_sched_cancel(struct sha204_sched *s, struct sha204_sched_req *r) {
+    uint8_t ret = SHA204_FUNC_FAIL;
+
+    pthread_mutex_lock(&s->lock);
+    if (r->state == SHA204_REQ_QUEUED) {
+        struct sha204_sched_req *prev = NULL;
+        for (struct sha204_sched_req *p = s->head[r->prio]; p; prev = p, p = p->next) {
+            if (p == r) {
+                sched_unlink(s, r->prio, prev, r);
+                r->req.status = SHA204_FUNC_FAIL;
+                sched_finish(r, SHA204_REQ_CANCELLED);
+                if (!s->clock_joined) sched_clock_leave(s);
+                pthread_cond_broadcast(&s->done);
+                ret = SHA204_SUCCESS;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+
+/** \brief 提前结束为owner保留器件, 例如提交者退出时
+ */
+void sha204_sched_release(struct sha204_sched *s, const void *owner) {
+    pthread_mutex_lock(&s->lock);
+    if (owner && s->owner == owner) {
+        s->owner = NULL;
+        sched_signal(s);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/** \brief 等待请求完成或被取消, 不能与完成回调同时使用.
+ *         调用线程是虚拟时间的参与者时, 等待期间leave, 返回前重新join
+ *
+ * \return 请求的执行结果
+ */
+uint8_t sha204_sched_wait(struct sha204_sched *s, struct sha204_sched_req *r) {
+    uint8_t joined = sha204_clock_joined();
+
+    pthread_mutex_lock(&s->lock);
+    if (joined && (r->state == SHA204_REQ_QUEUED || r->state == SHA204_REQ_RUNNING)) {
+        r->clock_wait = 1;
+        sha204_clock_leave();
+    }
+    while (r->state == SHA204_REQ_QUEUED || r->state == SHA204_REQ_RUNNING)
+        pthread_cond_wait(&s->done, &s->lock);
+    uint8_t clock_wait = r->clock_wait;
+    r->clock_wait = 0;
+    pthread_mutex_unlock(&s->lock);
+
+    if (clock_wait) {
+        sha204_clock_join();
+        if (clock_wait == 2) sha204_clock_release();
+    }
+
+    return r->req.status;
+}
+
+
+/** \brief 提交请求并等待完成
+ */
+uint8_t sha204_sched_execute(struct sha204_sched *s, struct sha204_sched_req *r) {
+    uint8_t status = sha204_sched_submit(s, r);
+    if (status != SHA204_SUCCESS) return status;
+
+    return sha204_sched_wait(s, r);
+}
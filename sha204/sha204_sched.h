@@ -0,0 +1,101 @@
+/*
+ * sha204_sched.h
+ *
+ * 单个加密芯片的请求调度器.
+ *
+ * 同一颗芯片既要处理时延敏感的认证(MAC/CheckMac), 又要处理后台任务(Random预取, 读slot, 校验配置).
+ * 调度器为每个器件维护一个派发线程, 按优先级分类排队, 同类内按截止时间先后(EDF)派发.
+ * 芯片命令无法抢占, 因此一条紧急请求最多等待一条正在执行的后台命令.
+ * 派发前用 *_EXEC_MAX 估算完成时间, 赶不上截止时间的请求直接以SHA204_TIMEOUT完成, 不再占用芯片.
+ *
+ * 带hold标记的请求完成后, 器件只派发同一owner的请求, 期间器件idle而不sleep, TempKey保持有效.
+ * owner的一条不带hold的请求完成, 或SHA204_SCHED_HOLD_MS内未再提交时释放.
+ * 其他提交者的更高优先级请求(例如后台序列保留期间到达的紧急认证)到达时保留立即结束, 该请求照常派发;
+ * 被打断的owner的TempKey随之失效, 其后续依赖TempKey的命令由芯片返回执行错误, 需从头重做序列.
+ *
+ * 虚拟时间(sha204_clock)下保留按虚拟时间到期. owner在join了时钟的线程上提交并等待时, 它算作参与者,
+ * 等待期间自动leave, 请求完成到它返回之间时间不推进, 所以它的下一步总在保留期内到达.
+ */
+
+#ifndef SHA204_SCHED_H
+#   define SHA204_SCHED_H
+
+#include <stdint.h>
+
+#include "sha204_request.h"
+
+//! 优先级分类, 数值越小越优先
+enum sha204_sched_class {
+    SHA204_PRIO_URGENT = 0,         //!< 认证等时延敏感请求
+    SHA204_PRIO_NORMAL,             //!< 普通请求
+    SHA204_PRIO_BACKGROUND,         //!< 后台请求: 随机数预取, 盘点读slot, 配置校验
+    SHA204_PRIO_COUNT
+};
+
+//! 请求状态
+enum sha204_sched_state {
+    SHA204_REQ_IDLE = 0,
+    SHA204_REQ_QUEUED,
+    SHA204_REQ_RUNNING,
+    SHA204_REQ_DONE,
+    SHA204_REQ_CANCELLED
+};
+
+//! hold期间等待owner提交下一步的最长时间(ms)
+#define SHA204_SCHED_HOLD_MS        (200)
+
+struct sha204_sched;
+struct sha204_sched_req;
+
+//! 命令序列回调, 在派发线程上执行, 期间独占器件. 返回值写入req.status
+typedef uint8_t (*sha204_sched_job)(int fd, void *arg);
+
+//! 完成回调, 在派发线程上执行, 不能阻塞; sha204_sched_destroy取消的请求在销毁者的线程上回调
+typedef void (*sha204_sched_done)(struct sha204_sched_req *r, void *arg);
+
+/**
+ * \brief 调度请求. 内存由调用者持有, 在完成或取消之前不能释放.
+ */
+struct sha204_sched_req {
+    struct sha204_request req;      //!< 单条命令, job为NULL时执行
+    sha204_sched_job job;           //!< 非NULL时执行命令序列(例如Nonce+MAC), 忽略req中的命令
+    void *job_arg;                  //!< job参数
+    uint16_t job_cost_ms;           //!< job在器件上的最坏执行时间, 一般为各命令 *_EXEC_MAX 之和
+    uint8_t prio;                   //!< enum sha204_sched_class
+    uint64_t deadline_us;           //!< 截止时间(sha204_sched_now_us时基), 0表示不限
+    sha204_sched_done on_complete;  //!< 完成回调, 可以为NULL
+    void *complete_arg;             //!< 完成回调参数
+    const void *owner;              //!< 提交者标识, 配合hold使用, 可以为NULL
+    uint8_t hold;                   //!< 完成后继续为owner保留器件, 用于Nonce/GenDig/MAC等依赖TempKey的多步序列
+
+    // 以下由调度器维护
+    volatile uint8_t state;         //!< enum sha204_sched_state
+    uint8_t clock_wait;             //!< 1: join了时钟的线程在sha204_sched_wait中; 2: 已替它hold住虚拟时间
+    uint64_t submit_us;             //!< 提交时间
+    uint64_t start_us;              //!< 开始执行时间
+    uint64_t finish_us;             //!< 完成时间
+    struct sha204_sched_req *next;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_sched *sha204_sched_create(int fd);
+void sha204_sched_destroy(struct sha204_sched *s);
+
+uint64_t sha204_sched_now_us(void);
+
+void sha204_sched_req_init(struct sha204_sched_req *r, uint8_t prio, uint32_t timeout_ms);
+void sha204_sched_set_limit(struct sha204_sched *s, uint32_t max_queued);
+uint8_t sha204_sched_submit(struct sha204_sched *s, struct sha204_sched_req *r);
+uint8_t sha204_sched_cancel(struct sha204_sched *s, struct sha204_sched_req *r);
+void sha204_sched_release(struct sha204_sched *s, const void *owner);
+uint8_t sha204_sched_wait(struct sha204_sched *s, struct sha204_sched_req *r);
+uint8_t sha204_sched_execute(struct sha204_sched *s, struct sha204_sched_req *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,922 @@
+/*
+ * sha204_sim.c
+ *
+ * ATSHA204A器件模型: 区域映像 + 访问规则 + TempKey状态机, 通过sha204p_attach代替i2c-dev.
+ */
+
+#include "sha204_sim.h"
+#include "atsha204_i2c.h"
+#include "sha204_comm.h"
+#include "sha204_comm_marshaling.h"
+#include "sha204_helper.h"
+#include "sha204_lib_return_codes.h"
+#include "sha204_clock.h"
+#include "sha256.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#define SIM_IMAGE_MAGIC         "SHA204S1"
+
+// config区字节偏移
+#define SIM_CFG_SIZE            (88)
+#define SIM_CFG_RW_BEGIN        (16)        // 0~15: SN, RevNum等只读字节
+#define SIM_CFG_OTP_MODE        (18)
+#define SIM_CFG_SLOT_CONFIG     (20)
+#define SIM_CFG_USE_FLAG        (52)        // slot 0~7的UseFlag/UpdateCount
+#define SIM_CFG_LAST_KEY_USE    (68)
+#define SIM_CFG_USER_EXTRA      (84)        // 84~87只能由UpdateExtra/Lock修改
+#define SIM_CFG_LOCK_VALUE      (86)
+#define SIM_CFG_LOCK_CONFIG     (87)
+
+#define SIM_UNLOCKED            (0x55)      // LockValue/LockConfig未锁定
+#define SIM_OTP_CONSUMPTION     (0x55)      // OTPmode: 锁定后只能把1写成0
+#define SIM_OTP_SIZE            (64)
+#define SIM_SLOT_COUNT          (16)
+#define SIM_SLOT_SIZE           (32)
+
+// SlotConfig位定义
+#define SIM_SLOT_READ_KEY(sc)   ((sc) & 0x0F)
+#define SIM_SLOT_CHECK_ONLY     (0x0010)    // 只能用于CheckMac
+#define SIM_SLOT_SINGLE_USE     (0x0020)    // slot 0~7每次使用消耗UseFlag的一位
+#define SIM_SLOT_ENCRYPT_READ   (0x0040)    // 与IsSecret同时置位时只能加密读
+#define SIM_SLOT_IS_SECRET      (0x0080)    // 禁止明文读
+#define SIM_SLOT_WRITE_KEY(sc)  (((sc) >> 8) & 0x0F)
+#define SIM_SLOT_DERIVE_CREATE  (0x1000)    // WriteConfig bit0: DeriveKey以WriteKey为父密钥, 否则roll
+#define SIM_SLOT_DERIVE_ENABLE  (0x2000)    // WriteConfig bit1: 允许DeriveKey
+#define SIM_SLOT_WRITE_ENCRYPT  (0x4000)    // WriteConfig bit2: 只能加密写(带MAC)
+#define SIM_SLOT_WRITE_NEVER    (0x8000)    // WriteConfig bit3: 禁止Write; DeriveKey需要输入MAC
+
+#define SIM_STATUS_MISCOMPARE   ((uint8_t) 0x01)    // CheckMac比较失败
+
+// I2C字地址
+enum sim_word_address {
+    SIM_WORD_RESET,
+    SIM_WORD_SLEEP,
+    SIM_WORD_IDLE,
+    SIM_WORD_NORMAL
+};
+
+enum sim_power {
+    SIM_SLEEP = 0,
+    SIM_IDLE,
+    SIM_AWAKE
+};
+
+// EEPROM映像, mmap到文件
+struct sha204_sim_image {
+    char magic[8];
+    uint8_t config[SIM_CFG_SIZE];
+    uint8_t otp[SIM_OTP_SIZE];
+    uint8_t data[SIM_SLOT_COUNT][SIM_SLOT_SIZE];
+    uint8_t seed[32];                       // 随机数种子, Nonce/Random模式0时更新
+};
+
+struct sha204_sim {
+    int fd;                                 // 交给上层使用的fd, 只作标识
+    int image_fd;                           // -1: 匿名映像
+    struct sha204_sim_image *img;
+    pthread_mutex_t lock;
+
+    uint8_t power;                          // enum sim_power
+    uint8_t timing;                         // 是否模拟执行时间
+    uint64_t wake_us;                       // 最近一次唤醒的时间, 看门狗起点
+    uint64_t busy_until_us;                 // 执行结束时间, 之前读写NACK
+    uint64_t rng_counter;
+    struct sha204h_temp_key temp_key;
+
+    uint8_t rsp[SHA204_RSP_SIZE_MAX];       // 输出缓冲
+    uint8_t rsp_len;                        // 0: 没有可读的响应
+    uint8_t rsp_pos;                        // 读指针, reset字地址归零
+};
+
+
+static int sim_nack(void) {
+    errno = EREMOTEIO;
+    return -1;
+}
+
+
+static uint8_t sim_config_locked(const struct sha204_sim *sim) {
+    return sim->img->config[SIM_CFG_LOCK_CONFIG] != SIM_UNLOCKED;
+}
+
+
+static uint8_t sim_data_locked(const struct sha204_sim *sim) {
+    return sim->img->config[SIM_CFG_LOCK_VALUE] != SIM_UNLOCKED;
+}
+
+
+static uint16_t sim_slot_config(const struct sha204_sim *sim, uint8_t slot) {
+    const uint8_t *p = &sim->img->config[SIM_CFG_SLOT_CONFIG + 2 * slot];
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+
+// SN[0:3]在config 0~3, SN[4:8]在config 8~12
+static void sim_sn(const struct sha204_sim *sim, uint8_t sn[9]) {
+    memcpy(sn, &sim->img->config[0], 4);
+    memcpy(sn + 4, &sim->img->config[8], 5);
+}
+
+
+// SingleUse的slot用完UseFlag后拒绝使用
+static uint8_t sim_key_check(const struct sha204_sim *sim, uint8_t slot) {
+    if ((sim_slot_config(sim, slot) & SIM_SLOT_SINGLE_USE) && slot < 8
+        && sim->img->config[SIM_CFG_USE_FLAG + 2 * slot] == 0)
+        return SHA204_STATUS_BYTE_EXEC;
+    return SHA204_SUCCESS;
+}
+
+
+static void sim_key_consume(struct sha204_sim *sim, uint8_t slot) {
+    if ((sim_slot_config(sim, slot) & SIM_SLOT_SINGLE_USE) && slot < 8)
+        sim->img->config[SIM_CFG_USE_FLAG + 2 * slot] >>= 1;
+}
+
+
+// 不提前退出的比较
+static uint8_t sim_equal(const uint8_t *a, const uint8_t *b, uint8_t len) {
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < len; ++i) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+
+// 区域地址对应的映像字节, 地址越界返回NULL
+static uint8_t *sim_zone_ptr(struct sha204_sim *sim, uint8_t zone, uint16_t addr, uint8_t size) {
+    uint8_t *base;
+    uint16_t mask, zone_size, offset;
+
+    switch (zone) {
+    case SHA204_ZONE_CONFIG:
+        base = sim->img->config;
+        mask = SHA204_ADDRESS_MASK_CONFIG;
+        zone_size = SIM_CFG_SIZE;
+        break;
+    case SHA204_ZONE_OTP:
+        base = sim->img->otp;
+        mask = SHA204_ADDRESS_MASK_OTP;
+        zone_size = SIM_OTP_SIZE;
+        break;
+    case SHA204_ZONE_DATA:
+        base = sim->img->data[0];
+        mask = SHA204_ADDRESS_MASK;
+        zone_size = sizeof(sim->img->data);
+        break;
+    default:
+        return NULL;
+    }
+
+    if (addr & ~mask) return NULL;
+    // 32字节访问: 地址bit3以上为块号; 4字节访问: 地址为字号
+    offset = (size == SHA204_ZONE_ACCESS_32) ? (addr >> 3) * SHA204_ZONE_ACCESS_32 : addr * SHA204_ZONE_ACCESS_4;
+    if (offset + size > zone_size) return NULL;
+
+    return base + offset;
+}
+
+
+// config区锁定前与真实器件一样输出ff ff 00 00测试图样
+static void sim_random(struct sha204_sim *sim, uint8_t update_seed, uint8_t out[32]) {
+    uint8_t msg[40];
+
+    if (!sim_config_locked(sim)) {
+        for (uint8_t i = 0; i < 32; ++i) out[i] = (i & 2) ? 0x00 : 0xFF;
+        return;
+    }
+
+    memcpy(msg, sim->img->seed, 32);
+    for (uint8_t i = 0; i < 8; ++i) msg[32 + i] = (uint8_t) (sim->rng_counter >> (8 * i));
+    sim->rng_counter++;
+    sha256(msg, sizeof(msg), out);
+
+    if (update_seed) {
+        memcpy(msg + 32, out, 8);
+        sha256(msg, sizeof(msg), sim->img->seed);
+    }
+}
+
+
+static uint8_t sim_cmd_read(struct sha204_sim *sim, uint8_t *pkt, uint16_t param2, uint8_t *out, uint8_t *out_len) {
+    uint8_t zone = pkt[READ_ZONE_IDX];
+    uint8_t size = (zone & READ_ZONE_MODE_32_BYTES) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+    struct sha204h_temp_key *tk = &sim->temp_key;
+    uint8_t *p;
+    uint16_t sc;
+
+    if (pkt[SHA204_COUNT_IDX] != READ_COUNT || (zone & ~READ_ZONE_MASK)) return SHA204_STATUS_BYTE_PARSE;
+    p = sim_zone_ptr(sim, zone & SHA204_ZONE_MASK, param2, size);
+    if (!p) return SHA204_STATUS_BYTE_PARSE;
+
+    switch (zone & SHA204_ZONE_MASK) {
+    case SHA204_ZONE_OTP:
+        if (!sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        break;
+    case SHA204_ZONE_DATA:
+        if (!sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        sc = sim_slot_config(sim, (uint8_t) (param2 >> 3));
+        if (!(sc & SIM_SLOT_IS_SECRET)) break;
+        if (!(sc & SIM_SLOT_ENCRYPT_READ) || size != SHA204_ZONE_ACCESS_32) return SHA204_STATUS_BYTE_EXEC;
+
+        // 加密读: TempKey须由GenDig(ReadKey)生成, 输出为明文异或TempKey
+        if (!tk->valid || tk->check_flag || !tk->gen_data || tk->source_flag
+            || tk->key_id != SIM_SLOT_READ_KEY(sc))
+            return SHA204_STATUS_BYTE_EXEC;
+        for (uint8_t i = 0; i < SHA204_ZONE_ACCESS_32; ++i) out[i] = p[i] ^ tk->value[i];
+        *out_len = SHA204_ZONE_ACCESS_32;
+        return SHA204_SUCCESS;
+    default:
+        break;
+    }
+
+    memcpy(out, p, size);
+    *out_len = size;
+    return SHA204_SUCCESS;
+}
+
+
+// 加密写: 解密后按sha204h_encrypt重算输入MAC并比较
+static uint8_t sim_write_encrypted(struct sha204_sim *sim, uint8_t zone, uint16_t addr, uint8_t *p,
+                                   const uint8_t *value, const uint8_t *mac) {
+    struct sha204h_temp_key *tk = &sim->temp_key;
+    uint8_t clear[SHA204_ZONE_ACCESS_32], scratch[SHA204_ZONE_ACCESS_32], expected[WRITE_MAC_SIZE];
+    struct sha204h_encrypt_in_out param = {
+        .zone = zone, .address = addr, .data = scratch, .mac = expected, .temp_key = tk
+    };
+    uint8_t ok;
+
+    for (uint8_t i = 0; i < SHA204_ZONE_ACCESS_32; ++i) clear[i] = value[i] ^ tk->value[i];
+    memcpy(scratch, clear, sizeof(scratch));
+    ok = sha204h_encrypt(param) == SHA204_SUCCESS && sim_equal(expected, mac, WRITE_MAC_SIZE);
+    tk->valid = 0;
+    if (!ok) return SHA204_STATUS_BYTE_EXEC;
+
+    memcpy(p, clear, SHA204_ZONE_ACCESS_32);
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_write(struct sha204_sim *sim, uint8_t *pkt, uint16_t param2) {
+    uint8_t zone = pkt[WRITE_ZONE_IDX];
+    uint8_t size = (zone & SHA204_ZONE_COUNT_FLAG) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+    uint8_t data_len = pkt[SHA204_COUNT_IDX] - SHA204_CMD_SIZE_MIN;
+    const uint8_t *value = &pkt[WRITE_VALUE_IDX];
+    const uint8_t *mac = NULL;
+    uint8_t *p;
+    uint16_t offset, sc;
+
+    if (zone & ~WRITE_ZONE_MASK) return SHA204_STATUS_BYTE_PARSE;
+    if (data_len == size + WRITE_MAC_SIZE) mac = value + size;
+    else if (data_len != size) return SHA204_STATUS_BYTE_PARSE;
+    p = sim_zone_ptr(sim, zone & SHA204_ZONE_MASK, param2, size);
+    if (!p) return SHA204_STATUS_BYTE_PARSE;
+
+    switch (zone & SHA204_ZONE_MASK) {
+    case SHA204_ZONE_CONFIG:
+        offset = (uint16_t) (p - sim->img->config);
+        if (sim_config_locked(sim) || mac || offset < SIM_CFG_RW_BEGIN || offset + size > SIM_CFG_USER_EXTRA)
+            return SHA204_STATUS_BYTE_EXEC;
+        break;
+
+    case SHA204_ZONE_OTP:
+        if (!sim_data_locked(sim)) break;
+        if (sim->img->config[SIM_CFG_OTP_MODE] != SIM_OTP_CONSUMPTION || mac) return SHA204_STATUS_BYTE_EXEC;
+        for (uint8_t i = 0; i < size; ++i) p[i] &= value[i];
+        return SHA204_SUCCESS;
+
+    default:
+        if (!sim_data_locked(sim)) {
+            if (mac) return SHA204_STATUS_BYTE_EXEC;
+            break;
+        }
+        sc = sim_slot_config(sim, (uint8_t) (param2 >> 3));
+        if (sc & SIM_SLOT_WRITE_NEVER) return SHA204_STATUS_BYTE_EXEC;
+        if (sc & SIM_SLOT_WRITE_ENCRYPT) {
+            if (!mac || size != SHA204_ZONE_ACCESS_32 || sim->temp_key.key_id != SIM_SLOT_WRITE_KEY(sc))
+                return SHA204_STATUS_BYTE_EXEC;
+            return sim_write_encrypted(sim, zone, param2, p, value, mac);
+        }
+        if (mac) return SHA204_STATUS_BYTE_EXEC;
+        break;
+    }
+
+    memcpy(p, value, size);
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_lock(struct sha204_sim *sim, uint8_t *pkt, uint16_t param2) {
+    uint8_t zone = pkt[LOCK_ZONE_IDX];
+    uint8_t crc[SHA204_CRC_SIZE] = {0, 0};
+    uint8_t *lock_byte;
+
+    if (pkt[SHA204_COUNT_IDX] != LOCK_COUNT || (zone & ~LOCK_ZONE_MASK)) return SHA204_STATUS_BYTE_PARSE;
+
+    if (zone & LOCK_ZONE_NO_CONFIG) {
+        // data区与OTP区一起锁定, 摘要依次覆盖data区和OTP区
+        if (!sim_config_locked(sim) || sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        for (uint8_t slot = 0; slot < SIM_SLOT_COUNT; ++slot)
+            sha204h_calculate_crc_chain(SIM_SLOT_SIZE, sim->img->data[slot], crc);
+        sha204h_calculate_crc_chain(SIM_OTP_SIZE, sim->img->otp, crc);
+        lock_byte = &sim->img->config[SIM_CFG_LOCK_VALUE];
+    } else {
+        if (sim_config_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        sha204h_calculate_crc_chain(SIM_CFG_SIZE, sim->img->config, crc);
+        lock_byte = &sim->img->config[SIM_CFG_LOCK_CONFIG];
+    }
+
+    if (!(zone & LOCK_ZONE_NO_CRC) && param2 != (uint16_t) (crc[0] | (crc[1] << 8))) return SHA204_STATUS_BYTE_EXEC;
+
+    *lock_byte = 0x00;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_nonce(struct sha204_sim *sim, uint8_t *pkt, uint8_t *out, uint8_t *out_len) {
+    uint8_t mode = pkt[NONCE_MODE_IDX];
+    struct sha204h_nonce_in_out param = {
+        .mode = mode, .num_in = &pkt[NONCE_INPUT_IDX], .rand_out = out, .temp_key = &sim->temp_key
+    };
+
+    if ((mode & ~NONCE_MODE_MASK) || mode == NONCE_MODE_INVALID) return SHA204_STATUS_BYTE_PARSE;
+
+    if (mode == NONCE_MODE_PASSTHROUGH) {
+        if (pkt[SHA204_COUNT_IDX] != NONCE_COUNT_LONG) return SHA204_STATUS_BYTE_PARSE;
+        param.rand_out = NULL;
+        return sha204h_nonce(param) == SHA204_SUCCESS ? SHA204_SUCCESS : SHA204_STATUS_BYTE_EXEC;
+    }
+
+    if (pkt[SHA204_COUNT_IDX] != NONCE_COUNT_SHORT) return SHA204_STATUS_BYTE_PARSE;
+    sim_random(sim, mode == NONCE_MODE_SEED_UPDATE, out);
+    if (sha204h_nonce(param) != SHA204_SUCCESS) return SHA204_STATUS_BYTE_EXEC;
+
+    *out_len = 32;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_random(struct sha204_sim *sim, uint8_t *pkt, uint8_t *out, uint8_t *out_len) {
+    uint8_t mode = pkt[RANDOM_MODE_IDX];
+
+    if (pkt[SHA204_COUNT_IDX] != RANDOM_COUNT || mode > RANDOM_NO_SEED_UPDATE) return SHA204_STATUS_BYTE_PARSE;
+
+    sim_random(sim, mode == RANDOM_SEED_UPDATE, out);
+    *out_len = 32;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_mac(struct sha204_sim *sim, uint8_t *pkt, uint16_t key_id, uint8_t *out, uint8_t *out_len) {
+    uint8_t mode = pkt[MAC_MODE_IDX];
+    uint8_t challenge = !(mode & MAC_MODE_BLOCK2_TEMPKEY);
+    uint8_t use_key = !(mode & MAC_MODE_BLOCK1_TEMPKEY);
+    uint8_t sn[9];
+    uint8_t status;
+
+    if ((mode & ~MAC_MODE_MASK) || key_id > SHA204_KEY_ID_MAX
+        || pkt[SHA204_COUNT_IDX] != (challenge ? MAC_COUNT_LONG : MAC_COUNT_SHORT))
+        return SHA204_STATUS_BYTE_PARSE;
+    if (use_key) {
+        if (!sim_data_locked(sim) || (sim_slot_config(sim, key_id) & SIM_SLOT_CHECK_ONLY))
+            return SHA204_STATUS_BYTE_EXEC;
+        status = sim_key_check(sim, key_id);
+        if (status != SHA204_SUCCESS) return status;
+    }
+
+    sim_sn(sim, sn);
+    struct sha204h_mac_in_out param = {
+        .mode = mode, .key_id = key_id, .challenge = challenge ? &pkt[MAC_CHALLENGE_IDX] : NULL,
+        .key = sim->img->data[key_id], .otp = sim->img->otp, .sn = sn, .response = out, .temp_key = &sim->temp_key
+    };
+    if (sha204h_mac(param) != SHA204_SUCCESS) return SHA204_STATUS_BYTE_EXEC;
+
+    if (use_key) sim_key_consume(sim, key_id);
+    *out_len = 32;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_hmac(struct sha204_sim *sim, uint8_t *pkt, uint16_t key_id, uint8_t *out, uint8_t *out_len) {
+    uint8_t mode = pkt[HMAC_MODE_IDX];
+    uint8_t sn[9];
+    uint8_t status;
+
+    if (pkt[SHA204_COUNT_IDX] != HMAC_COUNT || (mode & ~HMAC_MODE_MASK) || key_id > SHA204_KEY_ID_MAX)
+        return SHA204_STATUS_BYTE_PARSE;
+    if (!sim_data_locked(sim) || (sim_slot_config(sim, key_id) & SIM_SLOT_CHECK_ONLY))
+        return SHA204_STATUS_BYTE_EXEC;
+    status = sim_key_check(sim, key_id);
+    if (status != SHA204_SUCCESS) return status;
+
+    sim_sn(sim, sn);
+    struct sha204h_hmac_in_out param = {
+        .mode = mode, .key_id = key_id, .key = sim->img->data[key_id],
+        .otp = sim->img->otp, .sn = sn, .response = out, .temp_key = &sim->temp_key
+    };
+    if (sha204h_hmac(param) != SHA204_SUCCESS) return SHA204_STATUS_BYTE_EXEC;
+
+    sim_key_consume(sim, key_id);
+    *out_len = 32;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_gen_dig(struct sha204_sim *sim, uint8_t *pkt, uint16_t key_id) {
+    uint8_t zone = pkt[GENDIG_ZONE_IDX];
+    uint8_t *value;
+    uint8_t status;
+
+    if (pkt[SHA204_COUNT_IDX] != GENDIG_COUNT && pkt[SHA204_COUNT_IDX] != GENDIG_COUNT_DATA)
+        return SHA204_STATUS_BYTE_PARSE;
+
+    switch (zone) {
+    case GENDIG_ZONE_CONFIG:
+        if (key_id > 1) return SHA204_STATUS_BYTE_PARSE;
+        value = &sim->img->config[key_id * 32];
+        break;
+    case GENDIG_ZONE_OTP:
+        if (key_id > SHA204_OTP_BLOCK_MAX) return SHA204_STATUS_BYTE_PARSE;
+        value = &sim->img->otp[key_id * 32];
+        break;
+    case GENDIG_ZONE_DATA:
+        if (key_id > SHA204_KEY_ID_MAX) return SHA204_STATUS_BYTE_PARSE;
+        if (!sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        status = sim_key_check(sim, key_id);
+        if (status != SHA204_SUCCESS) return status;
+        value = sim->img->data[key_id];
+        break;
+    default:
+        return SHA204_STATUS_BYTE_PARSE;
+    }
+
+    struct sha204h_gen_dig_in_out param = {
+        .zone = zone, .key_id = key_id, .stored_value = value, .temp_key = &sim->temp_key
+    };
+    if (sha204h_gen_dig(param) != SHA204_SUCCESS) return SHA204_STATUS_BYTE_EXEC;
+
+    if (zone == GENDIG_ZONE_DATA) sim_key_consume(sim, key_id);
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_cmd_derive_key(struct sha204_sim *sim, uint8_t *pkt, uint16_t target) {
+    uint8_t random = pkt[DERIVE_KEY_RANDOM_IDX];
+    uint8_t count = pkt[SHA204_COUNT_IDX];
+    uint8_t expected[DERIVE_KEY_MAC_SIZE];
+    uint8_t parent;
+    uint16_t sc;
+
+    if ((random & ~DERIVE_KEY_RANDOM_FLAG) || target > SHA204_KEY_ID_MAX
+        || (count != DERIVE_KEY_COUNT_SMALL && count != DERIVE_KEY_COUNT_LARGE))
+        return SHA204_STATUS_BYTE_PARSE;
+    if (!sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+
+    sc = sim_slot_config(sim, target);
+    if (!(sc & SIM_SLOT_DERIVE_ENABLE)) return SHA204_STATUS_BYTE_EXEC;
+    parent = (sc & SIM_SLOT_DERIVE_CREATE) ? SIM_SLOT_WRITE_KEY(sc) : target;
+
+    if (sc & SIM_SLOT_WRITE_NEVER) {
+        struct sha204h_derive_key_mac_in_out mac_param = {
+            .random = random, .target_key_id = target, .parent_key = sim->img->data[parent], .mac = expected
+        };
+        if (count != DERIVE_KEY_COUNT_LARGE || sha204h_derive_key_mac(mac_param) != SHA204_SUCCESS
+            || !sim_equal(expected, &pkt[DERIVE_KEY_MAC_IDX], DERIVE_KEY_MAC_SIZE))
+            return SHA204_STATUS_BYTE_EXEC;
+    }
+
+    struct sha204h_derive_key_in_out param = {
+        .random = random, .target_key_id = target, .parent_key = sim->img->data[parent],
+        .target_key = sim->img->data[target], .temp_key = &sim->temp_key
+    };
+    return sha204h_derive_key(param) == SHA204_SUCCESS ? SHA204_SUCCESS : SHA204_STATUS_BYTE_EXEC;
+}
+
+
+// 没有对应的host helper, 按数据手册拼88字节消息
+static uint8_t sim_cmd_check_mac(struct sha204_sim *sim, uint8_t *pkt, uint16_t key_id) {
+    uint8_t mode = pkt[CHECKMAC_MODE_IDX];
+    const uint8_t *other = &pkt[CHECKMAC_DATA_IDX];
+    struct sha204h_temp_key *tk = &sim->temp_key;
+    uint8_t msg[SHA204_MSG_SIZE_MAC], digest[32];
+    uint8_t *p = msg;
+    uint8_t status;
+
+    if (pkt[SHA204_COUNT_IDX] != CHECKMAC_COUNT || (mode & ~CHECKMAC_MODE_MASK) || key_id > SHA204_KEY_ID_MAX)
+        return SHA204_STATUS_BYTE_PARSE;
+    if (!(mode & CHECKMAC_MODE_BLOCK1_TEMPKEY)) {
+        if (!sim_data_locked(sim)) return SHA204_STATUS_BYTE_EXEC;
+        status = sim_key_check(sim, key_id);
+        if (status != SHA204_SUCCESS) return status;
+    }
+    if ((mode & (CHECKMAC_MODE_BLOCK1_TEMPKEY | CHECKMAC_MODE_BLOCK2_TEMPKEY))
+        && (!tk->valid || tk->check_flag || !(mode & CHECKMAC_MODE_SOURCE_FLAG_MATCH) != !tk->source_flag))
+        return SHA204_STATUS_BYTE_EXEC;
+
+    memcpy(p, (mode & CHECKMAC_MODE_BLOCK1_TEMPKEY) ? tk->value : sim->img->data[key_id], 32);
+    p += 32;
+    memcpy(p, (mode & CHECKMAC_MODE_BLOCK2_TEMPKEY) ? tk->value : &pkt[CHECKMAC_CLIENT_CHALLENGE_IDX], 32);
+    p += 32;
+    memcpy(p, other, 4);
+    p += 4;
+    if (mode & CHECKMAC_MODE_INCLUDE_OTP_64) memcpy(p, sim->img->otp, 8);
+    else memset(p, 0, 8);
+    p += 8;
+    memcpy(p, other + 4, 3);
+    p += 3;
+    *p++ = SHA204_SN_8;
+    memcpy(p, other + 7, 4);
+    p += 4;
+    *p++ = SHA204_SN_0;
+    *p++ = SHA204_SN_1;
+    memcpy(p, other + 11, 2);
+
+    sha256_fixed(msg, SHA204_MSG_SIZE_MAC, digest);
+    if (mode & (CHECKMAC_MODE_BLOCK1_TEMPKEY | CHECKMAC_MODE_BLOCK2_TEMPKEY)) tk->valid = 0;
+
+    if (!sim_equal(digest, &pkt[CHECKMAC_CLIENT_RESPONSE_IDX], CHECKMAC_CLIENT_RESPONSE_SIZE))
+        return SIM_STATUS_MISCOMPARE;
+    if (!(mode & CHECKMAC_MODE_BLOCK1_TEMPKEY)) sim_key_consume(sim, key_id);
+    return SHA204_SUCCESS;
+}
+
+
+// UpdateExtra: 模式0写config 84, 模式1写config 85, 只能写一次
+static uint8_t sim_cmd_update_extra(struct sha204_sim *sim, uint8_t *pkt, uint16_t value) {
+    uint8_t mode = pkt[UPDATE_MODE_IDX];
+    uint8_t *p;
+
+    if (pkt[SHA204_COUNT_IDX] != UPDATE_COUNT || mode > UPDATE_CONFIG_BYTE_86) return SHA204_STATUS_BYTE_PARSE;
+
+    p = &sim->img->config[SIM_CFG_USER_EXTRA + mode];
+    if (!sim_config_locked(sim) || *p != 0) return SHA204_STATUS_BYTE_EXEC;
+
+    *p = (uint8_t) value;
+    return SHA204_SUCCESS;
+}
+
+
+static uint8_t sim_exec_ms(uint8_t op_code) {
+    switch (op_code) {
+    case SHA204_CHECKMAC:     return CHECKMAC_DELAY;
+    case SHA204_DERIVE_KEY:   return DERIVE_KEY_DELAY;
+    case SHA204_DEVREV:       return DEVREV_DELAY;
+    case SHA204_GENDIG:       return GENDIG_DELAY;
+    case SHA204_HMAC:         return HMAC_DELAY;
+    case SHA204_LOCK:         return LOCK_DELAY;
+    case SHA204_MAC:          return MAC_DELAY;
+    case SHA204_NONCE:        return NONCE_DELAY;
+    case SHA204_PAUSE:        return PAUSE_DELAY;
+    case SHA204_RANDOM:       return RANDOM_DELAY;
+    case SHA204_READ:         return READ_DELAY;
+    case SHA204_UPDATE_EXTRA: return UPDATE_DELAY;
+    case SHA204_WRITE:        return WRITE_DELAY;
+    default:                  return 0;
+    }
+}
+
+
+static void sim_respond(struct sha204_sim *sim, const uint8_t *data, uint8_t len) {
+    sim->rsp[SHA204_BUFFER_POS_COUNT] = len + 1 + SHA204_CRC_SIZE;
+    memcpy(&sim->rsp[1], data, len);
+    sha204c_calculate_crc(len + 1, sim->rsp, &sim->rsp[len + 1]);
+    sim->rsp_len = sim->rsp[SHA204_BUFFER_POS_COUNT];
+    sim->rsp_pos = 0;
+}
+
+
+static void sim_power(struct sha204_sim *sim, uint8_t power, uint64_t now) {
+    static const uint8_t wake_rsp = SHA204_STATUS_BYTE_WAKEUP;
+
+    sim->power = power;
+    sim->rsp_len = 0;
+    sim->rsp_pos = 0;
+
+    if (power == SIM_SLEEP) {
+        memset(&sim->temp_key, 0, sizeof(sim->temp_key));
+    } else if (power == SIM_AWAKE) {
+        sim->wake_us = now;
+        sim->busy_until_us = sim->timing ? now + SHA204_SIM_WAKEUP_US : 0;
+        sim_respond(sim, &wake_rsp, 1);
+    }
+}
+
+
+// 执行一个命令包 (count ... CRC), 结果放入输出缓冲
+static void sim_command(struct sha204_sim *sim, const uint8_t *buf, size_t len, uint64_t now) {
+    uint8_t pkt[SHA204_CMD_SIZE_MAX];
+    uint8_t out[32];
+    uint8_t out_len = 0;
+    uint8_t crc[SHA204_CRC_SIZE];
+    uint8_t count = len ? buf[SHA204_COUNT_IDX] : 0;
+    uint8_t status;
+    uint16_t param2;
+
+    if (len < SHA204_CMD_SIZE_MIN || len > SHA204_CMD_SIZE_MAX || count != len) {
+        status = SHA204_STATUS_BYTE_COMM;
+        sim_respond(sim, &status, 1);
+        return;
+    }
+    memcpy(pkt, buf, count);
+    sha204c_calculate_crc(count - SHA204_CRC_SIZE, pkt, crc);
+    if (crc[0] != pkt[count - 2] || crc[1] != pkt[count - 1]) {
+        status = SHA204_STATUS_BYTE_COMM;
+        sim_respond(sim, &status, 1);
+        return;
+    }
+
+    param2 = (uint16_t) (pkt[SHA204_PARAM2_IDX] | (pkt[SHA204_PARAM2_IDX + 1] << 8));
+
+    switch (pkt[SHA204_OPCODE_IDX]) {
+    case SHA204_READ:
+        status = sim_cmd_read(sim, pkt, param2, out, &out_len);
+        break;
+    case SHA204_WRITE:
+        status = sim_cmd_write(sim, pkt, param2);
+        break;
+    case SHA204_LOCK:
+        status = sim_cmd_lock(sim, pkt, param2);
+        break;
+    case SHA204_NONCE:
+        status = sim_cmd_nonce(sim, pkt, out, &out_len);
+        break;
+    case SHA204_RANDOM:
+        status = sim_cmd_random(sim, pkt, out, &out_len);
+        break;
+    case SHA204_MAC:
+        status = sim_cmd_mac(sim, pkt, param2, out, &out_len);
+        break;
+    case SHA204_HMAC:
+        status = sim_cmd_hmac(sim, pkt, param2, out, &out_len);
+        break;
+    case SHA204_GENDIG:
+        status = sim_cmd_gen_dig(sim, pkt, param2);
+        break;
+    case SHA204_DERIVE_KEY:
+        status = sim_cmd_derive_key(sim, pkt, param2);
+        break;
+    case SHA204_CHECKMAC:
+        status = sim_cmd_check_mac(sim, pkt, param2);
+        break;
+    case SHA204_UPDATE_EXTRA:
+        status = sim_cmd_update_extra(sim, pkt, param2);
+        break;
+    case SHA204_DEVREV:
+        if (count != DEVREV_COUNT) {
+            status = SHA204_STATUS_BYTE_PARSE;
+            break;
+        }
+        memcpy(out, &sim->img->config[4], 4);
+        out_len = 4;
+        status = SHA204_SUCCESS;
+        break;
+    case SHA204_PAUSE:
+        if (count != PAUSE_COUNT) {
+            status = SHA204_STATUS_BYTE_PARSE;
+            break;
+        }
+        // 未被选中的器件进入idle, 不返回响应
+        if (pkt[PAUSE_SELECT_IDX] != sim->img->config[SIM_CFG_USER_EXTRA + 1]) {
+            sim_power(sim, SIM_IDLE, now);
+            return;
+        }
+        status = SHA204_SUCCESS;
+        break;
+    default:
+        status = SHA204_STATUS_BYTE_PARSE;
+        break;
+    }
+
+    if (status == SHA204_SUCCESS && out_len) sim_respond(sim, out, out_len);
+    else sim_respond(sim, &status, 1);
+    memset(out, 0, sizeof(out));
+
+    if (sim->timing) sim->busy_until_us = now + sim_exec_ms(pkt[SHA204_OPCODE_IDX]) * 1000ULL;
+}
+
+
+// 看门狗: 唤醒后一直未进入sleep/idle则自行sleep, TempKey丢失
+static void sim_tick(struct sha204_sim *sim, uint64_t now) {
+    if (sim->power == SIM_AWAKE && now - sim->wake_us >= SHA204_SIM_WATCHDOG_MS * 1000ULL)
+        sim_power(sim, SIM_SLEEP, now);
+}
+
+
+static int sim_io_write(void *ctx, const uint8_t *buf, size_t len) {
+    struct sha204_sim *sim = (struct sha204_sim *) ctx;
+    uint64_t now = sha204_clock_now_us();
+
+    pthread_mutex_lock(&sim->lock);
+    sim_tick(sim, now);
+
+    if (sim->power != SIM_AWAKE) {
+        // SDA被拉低即唤醒, 这次写入本身不被应答
+        if (len > 0) sim_power(sim, SIM_AWAKE, now);
+        pthread_mutex_unlock(&sim->lock);
+        return sim_nack();
+    }
+    if (len == 0 || now < sim->busy_until_us) {
+        pthread_mutex_unlock(&sim->lock);
+        return sim_nack();
+    }
+
+    switch (buf[0]) {
+    case SIM_WORD_RESET:
+        sim->rsp_pos = 0;
+        break;
+    case SIM_WORD_SLEEP:
+        sim_power(sim, SIM_SLEEP, now);
+        break;
+    case SIM_WORD_IDLE:
+        sim_power(sim, SIM_IDLE, now);
+        break;
+    case SIM_WORD_NORMAL:
+        sim_command(sim, buf + 1, len - 1, now);
+        break;
+    default:
+        pthread_mutex_unlock(&sim->lock);
+        return sim_nack();
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+    return (int) len;
+}
+
+
+static int sim_io_read(void *ctx, uint8_t *buf, size_t len) {
+    struct sha204_sim *sim = (struct sha204_sim *) ctx;
+    uint64_t now = sha204_clock_now_us();
+
+    pthread_mutex_lock(&sim->lock);
+    sim_tick(sim, now);
+
+    if (sim->power != SIM_AWAKE || now < sim->busy_until_us || sim->rsp_len == 0) {
+        pthread_mutex_unlock(&sim->lock);
+        return sim_nack();
+    }
+
+    // 读过响应末尾时总线上为0xFF
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = sim->rsp_pos < sim->rsp_len ? sim->rsp[sim->rsp_pos++] : 0xFF;
+
+    pthread_mutex_unlock(&sim->lock);
+    return (int) len;
+}
+
+
+static const struct sha204p_transport sim_transport = {
+    .write = sim_io_write,
+    .read = sim_io_read,
+};
+
+
+static void sim_entropy(uint8_t *buf, size_t len) {
+    if (getrandom(buf, len, 0) == (ssize_t) len) return;
+
+    uint64_t x = sha204_clock_now_us() ^ ((uint64_t) getpid() << 32);
+    for (size_t i = 0; i < len; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (uint8_t) (x >> 56);
+    }
+}
+
+
+// 出厂状态: 随机SN, 所有slot明文读写, config/data均未锁定, OTP为消耗模式
+static void sim_factory_init(struct sha204_sim_image *img) {
+    static const uint8_t rev_num[4] = {0x00, 0x09, 0x04, 0x00};
+    uint8_t rnd[6];
+
+    memset(img, 0, sizeof(*img));
+    memcpy(img->magic, SIM_IMAGE_MAGIC, sizeof(img->magic));
+    sim_entropy(rnd, sizeof(rnd));
+    sim_entropy(img->seed, sizeof(img->seed));
+
+    img->config[0] = SHA204_SN_0;
+    img->config[1] = SHA204_SN_1;
+    memcpy(&img->config[2], rnd, 2);
+    memcpy(&img->config[4], rev_num, sizeof(rev_num));
+    memcpy(&img->config[8], rnd + 2, 4);
+    img->config[12] = SHA204_SN_8;
+    img->config[14] = 0x01;                 // I2C_Enable
+    img->config[16] = 0xC8;                 // I2C_Address
+    img->config[SIM_CFG_OTP_MODE] = SIM_OTP_CONSUMPTION;
+    for (uint8_t slot = 0; slot < 8; ++slot) img->config[SIM_CFG_USE_FLAG + 2 * slot] = 0xFF;
+    memset(&img->config[SIM_CFG_LAST_KEY_USE], 0xFF, 16);
+    img->config[SIM_CFG_LOCK_VALUE] = SIM_UNLOCKED;
+    img->config[SIM_CFG_LOCK_CONFIG] = SIM_UNLOCKED;
+
+    memset(img->otp, 0xFF, sizeof(img->otp));
+    memset(img->data, 0xFF, sizeof(img->data));
+}
+
+
+/** \brief 创建器件模型并挂接到一个新的fd上
+ *  \param[in] image_path EEPROM映像文件, 不存在时按出厂状态创建; NULL表示不保存的匿名映像
+ *  \return 器件模型, 失败返回NULL
+ */
+struct sha204_sim *sha204_sim_create(const char *image_path) {
+    struct sha204_sim *sim = (struct sha204_sim *) calloc(1, sizeof(*sim));
+    uint8_t fresh = 1;
+    struct stat st;
+    void *map;
+
+    if (!sim) {
+        printf("FAILED! sha204_sim_create: out of memory\n");
+        return NULL;
+    }
+    sim->fd = -1;
+    sim->image_fd = -1;
+    pthread_mutex_init(&sim->lock, NULL);
+
+    if (image_path) {
+        sim->image_fd = open(image_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (sim->image_fd < 0 || fstat(sim->image_fd, &st) < 0) {
+            printf("FAILED! open sim image %s: %s\n", image_path, strerror(errno));
+            goto fail;
+        }
+        fresh = st.st_size == 0;
+        if (!fresh && st.st_size != sizeof(struct sha204_sim_image)) {
+            printf("FAILED! %s is not a sim image\n", image_path);
+            goto fail;
+        }
+        if (fresh && ftruncate(sim->image_fd, sizeof(struct sha204_sim_image)) < 0) {
+            printf("FAILED! resize sim image %s: %s\n", image_path, strerror(errno));
+            goto fail;
+        }
+        map = mmap(NULL, sizeof(struct sha204_sim_image), PROT_READ | PROT_WRITE, MAP_SHARED, sim->image_fd, 0);
+    } else {
+        map = mmap(NULL, sizeof(struct sha204_sim_image), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (map == MAP_FAILED) {
+        printf("FAILED! mmap sim image: %s\n", strerror(errno));
+        goto fail;
+    }
+    sim->img = (struct sha204_sim_image *) map;
+
+    if (fresh) sim_factory_init(sim->img);
+    else if (memcmp(sim->img->magic, SIM_IMAGE_MAGIC, sizeof(sim->img->magic)) != 0) {
+        printf("FAILED! %s is not a sim image\n", image_path);
+        goto fail;
+    }
+
+    sim->fd = eventfd(0, EFD_CLOEXEC);
+    if (sim->fd < 0 || sha204p_attach(sim->fd, &sim_transport, sim) < 0) {
+        printf("FAILED! attach sim transport\n");
+        goto fail;
+    }
+
+    return sim;
+
+fail:
+    if (sim->fd >= 0) close(sim->fd);
+    sim->fd = -1;
+    sha204_sim_destroy(sim);
+    return NULL;
+}
+
+
+void sha204_sim_destroy(struct sha204_sim *sim) {
+    if (!sim) return;
+
+    if (sim->fd >= 0) {
+        sha204p_detach(sim->fd);
+        close(sim->fd);
+    }
+    if (sim->img) {
+        if (sim->image_fd >= 0) msync(sim->img, sizeof(*sim->img), MS_SYNC);
+        munmap(sim->img, sizeof(*sim->img));
+    }
+    if (sim->image_fd >= 0) close(sim->image_fd);
+
+    pthread_mutex_destroy(&sim->lock);
+    memset(&sim->temp_key, 0, sizeof(sim->temp_key));
+    free(sim);
+}
+
+
+/** \brief 器件模型的fd, 用法与打开的i2c-dev相同, 由sha204_sim_destroy关闭
+ */
+int sha204_sim_fd(const struct sha204_sim *sim) {
+    return sim->fd;
+}
+
+
+/** \brief 打开后命令按典型执行时间(*_DELAY)占用器件, 期间读写NACK; 唤醒后tWHI内同样NACK.
+ *         默认关闭, 命令写入后立即可以读取响应.
+ */
+void sha204_sim_set_timing(struct sha204_sim *sim, uint8_t enable) {
+    pthread_mutex_lock(&sim->lock);
+    sim->timing = enable;
+    if (!enable) sim->busy_until_us = 0;
+    pthread_mutex_unlock(&sim->lock);
+}
@@ -0,0 +1,45 @@
+/*
+ * sha204_sim.h
+ *
+ * 进程内的ATSHA204A器件模型, 以软件传输(sha204p_attach)的方式挂接到一个fd上,
+ * 上层代码把它当成打开的i2c-dev使用, 不需要硬件即可压测和验证.
+ *
+ * 模型范围:
+ *   - config/OTP/data区, LockConfig/LockValue锁定字节, 区域映像mmap到文件, 跨进程重启保留
+ *   - SlotConfig访问规则: IsSecret/EncryptRead读保护, WriteConfig明文/加密写/禁止写, CheckOnly, SingleUse
+ *   - TempKey状态(valid, source_flag, gen_data, key_id), sleep清除, idle保留
+ *   - 唤醒/sleep/idle/reset字地址, 看门狗超时后自动sleep
+ *   - sha204_comm_marshaling.h中的全部命令, 响应带count与CRC; 包CRC错误返回0xFF状态
+ *   - 可选的执行时间: 命令执行期间读写NACK, 与真实器件的轮询行为一致
+ * 摘要计算复用sha204h_nonce/mac/hmac/gen_dig/derive_key/encrypt, 与主机侧计算天然一致.
+ *
+ * 随机数由映像中的种子经SHA-256生成, 结果可复现; config区未锁定时与真实器件一样返回ff ff 00 00测试图样.
+ */
+
+#ifndef SHA204_SIM_H
+#   define SHA204_SIM_H
+
+#include <stdint.h>
+
+//! 看门狗超时(ms), 数据手册典型值
+#define SHA204_SIM_WATCHDOG_MS       (1300)
+
+//! 唤醒后到可以通信的时间(us), 数据手册tWHI
+#define SHA204_SIM_WAKEUP_US         (2500)
+
+struct sha204_sim;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_sim *sha204_sim_create(const char *image_path);
+void sha204_sim_destroy(struct sha204_sim *sim);
+int sha204_sim_fd(const struct sha204_sim *sim);
+void sha204_sim_set_timing(struct sha204_sim *sim, uint8_t enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_SIM_H
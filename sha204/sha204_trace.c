@@ -0,0 +1,580 @@
+/*
+ * sha204_trace.c
+ *
+ * I2C会话的录制, 加载与两个方向的重放
+ */
+
+#include "sha204_trace.h"
+#include "atsha204_i2c.h"
+#include "sha204_clock.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+static const char trace_magic[8] = {'S', '2', '0', '4', 'T', 'R', 'C', '1'};
+
+
+//------------------------------------------------------------------------------------------------
+// 录制
+
+struct sha204_trace_rec {
+    int fd;
+    const struct sha204p_transport *inner;  // 被包住的传输, NULL表示i2c-dev
+    void *inner_ctx;
+    FILE *fp;
+    pthread_mutex_t lock;
+    uint8_t started;
+    uint64_t last_us;                       // 上一条事件的开始时间
+    int error;                              // 第一次写文件失败的errno, 0表示正常; 失败后不再写入
+};
+
+//! 一条事件的最大长度: kind, 两个varint, 长度, errno, 数据
+#define REC_EVENT_MAX               (1 + 2 * 10 + 1 + 1 + 0xFF)
+
+
+static size_t rec_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) ((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+    return n;
+}
+
+
+// 写文件失败: 记下errno并停止录制, 截断在上一条完整事件之后的轨迹仍可加载. 调用时持有lock
+static void rec_fail(struct sha204_trace_rec *rec, const char *what) {
+    if (rec->error) return;
+    rec->error = errno ? errno : EIO;
+    printf("FAILED! trace %s: %s\n", what, strerror(rec->error));
+}
+
+
+static void rec_event(struct sha204_trace_rec *rec, uint8_t kind, uint64_t t0, uint64_t t1,
+                      const uint8_t *buf, size_t len, int ret) {
+    int saved_errno = errno;                // 调用者还要用errno打印NACK原因
+    uint8_t err = 0;
+
+    uint8_t event[REC_EVENT_MAX];
+    size_t n = 0;
+
+    if (ret < 0) err = (uint8_t) (saved_errno ? saved_errno : EIO);
+    else if ((size_t) ret != len) err = EIO;
+    if (len > 0xFF) len = 0xFF;
+
+    pthread_mutex_lock(&rec->lock);
+    if (!rec->started) {
+        rec->started = 1;
+        rec->last_us = t0;
+    }
+    event[n++] = kind;
+    n += rec_varint(event + n, t0 - rec->last_us);
+    n += rec_varint(event + n, t1 - t0);
+    event[n++] = (uint8_t) len;
+    event[n++] = err;
+    if (kind == SHA204_TRACE_WRITE || !err) {
+        memcpy(event + n, buf, len);
+        n += len;
+    }
+    rec->last_us = t0;
+
+    // 一条事件一次fwrite, 写不完整时停止录制, 不在半条事件之后继续写
+    errno = 0;
+    if (!rec->error && fwrite(event, 1, n, rec->fp) != n)
+        rec_fail(rec, "write");
+    pthread_mutex_unlock(&rec->lock);
+
+    errno = saved_errno;
+}
+
+
+static int rec_write(void *ctx, const uint8_t *buf, size_t len) {
+    struct sha204_trace_rec *rec = (struct sha204_trace_rec *) ctx;
+    uint64_t t0 = sha204_clock_now_us();
+    int ret = rec->inner ? rec->inner->write(rec->inner_ctx, buf, len) : (int) write(rec->fd, buf, len);
+
+    rec_event(rec, SHA204_TRACE_WRITE, t0, sha204_clock_now_us(), buf, len, ret);
+    return ret;
+}
+
+
+static int rec_read(void *ctx, uint8_t *buf, size_t len) {
+    struct sha204_trace_rec *rec = (struct sha204_trace_rec *) ctx;
+    uint64_t t0 = sha204_clock_now_us();
+    int ret = rec->inner ? rec->inner->read(rec->inner_ctx, buf, len) : (int) read(rec->fd, buf, len);
+
+    rec_event(rec, SHA204_TRACE_READ, t0, sha204_clock_now_us(), buf, len, ret);
+    return ret;
+}
+
+
+static const struct sha204p_transport rec_transport = {
+    .write = rec_write,
+    .read = rec_read,
+};
+
+
+/** \brief 开始录制fd上的读写, fd上已挂接的传输(例如sha204_sim)照常工作
+ *
+ * 须在fd上没有I/O时调用, 并在关闭fd或销毁被包住的传输之前sha204_trace_record_stop.
+ * 轨迹中有明文写入的密钥: 文件以0600创建, 已存在的普通文件改为0600, 不跟随符号链接.
+ * \param[in] fd   i2c-dev或已挂接软件传输的fd
+ * \param[in] path 轨迹文件, 已存在则覆盖
+ * \return 录制句柄, 失败返回NULL
+ */
+struct sha204_trace_rec *sha204_trace_record_start(int fd, const char *path) {
+    struct sha204_trace_rec *rec = (struct sha204_trace_rec *) calloc(1, sizeof(*rec));
+    if (!rec) return NULL;
+
+    rec->fd = fd;
+    pthread_mutex_init(&rec->lock, NULL);
+    struct stat st;
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (file >= 0 && fstat(file, &st) == 0 && S_ISREG(st.st_mode)) fchmod(file, 0600);
+    rec->fp = file >= 0 ? fdopen(file, "wb") : NULL;
+    if (!rec->fp) {
+        printf("FAILED! open trace %s: %s\n", path, strerror(errno));
+        if (file >= 0) close(file);
+        free(rec);
+        return NULL;
+    }
+    if (fwrite(trace_magic, 1, sizeof(trace_magic), rec->fp) != sizeof(trace_magic)) {
+        printf("FAILED! write trace %s: %s\n", path, strerror(errno ? errno : EIO));
+        fclose(rec->fp);
+        free(rec);
+        return NULL;
+    }
+
+    if (sha204p_transport_get(fd, &rec->inner, &rec->inner_ctx) == 0)
+        sha204p_detach(fd);
+    if (sha204p_attach(fd, &rec_transport, rec) < 0) {
+        printf("FAILED! attach trace recorder\n");
+        if (rec->inner) sha204p_attach(fd, rec->inner, rec->inner_ctx);
+        fclose(rec->fp);
+        free(rec);
+        return NULL;
+    }
+
+    return rec;
+}
+
+
+/** \brief 把已录制的事件写入文件
+ *
+ * \return 0成功; 录制过程中或这次写文件失败返回-1并设置errno, 此后的事件不再录制
+ */
+int sha204_trace_record_flush(struct sha204_trace_rec *rec) {
+    int error;
+
+    pthread_mutex_lock(&rec->lock);
+    errno = 0;
+    if (!rec->error && fflush(rec->fp) != 0)
+        rec_fail(rec, "flush");
+    error = rec->error;
+    pthread_mutex_unlock(&rec->lock);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+
+/** \brief 结束录制, 恢复原来的传输并写完文件
+ *
+ * \return 0成功; 轨迹不完整(录制过程中或关闭时写文件失败)返回-1并设置errno
+ */
+int sha204_trace_record_stop(struct sha204_trace_rec *rec) {
+    int error;
+
+    if (!rec) return 0;
+
+    sha204p_detach(rec->fd);
+    if (rec->inner) sha204p_attach(rec->fd, rec->inner, rec->inner_ctx);
+
+    errno = 0;
+    if (fclose(rec->fp) != 0)
+        rec_fail(rec, "close");
+    error = rec->error;
+    pthread_mutex_destroy(&rec->lock);
+    free(rec);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 加载
+
+struct sha204_trace {
+    uint32_t count;
+    struct sha204_trace_event *events;
+    uint8_t *file;                          // 事件的data指向这里
+};
+
+
+static int load_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p >= end) return -1;
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+
+/** \brief 读入轨迹文件
+ *  \return 轨迹, 文件不存在或格式错误时返回NULL
+ */
+struct sha204_trace *sha204_trace_load(const char *path) {
+    struct sha204_trace *trace = (struct sha204_trace *) calloc(1, sizeof(*trace));
+    FILE *fp = fopen(path, "rb");
+    long size = -1;
+    uint32_t capacity = 0;
+
+    if (!trace || !fp) {
+        printf("FAILED! open trace %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    if (fseek(fp, 0, SEEK_END) == 0) size = ftell(fp);
+    rewind(fp);
+    if (size < (long) sizeof(trace_magic)) goto corrupt;
+
+    trace->file = (uint8_t *) malloc((size_t) size);
+    if (!trace->file || fread(trace->file, 1, (size_t) size, fp) != (size_t) size) goto corrupt;
+    if (memcmp(trace->file, trace_magic, sizeof(trace_magic)) != 0) goto corrupt;
+
+    const uint8_t *p = trace->file + sizeof(trace_magic);
+    const uint8_t *end = trace->file + size;
+    uint64_t t_us = 0;
+    while (p < end) {
+        uint64_t dt, dur;
+        uint8_t kind = *p++;
+        if ((kind != SHA204_TRACE_WRITE && kind != SHA204_TRACE_READ)
+            || load_varint(&p, end, &dt) < 0 || load_varint(&p, end, &dur) < 0 || end - p < 2)
+            goto corrupt;
+
+        if (trace->count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct sha204_trace_event *events = (struct sha204_trace_event *)
+                    realloc(trace->events, capacity * sizeof(*events));
+            if (!events) goto corrupt;
+            trace->events = events;
+        }
+
+        struct sha204_trace_event *ev = &trace->events[trace->count++];
+        t_us += dt;
+        ev->t_us = t_us;
+        ev->dur_us = (uint32_t) dur;
+        ev->kind = kind;
+        ev->len = *p++;
+        ev->err = *p++;
+        ev->data = NULL;
+        if (kind == SHA204_TRACE_WRITE || !ev->err) {
+            if (end - p < ev->len) goto corrupt;
+            ev->data = p;
+            p += ev->len;
+        }
+    }
+
+    fclose(fp);
+    return trace;
+
+corrupt:
+    printf("FAILED! trace %s is truncated or not a trace file\n", path);
+fail:
+    if (fp) fclose(fp);
+    sha204_trace_free(trace);
+    return NULL;
+}
+
+
+void sha204_trace_free(struct sha204_trace *trace) {
+    if (!trace) return;
+
+    free(trace->events);
+    free(trace->file);
+    free(trace);
+}
+
+
+uint32_t sha204_trace_count(const struct sha204_trace *trace) {
+    return trace->count;
+}
+
+
+const struct sha204_trace_event *sha204_trace_get(const struct sha204_trace *trace, uint32_t i) {
+    return i < trace->count ? &trace->events[i] : NULL;
+}
+
+
+/** \brief 按字地址区分的事件名称: wake/sleep/idle/send/recv
+ */
+const char *sha204_trace_kind_name(const struct sha204_trace_event *ev) {
+    if (ev->kind == SHA204_TRACE_READ) return "recv";
+    if (!ev->len) return "write";
+
+    switch (ev->data[0]) {
+    case 0x00: return ev->len == 1 ? "wake" : "write";     // 唤醒脉冲与reset字地址在总线上相同
+    case 0x01: return "sleep";
+    case 0x02: return "idle";
+    case 0x03: return "send";
+    default:   return "write";
+    }
+}
+
+
+static uint64_t trace_duration_us(const struct sha204_trace *trace) {
+    if (!trace->count) return 0;
+
+    const struct sha204_trace_event *last = &trace->events[trace->count - 1];
+    return last->t_us + last->dur_us;
+}
+
+
+static void stats_skew(struct sha204_trace_stats *stats, int64_t *skew_sum, int64_t skew) {
+    *skew_sum += skew;
+    if ((skew < 0 ? -skew : skew) > (stats->max_skew_us < 0 ? -stats->max_skew_us : stats->max_skew_us))
+        stats->max_skew_us = skew;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 主机侧重放: 按录制的时间把读写发给器件
+
+/** \brief 按录制的时间把轨迹中主机侧的读写发给fd上的器件, 比较器件的结果
+ *
+ * 相对时间差为主机未能按时发出的延迟; 结果不同(应答/NACK, 读到的数据)计入mismatched.
+ * Nonce/Random等含随机数的响应本来就不同, 比较时需考虑.
+ * \param[in]  trace 轨迹
+ * \param[in]  fd    i2c-dev或器件模型的fd
+ * \param[out] stats 结果
+ */
+void sha204_trace_replay(const struct sha204_trace *trace, int fd, struct sha204_trace_stats *stats) {
+    uint8_t buf[0x100];
+    int64_t skew_sum = 0;
+    uint64_t start_us = sha204_clock_now_us();
+
+    memset(stats, 0, sizeof(*stats));
+    stats->events = trace->count;
+    stats->recorded_us = trace_duration_us(trace);
+
+    for (uint32_t i = 0; i < trace->count; ++i) {
+        const struct sha204_trace_event *ev = &trace->events[i];
+
+        sha204_clock_sleep_until_us(start_us + ev->t_us);
+        uint64_t t0 = sha204_clock_now_us();
+        int ret = ev->kind == SHA204_TRACE_WRITE ? sha204p_write(fd, ev->data, ev->len)
+                                                 : sha204p_read(fd, buf, ev->len);
+        uint8_t ok = ret == ev->len;
+
+        stats->matched++;
+        if (ok != !ev->err || (ok && ev->kind == SHA204_TRACE_READ && memcmp(buf, ev->data, ev->len) != 0))
+            stats->mismatched++;
+        stats_skew(stats, &skew_sum, (int64_t) (t0 - start_us) - (int64_t) ev->t_us);
+    }
+
+    stats->replayed_us = sha204_clock_now_us() - start_us;
+    if (stats->matched) stats->mean_skew_us = skew_sum / stats->matched;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 器件侧重放: 轨迹作为器件
+
+struct sha204_trace_dev {
+    struct sha204_trace *trace;
+    int fd;
+    pthread_mutex_t lock;
+    uint32_t pos;                           // 下一条待对应的事件
+    uint8_t started;
+    uint64_t start_us;                      // 主机第一次读写的时间
+    int64_t offset_us;                      // 主机时间 - 录制时间, 每次对上写事件时重新对齐
+    uint64_t last_us;                       // 主机最近一次读写的时间
+    int64_t skew_sum;
+    struct sha204_trace_stats stats;
+};
+
+
+static int dev_nack(uint8_t err) {
+    errno = err ? err : EREMOTEIO;
+    return -1;
+}
+
+
+// 对上一条事件, 记录相对时间差. 调用时持有lock
+static const struct sha204_trace_event *dev_take(struct sha204_trace_dev *dev, uint64_t now) {
+    const struct sha204_trace_event *ev = &dev->trace->events[dev->pos++];
+
+    dev->stats.matched++;
+    stats_skew(&dev->stats, &dev->skew_sum, (int64_t) (now - dev->start_us) - (int64_t) ev->t_us);
+    return ev;
+}
+
+
+static uint64_t dev_begin(struct sha204_trace_dev *dev) {
+    uint64_t now = sha204_clock_now_us();
+
+    if (!dev->started) {
+        dev->started = 1;
+        dev->start_us = now;
+        dev->offset_us = (int64_t) now;
+    }
+    dev->last_us = now;
+    return now;
+}
+
+
+static int dev_io_write(void *ctx, const uint8_t *buf, size_t len) {
+    struct sha204_trace_dev *dev = (struct sha204_trace_dev *) ctx;
+    const struct sha204_trace_event *events = dev->trace->events;
+
+    pthread_mutex_lock(&dev->lock);
+    uint64_t now = dev_begin(dev);
+
+    // 轨迹中主机还读过而这次没有读的: 多余的轮询, 或没有取的响应
+    while (dev->pos < dev->trace->count && events[dev->pos].kind == SHA204_TRACE_READ) {
+        dev->pos++;
+        dev->stats.skipped++;
+    }
+    if (dev->pos == dev->trace->count) {
+        dev->stats.extra++;
+        pthread_mutex_unlock(&dev->lock);
+        return dev_nack(0);
+    }
+
+    const struct sha204_trace_event *ev = dev_take(dev, now);
+    if (ev->len != len || memcmp(ev->data, buf, len) != 0) dev->stats.mismatched++;
+    dev->offset_us = (int64_t) now - (int64_t) ev->t_us;
+    uint8_t err = ev->err;
+    pthread_mutex_unlock(&dev->lock);
+
+    return err ? dev_nack(err) : (int) len;
+}
+
+
+static int dev_io_read(void *ctx, uint8_t *buf, size_t len) {
+    struct sha204_trace_dev *dev = (struct sha204_trace_dev *) ctx;
+    const struct sha204_trace_event *events = dev->trace->events;
+    uint32_t count = dev->trace->count;
+
+    pthread_mutex_lock(&dev->lock);
+    uint64_t now = dev_begin(dev);
+
+    if (dev->pos == count || events[dev->pos].kind == SHA204_TRACE_WRITE) {
+        // 轨迹中此时主机应当写, 这次多读了
+        dev->stats.extra++;
+        pthread_mutex_unlock(&dev->lock);
+        return dev_nack(0);
+    }
+
+    // 这一段连续读中下一次成功的读
+    uint32_t ok = dev->pos;
+    while (ok < count && events[ok].kind == SHA204_TRACE_READ && events[ok].err) ok++;
+    if (ok == count || events[ok].kind == SHA204_TRACE_WRITE) {
+        // 录制中这段读全部失败, 按顺序逐条失败
+        uint8_t err = dev_take(dev, now)->err;
+        pthread_mutex_unlock(&dev->lock);
+        return dev_nack(err);
+    }
+
+    // 响应的就绪时间: 紧跟在读之后则立即可读; 否则取最后一次失败轮询的结束, 没有失败的轮询则取成功读的时间
+    uint64_t ready_us = 0;
+    if (ok > 0) {
+        const struct sha204_trace_event *prev = &events[ok - 1];
+        if (prev->kind == SHA204_TRACE_WRITE) ready_us = events[ok].t_us;
+        else if (prev->err) ready_us = prev->t_us + prev->dur_us;
+    }
+    if ((int64_t) now - dev->offset_us < (int64_t) ready_us) {
+        // 主机比录制时来得早, 器件还在执行
+        if (dev->pos < ok) dev_take(dev, now);
+        else dev->stats.extra++;
+        pthread_mutex_unlock(&dev->lock);
+        return dev_nack(EREMOTEIO);
+    }
+
+    dev->stats.skipped += ok - dev->pos;
+    dev->pos = ok;
+    const struct sha204_trace_event *ev = dev_take(dev, now);
+    if (ev->len != len) dev->stats.mismatched++;
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = i < ev->len ? ev->data[i] : 0xFF;
+    pthread_mutex_unlock(&dev->lock);
+
+    return (int) len;
+}
+
+
+static const struct sha204p_transport dev_transport = {
+    .write = dev_io_write,
+    .read = dev_io_read,
+};
+
+
+/** \brief 以轨迹作为器件, 返回的句柄用sha204_trace_dev_fd取得fd, 用法与打开的i2c-dev相同
+ */
+struct sha204_trace_dev *sha204_trace_dev_open(const char *path) {
+    struct sha204_trace_dev *dev = (struct sha204_trace_dev *) calloc(1, sizeof(*dev));
+    if (!dev) return NULL;
+
+    dev->fd = -1;
+    pthread_mutex_init(&dev->lock, NULL);
+    dev->trace = sha204_trace_load(path);
+    if (!dev->trace) goto fail;
+
+    dev->fd = eventfd(0, EFD_CLOEXEC);
+    if (dev->fd < 0 || sha204p_attach(dev->fd, &dev_transport, dev) < 0) {
+        printf("FAILED! attach trace device\n");
+        if (dev->fd >= 0) close(dev->fd);
+        dev->fd = -1;
+        goto fail;
+    }
+
+    dev->stats.events = dev->trace->count;
+    dev->stats.recorded_us = trace_duration_us(dev->trace);
+    return dev;
+
+fail:
+    sha204_trace_free(dev->trace);
+    pthread_mutex_destroy(&dev->lock);
+    free(dev);
+    return NULL;
+}
+
+
+int sha204_trace_dev_fd(const struct sha204_trace_dev *dev) {
+    return dev->fd;
+}
+
+
+/** \brief 到目前为止的比较结果, 轨迹中尚未对应的事件计入skipped
+ */
+void sha204_trace_dev_stats(struct sha204_trace_dev *dev, struct sha204_trace_stats *stats) {
+    pthread_mutex_lock(&dev->lock);
+    *stats = dev->stats;
+    stats->skipped += dev->trace->count - dev->pos;
+    stats->replayed_us = dev->started ? dev->last_us - dev->start_us : 0;
+    if (stats->matched) stats->mean_skew_us = dev->skew_sum / stats->matched;
+    pthread_mutex_unlock(&dev->lock);
+}
+
+
+void sha204_trace_dev_close(struct sha204_trace_dev *dev) {
+    if (!dev) return;
+
+    sha204p_detach(dev->fd);
+    close(dev->fd);
+    sha204_trace_free(dev->trace);
+    pthread_mutex_destroy(&dev->lock);
+    free(dev);
+}
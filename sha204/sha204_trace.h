@@ -0,0 +1,82 @@
+/*
+ * sha204_trace.h
+ *
+ * I2C会话的录制与重放, 用于协议栈改动前后的时延回归比较.
+ *
+ * 录制: 在fd的传输外面包一层(sha204p_attach), 每次总线读写记一条事件: 相对开始的时间, 耗时, 长度, 结果, 数据.
+ * 唤醒/sleep/idle/命令按写入的字地址区分, 轮询中被NACK的读和sha204c_resync的重新同步也都在轨迹里.
+ * 时间取自sha204_clock, 虚拟时间下录制与重放都是确定的. 轨迹包含写入的明文(例如个人化时的密钥), 注意保管.
+ * 写文件失败(例如磁盘满)时停止录制, 已写入的完整事件保留, 由sha204_trace_record_flush/stop返回错误.
+ *
+ * 文件格式(小端): 8字节magic "S204TRC1", 之后逐条事件
+ *   u8 kind('W'/'R') | varint 距上一条开始的us | varint 耗时us | u8 长度 | u8 errno(0成功) | 数据
+ *   数据: 写事件为写入的字节, 成功的读事件为读到的字节, 失败的读没有数据
+ *
+ * 重放有两个方向:
+ *   sha204_trace_replay     按录制的时间把主机侧的读写发给一个器件(例如sha204_sim), 比较器件的结果与时间
+ *   sha204_trace_dev_open   以轨迹作为器件, 让当前的主机代码对它运行, 比较主机的行为与时间.
+ *                           响应的就绪时间取录制中最后一次被NACK的轮询(没有则取成功读的时间),
+ *                           主机更早来读得到NACK, 多出或少掉的轮询计入extra/skipped而不判为不一致.
+ */
+
+#ifndef SHA204_TRACE_H
+#   define SHA204_TRACE_H
+
+#include <stdint.h>
+
+#define SHA204_TRACE_WRITE           ('W')
+#define SHA204_TRACE_READ            ('R')
+
+//! 一条总线读写
+struct sha204_trace_event {
+    uint64_t t_us;                  //!< 相对第一条事件的开始时间
+    uint32_t dur_us;                //!< 读写本身的耗时
+    uint8_t kind;                   //!< SHA204_TRACE_WRITE / SHA204_TRACE_READ
+    uint8_t len;                    //!< 请求的字节数
+    uint8_t err;                    //!< 0成功, 否则为errno(NACK为EREMOTEIO等)
+    const uint8_t *data;            //!< 写入或读到的len字节, 失败的读为NULL
+};
+
+//! 重放结果
+struct sha204_trace_stats {
+    uint32_t events;                //!< 轨迹中的事件数
+    uint32_t matched;               //!< 按顺序对上的事件
+    uint32_t mismatched;            //!< 对上了但结果或数据不同
+    uint32_t skipped;               //!< 轨迹中有而这次没有的事件, 例如少了的轮询
+    uint32_t extra;                 //!< 这次多出来的事件
+    uint64_t recorded_us;           //!< 录制的会话时长
+    uint64_t replayed_us;           //!< 重放的会话时长
+    int64_t max_skew_us;            //!< 对上的事件的相对时间差(重放 - 录制)中绝对值最大的
+    int64_t mean_skew_us;           //!< 相对时间差的平均
+};
+
+struct sha204_trace;
+struct sha204_trace_rec;
+struct sha204_trace_dev;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha204_trace_rec *sha204_trace_record_start(int fd, const char *path);
+int sha204_trace_record_flush(struct sha204_trace_rec *rec);
+int sha204_trace_record_stop(struct sha204_trace_rec *rec);
+
+struct sha204_trace *sha204_trace_load(const char *path);
+void sha204_trace_free(struct sha204_trace *trace);
+uint32_t sha204_trace_count(const struct sha204_trace *trace);
+const struct sha204_trace_event *sha204_trace_get(const struct sha204_trace *trace, uint32_t i);
+const char *sha204_trace_kind_name(const struct sha204_trace_event *ev);
+
+void sha204_trace_replay(const struct sha204_trace *trace, int fd, struct sha204_trace_stats *stats);
+
+struct sha204_trace_dev *sha204_trace_dev_open(const char *path);
+int sha204_trace_dev_fd(const struct sha204_trace_dev *dev);
+void sha204_trace_dev_stats(struct sha204_trace_dev *dev, struct sha204_trace_stats *stats);
+void sha204_trace_dev_close(struct sha204_trace_dev *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHA204_TRACE_H
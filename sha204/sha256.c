@@ -37,20 +37,20 @@
  *		1.  Removed all code / data which supported SHA224, SHA384, SHA512		*
  *		2.  Moved stack variables wv and v to zram (needs 288 bytes of RAM)		*
  *		3.  Moved SHA256 constants to flash segment								*
+ *		4.  Fixed-width types, compression function dispatched at runtime		*
+ *			to SHA-NI / ARMv8 SHA2 when present (see sha256_hw.c)				*
  ********************************************************************************/
 /** \file 	SHA256.c
  *  \brief 	Implements SHA256 Algorithm
  *  \author SEM
  *  \date 	Sept 16, 2009
 */
-#if 0
-#define TEST_VECTORS
-#endif
-
-#if 0
+#if 1
 #define UNROLL_LOOPS /* Enable loops unrolling */
 #endif
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 //#include <ina90.h>
 
@@ -59,8 +59,8 @@
 //#include "defines.h"
 
 #define SHFR(x, n)    (x >> n)
-#define ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
-#define ROTL(x, n)   ((x << n) | (x >> ((sizeof(x) << 3) - n)))
+#define ROTR(x, n)   ((uint32) (((x) >> (n)) | ((x) << (32 - (n)))))
+#define ROTL(x, n)   ((uint32) (((x) << (n)) | ((x) >> (32 - (n)))))
 #define CH(x, y, z)  ((x & y) ^ (~x & z))
 #define MAJ(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
 
@@ -104,12 +104,12 @@
 }
 
 //flash uint32 sha256_h0[8] =
-uint32 sha256_h0[8] =
+const uint32 sha256_h0[8] =
             {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
              0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
 
 //flash uint32 sha256_k[64] =
-uint32 sha256_k[64] =
+const uint32 sha256_k[64] =
             {0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
              0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
              0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -133,124 +133,282 @@ uint32 sha256_k[64] =
 //#define zram32  ((UINT32*) zram)
 //#define eob32(buf) ((sizeof(buf)/sizeof(UINT32)))
 
-void sha256_transf(sha256_ctx *ctx, const uint8 *message,
-                   uint32 block_nb)
+/* Schedule and rounds for one block, w[0..15] already loaded. Always inlined so
+ * that the fixed-length kernels below fold their constant padding words into
+ * the message schedule. */
+
+static inline __attribute__((always_inline))
+void sha256_rounds(uint32 h[8], uint32 w[64])
 {
-    uint32 w[64];
     uint32 wv[8];
 //	uint32 *wv = &zram32[eob32(zram)-8];
 //	uint32 *w = &zram32[eob32(zram)-(8+64)];
 
     uint32 t1, t2;
-    const uint8 *sub_block;
-    int i;
 
 #ifndef UNROLL_LOOPS
     int j;
 #endif
 
-    for (i = 0; i < (int) block_nb; i++) {
-        sub_block = message + (i << 6);
-
 #ifndef UNROLL_LOOPS
-        for (j = 0; j < 16; j++) {
-            PACK32(&sub_block[j << 2], &w[j]);
-        }
+    for (j = 16; j < 64; j++) {
+        SHA256_SCR(j);
+    }
 
-        for (j = 16; j < 64; j++) {
-            SHA256_SCR(j);
-        }
+    for (j = 0; j < 8; j++) {
+        wv[j] = h[j];
+    }
 
-        for (j = 0; j < 8; j++) {
-            wv[j] = ctx->h[j];
-        }
+    for (j = 0; j < 64; j++) {
+        t1 = wv[7] + SHA256_F2(wv[4]) + CH(wv[4], wv[5], wv[6])
+            + sha256_k[j] + w[j];
+        t2 = SHA256_F1(wv[0]) + MAJ(wv[0], wv[1], wv[2]);
+        wv[7] = wv[6];
+        wv[6] = wv[5];
+        wv[5] = wv[4];
+        wv[4] = wv[3] + t1;
+        wv[3] = wv[2];
+        wv[2] = wv[1];
+        wv[1] = wv[0];
+        wv[0] = t1 + t2;
+    }
 
-        for (j = 0; j < 64; j++) {
-            t1 = wv[7] + SHA256_F2(wv[4]) + CH(wv[4], wv[5], wv[6])
-                + sha256_k[j] + w[j];
-            t2 = SHA256_F1(wv[0]) + MAJ(wv[0], wv[1], wv[2]);
-            wv[7] = wv[6];
-            wv[6] = wv[5];
-            wv[5] = wv[4];
-            wv[4] = wv[3] + t1;
-            wv[3] = wv[2];
-            wv[2] = wv[1];
-            wv[1] = wv[0];
-            wv[0] = t1 + t2;
-        }
+    for (j = 0; j < 8; j++) {
+        h[j] += wv[j];
+    }
+#else
+    SHA256_SCR(16); SHA256_SCR(17); SHA256_SCR(18); SHA256_SCR(19);
+    SHA256_SCR(20); SHA256_SCR(21); SHA256_SCR(22); SHA256_SCR(23);
+    SHA256_SCR(24); SHA256_SCR(25); SHA256_SCR(26); SHA256_SCR(27);
+    SHA256_SCR(28); SHA256_SCR(29); SHA256_SCR(30); SHA256_SCR(31);
+    SHA256_SCR(32); SHA256_SCR(33); SHA256_SCR(34); SHA256_SCR(35);
+    SHA256_SCR(36); SHA256_SCR(37); SHA256_SCR(38); SHA256_SCR(39);
+    SHA256_SCR(40); SHA256_SCR(41); SHA256_SCR(42); SHA256_SCR(43);
+    SHA256_SCR(44); SHA256_SCR(45); SHA256_SCR(46); SHA256_SCR(47);
+    SHA256_SCR(48); SHA256_SCR(49); SHA256_SCR(50); SHA256_SCR(51);
+    SHA256_SCR(52); SHA256_SCR(53); SHA256_SCR(54); SHA256_SCR(55);
+    SHA256_SCR(56); SHA256_SCR(57); SHA256_SCR(58); SHA256_SCR(59);
+    SHA256_SCR(60); SHA256_SCR(61); SHA256_SCR(62); SHA256_SCR(63);
+
+    wv[0] = h[0]; wv[1] = h[1];
+    wv[2] = h[2]; wv[3] = h[3];
+    wv[4] = h[4]; wv[5] = h[5];
+    wv[6] = h[6]; wv[7] = h[7];
+
+    SHA256_EXP(0,1,2,3,4,5,6,7, 0); SHA256_EXP(7,0,1,2,3,4,5,6, 1);
+    SHA256_EXP(6,7,0,1,2,3,4,5, 2); SHA256_EXP(5,6,7,0,1,2,3,4, 3);
+    SHA256_EXP(4,5,6,7,0,1,2,3, 4); SHA256_EXP(3,4,5,6,7,0,1,2, 5);
+    SHA256_EXP(2,3,4,5,6,7,0,1, 6); SHA256_EXP(1,2,3,4,5,6,7,0, 7);
+    SHA256_EXP(0,1,2,3,4,5,6,7, 8); SHA256_EXP(7,0,1,2,3,4,5,6, 9);
+    SHA256_EXP(6,7,0,1,2,3,4,5,10); SHA256_EXP(5,6,7,0,1,2,3,4,11);
+    SHA256_EXP(4,5,6,7,0,1,2,3,12); SHA256_EXP(3,4,5,6,7,0,1,2,13);
+    SHA256_EXP(2,3,4,5,6,7,0,1,14); SHA256_EXP(1,2,3,4,5,6,7,0,15);
+    SHA256_EXP(0,1,2,3,4,5,6,7,16); SHA256_EXP(7,0,1,2,3,4,5,6,17);
+    SHA256_EXP(6,7,0,1,2,3,4,5,18); SHA256_EXP(5,6,7,0,1,2,3,4,19);
+    SHA256_EXP(4,5,6,7,0,1,2,3,20); SHA256_EXP(3,4,5,6,7,0,1,2,21);
+    SHA256_EXP(2,3,4,5,6,7,0,1,22); SHA256_EXP(1,2,3,4,5,6,7,0,23);
+    SHA256_EXP(0,1,2,3,4,5,6,7,24); SHA256_EXP(7,0,1,2,3,4,5,6,25);
+    SHA256_EXP(6,7,0,1,2,3,4,5,26); SHA256_EXP(5,6,7,0,1,2,3,4,27);
+    SHA256_EXP(4,5,6,7,0,1,2,3,28); SHA256_EXP(3,4,5,6,7,0,1,2,29);
+    SHA256_EXP(2,3,4,5,6,7,0,1,30); SHA256_EXP(1,2,3,4,5,6,7,0,31);
+    SHA256_EXP(0,1,2,3,4,5,6,7,32); SHA256_EXP(7,0,1,2,3,4,5,6,33);
+    SHA256_EXP(6,7,0,1,2,3,4,5,34); SHA256_EXP(5,6,7,0,1,2,3,4,35);
+    SHA256_EXP(4,5,6,7,0,1,2,3,36); SHA256_EXP(3,4,5,6,7,0,1,2,37);
+    SHA256_EXP(2,3,4,5,6,7,0,1,38); SHA256_EXP(1,2,3,4,5,6,7,0,39);
+    SHA256_EXP(0,1,2,3,4,5,6,7,40); SHA256_EXP(7,0,1,2,3,4,5,6,41);
+    SHA256_EXP(6,7,0,1,2,3,4,5,42); SHA256_EXP(5,6,7,0,1,2,3,4,43);
+    SHA256_EXP(4,5,6,7,0,1,2,3,44); SHA256_EXP(3,4,5,6,7,0,1,2,45);
+    SHA256_EXP(2,3,4,5,6,7,0,1,46); SHA256_EXP(1,2,3,4,5,6,7,0,47);
+    SHA256_EXP(0,1,2,3,4,5,6,7,48); SHA256_EXP(7,0,1,2,3,4,5,6,49);
+    SHA256_EXP(6,7,0,1,2,3,4,5,50); SHA256_EXP(5,6,7,0,1,2,3,4,51);
+    SHA256_EXP(4,5,6,7,0,1,2,3,52); SHA256_EXP(3,4,5,6,7,0,1,2,53);
+    SHA256_EXP(2,3,4,5,6,7,0,1,54); SHA256_EXP(1,2,3,4,5,6,7,0,55);
+    SHA256_EXP(0,1,2,3,4,5,6,7,56); SHA256_EXP(7,0,1,2,3,4,5,6,57);
+    SHA256_EXP(6,7,0,1,2,3,4,5,58); SHA256_EXP(5,6,7,0,1,2,3,4,59);
+    SHA256_EXP(4,5,6,7,0,1,2,3,60); SHA256_EXP(3,4,5,6,7,0,1,2,61);
+    SHA256_EXP(2,3,4,5,6,7,0,1,62); SHA256_EXP(1,2,3,4,5,6,7,0,63);
+
+    h[0] += wv[0]; h[1] += wv[1];
+    h[2] += wv[2]; h[3] += wv[3];
+    h[4] += wv[4]; h[5] += wv[5];
+    h[6] += wv[6]; h[7] += wv[7];
+#endif /* !UNROLL_LOOPS */
+}
 
-        for (j = 0; j < 8; j++) {
-            ctx->h[j] += wv[j];
-        }
+static inline __attribute__((always_inline))
+void sha256_block(uint32 h[8], const uint8 *sub_block)
+{
+    uint32 w[64];
+
+#ifndef UNROLL_LOOPS
+    int j;
+
+    for (j = 0; j < 16; j++) {
+        PACK32(&sub_block[j << 2], &w[j]);
+    }
 #else
-        PACK32(&sub_block[ 0], &w[ 0]); PACK32(&sub_block[ 4], &w[ 1]);
-        PACK32(&sub_block[ 8], &w[ 2]); PACK32(&sub_block[12], &w[ 3]);
-        PACK32(&sub_block[16], &w[ 4]); PACK32(&sub_block[20], &w[ 5]);
-        PACK32(&sub_block[24], &w[ 6]); PACK32(&sub_block[28], &w[ 7]);
-        PACK32(&sub_block[32], &w[ 8]); PACK32(&sub_block[36], &w[ 9]);
-        PACK32(&sub_block[40], &w[10]); PACK32(&sub_block[44], &w[11]);
-        PACK32(&sub_block[48], &w[12]); PACK32(&sub_block[52], &w[13]);
-        PACK32(&sub_block[56], &w[14]); PACK32(&sub_block[60], &w[15]);
-
-        SHA256_SCR(16); SHA256_SCR(17); SHA256_SCR(18); SHA256_SCR(19);
-        SHA256_SCR(20); SHA256_SCR(21); SHA256_SCR(22); SHA256_SCR(23);
-        SHA256_SCR(24); SHA256_SCR(25); SHA256_SCR(26); SHA256_SCR(27);
-        SHA256_SCR(28); SHA256_SCR(29); SHA256_SCR(30); SHA256_SCR(31);
-        SHA256_SCR(32); SHA256_SCR(33); SHA256_SCR(34); SHA256_SCR(35);
-        SHA256_SCR(36); SHA256_SCR(37); SHA256_SCR(38); SHA256_SCR(39);
-        SHA256_SCR(40); SHA256_SCR(41); SHA256_SCR(42); SHA256_SCR(43);
-        SHA256_SCR(44); SHA256_SCR(45); SHA256_SCR(46); SHA256_SCR(47);
-        SHA256_SCR(48); SHA256_SCR(49); SHA256_SCR(50); SHA256_SCR(51);
-        SHA256_SCR(52); SHA256_SCR(53); SHA256_SCR(54); SHA256_SCR(55);
-        SHA256_SCR(56); SHA256_SCR(57); SHA256_SCR(58); SHA256_SCR(59);
-        SHA256_SCR(60); SHA256_SCR(61); SHA256_SCR(62); SHA256_SCR(63);
-
-        wv[0] = ctx->h[0]; wv[1] = ctx->h[1];
-        wv[2] = ctx->h[2]; wv[3] = ctx->h[3];
-        wv[4] = ctx->h[4]; wv[5] = ctx->h[5];
-        wv[6] = ctx->h[6]; wv[7] = ctx->h[7];
-
-        SHA256_EXP(0,1,2,3,4,5,6,7, 0); SHA256_EXP(7,0,1,2,3,4,5,6, 1);
-        SHA256_EXP(6,7,0,1,2,3,4,5, 2); SHA256_EXP(5,6,7,0,1,2,3,4, 3);
-        SHA256_EXP(4,5,6,7,0,1,2,3, 4); SHA256_EXP(3,4,5,6,7,0,1,2, 5);
-        SHA256_EXP(2,3,4,5,6,7,0,1, 6); SHA256_EXP(1,2,3,4,5,6,7,0, 7);
-        SHA256_EXP(0,1,2,3,4,5,6,7, 8); SHA256_EXP(7,0,1,2,3,4,5,6, 9);
-        SHA256_EXP(6,7,0,1,2,3,4,5,10); SHA256_EXP(5,6,7,0,1,2,3,4,11);
-        SHA256_EXP(4,5,6,7,0,1,2,3,12); SHA256_EXP(3,4,5,6,7,0,1,2,13);
-        SHA256_EXP(2,3,4,5,6,7,0,1,14); SHA256_EXP(1,2,3,4,5,6,7,0,15);
-        SHA256_EXP(0,1,2,3,4,5,6,7,16); SHA256_EXP(7,0,1,2,3,4,5,6,17);
-        SHA256_EXP(6,7,0,1,2,3,4,5,18); SHA256_EXP(5,6,7,0,1,2,3,4,19);
-        SHA256_EXP(4,5,6,7,0,1,2,3,20); SHA256_EXP(3,4,5,6,7,0,1,2,21);
-        SHA256_EXP(2,3,4,5,6,7,0,1,22); SHA256_EXP(1,2,3,4,5,6,7,0,23);
-        SHA256_EXP(0,1,2,3,4,5,6,7,24); SHA256_EXP(7,0,1,2,3,4,5,6,25);
-        SHA256_EXP(6,7,0,1,2,3,4,5,26); SHA256_EXP(5,6,7,0,1,2,3,4,27);
-        SHA256_EXP(4,5,6,7,0,1,2,3,28); SHA256_EXP(3,4,5,6,7,0,1,2,29);
-        SHA256_EXP(2,3,4,5,6,7,0,1,30); SHA256_EXP(1,2,3,4,5,6,7,0,31);
-        SHA256_EXP(0,1,2,3,4,5,6,7,32); SHA256_EXP(7,0,1,2,3,4,5,6,33);
-        SHA256_EXP(6,7,0,1,2,3,4,5,34); SHA256_EXP(5,6,7,0,1,2,3,4,35);
-        SHA256_EXP(4,5,6,7,0,1,2,3,36); SHA256_EXP(3,4,5,6,7,0,1,2,37);
-        SHA256_EXP(2,3,4,5,6,7,0,1,38); SHA256_EXP(1,2,3,4,5,6,7,0,39);
-        SHA256_EXP(0,1,2,3,4,5,6,7,40); SHA256_EXP(7,0,1,2,3,4,5,6,41);
-        SHA256_EXP(6,7,0,1,2,3,4,5,42); SHA256_EXP(5,6,7,0,1,2,3,4,43);
-        SHA256_EXP(4,5,6,7,0,1,2,3,44); SHA256_EXP(3,4,5,6,7,0,1,2,45);
-        SHA256_EXP(2,3,4,5,6,7,0,1,46); SHA256_EXP(1,2,3,4,5,6,7,0,47);
-        SHA256_EXP(0,1,2,3,4,5,6,7,48); SHA256_EXP(7,0,1,2,3,4,5,6,49);
-        SHA256_EXP(6,7,0,1,2,3,4,5,50); SHA256_EXP(5,6,7,0,1,2,3,4,51);
-        SHA256_EXP(4,5,6,7,0,1,2,3,52); SHA256_EXP(3,4,5,6,7,0,1,2,53);
-        SHA256_EXP(2,3,4,5,6,7,0,1,54); SHA256_EXP(1,2,3,4,5,6,7,0,55);
-        SHA256_EXP(0,1,2,3,4,5,6,7,56); SHA256_EXP(7,0,1,2,3,4,5,6,57);
-        SHA256_EXP(6,7,0,1,2,3,4,5,58); SHA256_EXP(5,6,7,0,1,2,3,4,59);
-        SHA256_EXP(4,5,6,7,0,1,2,3,60); SHA256_EXP(3,4,5,6,7,0,1,2,61);
-        SHA256_EXP(2,3,4,5,6,7,0,1,62); SHA256_EXP(1,2,3,4,5,6,7,0,63);
-
-        ctx->h[0] += wv[0]; ctx->h[1] += wv[1];
-        ctx->h[2] += wv[2]; ctx->h[3] += wv[3];
-        ctx->h[4] += wv[4]; ctx->h[5] += wv[5];
-        ctx->h[6] += wv[6]; ctx->h[7] += wv[7];
+    PACK32(&sub_block[ 0], &w[ 0]); PACK32(&sub_block[ 4], &w[ 1]);
+    PACK32(&sub_block[ 8], &w[ 2]); PACK32(&sub_block[12], &w[ 3]);
+    PACK32(&sub_block[16], &w[ 4]); PACK32(&sub_block[20], &w[ 5]);
+    PACK32(&sub_block[24], &w[ 6]); PACK32(&sub_block[28], &w[ 7]);
+    PACK32(&sub_block[32], &w[ 8]); PACK32(&sub_block[36], &w[ 9]);
+    PACK32(&sub_block[40], &w[10]); PACK32(&sub_block[44], &w[11]);
+    PACK32(&sub_block[48], &w[12]); PACK32(&sub_block[52], &w[13]);
+    PACK32(&sub_block[56], &w[14]); PACK32(&sub_block[60], &w[15]);
 #endif /* !UNROLL_LOOPS */
+
+    sha256_rounds(h, w);
+}
+
+/* Portable compression function, also the fallback when the CPU has no SHA instructions */
+
+void sha256_compress_generic(uint32 h[8], const uint8 *message,
+                             size_t block_nb)
+{
+    size_t i;
+
+    for (i = 0; i < block_nb; i++) {
+        sha256_block(h, message + (i << 6));
+    }
+}
+
+/* Runtime dispatch */
+
+struct sha256_backend_desc {
+    const char *name;
+    sha256_compress_fn compress;
+};
+
+static const struct sha256_backend_desc sha256_generic_backend = {
+    "generic", sha256_compress_generic
+};
+
+static struct sha256_backend_desc sha256_hw_backend;
+static const struct sha256_backend_desc *sha256_current;
+
+/* Check a backend against the "abc" vector before trusting it */
+static int sha256_backend_ok(sha256_compress_fn compress)
+{
+    static const uint8 expect[SHA256_DIGEST_SIZE] =
+        {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+         0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+         0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+         0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+    uint8 block[SHA256_BLOCK_SIZE];
+    uint8 digest[SHA256_DIGEST_SIZE];
+    uint32 h[8];
+    int i;
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, "abc", 3);
+    block[3] = 0x80;
+    block[SHA256_BLOCK_SIZE - 1] = 24;
+
+    memcpy(h, sha256_h0, sizeof(h));
+    compress(h, block, 1);
+    for (i = 0; i < 8; i++) {
+        UNPACK32(h[i], &digest[i << 2]);
+    }
+
+    return memcmp(digest, expect, sizeof(digest)) == 0;
+}
+
+static const struct sha256_backend_desc *sha256_probe_hw(void)
+{
+    const struct sha256_backend_desc *hw;
+    const char *name = NULL;
+    sha256_compress_fn compress;
+
+    hw = __atomic_load_n(&sha256_current, __ATOMIC_ACQUIRE);
+    if (hw == &sha256_hw_backend) {
+        return hw;
+    }
+
+    compress = sha256_hw_compress(&name);
+    if (compress == NULL || !sha256_backend_ok(compress)) {
+        return NULL;
+    }
+
+    /* Every thread computes the same values, so racing writers are harmless */
+    sha256_hw_backend.name = name;
+    sha256_hw_backend.compress = compress;
+    return &sha256_hw_backend;
+}
+
+/* Pick the backend on first use: SHA256_BACKEND=generic forces the portable code */
+static const struct sha256_backend_desc *sha256_resolve(void)
+{
+    const struct sha256_backend_desc *backend = NULL;
+    const char *env = getenv("SHA256_BACKEND");
+
+    if (env == NULL || strcmp(env, "generic") != 0) {
+        backend = sha256_probe_hw();
+    }
+    if (backend == NULL) {
+        backend = &sha256_generic_backend;
+    }
+
+    __atomic_store_n(&sha256_current, backend, __ATOMIC_RELEASE);
+    return backend;
+}
+
+void sha256_compress(uint32 h[8], const uint8 *message, size_t block_nb)
+{
+    const struct sha256_backend_desc *backend;
+
+    backend = __atomic_load_n(&sha256_current, __ATOMIC_ACQUIRE);
+    if (backend == NULL) {
+        backend = sha256_resolve();
+    }
+
+    backend->compress(h, message, block_nb);
+}
+
+void sha256_transf(sha256_ctx *ctx, const uint8 *message,
+                   uint32 block_nb)
+{
+    if (block_nb) {
+        sha256_compress(ctx->h, message, block_nb);
     }
 }
 
+/* Name of the active backend: "generic", "sha-ni" or "armv8-sha2" */
+const char *sha256_backend(void)
+{
+    const struct sha256_backend_desc *backend;
+
+    backend = __atomic_load_n(&sha256_current, __ATOMIC_ACQUIRE);
+    if (backend == NULL) {
+        backend = sha256_resolve();
+    }
+
+    return backend->name;
+}
+
+/* Select a backend by name, NULL or "auto" for the fastest available.
+ * Returns -1 if the requested backend is not supported on this CPU. */
+int sha256_use_backend(const char *name)
+{
+    const struct sha256_backend_desc *backend;
+
+    if (name == NULL || strcmp(name, "auto") == 0) {
+        backend = sha256_probe_hw();
+        if (backend == NULL) {
+            backend = &sha256_generic_backend;
+        }
+    } else if (strcmp(name, "generic") == 0) {
+        backend = &sha256_generic_backend;
+    } else {
+        backend = sha256_probe_hw();
+        if (backend == NULL || strcmp(name, backend->name) != 0) {
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&sha256_current, backend, __ATOMIC_RELEASE);
+    return 0;
+}
+
 void sha256(const uint8 *message, uint32 len, uint8 *digest)
 {
     sha256_ctx ctx;
@@ -260,6 +418,153 @@ void sha256(const uint8 *message, uint32 len, uint8 *digest)
     sha256_final(&ctx, digest);
 }
 
+/* Fixed-length one-shot hashing. len is a compile-time constant in every
+ * instance below, so the tail block, its padding and the bit length are laid
+ * out at compile time and nothing is buffered through a sha256_ctx. */
+
+/* Word j of the padded tail: message bytes, the 0x80 marker, zeros, bit length */
+static inline __attribute__((always_inline))
+uint32 sha256_tail_word(const uint8 *tail, const uint32 rem, const uint32 bits,
+                        const uint32 tail_len, const uint32 j)
+{
+    const uint32 pos = j << 2;
+    uint32 x = 0;
+    uint32 k;
+
+    if (pos + 4 <= rem) {
+        PACK32(&tail[pos], &x);
+        return x;
+    }
+    if (pos + 4 == tail_len) {
+        return bits;
+    }
+
+    for (k = 0; k < 4; k++) {
+        if (pos + k < rem) {
+            x |= (uint32) tail[pos + k] << (24 - 8 * k);
+        } else if (pos + k == rem) {
+            x |= (uint32) 0x80 << (24 - 8 * k);
+        }
+    }
+    return x;
+}
+
+/* Padded tail block b of a message with rem trailing bytes, straight into w[] */
+#define SHA256_TAIL_BLOCK(b)                                                \
+{                                                                           \
+    w[ 0] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  0);      \
+    w[ 1] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  1);      \
+    w[ 2] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  2);      \
+    w[ 3] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  3);      \
+    w[ 4] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  4);      \
+    w[ 5] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  5);      \
+    w[ 6] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  6);      \
+    w[ 7] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  7);      \
+    w[ 8] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  8);      \
+    w[ 9] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) +  9);      \
+    w[10] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 10);      \
+    w[11] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 11);      \
+    w[12] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 12);      \
+    w[13] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 13);      \
+    w[14] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 14);      \
+    w[15] = sha256_tail_word(tail, rem, bits, tail_len, 16 * (b) + 15);      \
+    sha256_rounds(h, w);                                                    \
+}
+
+static inline __attribute__((always_inline))
+void sha256_fixed_body(const uint32 iv[8], const uint32 prefix_len,
+                       const uint8 *message, const uint32 len, uint8 *digest)
+{
+    const uint32 full_nb = len / SHA256_BLOCK_SIZE;
+    const uint32 rem = len % SHA256_BLOCK_SIZE;
+    const uint32 tail_nb = rem < SHA256_BLOCK_SIZE - 8 ? 1 : 2;
+    const uint32 tail_len = tail_nb * SHA256_BLOCK_SIZE;
+    const uint32 bits = (prefix_len + len) << 3;
+    const uint8 *tail = message + full_nb * SHA256_BLOCK_SIZE;
+    const struct sha256_backend_desc *backend;
+    uint8 block[2 * SHA256_BLOCK_SIZE];
+    uint32 w[64];
+    uint32 h[8];
+
+    memcpy(h, iv, sizeof(h));
+
+    backend = __atomic_load_n(&sha256_current, __ATOMIC_ACQUIRE);
+    if (backend == NULL) {
+        backend = sha256_resolve();
+    }
+
+    if (backend == &sha256_generic_backend) {
+        if (full_nb) {
+            sha256_compress_generic(h, message, full_nb);
+        }
+        SHA256_TAIL_BLOCK(0);
+        if (tail_nb == 2) {
+            SHA256_TAIL_BLOCK(1);
+        }
+    } else {
+        if (full_nb) {
+            backend->compress(h, message, full_nb);
+        }
+        memcpy(block, tail, rem);
+        block[rem] = 0x80;
+        memset(block + rem + 1, 0, tail_len - rem - 1 - 4);
+        UNPACK32(bits, block + tail_len - 4);
+        backend->compress(h, block, tail_nb);
+    }
+
+    UNPACK32(h[0], &digest[ 0]);
+    UNPACK32(h[1], &digest[ 4]);
+    UNPACK32(h[2], &digest[ 8]);
+    UNPACK32(h[3], &digest[12]);
+    UNPACK32(h[4], &digest[16]);
+    UNPACK32(h[5], &digest[20]);
+    UNPACK32(h[6], &digest[24]);
+    UNPACK32(h[7], &digest[28]);
+}
+
+void sha256_fixed_39(const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(sha256_h0, 0, message, 39, digest);
+}
+
+void sha256_fixed_55(const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(sha256_h0, 0, message, 55, digest);
+}
+
+void sha256_fixed_88(const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(sha256_h0, 0, message, 88, digest);
+}
+
+void sha256_fixed_96(const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(sha256_h0, 0, message, 96, digest);
+}
+
+void sha256_fixed_152(const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(sha256_h0, 0, message, 152, digest);
+}
+
+/* Resume from a midstate taken after one 64-byte block, e.g. an HMAC key block */
+
+void sha256_midstate(const uint8 *block, uint32 state[8])
+{
+    memcpy(state, sha256_h0, 8 * sizeof(uint32));
+    sha256_compress(state, block, 1);
+}
+
+void sha256_resume_32(const uint32 state[8], const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(state, SHA256_BLOCK_SIZE, message, 32, digest);
+}
+
+void sha256_resume_88(const uint32 state[8], const uint8 *message, uint8 *digest)
+{
+    sha256_fixed_body(state, SHA256_BLOCK_SIZE, message, 88, digest);
+}
+
 void sha256_init(sha256_ctx *ctx)
 {
 #ifndef UNROLL_LOOPS
@@ -278,45 +583,68 @@ void sha256_init(sha256_ctx *ctx)
     ctx->tot_len = 0;
 }
 
-void sha256_update(sha256_ctx *ctx, const uint8 *message,
-                   uint32 len)
+/* Only a partial head block (completing ctx->block) and the trailing partial
+ * block are staged; every whole block is compressed straight from the
+ * caller's buffer. */
+static void sha256_update_bytes(sha256_ctx *ctx, const uint8 *message,
+                                size_t len)
 {
-    uint32 block_nb;
-    uint32 new_len, rem_len, tmp_len;
-    const uint8 *shifted_message;
-
-    tmp_len = SHA256_BLOCK_SIZE - ctx->len;
-    rem_len = len < tmp_len ? len : tmp_len;
+    size_t block_nb;
+    uint32 fill;
+
+    if (ctx->len) {
+        fill = SHA256_BLOCK_SIZE - ctx->len;
+        if (len < fill) {
+            memcpy(&ctx->block[ctx->len], message, len);
+            ctx->len += len;
+            return;
+        }
 
-    memcpy(&ctx->block[ctx->len], message, rem_len);
+        memcpy(&ctx->block[ctx->len], message, fill);
+        sha256_compress(ctx->h, ctx->block, 1);
+        ctx->tot_len += SHA256_BLOCK_SIZE;
+        ctx->len = 0;
 
-    if (ctx->len + len < SHA256_BLOCK_SIZE) {
-        ctx->len += len;
-        return;
+        message += fill;
+        len -= fill;
     }
 
-    new_len = len - rem_len;
-    block_nb = new_len / SHA256_BLOCK_SIZE;
+    block_nb = len / SHA256_BLOCK_SIZE;
+    if (block_nb) {
+        sha256_compress(ctx->h, message, block_nb);
+        ctx->tot_len += (uint64) block_nb << 6;
 
-    shifted_message = message + rem_len;
+        message += block_nb << 6;
+        len -= block_nb << 6;
+    }
 
-    sha256_transf(ctx, ctx->block, 1);
-    sha256_transf(ctx, shifted_message, block_nb);
+    if (len) {
+        memcpy(ctx->block, message, len);
+        ctx->len = len;
+    }
+}
 
-    rem_len = new_len % SHA256_BLOCK_SIZE;
+void sha256_update(sha256_ctx *ctx, const uint8 *message,
+                   uint32 len)
+{
+    sha256_update_bytes(ctx, message, len);
+}
 
-    memcpy(ctx->block, &shifted_message[block_nb << 6],
-           rem_len);
+/* Scatter-gather update, equivalent to sha256_update() on each element in turn */
+void sha256_updatev(sha256_ctx *ctx, const struct iovec *iov, int iovcnt)
+{
+    int i;
 
-    ctx->len = rem_len;
-    ctx->tot_len += (block_nb + 1) << 6;
+    for (i = 0; i < iovcnt; i++) {
+        sha256_update_bytes(ctx, (const uint8 *) iov[i].iov_base, iov[i].iov_len);
+    }
 }
 
 void sha256_final(sha256_ctx *ctx, uint8 *digest)
 {
     uint32 block_nb;
     uint32 pm_len;
-    uint32 len_b;
+    uint64 len_b;
 
 #ifndef UNROLL_LOOPS
     int i;
@@ -330,7 +658,8 @@ void sha256_final(sha256_ctx *ctx, uint8 *digest)
 
     memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
     ctx->block[ctx->len] = 0x80;
-    UNPACK32(len_b, ctx->block + pm_len - 4);
+    UNPACK32((uint32) (len_b >> 32), ctx->block + pm_len - 8);
+    UNPACK32((uint32) len_b, ctx->block + pm_len - 4);
 
     sha256_transf(ctx, ctx->block, block_nb);
 
@@ -360,39 +689,13 @@ void sha256_noPad(sha256_ctx *ctx, uint8 *digest)
 }
 
 
-#ifdef TEST_VECTORS
-
 /* FIPS 180-2 Validation tests */
 
-#include <stdio.h>
-#include <stdlib.h>
-
-void test(const uint8 *vector, uint8 *digest,
-          uint32 digest_size)
+static int sha256_test_vectors(void)
 {
-    uint8 output[2 * SHA256_DIGEST_SIZE + 1];
-    int i;
-
-    output[2 * digest_size] = '\0';
-
-    for (i = 0; i < (int) digest_size ; i++) {
-       sprintf((char *) output + 2 * i, "%02x", digest[i]);
-    }
-
-    //printf("H: %s\n", output);
-    if (strcmp((char *) vector, (char *) output)) {
-        fprintf(stderr, "Test failed.\n");
-//      exit(EXIT_FAILURE);
-        exit(-1);
-    }
-}
-
-int SHA256main()
-{
-#if 1
-      static const uint8 *vectors[3] =
+    static const char *vectors[3] =
     {
-    	/* SHA-256 */
+        /* SHA-256 */
         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
         "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
@@ -404,36 +707,54 @@ int SHA256main()
     uint8 message3[100];
     uint32 message3_updates  = 1000000/sizeof(message3);
 
-	sha256_ctx ctx;
-    uint8 digest[SHA256_DIGEST_SIZE];
+    sha256_ctx ctx;
+    uint8 digest[3][SHA256_DIGEST_SIZE];
+    char output[2 * SHA256_DIGEST_SIZE + 1];
     uint32 i;
+    int j, failed = 0;
 
     memset(message3, 'a', sizeof(message3));
 
-    //printf("SHA-2 FIPS 180-2 Validation tests\n\n");
+    sha256(message1, strlen((const char *) message1), digest[0]);
+    sha256(message2a, strlen((const char *) message2a), digest[1]);
 
-    //printf("SHA-256 Test vectors\n");
+    sha256_init(&ctx);
+    for (i = 0; i < message3_updates; i++) {
+        sha256_update(&ctx, message3, sizeof(message3));
+    }
+    sha256_final(&ctx, digest[2]);
 
-    sha256(message1, strlen((char *) message1), digest);
-//  test(vectors[0], digest, SHA256_DIGEST_SIZE);
-    sha256(message2a, strlen((char *) message2a), digest);
-//  test(vectors[1], digest, SHA256_DIGEST_SIZE);
+    for (j = 0; j < 3; j++) {
+        for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+            sprintf(output + 2 * i, "%02x", digest[j][i]);
+        }
+        if (strcmp(vectors[j], output)) {
+            printf("FAILED! sha256 %s vector %d: %s\n", sha256_backend(), j, output);
+            failed = 1;
+        }
+    }
 
-	sha256_init(&ctx);
-	for(i=0; i<message3_updates; i++)
-		sha256_update( &ctx, message3, sizeof(message3) );
-	sha256_final(&ctx, digest);
-//  test(vectors[2], digest, SHA256_DIGEST_SIZE);
+    return failed;
+}
 
-    //printf("\n");
-    //printf("All tests passed.\n");
+/* Run the FIPS vectors on every backend this CPU supports, then restore
+ * the active one. Returns 0 when all pass. Not meant to run concurrently
+ * with other hashing since it switches the global backend. */
+int sha256_self_test(void)
+{
+    const struct sha256_backend_desc *saved;
+    int failed;
 
-	// debug: breakpoint target
-	asm volatile("nop"::);
+    saved = __atomic_load_n(&sha256_current, __ATOMIC_ACQUIRE);
 
-#endif
-  return 0;
-}
+    __atomic_store_n(&sha256_current, &sha256_generic_backend, __ATOMIC_RELEASE);
+    failed = sha256_test_vectors();
 
-#endif /* TEST_VECTORS */
+    if (sha256_probe_hw() != NULL) {
+        __atomic_store_n(&sha256_current, &sha256_hw_backend, __ATOMIC_RELEASE);
+        failed |= sha256_test_vectors();
+    }
 
+    __atomic_store_n(&sha256_current, saved, __ATOMIC_RELEASE);
+    return failed;
+}
@@ -38,6 +38,10 @@
 #ifndef SHA2_H
 #define SHA2_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
 #define SHA224_DIGEST_SIZE ( 224 / 8)
 #define SHA256_DIGEST_SIZE ( 256 / 8)
 
@@ -55,9 +59,10 @@ typedef unsigned long long uint64;
 
 #ifndef SHA2_TYPES
 #define SHA2_TYPES
-typedef unsigned char uint8;
-typedef unsigned int  uint16;
-typedef unsigned long uint32;
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
 #endif
 
 #ifdef __cplusplus
@@ -65,7 +70,7 @@ extern "C" {
 #endif
 
 typedef struct {
-    uint32 tot_len;
+    uint64 tot_len;
     uint32 len;
     uint8 block[2 * SHA256_BLOCK_SIZE];
     uint32 h[8];
@@ -73,12 +78,61 @@ typedef struct {
 
 void sha256_init(sha256_ctx * ctx);
 void sha256_update(sha256_ctx *ctx, const uint8 *message, uint32 len);
+void sha256_updatev(sha256_ctx *ctx, const struct iovec *iov, int iovcnt);
 void sha256_final(sha256_ctx *ctx, uint8 *digest);
 
 void sha256_noPad(sha256_ctx *ctx, uint8 *digest);
 
 void sha256(const uint8 *message, uint32 len, uint8 *digest);
 
+extern const uint32 sha256_h0[8];
+extern const uint32 sha256_k[64];
+
+/* One-shot kernels for the ATSHA204 host-side message sizes */
+
+void sha256_fixed_39(const uint8 *message, uint8 *digest);
+void sha256_fixed_55(const uint8 *message, uint8 *digest);
+void sha256_fixed_88(const uint8 *message, uint8 *digest);
+void sha256_fixed_96(const uint8 *message, uint8 *digest);
+void sha256_fixed_152(const uint8 *message, uint8 *digest);
+
+void sha256_midstate(const uint8 *block, uint32 state[8]);
+void sha256_resume_32(const uint32 state[8], const uint8 *message, uint8 *digest);
+void sha256_resume_88(const uint32 state[8], const uint8 *message, uint8 *digest);
+
+/* With a constant len this folds to the matching kernel, other lengths use sha256() */
+static inline void sha256_fixed(const uint8 *message, uint32 len, uint8 *digest)
+{
+    switch (len) {
+    case 39:  sha256_fixed_39(message, digest);  break;
+    case 55:  sha256_fixed_55(message, digest);  break;
+    case 88:  sha256_fixed_88(message, digest);  break;
+    case 96:  sha256_fixed_96(message, digest);  break;
+    case 152: sha256_fixed_152(message, digest); break;
+    default:  sha256(message, len, digest);      break;
+    }
+}
+
+/* Compression function backends, selected at runtime */
+
+typedef void (*sha256_compress_fn)(uint32 h[8], const uint8 *message, size_t block_nb);
+
+void sha256_transf(sha256_ctx *ctx, const uint8 *message, uint32 block_nb);
+void sha256_compress(uint32 h[8], const uint8 *message, size_t block_nb);
+void sha256_compress_generic(uint32 h[8], const uint8 *message, size_t block_nb);
+sha256_compress_fn sha256_hw_compress(const char **name);
+
+const char *sha256_backend(void);
+int sha256_use_backend(const char *name);
+int sha256_self_test(void);
+
+/* Multi-buffer: independent messages hashed in parallel SIMD lanes (sha256_mb.c) */
+
+void sha256_many(const uint8 *const msgs[], const uint32 lens[],
+                 uint8 *const digests[], size_t n);
+int sha256_many_lanes(void);
+int sha256_many_use_lanes(int lanes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,214 @@
+/** \file 	sha256_hw.c
+ *  \brief 	SHA-256 compression using CPU SHA instructions
+ *
+ *  x86-64: SHA-NI (sha256rnds2/sha256msg1/sha256msg2), detected with cpuid.
+ *  AArch64: ARMv8 crypto extension (sha256h/sha256h2/sha256su0/sha256su1), detected with HWCAP_SHA2.
+ *  Other targets (e.g. the ARMv7 i.MX6UL, which has no SHA instructions) return NULL and
+ *  sha256.c keeps the portable code. Both kernels are compiled with function-level target
+ *  attributes, so the rest of the build needs no extra -m flags.
+ */
+
+#include <stddef.h>
+
+#include "sha256.h"
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Four rounds, message words Mc, constants K[4g..4g+3] */
+#define SHANI_RNDS(Mc, g)                                                       \
+    MSG = _mm_add_epi32(Mc, _mm_loadu_si128((const __m128i *) &sha256_k[4 * (g)])); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+
+#define SHANI_RNDS_END                                                          \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E);                                         \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+/* Message schedule: Mn += W[t-7] part, then sigma1 */
+#define SHANI_MSG2(Mn, Mc, Mp)                                                  \
+    TMP = _mm_alignr_epi8(Mc, Mp, 4);                                           \
+    Mn = _mm_add_epi32(Mn, TMP);                                                \
+    Mn = _mm_sha256msg2_epu32(Mn, Mc);
+
+#define SHANI_MSG1(Mp, Mc)                                                      \
+    Mp = _mm_sha256msg1_epu32(Mp, Mc);
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32 h[8], const uint8 *message, size_t block_nb)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, MSG, TMP;
+    __m128i M0, M1, M2, M3;
+    __m128i ABEF_SAVE, CDGH_SAVE;
+
+    /* h[0..7] = ABCDEFGH -> ABEF / CDGH as expected by sha256rnds2 */
+    TMP = _mm_loadu_si128((const __m128i *) &h[0]);
+    STATE1 = _mm_loadu_si128((const __m128i *) &h[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    while (block_nb--) {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        M0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message +  0)), MASK);
+        SHANI_RNDS(M0, 0);  SHANI_RNDS_END;
+
+        M1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 16)), MASK);
+        SHANI_RNDS(M1, 1);  SHANI_RNDS_END;                      SHANI_MSG1(M0, M1);
+
+        M2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 32)), MASK);
+        SHANI_RNDS(M2, 2);  SHANI_RNDS_END;                      SHANI_MSG1(M1, M2);
+
+        M3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (message + 48)), MASK);
+        SHANI_RNDS(M3, 3);  SHANI_MSG2(M0, M3, M2); SHANI_RNDS_END; SHANI_MSG1(M2, M3);
+
+        SHANI_RNDS(M0, 4);  SHANI_MSG2(M1, M0, M3); SHANI_RNDS_END; SHANI_MSG1(M3, M0);
+        SHANI_RNDS(M1, 5);  SHANI_MSG2(M2, M1, M0); SHANI_RNDS_END; SHANI_MSG1(M0, M1);
+        SHANI_RNDS(M2, 6);  SHANI_MSG2(M3, M2, M1); SHANI_RNDS_END; SHANI_MSG1(M1, M2);
+        SHANI_RNDS(M3, 7);  SHANI_MSG2(M0, M3, M2); SHANI_RNDS_END; SHANI_MSG1(M2, M3);
+        SHANI_RNDS(M0, 8);  SHANI_MSG2(M1, M0, M3); SHANI_RNDS_END; SHANI_MSG1(M3, M0);
+        SHANI_RNDS(M1, 9);  SHANI_MSG2(M2, M1, M0); SHANI_RNDS_END; SHANI_MSG1(M0, M1);
+        SHANI_RNDS(M2, 10); SHANI_MSG2(M3, M2, M1); SHANI_RNDS_END; SHANI_MSG1(M1, M2);
+        SHANI_RNDS(M3, 11); SHANI_MSG2(M0, M3, M2); SHANI_RNDS_END; SHANI_MSG1(M2, M3);
+        SHANI_RNDS(M0, 12); SHANI_MSG2(M1, M0, M3); SHANI_RNDS_END; SHANI_MSG1(M3, M0);
+        SHANI_RNDS(M1, 13); SHANI_MSG2(M2, M1, M0); SHANI_RNDS_END;
+        SHANI_RNDS(M2, 14); SHANI_MSG2(M3, M2, M1); SHANI_RNDS_END;
+        SHANI_RNDS(M3, 15);                         SHANI_RNDS_END;
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+
+        message += SHA256_BLOCK_SIZE;
+    }
+
+    /* ABEF / CDGH -> ABCDEFGH */
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+
+    _mm_storeu_si128((__m128i *) &h[0], STATE0);
+    _mm_storeu_si128((__m128i *) &h[4], STATE1);
+}
+
+/* SHA-NI: CPUID.(EAX=7,ECX=0):EBX[29]; the kernel also uses SSSE3 pshufb and SSE4.1 pblendw */
+static int sha256_cpu_has_shani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+
+    return (ebx & (1u << 29)) != 0;
+}
+
+sha256_compress_fn sha256_hw_compress(const char **name)
+{
+    if (!sha256_cpu_has_shani()) {
+        return NULL;
+    }
+
+    *name = "sha-ni";
+    return sha256_compress_shani;
+}
+
+
+#elif defined(__aarch64__) && defined(__GNUC__)
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+/* Four rounds with constants K[4g..4g+3]; M0 is then advanced to the words for round group g+4 */
+#define ARMV8_QUAD(g, M0, M1, M2, M3)                                           \
+    W = vaddq_u32(M0, vld1q_u32(&sha256_k[4 * (g)]));                           \
+    M0 = vsha256su0q_u32(M0, M1);                                               \
+    T = STATE0;                                                                 \
+    STATE0 = vsha256hq_u32(STATE0, STATE1, W);                                  \
+    STATE1 = vsha256h2q_u32(STATE1, T, W);                                      \
+    M0 = vsha256su1q_u32(M0, M2, M3);
+
+#define ARMV8_QUAD_LAST(g, M0)                                                  \
+    W = vaddq_u32(M0, vld1q_u32(&sha256_k[4 * (g)]));                           \
+    T = STATE0;                                                                 \
+    STATE0 = vsha256hq_u32(STATE0, STATE1, W);                                  \
+    STATE1 = vsha256h2q_u32(STATE1, T, W);
+
+__attribute__((target("+crypto")))
+static void sha256_compress_armv8(uint32 h[8], const uint8 *message, size_t block_nb)
+{
+    uint32x4_t STATE0, STATE1, ABCD_SAVE, EFGH_SAVE, W, T;
+    uint32x4_t M0, M1, M2, M3;
+
+    STATE0 = vld1q_u32(&h[0]);
+    STATE1 = vld1q_u32(&h[4]);
+
+    while (block_nb--) {
+        ABCD_SAVE = STATE0;
+        EFGH_SAVE = STATE1;
+
+        M0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message +  0)));
+        M1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 16)));
+        M2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 32)));
+        M3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 48)));
+
+        ARMV8_QUAD(0,  M0, M1, M2, M3);
+        ARMV8_QUAD(1,  M1, M2, M3, M0);
+        ARMV8_QUAD(2,  M2, M3, M0, M1);
+        ARMV8_QUAD(3,  M3, M0, M1, M2);
+        ARMV8_QUAD(4,  M0, M1, M2, M3);
+        ARMV8_QUAD(5,  M1, M2, M3, M0);
+        ARMV8_QUAD(6,  M2, M3, M0, M1);
+        ARMV8_QUAD(7,  M3, M0, M1, M2);
+        ARMV8_QUAD(8,  M0, M1, M2, M3);
+        ARMV8_QUAD(9,  M1, M2, M3, M0);
+        ARMV8_QUAD(10, M2, M3, M0, M1);
+        ARMV8_QUAD(11, M3, M0, M1, M2);
+        ARMV8_QUAD_LAST(12, M0);
+        ARMV8_QUAD_LAST(13, M1);
+        ARMV8_QUAD_LAST(14, M2);
+        ARMV8_QUAD_LAST(15, M3);
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+
+        message += SHA256_BLOCK_SIZE;
+    }
+
+    vst1q_u32(&h[0], STATE0);
+    vst1q_u32(&h[4], STATE1);
+}
+
+sha256_compress_fn sha256_hw_compress(const char **name)
+{
+    if (!(getauxval(AT_HWCAP) & HWCAP_SHA2)) {
+        return NULL;
+    }
+
+    *name = "armv8-sha2";
+    return sha256_compress_armv8;
+}
+
+
+#else
+
+sha256_compress_fn sha256_hw_compress(const char **name)
+{
+    (void) name;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,225 @@
+/** \file 	sha256_mb.c
+ *  \brief 	Multi-buffer SHA-256: hash many independent messages per call
+ *
+ *  Server-side verification hashes thousands of short (mostly 88-byte MAC) messages.
+ *  A single SHA-256 stream is a serial dependency chain, so instead each SIMD lane
+ *  carries a different message: 4 lanes on SSE2/NEON, 8 on AVX2, 16 on AVX-512.
+ *  32-bit ARM toolchains default to VFP without NEON, so a NEON copy of the 4-lane
+ *  kernel is built with a target attribute and picked at run time from HWCAP_NEON.
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+/**
+ * \brief Per-lane job: full blocks are read in place, the padded tail from tail[]
+ */
+struct sha256_mb_lane {
+    long job;                           /* index into msgs[], -1 when idle */
+    const uint8 *message;
+    uint32 full_nb;                     /* whole 64-byte blocks in the message */
+    uint32 block_nb;                    /* total blocks including padding */
+    uint32 index;                       /* current block */
+    uint8 tail[2 * SHA256_BLOCK_SIZE];
+};
+
+static inline void sha256_mb_lane_start(struct sha256_mb_lane *lane, long job,
+                                        const uint8 *message, uint32 len)
+{
+    uint32 rem = len % SHA256_BLOCK_SIZE;
+    uint32 tail_nb = rem < SHA256_BLOCK_SIZE - 8 ? 1 : 2;
+    uint64 len_b = (uint64) len << 3;
+    uint8 *end;
+    int i;
+
+    lane->job = job;
+    lane->message = message;
+    lane->full_nb = len / SHA256_BLOCK_SIZE;
+    lane->block_nb = lane->full_nb + tail_nb;
+    lane->index = 0;
+
+    memset(lane->tail, 0, tail_nb * SHA256_BLOCK_SIZE);
+    if (rem) {
+        memcpy(lane->tail, message + len - rem, rem);
+    }
+    lane->tail[rem] = 0x80;
+
+    end = lane->tail + tail_nb * SHA256_BLOCK_SIZE;
+    for (i = 1; i <= 8; i++) {
+        end[-i] = (uint8) (len_b >> (8 * (i - 1)));
+    }
+}
+
+static inline const uint8 *sha256_mb_lane_block(const struct sha256_mb_lane *lane)
+{
+    if (lane->index < lane->full_nb) {
+        return lane->message + lane->index * SHA256_BLOCK_SIZE;
+    }
+
+    return lane->tail + (lane->index - lane->full_nb) * SHA256_BLOCK_SIZE;
+}
+
+/* Advance to the next block, returns 1 when the message is finished */
+static inline int sha256_mb_lane_next(struct sha256_mb_lane *lane)
+{
+    return ++lane->index == lane->block_nb;
+}
+
+
+#define SHA256_MB_LANES     4
+#define SHA256_MB_TARGET
+#include "sha256_mb_lanes.h"
+#undef SHA256_MB_TARGET
+#undef SHA256_MB_LANES
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#define SHA256_MB_LANES     8
+#define SHA256_MB_TARGET    __attribute__((target("avx2")))
+#include "sha256_mb_lanes.h"
+#undef SHA256_MB_TARGET
+#undef SHA256_MB_LANES
+
+#define SHA256_MB_LANES     16
+#define SHA256_MB_TARGET    __attribute__((target("avx512f")))
+#include "sha256_mb_lanes.h"
+#undef SHA256_MB_TARGET
+#undef SHA256_MB_LANES
+
+#elif defined(__arm__) && defined(__GNUC__) && !defined(__ARM_NEON)
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+#define SHA256_MB_LANES     4
+#define SHA256_MB_SUFFIX    _neon
+#define SHA256_MB_TARGET    __attribute__((target("fpu=neon")))
+#include "sha256_mb_lanes.h"
+#undef SHA256_MB_TARGET
+#undef SHA256_MB_SUFFIX
+#undef SHA256_MB_LANES
+
+#endif
+
+typedef void (*sha256_many_fn)(const uint8 *const msgs[], const uint32 lens[],
+                               uint8 *const digests[], size_t n);
+
+struct sha256_many_desc {
+    int lanes;                          /* 0: hash one message at a time */
+    sha256_many_fn fn;
+};
+
+static struct sha256_many_desc sha256_many_best;
+static const struct sha256_many_desc *sha256_many_current;
+
+/* Widest lane count the CPU supports. SHA-NI / ARMv8 SHA2 on a single stream
+ * beats 4 and 8 lanes, only AVX-512 is faster than them. */
+static const struct sha256_many_desc *sha256_many_resolve(void)
+{
+    struct sha256_many_desc best = { 4, sha256_many_x4 };
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        best.lanes = 16;
+        best.fn = sha256_many_x16;
+    } else if (__builtin_cpu_supports("avx2")) {
+        best.lanes = 8;
+        best.fn = sha256_many_x8;
+    }
+#elif defined(__arm__) && defined(__GNUC__) && !defined(__ARM_NEON)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        best.fn = sha256_many_x4_neon;
+    }
+#endif
+
+    if (best.lanes < 16 && strcmp(sha256_backend(), "generic") != 0) {
+        best.lanes = 0;
+        best.fn = NULL;
+    }
+
+    /* Every thread computes the same values, so racing writers are harmless */
+    sha256_many_best = best;
+    __atomic_store_n(&sha256_many_current, &sha256_many_best, __ATOMIC_RELEASE);
+    return &sha256_many_best;
+}
+
+/* Number of SIMD lanes sha256_many() uses, 0 if it hashes serially */
+int sha256_many_lanes(void)
+{
+    const struct sha256_many_desc *desc;
+
+    desc = __atomic_load_n(&sha256_many_current, __ATOMIC_ACQUIRE);
+    if (desc == NULL) {
+        desc = sha256_many_resolve();
+    }
+
+    return desc->lanes;
+}
+
+/* Force a lane count: 0 hashes serially, 4, 8 or 16 use that kernel, -1 restores the
+ * automatic choice. Returns -1 if the CPU lacks the instructions for that width.
+ * Meant for tests and benchmarks, call it before other threads use sha256_many(). */
+int sha256_many_use_lanes(int lanes)
+{
+    struct sha256_many_desc desc = { lanes, NULL };
+
+    if (lanes < 0) {
+        sha256_many_resolve();
+        return 0;
+    }
+
+    if (lanes == 4) {
+        desc.fn = sha256_many_x4;
+#if defined(__arm__) && defined(__GNUC__) && !defined(__ARM_NEON)
+        if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+            desc.fn = sha256_many_x4_neon;
+        }
+#endif
+    }
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (lanes == 8 && __builtin_cpu_supports("avx2")) {
+        desc.fn = sha256_many_x8;
+    } else if (lanes == 16 && __builtin_cpu_supports("avx512f")) {
+        desc.fn = sha256_many_x16;
+    }
+#endif
+
+    if (lanes != 0 && desc.fn == NULL) {
+        return -1;
+    }
+
+    sha256_many_best = desc;
+    __atomic_store_n(&sha256_many_current, &sha256_many_best, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * \brief Hash n independent messages, digests[i] = SHA-256(msgs[i], lens[i])
+ *
+ * Messages may have different lengths and may alias each other; digests must not
+ * overlap any message.
+ */
+void sha256_many(const uint8 *const msgs[], const uint32 lens[],
+                 uint8 *const digests[], size_t n)
+{
+    const struct sha256_many_desc *desc;
+    size_t i;
+
+    desc = __atomic_load_n(&sha256_many_current, __ATOMIC_ACQUIRE);
+    if (desc == NULL) {
+        desc = sha256_many_resolve();
+    }
+
+    /* With fewer jobs than half the lanes most of each pass would be idle */
+    if (desc->fn == NULL || n < (size_t) desc->lanes / 2) {
+        for (i = 0; i < n; i++) {
+            sha256(msgs[i], lens[i], digests[i]);
+        }
+        return;
+    }
+
+    desc->fn(msgs, lens, digests, n);
+}
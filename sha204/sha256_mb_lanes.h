@@ -0,0 +1,122 @@
+/** \file 	sha256_mb_lanes.h
+ *  \brief 	Multi-buffer SHA-256 kernel, one message per SIMD lane
+ *
+ *  Included by sha256_mb.c once per lane count with
+ *  SHA256_MB_LANES (4, 8, 16) and SHA256_MB_TARGET (function attribute, may be empty) defined,
+ *  optionally SHA256_MB_SUFFIX to name a second copy of the same lane count.
+ *  Uses GCC vector extensions, so the same source becomes SSE2/AVX2/AVX-512 on x86-64 and
+ *  NEON on AArch64, or on 32-bit ARM when SHA256_MB_TARGET enables fpu=neon;
+ *  without SIMD the compiler lowers it to scalar code.
+ */
+
+#define MB_CAT(a, b)    a##b
+#define MB_XCAT(a, b)   MB_CAT(a, b)
+#define MB_VEC          MB_XCAT(sha256_vec, SHA256_MB_LANES)
+#ifdef SHA256_MB_SUFFIX
+#define MB_FN           MB_XCAT(MB_XCAT(sha256_many_x, SHA256_MB_LANES), SHA256_MB_SUFFIX)
+#else
+#define MB_FN           MB_XCAT(sha256_many_x, SHA256_MB_LANES)
+#endif
+
+typedef uint32 MB_VEC __attribute__((vector_size(4 * SHA256_MB_LANES)));
+
+#define MB_ROTR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define MB_S0(x)        (MB_ROTR(x,  2) ^ MB_ROTR(x, 13) ^ MB_ROTR(x, 22))
+#define MB_S1(x)        (MB_ROTR(x,  6) ^ MB_ROTR(x, 11) ^ MB_ROTR(x, 25))
+#define MB_s0(x)        (MB_ROTR(x,  7) ^ MB_ROTR(x, 18) ^ ((x) >>  3))
+#define MB_s1(x)        (MB_ROTR(x, 17) ^ MB_ROTR(x, 19) ^ ((x) >> 10))
+
+/*
+ * Lanes are refilled as soon as their message finishes, so ragged lengths only
+ * cost idle lanes at the very end of the batch. Idle lanes are masked out of
+ * the state update.
+ */
+SHA256_MB_TARGET
+static void MB_FN(const uint8 *const msgs[], const uint32 lens[],
+                  uint8 *const digests[], size_t n)
+{
+    struct sha256_mb_lane lane[SHA256_MB_LANES];
+    MB_VEC s[8], w[16];
+    MB_VEC a, b, c, d, e, f, g, h, t1, t2, mask;
+    size_t next = 0;
+    int i, j, t, active;
+
+    for (i = 0; i < SHA256_MB_LANES; i++) {
+        lane[i].job = -1;
+    }
+
+    for (;;) {
+        active = 0;
+
+        for (i = 0; i < SHA256_MB_LANES; i++) {
+            if (lane[i].job < 0 && next < n) {
+                sha256_mb_lane_start(&lane[i], (long) next, msgs[next], lens[next]);
+                for (j = 0; j < 8; j++) {
+                    s[j][i] = sha256_h0[j];
+                }
+                next++;
+            }
+
+            if (lane[i].job >= 0) {
+                const uint8 *p = sha256_mb_lane_block(&lane[i]);
+
+                for (j = 0; j < 16; j++) {
+                    w[j][i] = ((uint32) p[4 * j] << 24) | ((uint32) p[4 * j + 1] << 16)
+                            | ((uint32) p[4 * j + 2] << 8) | (uint32) p[4 * j + 3];
+                }
+                mask[i] = 0xffffffff;
+                active++;
+            } else {
+                for (j = 0; j < 16; j++) {
+                    w[j][i] = 0;
+                }
+                mask[i] = 0;
+            }
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        a = s[0]; b = s[1]; c = s[2]; d = s[3];
+        e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+        for (t = 0; t < 64; t++) {
+            if (t >= 16) {
+                w[t & 15] += MB_s1(w[(t - 2) & 15]) + w[(t - 7) & 15] + MB_s0(w[(t - 15) & 15]);
+            }
+            t1 = h + MB_S1(e) + ((e & f) ^ (~e & g)) + sha256_k[t] + w[t & 15];
+            t2 = MB_S0(a) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        s[0] += a & mask; s[1] += b & mask; s[2] += c & mask; s[3] += d & mask;
+        s[4] += e & mask; s[5] += f & mask; s[6] += g & mask; s[7] += h & mask;
+
+        for (i = 0; i < SHA256_MB_LANES; i++) {
+            if (lane[i].job >= 0 && sha256_mb_lane_next(&lane[i])) {
+                uint8 *digest = digests[lane[i].job];
+
+                for (j = 0; j < 8; j++) {
+                    uint32 x = s[j][i];
+                    digest[4 * j + 0] = (uint8) (x >> 24);
+                    digest[4 * j + 1] = (uint8) (x >> 16);
+                    digest[4 * j + 2] = (uint8) (x >>  8);
+                    digest[4 * j + 3] = (uint8) (x      );
+                }
+                lane[i].job = -1;
+            }
+        }
+    }
+}
+
+#undef MB_ROTR
+#undef MB_S0
+#undef MB_S1
+#undef MB_s0
+#undef MB_s1
+#undef MB_FN
+#undef MB_VEC
+#undef MB_XCAT
+#undef MB_CAT
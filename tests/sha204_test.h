@@ -0,0 +1,52 @@
+/*
+ * sha204_test.h
+ *
+ * 单元测试的公共部分. 测试在进程内的器件模型(sha204_sim)上运行, 默认使用虚拟时间, 不需要硬件也不真实睡眠.
+ * 每个测试是一个可执行文件, 全部通过返回0, ctest按返回值判定.
+ */
+
+#ifndef SHA204_TEST_H
+#   define SHA204_TEST_H
+
+#include <stdio.h>
+
+#include "../sha204/sha204_sim.h"
+#include "../sha204/atsha204_actions.h"
+#include "../sha204/sha204_lib_return_codes.h"
+
+//! 条件不成立时打印位置并让测试失败
+#define CHECK(cond) do {                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "FAILED! %s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+            return 1;                                                           \
+        }                                                                       \
+    } while (0)
+
+//! 运行一个子测试(返回0表示通过的函数)
+#define RUN_TEST(fn) do {                                                       \
+        if ((fn)() != 0) {                                                      \
+            fprintf(stderr, "FAILED! %s\n", #fn);                               \
+            return 1;                                                           \
+        }                                                                       \
+        fprintf(stderr, "ok %s\n", #fn);                                        \
+    } while (0)
+
+
+/** \brief 创建匿名映像的器件模型, 开启执行时间
+ *
+ * \param[in] lock_config 非0时锁定config区, 之后Random才输出随机数, 数据区才能读写
+ * \return 器件模型, 失败返回NULL
+ */
+static inline struct sha204_sim *test_sim_create(int lock_config) {
+    struct sha204_sim *sim = sha204_sim_create(NULL);
+
+    if (!sim) return NULL;
+    sha204_sim_set_timing(sim, 1);
+    if (lock_config && atsha204_lock_conf(sha204_sim_fd(sim)) != SHA204_SUCCESS) {
+        sha204_sim_destroy(sim);
+        return NULL;
+    }
+    return sim;
+}
+
+#endif //SHA204_TEST_H
@@ -0,0 +1,253 @@
+/*
+ * test_actions.c
+ *
+ * atsha204_actions在器件模型上: config区快照解析出的各字段与原始字节一致;
+ * 批量读slot跳过IsSecret的slot, read_mask只含明文读出的slot;
+ * 挑战-响应认证(单项与批量)接受正确的密钥, 拒绝改动了一个字节的密钥.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_clock.h"
+
+#include <string.h>
+
+// 个人化后IsSecret的slot; slot 5另有EncryptRead, slot 9只有EncryptRead(不是IsSecret, 仍可明文读)
+#define SECRET_SLOTS    ((uint16_t) ((1u << 0) | (1u << 1) | (1u << 5)))
+
+static uint8_t key[32];
+static uint8_t slot_data[16][32];
+
+
+// config区可写部分(字节16~83)的目标内容: 在出厂内容上改SlotConfig, UseFlag/UpdateCount与LastKeyUse
+static void config_init(const uint8_t factory[88], uint8_t data[68]) {
+    memcpy(data, factory + 16, 68);
+    for (int i = 0; i < 16; ++i) {
+        uint16_t sc = (uint16_t) (0x0100 * (i & 0x0F));
+        if (SECRET_SLOTS & (1u << i)) sc |= 0x80;
+        if (i == 5 || i == 9) sc |= 0x40;
+        data[4 + 2 * i] = (uint8_t) sc;
+        data[5 + 2 * i] = (uint8_t) (sc >> 8);
+    }
+    for (int i = 0; i < 8; ++i) {
+        data[36 + 2 * i] = (uint8_t) (0xFF >> i);
+        data[37 + 2 * i] = (uint8_t) (i * 3);
+    }
+    for (int i = 0; i < 16; ++i) data[52 + i] = (uint8_t) (0xF0 ^ i);
+}
+
+
+// 写config区并锁定; lock_data非0时再写入各slot(slot 0为密钥)并锁定data区
+static struct sha204_sim *personalized_sim(int lock_data) {
+    struct atsha204_config factory;
+    uint8_t data[68];
+
+    struct sha204_sim *sim = sha204_sim_create(NULL);
+    if (!sim) return NULL;
+    sha204_sim_set_timing(sim, 1);
+    int fd = sha204_sim_fd(sim);
+
+    if (atsha204_config_snapshot(fd, &factory) != SHA204_SUCCESS) goto fail;
+    config_init(factory.raw, data);
+    if (atsha204_write_config(fd, data) != SHA204_SUCCESS || atsha204_lock_conf(fd) != SHA204_SUCCESS) goto fail;
+    if (!lock_data) return sim;
+
+    for (int slot = 0; slot < 16; ++slot)
+        if (atsha204_write_data(fd, slot, slot ? slot_data[slot] : key) != SHA204_SUCCESS) goto fail;
+    if (atsha204_lock_data(fd) != SHA204_SUCCESS) goto fail;
+    return sim;
+
+fail:
+    sha204_sim_destroy(sim);
+    return NULL;
+}
+
+
+// 快照的各字段按数据手册的偏移取自原始字节, 并与单独的读取函数一致
+static int test_config_snapshot(void) {
+    struct atsha204_config conf, parsed;
+    uint8_t raw[88], expected[68], sn[9], lock[4];
+
+    struct sha204_sim *sim = personalized_sim(0);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+
+    CHECK(atsha204_config_snapshot(fd, &conf) == SHA204_SUCCESS);
+    CHECK(atsha204_read_config(fd, raw) == SHA204_SUCCESS);
+    CHECK(memcmp(conf.raw, raw, sizeof(raw)) == 0);
+
+    CHECK(memcmp(conf.sn, raw, 4) == 0 && memcmp(conf.sn + 4, raw + 8, 5) == 0);
+    CHECK(atsha204_read_sn(fd, sn) == SHA204_SUCCESS);
+    CHECK(memcmp(conf.sn, sn, sizeof(sn)) == 0);
+    CHECK(memcmp(conf.rev_num, raw + 4, 4) == 0);
+
+    config_init(raw, expected);
+    CHECK(memcmp(raw + 16, expected, sizeof(expected)) == 0);
+    for (int i = 0; i < 16; ++i) {
+        CHECK(conf.slot_config[i] == (uint16_t) (raw[20 + 2 * i] | (raw[21 + 2 * i] << 8)));
+        CHECK(((conf.slot_config[i] & 0x80) != 0) == ((SECRET_SLOTS >> i) & 1));
+        CHECK((conf.slot_config[i] >> 8) == i);
+    }
+    for (int i = 0; i < 8; ++i) {
+        CHECK(conf.use_flag[i] == (uint8_t) (0xFF >> i));
+        CHECK(conf.update_count[i] == (uint8_t) (i * 3));
+    }
+    CHECK(memcmp(conf.last_key_use, raw + 68, 16) == 0);
+    CHECK(conf.last_key_use[15] == (0xF0 ^ 15));
+
+    // 锁定字节: config区已锁定, data区未锁定
+    CHECK(memcmp(conf.lock, raw + 84, 4) == 0);
+    CHECK(atsha204_read_lock(fd, lock) == SHA204_SUCCESS);
+    CHECK(memcmp(conf.lock, lock, sizeof(lock)) == 0);
+    CHECK(conf.lock[3] == 0x00 && conf.lock[2] != 0x00);
+
+    // 不经芯片解析任意内容: 每个字节等于偏移时逐项核对
+    for (int i = 0; i < 88; ++i) raw[i] = (uint8_t) i;
+    atsha204_config_parse(raw, &parsed);
+    CHECK(parsed.sn[0] == 0 && parsed.sn[3] == 3 && parsed.sn[4] == 8 && parsed.sn[8] == 12);
+    CHECK(parsed.rev_num[0] == 4 && parsed.rev_num[3] == 7);
+    CHECK(parsed.slot_config[0] == 0x1514 && parsed.slot_config[15] == 0x3332);
+    CHECK(parsed.use_flag[0] == 52 && parsed.update_count[0] == 53);
+    CHECK(parsed.use_flag[7] == 66 && parsed.update_count[7] == 67);
+    CHECK(parsed.last_key_use[0] == 68 && parsed.last_key_use[15] == 83);
+    CHECK(parsed.lock[0] == 84 && parsed.lock[3] == 87);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 一次批量读: slot_mask中IsSecret的slot不读, 其缓冲区保持不变; 读出的明文与写入的一致
+static int check_bulk(int fd, const struct atsha204_config *conf, uint16_t slot_mask) {
+    uint8_t data[16][32];
+    uint16_t read_mask = 0xFFFF;
+
+    memset(data, 0xEE, sizeof(data));
+    CHECK(atsha204_read_data_bulk(fd, conf, slot_mask, data, &read_mask) == SHA204_SUCCESS);
+    CHECK(read_mask == (slot_mask & ~SECRET_SLOTS));
+    for (int slot = 0; slot < 16; ++slot) {
+        if (read_mask & (1u << slot)) {
+            CHECK(memcmp(data[slot], slot_data[slot], 32) == 0);
+        } else {
+            for (int i = 0; i < 32; ++i) CHECK(data[slot][i] == 0xEE);
+        }
+    }
+    return 0;
+}
+
+
+static int test_read_data_bulk(void) {
+    struct atsha204_config conf;
+    uint8_t data[16][32];
+    uint16_t read_mask;
+
+    struct sha204_sim *sim = personalized_sim(1);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+    CHECK(atsha204_config_snapshot(fd, &conf) == SHA204_SUCCESS);
+
+    // 密钥slot与明文slot混合, 含只有EncryptRead的slot 9; 调用者给出快照或由函数自己读
+    static const uint16_t masks[] = {0xFFFF, 0x0223, 0x0003, 0x0200, 0x0000};
+    for (uint32_t i = 0; i < sizeof(masks) / sizeof(masks[0]); ++i) {
+        CHECK(check_bulk(fd, &conf, masks[i]) == 0);
+        CHECK(check_bulk(fd, NULL, masks[i]) == 0);
+    }
+
+    // 与逐个slot读一致
+    CHECK(atsha204_read_data(fd, 9, data[0]) == SHA204_SUCCESS);
+    CHECK(memcmp(data[0], slot_data[9], 32) == 0);
+    sha204_sim_destroy(sim);
+
+    // data区未锁定时不读
+    sim = personalized_sim(0);
+    CHECK(sim);
+    read_mask = 0xFFFF;
+    CHECK(atsha204_read_data_bulk(sha204_sim_fd(sim), NULL, 0xFFFF, data, &read_mask) != SHA204_SUCCESS);
+    CHECK(read_mask == 0);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 主机挑战与器件Nonce两种方式: 正确的密钥通过, 任一字节改动一位的密钥不通过
+static int test_authentication(void) {
+    static const uint8_t modes[] = {AUTH_MODE_HOST_CHALLENGE, AUTH_MODE_DEVICE_NONCE};
+    uint8_t wrong[32];
+
+    struct sha204_sim *sim = personalized_sim(1);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+
+    for (uint32_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        CHECK(random_challenge_response_authentication(fd, 0, key, modes[m]) == SHA204_SUCCESS);
+        for (int i = 0; i < 32; i += 31) {
+            memcpy(wrong, key, sizeof(wrong));
+            wrong[i] ^= 0x01;
+            CHECK(random_challenge_response_authentication(fd, 0, wrong, modes[m]) != SHA204_SUCCESS);
+        }
+        // 另一个slot的内容不是这把密钥
+        CHECK(random_challenge_response_authentication(fd, 2, key, modes[m]) != SHA204_SUCCESS);
+    }
+    CHECK(random_challenge_response_authentication(fd, 0, key, 7) == SHA204_BAD_PARAM);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 一批中正确与改动过的密钥交错, 两种挑战来源, 挑战由调用者给出或自动生成: pass_mask恰为正确的各项
+static int test_authenticate_batch(void) {
+    static const uint8_t challenge[32] = {1, 2, 3};
+    struct atsha204_auth_check checks[ATSHA204_AUTH_BATCH_MAX];
+    uint8_t wrong[8][32];
+    uint32_t pass_mask, expected = 0;
+
+    struct sha204_sim *sim = personalized_sim(1);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        memcpy(wrong[i], key, 32);
+        wrong[i][(i * 5) % 32] ^= (uint8_t) (1u << i);
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        checks[i].key_id = 0;
+        checks[i].mode = (i & 1) ? AUTH_MODE_DEVICE_NONCE : AUTH_MODE_HOST_CHALLENGE;
+        checks[i].challenge = (i & 2) ? challenge : NULL;
+        checks[i].key = (i & 4) ? wrong[i / 2] : key;
+        if (!(i & 4)) expected |= 1u << i;
+    }
+
+    CHECK(atsha204_authenticate_batch(fd, checks, 16, &pass_mask) == SHA204_SUCCESS);
+    CHECK(pass_mask == expected);
+
+    // 只有一项与空的批量
+    CHECK(atsha204_authenticate_batch(fd, &checks[4], 1, &pass_mask) == SHA204_SUCCESS);
+    CHECK(pass_mask == 0);
+    CHECK(atsha204_authenticate_batch(fd, &checks[0], 1, &pass_mask) == SHA204_SUCCESS);
+    CHECK(pass_mask == 1);
+    CHECK(atsha204_authenticate_batch(fd, checks, 0, &pass_mask) == SHA204_SUCCESS);
+    CHECK(pass_mask == 0);
+
+    // 参数错误时整批不执行
+    checks[3].key_id = 16;
+    CHECK(atsha204_authenticate_batch(fd, checks, 16, &pass_mask) == SHA204_BAD_PARAM);
+    CHECK(pass_mask == 0);
+    CHECK(atsha204_authenticate_batch(fd, checks, ATSHA204_AUTH_BATCH_MAX + 1, &pass_mask) == SHA204_BAD_PARAM);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+    for (int i = 0; i < 32; ++i) key[i] = (uint8_t) (0xA5 ^ (i * 7));
+    for (int slot = 0; slot < 16; ++slot)
+        for (int i = 0; i < 32; ++i) slot_data[slot][i] = (uint8_t) (slot * 16 + i);
+
+    RUN_TEST(test_config_snapshot);
+    RUN_TEST(test_read_data_bulk);
+    RUN_TEST(test_authentication);
+    RUN_TEST(test_authenticate_batch);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * test_admit.c
+ *
+ * 准入控制(sha204_admit): 按芯片时间计的令牌桶, 按次数计的EEPROM写预算, 在途上限, 退还令牌,
+ * 长时间空闲后的补充不溢出.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_admit.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+
+#define SECOND_US       (1000000ULL)
+
+
+// 从now_us开始连续提交同一条请求(每条完成后才提交下一条), 返回准入的条数
+static uint32_t admit_burst(struct sha204_admit *a, const struct sha204_request *req, uint64_t now_us) {
+    uint32_t n = 0;
+
+    while (n < 10000 && sha204_admit_request(a, req, now_us) == SHA204_SUCCESS) {
+        sha204_admit_done(a);
+        n++;
+    }
+    return n;
+}
+
+
+static int test_chip_time_budget(void) {
+    struct sha204_admit_policy policy;
+    struct sha204_admit a;
+    struct sha204_request random, read;
+
+    sha204_admit_default_policy(&policy);
+    sha204_admit_init(&a, &policy, 0);
+    sha204_request_init(&random, SHA204_RANDOM, RANDOM_NO_SEED_UPDATE, 0, NULL, 0);
+    sha204_request_init(&read, SHA204_READ, SHA204_ZONE_CONFIG, 0, NULL, 0);
+    uint32_t cost = sha204_request_cost_ms(&random);
+    CHECK(cost > 0);
+
+    // 突发受加密类命令的桶限制, 客户端桶还有余量
+    uint32_t crypto_burst = policy.class_burst_ms[SHA204_ADMIT_CRYPTO];
+    CHECK(admit_burst(&a, &random, 0) == crypto_burst / cost);
+    CHECK(sha204_admit_request(&a, &random, 0) == SHA204_RATE_LIMITED);
+    CHECK(a.rejected == 2);
+
+    // 读命令不受加密类的桶限制, 只受客户端桶限制
+    CHECK(sha204_admit_request(&a, &read, 0) == SHA204_SUCCESS);
+    sha204_admit_done(&a);
+
+    // 一秒后按速率补充
+    uint32_t crypto_rate = policy.class_ms_per_s[SHA204_ADMIT_CRYPTO];
+    CHECK(admit_burst(&a, &random, SECOND_US) == crypto_rate / cost);
+    return 0;
+}
+
+
+static int test_eeprom_writes(void) {
+    struct sha204_admit_policy policy;
+    struct sha204_admit a;
+    struct sha204_request write;
+    uint8_t data[4] = {0};
+
+    sha204_admit_default_policy(&policy);
+    memset(policy.class_ms_per_s, 0, sizeof(policy.class_ms_per_s));
+    policy.client_ms_per_s = 0;
+    policy.eeprom_per_hour = 3600;
+    policy.eeprom_burst = 10;
+    sha204_admit_init(&a, &policy, 0);
+    sha204_request_init(&write, SHA204_WRITE, SHA204_ZONE_CONFIG, 5, data, sizeof(data));
+
+    CHECK(sha204_admit_class_of(SHA204_WRITE) == SHA204_ADMIT_EEPROM);
+    CHECK(admit_burst(&a, &write, 0) == 10);
+    // 每小时3600次即每秒一次
+    CHECK(sha204_admit_request(&a, &write, SECOND_US / 2) == SHA204_RATE_LIMITED);
+    CHECK(admit_burst(&a, &write, 3 * SECOND_US) == 3);
+    return 0;
+}
+
+
+static int test_queue_limit_and_refund(void) {
+    struct sha204_admit_policy policy;
+    struct sha204_admit a;
+    struct sha204_request random;
+
+    sha204_admit_default_policy(&policy);
+    policy.max_queued = 2;
+    sha204_admit_init(&a, &policy, 0);
+    sha204_request_init(&random, SHA204_RANDOM, RANDOM_NO_SEED_UPDATE, 0, NULL, 0);
+
+    CHECK(sha204_admit_request(&a, &random, 0) == SHA204_SUCCESS);
+    CHECK(sha204_admit_request(&a, &random, 0) == SHA204_SUCCESS);
+    CHECK(sha204_admit_request(&a, &random, 0) == SHA204_QUEUE_FULL);
+    sha204_admit_done(&a);
+    CHECK(a.queued == 1);
+
+    // 退还令牌, 在途数不变
+    uint64_t before = a.classes[SHA204_ADMIT_CRYPTO].milli_tokens;
+    sha204_admit_refund(&a, &random);
+    CHECK(a.classes[SHA204_ADMIT_CRYPTO].milli_tokens == before + sha204_request_cost_ms(&random) * 1000ULL);
+    CHECK(a.queued == 1);
+
+    // 退还不超过桶容量
+    sha204_admit_refund(&a, &random);
+    sha204_admit_refund(&a, &random);
+    CHECK(a.classes[SHA204_ADMIT_CRYPTO].milli_tokens <= policy.class_burst_ms[SHA204_ADMIT_CRYPTO] * 1000ULL);
+    return 0;
+}
+
+
+// 最大的速率与容量, 相隔极长时间: 补充后桶恰好满, 不回绕
+static int test_refill_overflow(void) {
+    struct sha204_admit_policy policy;
+    struct sha204_admit a;
+    struct sha204_request write;
+    uint8_t data[4] = {0};
+
+    sha204_admit_default_policy(&policy);
+    policy.client_ms_per_s = UINT32_MAX;
+    policy.client_burst_ms = UINT32_MAX;
+    policy.eeprom_per_hour = UINT32_MAX;
+    policy.eeprom_burst = UINT32_MAX;
+    sha204_admit_init(&a, &policy, 0);
+    a.client.milli_tokens = 0;
+    a.eeprom.milli_tokens = 0;
+    sha204_request_init(&write, SHA204_WRITE, SHA204_ZONE_CONFIG, 5, data, sizeof(data));
+
+    CHECK(sha204_admit_request(&a, &write, UINT64_MAX / 2) == SHA204_SUCCESS);
+    CHECK(a.client.milli_tokens == (uint64_t) UINT32_MAX * 1000 - sha204_request_cost_ms(&write) * 1000ULL);
+    CHECK(a.eeprom.milli_tokens == (uint64_t) UINT32_MAX * 1000 - 1000);
+    return 0;
+}
+
+
+int main(void) {
+    RUN_TEST(test_chip_time_budget);
+    RUN_TEST(test_eeprom_writes);
+    RUN_TEST(test_queue_limit_and_refund);
+    RUN_TEST(test_refill_overflow);
+    return 0;
+}
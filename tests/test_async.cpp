@@ -0,0 +1,163 @@
+/*
+ * test_async.cpp
+ *
+ * C++20协程接口(sha204_async.hpp)在器件模型上: 两颗芯片在同一个reactor上交错执行,
+ * co_await返回的结果与同步执行一致; 相邻的co_await之间器件保持唤醒, Nonce之后的MAC能用到TempKey;
+ * 参数错误的命令不挂起, 直接返回错误码.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_async.hpp"
+#include "../sha204/sha204_clock.h"
+
+#include <cstring>
+
+#if !defined(__cpp_impl_coroutine)
+#error "test_async needs C++20 coroutines"
+#endif
+
+#define DEVICES         (2)
+
+// 最简单的协程类型: 立即开始执行, 结束时释放协程帧
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+
+struct result {
+    uint8_t done;
+    sha204_request slot, mac, tempkey_mac;
+};
+
+static const uint8_t challenge[MAC_CHALLENGE_SIZE] = {0x5A, 0x01, 0x02, 0x03};
+static const uint8_t num_in[NONCE_NUMIN_SIZE_PASSTHROUGH] = {0xA5, 0x10, 0x20, 0x30};
+
+
+static task run(sha204::async_device &dev, result &out) {
+    out.slot = co_await dev.read_slot(0);
+    out.mac = co_await dev.mac(challenge, 0);
+
+    // 两条命令之间没有让出器件, TempKey仍然有效
+    sha204_request nonce = co_await dev.nonce(NONCE_MODE_PASSTHROUGH, num_in);
+    out.tempkey_mac = co_await dev.execute(SHA204_MAC, MAC_MODE_PASSTHROUGH, 0);
+    out.done = nonce.status == SHA204_SUCCESS;
+}
+
+
+static task run_bad_param(sha204::async_device &dev, uint8_t &status) {
+    static uint8_t data[255];
+    sha204_request rsp = co_await dev.execute(SHA204_WRITE, 0, 0, data, sizeof(data));
+    status = rsp.status;
+}
+
+
+// 同步执行一组相邻的命令, 结果作为参照
+static uint8_t execute(int fd, sha204_request *reqs, int n) {
+    sha204_awake awake = {0, 0};
+    uint8_t status = SHA204_SUCCESS;
+    uint16_t cost_ms = 0;
+
+    for (int i = 0; i < n; ++i) cost_ms += sha204_request_cost_ms(&reqs[i]);
+    sha204_request_wake(fd, &awake, cost_ms);
+    for (int i = 0; i < n && status == SHA204_SUCCESS; ++i)
+        status = sha204_request_execute(fd, &reqs[i]);
+    sha204_request_sleep(fd, &awake);
+    return status;
+}
+
+
+static int test_coroutines(void) {
+    struct sha204_sim *sims[DEVICES];
+    uint8_t key[DEVICES][32];
+    result results[DEVICES];
+
+    for (int i = 0; i < DEVICES; ++i) {
+        sims[i] = test_sim_create(1);
+        CHECK(sims[i]);
+        for (int j = 0; j < 32; ++j) key[i][j] = (uint8_t) (i * 16 + j);
+        CHECK(atsha204_write_data(sha204_sim_fd(sims[i]), 0, key[i]) == SHA204_SUCCESS);
+        CHECK(atsha204_lock_data(sha204_sim_fd(sims[i])) == SHA204_SUCCESS);
+    }
+
+    sha204_reactor *reactor = sha204_reactor_create();
+    CHECK(reactor);
+    {
+        sha204::async_device dev0(reactor, sha204_sim_fd(sims[0]));
+        sha204::async_device dev1(reactor, sha204_sim_fd(sims[1]));
+        memset(results, 0, sizeof(results));
+        run(dev0, results[0]);
+        run(dev1, results[1]);
+        CHECK(!results[0].done && !results[1].done);
+        sha204_reactor_run(reactor);
+    }
+    sha204_reactor_destroy(reactor);
+
+    for (int i = 0; i < DEVICES; ++i) {
+        const result &r = results[i];
+        CHECK(r.done);
+        CHECK(r.slot.status == SHA204_SUCCESS && memcmp(&r.slot.rsp[SHA204_BUFFER_POS_DATA], key[i], 32) == 0);
+        CHECK(r.mac.status == SHA204_SUCCESS);
+        CHECK(r.tempkey_mac.status == SHA204_SUCCESS);
+
+        sha204_request reqs[3];
+        CHECK(sha204_request_init(&reqs[0], SHA204_MAC, MAC_MODE_CHALLENGE, 0, challenge, MAC_CHALLENGE_SIZE)
+              == SHA204_SUCCESS);
+        CHECK(sha204_request_init(&reqs[1], SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, num_in, sizeof(num_in))
+              == SHA204_SUCCESS);
+        CHECK(sha204_request_init(&reqs[2], SHA204_MAC, MAC_MODE_PASSTHROUGH, 0, NULL, 0) == SHA204_SUCCESS);
+        CHECK(execute(sha204_sim_fd(sims[i]), reqs, 3) == SHA204_SUCCESS);
+        CHECK(memcmp(&r.mac.rsp[SHA204_BUFFER_POS_DATA], &reqs[0].rsp[SHA204_BUFFER_POS_DATA], 32) == 0);
+        CHECK(memcmp(&r.tempkey_mac.rsp[SHA204_BUFFER_POS_DATA], &reqs[2].rsp[SHA204_BUFFER_POS_DATA], 32) == 0);
+    }
+
+    // 两颗芯片的密钥不同
+    CHECK(memcmp(&results[0].mac.rsp[SHA204_BUFFER_POS_DATA], &results[1].mac.rsp[SHA204_BUFFER_POS_DATA], 32) != 0);
+
+    for (int i = 0; i < DEVICES; ++i) sha204_sim_destroy(sims[i]);
+    return 0;
+}
+
+
+// 没有TempKey的MAC在器件上失败, 错误码同样经co_await返回
+static int test_errors(void) {
+    struct sha204_sim *sim = test_sim_create(1);
+    CHECK(sim);
+    CHECK(atsha204_lock_data(sha204_sim_fd(sim)) == SHA204_SUCCESS);
+
+    sha204_reactor *reactor = sha204_reactor_create();
+    CHECK(reactor);
+    uint8_t status = SHA204_SUCCESS;
+    {
+        sha204::async_device dev(reactor, sha204_sim_fd(sim));
+
+        // 数据字段过长: 不提交, 不挂起
+        run_bad_param(dev, status);
+        CHECK(status == SHA204_BAD_PARAM);
+        CHECK(sha204_reactor_next_us(reactor) == 0);
+
+        status = SHA204_SUCCESS;
+        [](sha204::async_device &d, uint8_t &s) -> task {
+            sha204_request rsp = co_await d.execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY, 0);
+            s = rsp.status;
+        }(dev, status);
+        sha204_reactor_run(reactor);
+        CHECK(status != SHA204_SUCCESS);
+    }
+    sha204_reactor_destroy(reactor);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_coroutines);
+    RUN_TEST(test_errors);
+    return 0;
+}
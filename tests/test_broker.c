@@ -0,0 +1,231 @@
+/*
+ * test_broker.c
+ *
+ * 多进程共享芯片(sha204_broker): 客户端经共享内存提交命令, 非法的器件编号/优先级/命令被拒绝,
+ * 同一uid的连接共用准入预算, 断开重连不会补满; 没有封住大小的共享内存被拒绝, 改乱提交队列指针的客户端被断开.
+ */
+
+#define _GNU_SOURCE                     // F_ADD_SEALS
+
+#include "sha204_test.h"
+#include "../sha204/sha204_broker.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/memfd.h>
+
+static char socket_path[64];
+static struct sha204_broker *broker;
+
+
+static void *broker_thread(void *arg) {
+    (void) arg;
+    sha204_broker_run(broker);
+    return NULL;
+}
+
+
+static int start_broker(struct sha204_sim *sim, const struct sha204_admit_policy *policy, pthread_t *thread) {
+    snprintf(socket_path, sizeof(socket_path), "/tmp/sha204_test_broker.%d.sock", (int) getpid());
+    broker = sha204_broker_create(socket_path);
+    CHECK(broker);
+    CHECK(sha204_broker_add_device(broker, sha204_sim_fd(sim)) == 0);
+    if (policy) sha204_broker_set_policy(broker, policy);
+    CHECK(pthread_create(thread, NULL, broker_thread, NULL) == 0);
+    return 0;
+}
+
+
+static void stop_broker(pthread_t thread) {
+    sha204_broker_stop(broker);
+    pthread_join(thread, NULL);
+    sha204_broker_destroy(broker);
+}
+
+
+static int test_execute_and_validate(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    pthread_t thread;
+    CHECK(start_broker(sim, NULL, &thread) == 0);
+
+    struct sha204_client *c = sha204_client_connect(socket_path, 8);
+    CHECK(c);
+    CHECK(sha204_client_devices(c) == 1);
+
+    struct sha204_request req;
+    sha204_request_init(&req, SHA204_DEVREV, 0, 0, NULL, 0);
+    CHECK(sha204_client_execute(c, 0, SHA204_PRIO_NORMAL, 0, 0, &req) == SHA204_SUCCESS);
+    CHECK(req.rsp[0] == DEVREV_RSP_SIZE);
+
+    // 不存在的器件, 非法优先级, 数据长度与命令不符
+    sha204_request_init(&req, SHA204_DEVREV, 0, 0, NULL, 0);
+    CHECK(sha204_client_execute(c, 1, SHA204_PRIO_NORMAL, 0, 0, &req) == SHA204_BAD_PARAM);
+    CHECK(sha204_client_execute(c, 0, SHA204_PRIO_COUNT, 0, 0, &req) == SHA204_BAD_PARAM);
+    req.data_len = SHA204_REQ_DATA_MAX + 1;
+    CHECK(sha204_client_execute(c, 0, SHA204_PRIO_NORMAL, 0, 0, &req) == SHA204_BAD_PARAM);
+
+    // 拒绝之后连接仍可用
+    sha204_request_init(&req, SHA204_DEVREV, 0, 0, NULL, 0);
+    CHECK(sha204_client_execute(c, 0, SHA204_PRIO_URGENT, 0, 0, &req) == SHA204_SUCCESS);
+
+    sha204_client_close(c);
+    stop_broker(thread);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 每秒1ms的芯片时间, 突发200ms: 同一用户最多4条Random, 重连后仍然用完
+static int test_budget_per_uid(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_admit_policy policy;
+    sha204_admit_default_policy(&policy);
+    policy.client_ms_per_s = 1;
+    policy.client_burst_ms = 200;
+    pthread_t thread;
+    CHECK(start_broker(sim, &policy, &thread) == 0);
+
+    for (int conn = 0; conn < 2; ++conn) {
+        struct sha204_client *c = sha204_client_connect(socket_path, 8);
+        CHECK(c);
+        uint32_t admitted = 0;
+        uint8_t status = SHA204_SUCCESS;
+
+        for (int i = 0; i < 10; ++i) {
+            struct sha204_request req;
+            sha204_request_init(&req, SHA204_RANDOM, RANDOM_NO_SEED_UPDATE, 0, NULL, 0);
+            status = sha204_client_execute(c, 0, SHA204_PRIO_NORMAL, 0, 0, &req);
+            if (status == SHA204_SUCCESS) admitted++;
+        }
+        CHECK(status == SHA204_RATE_LIMITED);
+        CHECK(admitted == (conn == 0 ? 200 / RANDOM_EXEC_MAX : 0));
+        sha204_client_close(c);
+    }
+
+    stop_broker(thread);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 不经客户端库的连接, 用于构造不守规矩的客户端. 返回握手回复的n_devices, 失败返回-1
+struct raw_client {
+    int sock;
+    int sq_efd;
+    int cq_efd;
+    struct sha204_broker_shm *shm;
+    size_t shm_size;
+};
+
+static int raw_connect(struct raw_client *rc, int seal) {
+    struct sockaddr_un addr;
+    struct sha204_broker_hello hello = {SHA204_BROKER_MAGIC, SHA204_BROKER_VERSION, 4,
+                                        sizeof(struct sha204_broker_msg), 0};
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = &hello, .iov_len = sizeof(hello) };
+    struct msghdr mh;
+
+    rc->shm_size = sizeof(struct sha204_broker_shm) + 2 * 4 * sizeof(struct sha204_broker_msg);
+    int memfd = (int) syscall(SYS_memfd_create, "sha204-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, (off_t) rc->shm_size) != 0) return -1;
+    if (seal && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) return -1;
+    rc->shm = (struct sha204_broker_shm *) mmap(NULL, rc->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (rc->shm == MAP_FAILED) return -1;
+    rc->sq_efd = eventfd(0, EFD_CLOEXEC);
+    rc->cq_efd = eventfd(0, EFD_CLOEXEC);
+    rc->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(rc->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) return -1;
+
+    memset(&mh, 0, sizeof(mh));
+    memset(&control, 0, sizeof(control));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = { memfd, rc->sq_efd, rc->cq_efd };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int ret = -1;
+    if (sendmsg(rc->sock, &mh, MSG_NOSIGNAL) == sizeof(hello) && recv(rc->sock, &hello, sizeof(hello), 0) == sizeof(hello))
+        ret = (int) hello.n_devices;
+    close(memfd);
+    return ret;
+}
+
+
+static void raw_close(struct raw_client *rc) {
+    munmap(rc->shm, rc->shm_size);
+    close(rc->sock);
+    close(rc->sq_efd);
+    close(rc->cq_efd);
+}
+
+
+static int test_hostile_client(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    pthread_t thread;
+    CHECK(start_broker(sim, NULL, &thread) == 0);
+    struct raw_client rc;
+
+    // 没有F_SEAL_SHRINK: 客户端可以事后缩小共享内存, 拒绝
+    CHECK(raw_connect(&rc, 0) == 0);
+    raw_close(&rc);
+
+    // 提交队列的tail远超队列长度: broker断开该客户端, 不在无效记录上空转
+    CHECK(raw_connect(&rc, 1) == 1);
+    __atomic_store_n(&rc.shm->sq.tail, rc.shm->sq.head + 0x7fffffff, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    CHECK(write(rc.sq_efd, &one, sizeof(one)) == sizeof(one));
+    struct pollfd pfd = { .fd = rc.sock, .events = POLLIN };
+    char byte;
+    CHECK(poll(&pfd, 1, 5000) == 1);
+    CHECK(recv(rc.sock, &byte, sizeof(byte), 0) == 0);
+    raw_close(&rc);
+
+    // 其他客户端不受影响
+    struct sha204_client *c = sha204_client_connect(socket_path, 8);
+    CHECK(c);
+    struct sha204_request req;
+    sha204_request_init(&req, SHA204_DEVREV, 0, 0, NULL, 0);
+    CHECK(sha204_client_execute(c, 0, SHA204_PRIO_NORMAL, 0, 0, &req) == SHA204_SUCCESS);
+    sha204_client_close(c);
+
+    stop_broker(thread);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_execute_and_validate);
+    RUN_TEST(test_budget_per_uid);
+    RUN_TEST(test_hostile_client);
+    return 0;
+}
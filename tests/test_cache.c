@@ -0,0 +1,195 @@
+/*
+ * test_cache.c
+ *
+ * config区持久缓存(sha204_cache, atsha204_config_snapshot_cached): 锁定的芯片命中后只读第0块与字0x15,
+ * 结果与直接读芯片相同; 未锁定的芯片不缓存; UpdateExtra之后读到新值; SingleUse密钥的UseFlag从芯片重读;
+ * 其他用户可写的目录中不使用缓存.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_cache.h"
+#include "../sha204/sha204_trace.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_request.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char dir[64], cache_path[96], trace_path[96], image_path[96], single_use_path[96];
+
+
+// 录制一次atsha204_config_snapshot_cached, 返回轨迹中总线写的次数(含唤醒/sleep), 出错返回-1
+static int snapshot_writes(struct sha204_sim *sim, struct sha204_cache *cache, struct atsha204_config *conf) {
+    struct sha204_trace_rec *rec = sha204_trace_record_start(sha204_sim_fd(sim), trace_path);
+    if (!rec) return -1;
+    uint8_t status = atsha204_config_snapshot_cached(sha204_sim_fd(sim), cache, conf);
+    if (sha204_trace_record_stop(rec) != 0 || status != SHA204_SUCCESS) return -1;
+
+    struct sha204_trace *trace = sha204_trace_load(trace_path);
+    if (!trace) return -1;
+    int writes = 0;
+    for (uint32_t i = 0; i < sha204_trace_count(trace); ++i)
+        writes += sha204_trace_get(trace, i)->kind == SHA204_TRACE_WRITE;
+    sha204_trace_free(trace);
+    return writes;
+}
+
+
+// 锁定后仍可执行的单条命令, 两次快照之间改变芯片状态
+static uint8_t execute(int fd, uint8_t op_code, uint8_t param_1, uint16_t param_2, const uint8_t *data, uint8_t len) {
+    struct sha204_request req;
+    struct sha204_awake awake = {0, 0};
+
+    sha204_request_init(&req, op_code, param_1, param_2, data, len);
+    sha204_request_wake(fd, &awake, sha204_request_cost_ms(&req));
+    uint8_t status = sha204_request_execute(fd, &req);
+    sha204_request_sleep(fd, &awake);
+    return status;
+}
+
+
+static int test_locked_chip_hits(void) {
+    struct atsha204_config direct, first, second, third;
+
+    struct sha204_sim *sim = sha204_sim_create(image_path);
+    CHECK(sim);
+    CHECK(atsha204_lock_conf(sha204_sim_fd(sim)) == SHA204_SUCCESS);
+    CHECK(atsha204_lock_data(sha204_sim_fd(sim)) == SHA204_SUCCESS);
+    CHECK(atsha204_config_snapshot(sha204_sim_fd(sim), &direct) == SHA204_SUCCESS);
+    sha204_sim_destroy(sim);
+
+    // 第一次未命中, 读完整个config区并记入缓存
+    struct sha204_cache *cache = sha204_cache_open(cache_path);
+    CHECK(cache);
+    sim = sha204_sim_create(image_path);
+    CHECK(sim);
+    int miss_writes = snapshot_writes(sim, cache, &first);
+    CHECK(miss_writes > 0);
+    CHECK(memcmp(first.raw, direct.raw, sizeof(direct.raw)) == 0);
+    sha204_sim_destroy(sim);
+    sha204_cache_close(cache);
+
+    // 重新打开(相当于进程重启)后命中
+    cache = sha204_cache_open(cache_path);
+    CHECK(cache);
+    sim = sha204_sim_create(image_path);
+    CHECK(sim);
+    int hit_writes = snapshot_writes(sim, cache, &second);
+    CHECK(hit_writes > 0 && hit_writes < miss_writes);
+    CHECK(memcmp(second.raw, direct.raw, sizeof(direct.raw)) == 0);
+
+    // 锁定后UpdateExtra仍可修改字节84, 命中时从芯片重读字0x15
+    CHECK(execute(sha204_sim_fd(sim), SHA204_UPDATE_EXTRA, 0, 0x42, NULL, 0) == SHA204_SUCCESS);
+    CHECK(snapshot_writes(sim, cache, &third) == hit_writes);
+    CHECK(third.lock[0] == 0x42);
+    CHECK(third.raw[84] == 0x42);
+
+    sha204_sim_destroy(sim);
+    sha204_cache_close(cache);
+    return 0;
+}
+
+
+// slot0为SingleUse: 每次MAC消耗UseFlag的一位, 命中时读到的是芯片上的当前值
+static int test_single_use_refreshed(void) {
+    struct atsha204_config conf, direct;
+    uint8_t challenge[32] = {1, 2, 3};
+
+    struct sha204_sim *sim = sha204_sim_create(single_use_path);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+    CHECK(atsha204_config_snapshot(fd, &conf) == SHA204_SUCCESS);
+    conf.raw[20] |= 0x20;
+    CHECK(atsha204_write_config(fd, conf.raw + 16) == SHA204_SUCCESS);
+    CHECK(atsha204_lock_conf(fd) == SHA204_SUCCESS);
+    CHECK(atsha204_lock_data(fd) == SHA204_SUCCESS);
+
+    struct sha204_cache *cache = sha204_cache_open(cache_path);
+    CHECK(cache);
+    int miss_writes = snapshot_writes(sim, cache, &conf);
+    CHECK(miss_writes > 0);
+    CHECK(conf.use_flag[0] == 0xFF);
+
+    CHECK(execute(fd, SHA204_MAC, 0, 0, challenge, sizeof(challenge)) == SHA204_SUCCESS);
+    int hit_writes = snapshot_writes(sim, cache, &conf);
+    CHECK(hit_writes > 0 && hit_writes < miss_writes);
+    CHECK(conf.use_flag[0] == 0x7F);
+    CHECK(atsha204_config_snapshot(fd, &direct) == SHA204_SUCCESS);
+    CHECK(memcmp(conf.raw, direct.raw, sizeof(direct.raw)) == 0);
+
+    CHECK(execute(fd, SHA204_MAC, 0, 0, challenge, sizeof(challenge)) == SHA204_SUCCESS);
+    CHECK(snapshot_writes(sim, cache, &conf) == hit_writes);
+    CHECK(conf.use_flag[0] == 0x3F);
+
+    sha204_sim_destroy(sim);
+    sha204_cache_close(cache);
+    return 0;
+}
+
+
+static int test_unlocked_chip_not_cached(void) {
+    struct atsha204_config conf;
+    uint8_t block0[32], config[88];
+
+    struct sha204_cache *cache = sha204_cache_open(cache_path);
+    CHECK(cache);
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+
+    int first = snapshot_writes(sim, cache, &conf);
+    CHECK(first > 0);
+    CHECK(snapshot_writes(sim, cache, &conf) == first);
+    memcpy(block0, conf.raw, sizeof(block0));
+    CHECK(sha204_cache_lookup(cache, block0, config) != 0);
+
+    sha204_sim_destroy(sim);
+    sha204_cache_close(cache);
+    return 0;
+}
+
+
+// 其他用户可写的目录中的缓存可能被替换, 拒绝打开
+static int test_insecure_directory(void) {
+    char open_dir[80], path[96];
+
+    snprintf(open_dir, sizeof(open_dir), "%s/open", dir);
+    snprintf(path, sizeof(path), "%s/config.cache", open_dir);
+    CHECK(mkdir(open_dir, 0700) == 0);
+    CHECK(chmod(open_dir, 0777) == 0);
+    CHECK(sha204_cache_open(path) == NULL);
+    rmdir(open_dir);
+    return 0;
+}
+
+
+static int run_tests(void) {
+    RUN_TEST(test_locked_chip_hits);
+    RUN_TEST(test_single_use_refreshed);
+    RUN_TEST(test_unlocked_chip_not_cached);
+    RUN_TEST(test_insecure_directory);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    strcpy(dir, "/tmp/sha204_test_cache.XXXXXX");
+    if (!mkdtemp(dir)) return 1;
+    snprintf(cache_path, sizeof(cache_path), "%s/config.cache", dir);
+    snprintf(trace_path, sizeof(trace_path), "%s/snapshot.trc", dir);
+    snprintf(image_path, sizeof(image_path), "%s/sim.img", dir);
+    snprintf(single_use_path, sizeof(single_use_path), "%s/single_use.img", dir);
+
+    int ret = run_tests();
+
+    unlink(cache_path);
+    unlink(trace_path);
+    unlink(image_path);
+    unlink(single_use_path);
+    rmdir(dir);
+    return ret;
+}
@@ -0,0 +1,160 @@
+/*
+ * test_clock.c
+ *
+ * 虚拟时间(sha204_clock): 睡眠不占用真实时间, 所有参与者都睡眠时才推进并按到期先后唤醒,
+ * hold期间未join的睡眠者也等待, 多个器件的调度器在虚拟时间里并行执行.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+static uint64_t real_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static int test_sleep_is_virtual(void) {
+    uint64_t start_us = sha204_clock_now_us(), real_start_us = real_now_us();
+
+    sha204_clock_sleep_us(10 * 1000000ULL);
+    CHECK(sha204_clock_now_us() - start_us == 10 * 1000000ULL);
+    CHECK(real_now_us() - real_start_us < 1000000);
+    return 0;
+}
+
+
+struct sleeper {
+    uint64_t sleep_us;
+    uint64_t woke_us;
+};
+
+static uint32_t n_joined;
+
+static void *participant(void *arg) {
+    struct sleeper *s = (struct sleeper *) arg;
+
+    sha204_clock_join();
+    __atomic_add_fetch(&n_joined, 1, __ATOMIC_RELEASE);
+    sha204_clock_sleep_us(s->sleep_us);
+    s->woke_us = sha204_clock_now_us();
+    sha204_clock_leave();
+    return NULL;
+}
+
+
+// 主线程join期间时间不推进; 离开后两个参与者都在睡眠, 时间依次跳到各自的到期时间
+static int test_participants(void) {
+    struct sleeper s[2] = {{30000, 0}, {10000, 0}};
+    pthread_t threads[2];
+
+    n_joined = 0;
+    sha204_clock_join();
+    uint64_t start_us = sha204_clock_now_us();
+    for (int i = 0; i < 2; ++i) CHECK(pthread_create(&threads[i], NULL, participant, &s[i]) == 0);
+    while (__atomic_load_n(&n_joined, __ATOMIC_ACQUIRE) < 2) sched_yield();
+    CHECK(sha204_clock_now_us() == start_us);
+    sha204_clock_leave();
+
+    for (int i = 0; i < 2; ++i) pthread_join(threads[i], NULL);
+    CHECK(s[1].woke_us == start_us + 10000);
+    CHECK(s[0].woke_us == start_us + 30000);
+    return 0;
+}
+
+
+static uint32_t woke;
+
+static void *plain_sleeper(void *arg) {
+    (void) arg;
+    sha204_clock_sleep_us(5000);
+    __atomic_store_n(&woke, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+// hold是不属于任何线程的参与者, release之前时间不推进
+static int test_hold(void) {
+    pthread_t thread;
+
+    woke = 0;
+    sha204_clock_hold();
+    CHECK(pthread_create(&thread, NULL, plain_sleeper, NULL) == 0);
+    usleep(20000);
+    CHECK(!__atomic_load_n(&woke, __ATOMIC_ACQUIRE));
+    sha204_clock_release();
+    pthread_join(thread, NULL);
+    CHECK(__atomic_load_n(&woke, __ATOMIC_ACQUIRE));
+    return 0;
+}
+
+
+#define DEVICES         (4)
+#define PER_DEVICE      (10)
+
+// 同时向各器件提交Nonce, 返回全部完成所用的虚拟时间
+static uint64_t run_nonces(struct sha204_sched **scheds, int n_devices) {
+    static struct sha204_sched_req reqs[DEVICES][PER_DEVICE];
+    uint8_t num_in[20] = {0};
+    uint64_t start_us = sha204_clock_now_us();
+
+    sha204_clock_join();
+    for (int i = 0; i < n_devices; ++i)
+        for (int k = 0; k < PER_DEVICE; ++k) {
+            sha204_sched_req_init(&reqs[i][k], SHA204_PRIO_NORMAL, 0);
+            sha204_request_init(&reqs[i][k].req, SHA204_NONCE, NONCE_MODE_SEED_UPDATE, 0, num_in, sizeof(num_in));
+            if (sha204_sched_submit(scheds[i], &reqs[i][k]) != SHA204_SUCCESS) return 0;
+        }
+    sha204_clock_leave();
+
+    for (int i = 0; i < n_devices; ++i)
+        for (int k = 0; k < PER_DEVICE; ++k)
+            if (sha204_sched_wait(scheds[i], &reqs[i][k]) != SHA204_SUCCESS) return 0;
+    return sha204_clock_now_us() - start_us;
+}
+
+
+// 各器件的执行时间相互重叠: 4个器件与1个器件所用的虚拟时间相近
+static int test_devices_overlap(void) {
+    struct sha204_sim *sims[DEVICES];
+    struct sha204_sched *scheds[DEVICES];
+
+    for (int i = 0; i < DEVICES; ++i) {
+        sims[i] = test_sim_create(0);
+        CHECK(sims[i]);
+        scheds[i] = sha204_sched_create(sha204_sim_fd(sims[i]));
+        CHECK(scheds[i]);
+    }
+
+    uint64_t one_us = run_nonces(scheds, 1);
+    uint64_t all_us = run_nonces(scheds, DEVICES);
+    CHECK(one_us >= PER_DEVICE * NONCE_DELAY * 1000ULL);
+    CHECK(all_us > 0 && all_us < one_us * 3 / 2);
+
+    for (int i = 0; i < DEVICES; ++i) {
+        sha204_sched_destroy(scheds[i]);
+        sha204_sim_destroy(sims[i]);
+    }
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+    CHECK(sha204_clock_is_virtual());
+
+    RUN_TEST(test_sleep_is_virtual);
+    RUN_TEST(test_participants);
+    RUN_TEST(test_hold);
+    RUN_TEST(test_devices_overlap);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * test_config_plan.c
+ *
+ * 写config区计划(atsha204_config_plan): 只写与目标不同的字, 块1中两个以上的字不同时合并为一次32字节写;
+ * atsha204_write_config按计划写入器件模型后读回一致, 没有不同的字时不写.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+
+
+static int test_plan(void) {
+    uint8_t current[88], data[68];
+    struct atsha204_config_plan plan;
+
+    memset(current, 0, sizeof(current));
+    memset(data, 0, sizeof(data));
+    atsha204_config_plan(current, data, &plan);
+    CHECK(plan.n == 0);
+
+    // 首尾两个字
+    data[0] = 1;
+    data[67] = 1;
+    atsha204_config_plan(current, data, &plan);
+    CHECK(plan.n == 2);
+    CHECK(plan.writes[0].addr == 0x04 && plan.writes[0].size == SHA204_ZONE_ACCESS_4 && plan.writes[0].offset == 0);
+    CHECK(plan.writes[1].addr == 0x14 && plan.writes[1].size == SHA204_ZONE_ACCESS_4 && plan.writes[1].offset == 64);
+
+    // 块1中只有一个字不同: 4字节写
+    data[16] = 1;
+    atsha204_config_plan(current, data, &plan);
+    CHECK(plan.n == 3);
+    CHECK(plan.writes[1].addr == 0x08 && plan.writes[1].size == SHA204_ZONE_ACCESS_4 && plan.writes[1].offset == 16);
+
+    // 块1中两个字不同: 一次32字节写, param_2为块号<<3
+    data[20] = 1;
+    atsha204_config_plan(current, data, &plan);
+    CHECK(plan.n == 3);
+    CHECK(plan.writes[1].addr == (1 << 3) && plan.writes[1].size == SHA204_ZONE_ACCESS_32);
+    CHECK(plan.writes[1].offset == 16);
+
+    // 全部不同: 块0中4个字, 块1, 块2中5个字
+    memset(data, 0x11, sizeof(data));
+    atsha204_config_plan(current, data, &plan);
+    CHECK(plan.n == 4 + 1 + 5);
+    for (uint8_t i = 0; i < plan.n; ++i)
+        CHECK(plan.writes[i].size == SHA204_ZONE_ACCESS_4 || plan.writes[i].addr == (1 << 3));
+    return 0;
+}
+
+
+static uint64_t timed_write(int fd, uint8_t data[68], uint8_t *status) {
+    uint64_t start_us = sha204_clock_now_us();
+
+    *status = atsha204_write_config(fd, data);
+    return sha204_clock_now_us() - start_us;
+}
+
+
+// 器件上的写入: 全部写入 > 改一个字 > 没有不同(只读比较)
+static int test_write_config(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    int fd = sha204_sim_fd(sim);
+    uint8_t data[68], readback[88], status;
+
+    for (int i = 0; i < 68; ++i) data[i] = (uint8_t) (i * 3);
+    uint64_t full_us = timed_write(fd, data, &status);
+    CHECK(status == SHA204_SUCCESS);
+    CHECK(atsha204_read_config(fd, readback) == SHA204_SUCCESS);
+    CHECK(memcmp(readback + 16, data, sizeof(data)) == 0);
+
+    data[5] ^= 0xFF;
+    uint64_t one_us = timed_write(fd, data, &status);
+    CHECK(status == SHA204_SUCCESS);
+    CHECK(atsha204_read_config(fd, readback) == SHA204_SUCCESS);
+    CHECK(memcmp(readback + 16, data, sizeof(data)) == 0);
+
+    uint64_t none_us = timed_write(fd, data, &status);
+    CHECK(status == SHA204_SUCCESS);
+    CHECK(none_us + WRITE_EXEC_MAX * 1000ULL >= one_us);
+    CHECK(none_us < one_us && one_us < full_us);
+
+    // 由读回内容得出的计划为空
+    struct atsha204_config_plan plan;
+    atsha204_config_plan(readback, data, &plan);
+    CHECK(plan.n == 0);
+    CHECK(atsha204_write_config_plan(fd, &plan, data) == SHA204_SUCCESS);
+
+    // 锁定后不能再写
+    CHECK(atsha204_lock_conf(fd) == SHA204_SUCCESS);
+    data[5] ^= 0xFF;
+    CHECK(atsha204_write_config(fd, data) != SHA204_SUCCESS);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_plan);
+    RUN_TEST(test_write_config);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * test_drbg.c
+ *
+ * 芯片播种的HMAC-DRBG(sha204_drbg): NIST CAVP已知答案测试, 没有随机数池时拒绝输出,
+ * 播种与重新播种从池中取的字节数, 分段生成, 线程之间的实例互相独立.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_drbg.h"
+#include "../sha204/sha204_entropy.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_clock.h"
+
+#include <string.h>
+#include <pthread.h>
+
+
+static int test_known_answer(void) {
+    CHECK(sha204_drbg_self_test() == SHA204_SUCCESS);
+    return 0;
+}
+
+
+// 还没有随机数池: 第一次播种失败, 不输出未经芯片播种的字节
+static int test_no_source(void) {
+    uint8_t buf[32];
+
+    memset(buf, 0xAA, sizeof(buf));
+    CHECK(sha204_drbg_generate(buf, sizeof(buf)) == SHA204_FUNC_FAIL);
+    for (size_t i = 0; i < sizeof(buf); ++i) CHECK(buf[i] == 0);
+    return 0;
+}
+
+
+static void *generate_thread(void *arg) {
+    uint8_t *out = (uint8_t *) arg;
+
+    if (sha204_drbg_generate(out, 32) != SHA204_SUCCESS) memset(out, 0, 32);
+    return NULL;
+}
+
+
+static int test_seeded_from_pool(void) {
+    struct sha204_sim *sim = test_sim_create(1);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    struct sha204_entropy *e = sha204_entropy_create(s, 256, 128);
+    CHECK(e);
+    sha204_drbg_set_source(e);
+
+    struct sha204_entropy_stats st;
+    static uint8_t big[SHA204_DRBG_MAX_REQUEST + 100];
+    uint8_t a[32], b[32], other[32], zero[32];
+
+    memset(zero, 0, sizeof(zero));
+    sha204_clock_sleep_us(1000000);
+
+    // 首次播种取48字节
+    CHECK(sha204_drbg_generate(a, sizeof(a)) == SHA204_SUCCESS);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.served == 48);
+
+    CHECK(sha204_drbg_generate(b, sizeof(b)) == SHA204_SUCCESS);
+    CHECK(memcmp(a, b, sizeof(a)) != 0);
+
+    // 超过SHA204_DRBG_MAX_REQUEST分段生成, 不需要重新播种
+    CHECK(sha204_drbg_generate(big, sizeof(big)) == SHA204_SUCCESS);
+    CHECK(memcmp(big + SHA204_DRBG_MAX_REQUEST, zero, 32) != 0);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.served == 48);
+
+    // 重新播种取32字节
+    CHECK(sha204_drbg_reseed() == SHA204_SUCCESS);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.served == 48 + 32);
+
+    // 另一个线程有自己的实例, 另取48字节播种
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, generate_thread, other) == 0);
+    pthread_join(thread, NULL);
+    CHECK(memcmp(other, zero, sizeof(other)) != 0);
+    CHECK(memcmp(other, a, sizeof(other)) != 0);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.served == 48 + 32 + 48);
+
+    sha204_drbg_set_source(NULL);
+    CHECK(sha204_drbg_reseed() == SHA204_FUNC_FAIL);
+
+    sha204_entropy_destroy(e);
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_known_answer);
+    RUN_TEST(test_no_source);
+    RUN_TEST(test_seeded_from_pool);
+    return 0;
+}
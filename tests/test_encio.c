@@ -0,0 +1,131 @@
+/*
+ * test_encio.c
+ *
+ * 流水线化的加密读写(sha204_encio): 一次唤醒内依次加密写入并读回多个slot, 与逐条的atsha204_encrypted_read一致;
+ * 密钥错误的slot单独失败, 不影响后续slot; 调用者传入awake时返回后器件仍醒着.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_encio.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+
+#define KEY_SLOT        (1)
+
+static struct sha204_sim *sim;
+static int fd;
+static uint8_t key[32], num_in[20] = {4, 5, 6};
+
+
+// slot2, slot3: IsSecret|EncryptRead, ReadKey 1; 加密写, WriteKey 1. slot1为明文的密钥
+static int setup(void) {
+    uint8_t config[68] = {0xC8, 0x00, 0x55, 0x00,
+                          0x80, 0x80, 0x00, 0x00, 0xC1, 0x41, 0xC1, 0x41};
+    uint8_t blank[32];
+
+    for (int i = 0; i < 32; ++i) key[i] = (uint8_t) (0xA5 ^ (i * 7));
+    memset(blank, 0, sizeof(blank));
+
+    sim = test_sim_create(0);
+    CHECK(sim);
+    fd = sha204_sim_fd(sim);
+    CHECK(atsha204_write_config(fd, config) == SHA204_SUCCESS);
+    CHECK(atsha204_lock_conf(fd) == SHA204_SUCCESS);
+    for (int slot = 0; slot < 16; ++slot)
+        CHECK(atsha204_write_data(fd, slot, slot == KEY_SLOT ? key : blank) == SHA204_SUCCESS);
+    CHECK(atsha204_lock_data(fd) == SHA204_SUCCESS);
+    return 0;
+}
+
+
+static void op_init(struct sha204_encio_op *op, uint8_t write, uint16_t slot, const uint8_t *op_key) {
+    memset(op, 0, sizeof(*op));
+    op->write = write;
+    op->slot = slot;
+    op->key_id = KEY_SLOT;
+    op->key = op_key;
+}
+
+
+static int test_write_then_read(void) {
+    struct sha204_encio_op ops[4];
+    uint8_t data[2][32], check[32];
+
+    for (int i = 0; i < 32; ++i) {
+        data[0][i] = (uint8_t) (i * 3);
+        data[1][i] = (uint8_t) (0xFF - i);
+    }
+    op_init(&ops[0], 1, 2, key);
+    op_init(&ops[1], 1, 3, key);
+    op_init(&ops[2], 0, 2, key);
+    op_init(&ops[3], 0, 3, key);
+    memcpy(ops[0].data, data[0], 32);
+    memcpy(ops[1].data, data[1], 32);
+
+    CHECK(sha204_encio_run(fd, NULL, NONCE_MODE_NO_SEED_UPDATE, num_in, ops, 4) == SHA204_SUCCESS);
+    for (int i = 0; i < 4; ++i) CHECK(ops[i].status == SHA204_SUCCESS);
+    CHECK(memcmp(ops[2].data, data[0], 32) == 0);
+    CHECK(memcmp(ops[3].data, data[1], 32) == 0);
+
+    // 与逐条执行的加密读一致
+    CHECK(atsha204_encrypted_read(fd, KEY_SLOT, key, 2, check) == SHA204_SUCCESS);
+    CHECK(memcmp(check, data[0], 32) == 0);
+    return 0;
+}
+
+
+// 错误的WriteKey: 输入MAC不符, 器件拒绝写入; 下一个slot仍正常读出
+static int test_wrong_key(void) {
+    struct sha204_encio_op ops[3];
+    uint8_t wrong[32], before[32];
+
+    memcpy(wrong, key, sizeof(wrong));
+    wrong[0] ^= 1;
+    CHECK(atsha204_encrypted_read(fd, KEY_SLOT, key, 2, before) == SHA204_SUCCESS);
+
+    op_init(&ops[0], 1, 2, wrong);
+    op_init(&ops[1], 0, 3, key);
+    op_init(&ops[2], 0, 2, key);
+    memset(ops[0].data, 0x5A, 32);
+
+    CHECK(sha204_encio_run(fd, NULL, NONCE_MODE_SEED_UPDATE, num_in, ops, 3) == ops[0].status);
+    CHECK(ops[0].status != SHA204_SUCCESS);
+    CHECK(ops[1].status == SHA204_SUCCESS);
+    CHECK(ops[2].status == SHA204_SUCCESS);
+    CHECK(memcmp(ops[2].data, before, 32) == 0);
+    return 0;
+}
+
+
+// 调用者管理唤醒状态: 两次调用之间器件不sleep
+static int test_caller_awake(void) {
+    struct sha204_encio_op op;
+    struct sha204_awake awake = {0, 0};
+
+    op_init(&op, 0, 3, key);
+    CHECK(sha204_encio_run(fd, &awake, NONCE_MODE_NO_SEED_UPDATE, num_in, &op, 1) == SHA204_SUCCESS);
+    CHECK(awake.awake);
+    op_init(&op, 0, 2, key);
+    CHECK(sha204_encio_run(fd, &awake, NONCE_MODE_NO_SEED_UPDATE, num_in, &op, 1) == SHA204_SUCCESS);
+    CHECK(awake.awake);
+    sha204_request_sleep(fd, &awake);
+    CHECK(!awake.awake);
+
+    // 参数检查
+    CHECK(sha204_encio_run(fd, NULL, 0xFF, num_in, &op, 1) == SHA204_BAD_PARAM);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    CHECK(setup() == 0);
+    RUN_TEST(test_write_then_read);
+    RUN_TEST(test_wrong_key);
+    RUN_TEST(test_caller_awake);
+    sha204_sim_destroy(sim);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * test_entropy.c
+ *
+ * 随机数池(sha204_entropy): 预取补满, 从池中读取不等待芯片, 池不够时同步补足, 字节不重复交付,
+ * config区未锁定时拒绝工作.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_entropy.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <string.h>
+
+
+// 8字节一组, 任意两组不相同(32字节Random输出之间重复的概率可以忽略)
+static int unique_blocks(const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i + 8 <= len; i += 8)
+        for (size_t j = i + 8; j + 8 <= len; j += 8)
+            if (memcmp(buf + i, buf + j, 8) == 0) return 0;
+    return 1;
+}
+
+
+static int test_prefetch_and_read(void) {
+    struct sha204_sim *sim = test_sim_create(1);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    struct sha204_entropy *e = sha204_entropy_create(s, 200, 96);
+    CHECK(e);
+
+    struct sha204_entropy_stats st;
+    static uint8_t all[2048];
+    size_t total = 0;
+
+    // 容量向上取整到224字节, 7条Random
+    sha204_clock_sleep_us(1000000);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.level == 224);
+    CHECK(st.refills == 7);
+
+    // 池中足够时立即返回
+    uint64_t start_us = sha204_clock_now_us();
+    CHECK(sha204_entropy_read(e, all, 40) == SHA204_SUCCESS);
+    CHECK(sha204_clock_now_us() - start_us < RANDOM_EXEC_MAX * 1000);
+    total += 40;
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.from_pool == 40);
+    CHECK(st.inline_randoms == 0);
+
+    // 超过池容量的读取: 取空池后同步执行Random补足
+    CHECK(sha204_entropy_read(e, all + total, 500) == SHA204_SUCCESS);
+    total += 500;
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.inline_randoms > 0);
+    CHECK(st.served == total);
+
+    // 低于低水位后后台补充, 直到再放不下一条Random
+    sha204_clock_sleep_us(1000000);
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.level > 224 - SHA204_ENTROPY_BLOCK && st.level <= 224);
+
+    for (int k = 1; k <= 20; ++k) {
+        size_t n = (size_t) (k * 7) % 40 + 1;
+        CHECK(sha204_entropy_read(e, all + total, n) == SHA204_SUCCESS);
+        total += n;
+        sha204_clock_sleep_us(20000);
+    }
+    CHECK(unique_blocks(all, total));
+
+    sha204_entropy_destroy(e);
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static int test_unlocked_config(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    struct sha204_entropy *e = sha204_entropy_create(s, 64, 32);
+    CHECK(e);
+
+    uint8_t buf[16];
+    memset(buf, 0xAA, sizeof(buf));
+    sha204_clock_sleep_us(1000000);
+    CHECK(sha204_entropy_read(e, buf, sizeof(buf)) == SHA204_FUNC_FAIL);
+    for (size_t i = 0; i < sizeof(buf); ++i) CHECK(buf[i] == 0);
+
+    struct sha204_entropy_stats st;
+    sha204_entropy_get_stats(e, &st);
+    CHECK(st.level == 0);
+    CHECK(st.served == 0);
+
+    sha204_entropy_destroy(e);
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_prefetch_and_read);
+    RUN_TEST(test_unlocked_config);
+    return 0;
+}
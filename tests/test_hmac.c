@@ -0,0 +1,153 @@
+/*
+ * test_hmac.c
+ *
+ * sha204h_hmac的每线程密钥缓存: 命中, 未命中, 淘汰, 换密钥, sha204h_hmac_cache_clear之后与其他线程,
+ * 结果都与不经缓存的计算(按FIPS 198直接算的HMAC, 以及sha204h_hmac_key_init/sha204h_hmac_with_key)一致.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_helper.h"
+#include "../sha204/sha204_comm_marshaling.h"
+#include "../sha204/sha256.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#define KEYS            (SHA204H_HMAC_CACHE_SIZE + 4)
+
+static uint8_t keys[KEYS][32];
+
+
+// HMAC命令的消息(模式0): 32字节0, TempKey, opcode, mode, keyID, 11字节0, SN[8], 4字节0, SN[0:1], 2字节0
+static void reference_hmac(const uint8_t key[32], const uint8_t temp_key[32], uint16_t key_id, uint8_t out[32]) {
+    uint8_t text[88], pad[64], inner[32];
+    sha256_ctx ctx;
+
+    memset(text, 0, sizeof(text));
+    memcpy(text + 32, temp_key, 32);
+    text[64] = SHA204_HMAC;
+    text[65] = 0;
+    text[66] = (uint8_t) (key_id & 0xFF);
+    text[67] = (uint8_t) (key_id >> 8);
+    text[79] = SHA204_SN_8;
+    text[84] = SHA204_SN_0;
+    text[85] = SHA204_SN_1;
+
+    memset(pad, 0x36, sizeof(pad));
+    for (int i = 0; i < 32; ++i) pad[i] ^= key[i];
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, text, sizeof(text));
+    sha256_final(&ctx, inner);
+
+    memset(pad, 0x5C, sizeof(pad));
+    for (int i = 0; i < 32; ++i) pad[i] ^= key[i];
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, inner, sizeof(inner));
+    sha256_final(&ctx, out);
+}
+
+
+// 以第k个密钥与随k, round变化的TempKey分别经缓存与不经缓存计算, 比较
+static int check_key(int k, int round) {
+    struct sha204h_temp_key temp_key;
+    struct sha204h_hmac_key hkey;
+    uint8_t cached[32], direct[32], expected[32];
+
+    memset(&temp_key, 0, sizeof(temp_key));
+    for (int i = 0; i < 32; ++i) temp_key.value[i] = (uint8_t) (k * 31 + round * 7 + i);
+    reference_hmac(keys[k], temp_key.value, (uint16_t) (k & 0x0F), expected);
+
+    temp_key.valid = 1;
+    struct sha204h_hmac_in_out param = {0, (uint16_t) (k & 0x0F), keys[k], NULL, NULL, cached, &temp_key};
+    CHECK(sha204h_hmac(param) == SHA204_SUCCESS);
+    CHECK(!temp_key.valid);
+    CHECK(memcmp(cached, expected, 32) == 0);
+
+    temp_key.valid = 1;
+    param.response = direct;
+    sha204h_hmac_key_init(&hkey, keys[k]);
+    CHECK(sha204h_hmac_with_key(param, &hkey) == SHA204_SUCCESS);
+    sha204h_hmac_key_clear(&hkey);
+    CHECK(memcmp(direct, expected, 32) == 0);
+    return 0;
+}
+
+
+// 未命中后命中, 两个密钥交替
+static int test_hit_and_miss(void) {
+    for (int round = 0; round < 3; ++round) {
+        CHECK(check_key(0, round) == 0);
+        CHECK(check_key(1, round) == 0);
+    }
+    return 0;
+}
+
+
+// 超过缓存容量的密钥轮流使用: 被淘汰的密钥重新计算
+static int test_eviction(void) {
+    for (int round = 0; round < 3; ++round)
+        for (int k = 0; k < KEYS; ++k) CHECK(check_key(k, round) == 0);
+    return 0;
+}
+
+
+// 同一个缓存位置上换了密钥(密钥轮换): 不会用到旧密钥的中间状态
+static int test_key_change(void) {
+    CHECK(check_key(2, 0) == 0);
+    keys[2][0] ^= 0x80;
+    CHECK(check_key(2, 1) == 0);
+    keys[2][31] ^= 0x01;
+    CHECK(check_key(2, 2) == 0);
+    return 0;
+}
+
+
+static void *other_thread(void *arg) {
+    (void) arg;
+    for (int k = 0; k < 4; ++k)
+        if (check_key(k, 9) != 0) return (void *) 1;
+    return NULL;
+}
+
+
+static void *clear_thread(void *arg) {
+    (void) arg;
+    sha204h_hmac_cache_clear();
+    return NULL;
+}
+
+
+// 清除后重新计算; 其他线程的缓存各自独立
+static int test_clear(void) {
+    pthread_t thread;
+    void *ret;
+
+    CHECK(check_key(3, 0) == 0);
+    sha204h_hmac_cache_clear();
+    CHECK(check_key(3, 1) == 0);
+
+    CHECK(pthread_create(&thread, NULL, other_thread, NULL) == 0);
+    pthread_join(thread, &ret);
+    CHECK(ret == NULL);
+
+    // 其他线程清除, 本线程下次使用时丢弃
+    CHECK(pthread_create(&thread, NULL, clear_thread, NULL) == 0);
+    pthread_join(thread, NULL);
+    keys[3][5] ^= 0x10;
+    CHECK(check_key(3, 2) == 0);
+    return 0;
+}
+
+
+int main(void) {
+    for (int k = 0; k < KEYS; ++k)
+        for (int i = 0; i < 32; ++i) keys[k][i] = (uint8_t) (k * 13 + i * 5 + 1);
+
+    RUN_TEST(test_hit_and_miss);
+    RUN_TEST(test_eviction);
+    RUN_TEST(test_key_change);
+    RUN_TEST(test_clear);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * test_mpsc.c
+ *
+ * MPSC提交队列(sha204_mpsc): 多个生产者并发提交全部完成, 队列满时拒绝, eventfd通知,
+ * 销毁时已入队的请求都完成并唤醒等待者.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_mpsc.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm_marshaling.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+#define PRODUCERS       (8)
+#define PER_PRODUCER    (8)
+
+static struct sha204_worker *worker;
+static uint32_t completed, rejected;
+
+
+static void devrev_init(struct sha204_request *req) {
+    sha204_request_init(req, SHA204_DEVREV, 0, 0, NULL, 0);
+}
+
+
+static void *producer(void *arg) {
+    (void) arg;
+    for (int i = 0; i < PER_PRODUCER; ++i) {
+        struct sha204_future *f = (struct sha204_future *) malloc(sizeof(*f));
+        struct sha204_request req;
+
+        devrev_init(&req);
+        sha204_future_init(f, -1);
+        if (sha204_worker_submit(worker, &req, f) == SHA204_SUCCESS) {
+            // 完成后立即释放future, 工作线程之后不能再访问它
+            if (sha204_future_wait(f) == SHA204_SUCCESS && f->result.rsp[0] == DEVREV_RSP_SIZE)
+                __atomic_add_fetch(&completed, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&rejected, 1, __ATOMIC_RELAXED);
+        }
+        free(f);
+    }
+    return NULL;
+}
+
+
+static int test_concurrent_producers(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    worker = sha204_worker_create(sha204_sim_fd(sim), PRODUCERS * PER_PRODUCER);
+    CHECK(worker);
+
+    pthread_t threads[PRODUCERS];
+    completed = rejected = 0;
+    for (int i = 0; i < PRODUCERS; ++i) CHECK(pthread_create(&threads[i], NULL, producer, NULL) == 0);
+    for (int i = 0; i < PRODUCERS; ++i) pthread_join(threads[i], NULL);
+
+    CHECK(rejected == 0);
+    CHECK(completed == PRODUCERS * PER_PRODUCER);
+
+    sha204_worker_destroy(worker);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static int test_queue_full_and_eventfd(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    int efd = eventfd(0, EFD_CLOEXEC);
+    CHECK(efd >= 0);
+    worker = sha204_worker_create(sha204_sim_fd(sim), 4);
+    CHECK(worker);
+
+    // 提交比执行快得多, 容量4的队列很快就满
+    static struct sha204_future f[1024];
+    struct sha204_request req;
+    uint32_t accepted = 0;
+    devrev_init(&req);
+    for (int i = 0; i < 1024; ++i) {
+        sha204_future_init(&f[i], efd);
+        uint8_t status = sha204_worker_submit(worker, &req, &f[i]);
+        CHECK(status == SHA204_SUCCESS || status == SHA204_QUEUE_FULL);
+        if (status != SHA204_SUCCESS) break;
+        accepted++;
+    }
+    CHECK(accepted >= 4 && accepted < 1024);
+
+    uint64_t signalled = 0, value;
+    while (signalled < accepted) {
+        CHECK(read(efd, &value, sizeof(value)) == sizeof(value));
+        signalled += value;
+    }
+    for (uint32_t i = 0; i < accepted; ++i) {
+        CHECK(sha204_future_done(&f[i]));
+        CHECK(f[i].result.status == SHA204_SUCCESS);
+    }
+
+    // 同步执行
+    CHECK(sha204_worker_execute(worker, &req) == SHA204_SUCCESS);
+    CHECK(req.rsp[0] == DEVREV_RSP_SIZE);
+
+    sha204_worker_destroy(worker);
+    close(efd);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static uint32_t submitted;
+
+static void *waiter(void *arg) {
+    struct sha204_future *f = (struct sha204_future *) arg;
+    struct sha204_request req;
+    long n = 0;
+
+    devrev_init(&req);
+    for (int i = 0; i < 64; ++i) {
+        sha204_future_init(&f[i], -1);
+        if (sha204_worker_submit(worker, &req, &f[i]) != SHA204_SUCCESS) break;
+        n++;
+    }
+    __atomic_store_n(&submitted, 1, __ATOMIC_RELEASE);
+    for (long i = 0; i < n; ++i) sha204_future_wait(&f[i]);
+    return (void *) n;
+}
+
+
+// 提交者还在等待结果时销毁: 已入队的请求都执行完成, 等待者都被唤醒, 唤醒不访问已释放的内存
+static int test_destroy_with_waiters(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+
+    for (int k = 0; k < 8; ++k) {
+        static struct sha204_future f[64];
+        pthread_t thread;
+        void *n;
+
+        worker = sha204_worker_create(sha204_sim_fd(sim), 64);
+        CHECK(worker);
+        submitted = 0;
+        CHECK(pthread_create(&thread, NULL, waiter, f) == 0);
+        while (!__atomic_load_n(&submitted, __ATOMIC_ACQUIRE)) sched_yield();
+        sha204_worker_destroy(worker);
+        pthread_join(thread, &n);
+        CHECK((long) n == 64);
+        for (long i = 0; i < (long) n; ++i) CHECK(f[i].result.status == SHA204_SUCCESS);
+    }
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_concurrent_producers);
+    RUN_TEST(test_queue_full_and_eventfd);
+    RUN_TEST(test_destroy_with_waiters);
+    return 0;
+}
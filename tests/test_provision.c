@@ -0,0 +1,175 @@
+/*
+ * test_provision.c
+ *
+ * 生产线个人化(sha204_provision): 两条总线上的多颗芯片按profile写入config区与slot并锁定,
+ * 按芯片生成的密钥与SN相关, 已个人化的芯片再次运行时不做写入, 配置不同的已锁定芯片报错;
+ * 带CRC锁定只适用于出厂状态的data区, 不带CRC时profile以外的slot不影响锁定.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_provision.h"
+#include "../sha204/sha204_clock.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define SOCKETS         (4)
+#define BUSES           (2)
+
+static char image_path[SOCKETS][64];
+static uint8_t fixed[32] = "3wlink.cn";
+
+
+static uint8_t derive(void *ctx, const uint8_t sn[9], uint8_t slot, uint8_t out[32]) {
+    for (int i = 0; i < 32; ++i) out[i] = (uint8_t) (sn[i % 9] ^ slot ^ (uint8_t) (uintptr_t) ctx);
+    return SHA204_SUCCESS;
+}
+
+
+// slot0, slot4: IsSecret; slot1: IsSecret|EncryptRead, 加密写; 其余明文
+static void profile_init(struct sha204_prov_profile *p, const struct sha204_prov_slot *slots, uint8_t n_slots) {
+    static const uint8_t head[16] = {0xC8, 0x00, 0x55, 0x00, 0x80, 0x80, 0xC0, 0xF0,
+                                     0x41, 0x40, 0x41, 0x00, 0x80, 0xA0, 0x80, 0xA0};
+
+    memset(p->config, 0, sizeof(p->config));
+    memcpy(p->config, head, sizeof(head));
+    for (int i = 32; i < 52; i += 2) p->config[i] = 0xFF;
+    memset(p->config + 52, 0xFF, 16);
+    p->slots = slots;
+    p->n_slots = n_slots;
+    p->lock = SHA204_PROV_LOCK_ALL;
+    p->data_crc = SHA204_PROV_CRC_BLANK;
+}
+
+
+// 在各映像上运行一次; prepare不为NULL时先对每颗芯片调用
+static int run_prepared(const struct sha204_prov_profile *p, struct sha204_prov_result *results, uint8_t *status,
+                        int (*prepare)(int fd)) {
+    struct sha204_sim *sims[SOCKETS];
+    struct sha204_prov_socket sockets[SOCKETS];
+
+    for (int i = 0; i < SOCKETS; ++i) {
+        sims[i] = sha204_sim_create(image_path[i]);
+        CHECK(sims[i]);
+        sha204_sim_set_timing(sims[i], 1);
+        sockets[i].fd = sha204_sim_fd(sims[i]);
+        sockets[i].bus = (uint32_t) (i % BUSES);
+        if (prepare) CHECK(prepare(sockets[i].fd) == 0);
+    }
+    *status = sha204_provision_run(p, sockets, SOCKETS, results);
+    for (int i = 0; i < SOCKETS; ++i) sha204_sim_destroy(sims[i]);
+    return 0;
+}
+
+
+static int run(const struct sha204_prov_profile *p, struct sha204_prov_result *results, uint8_t *status) {
+    return run_prepared(p, results, status, NULL);
+}
+
+
+// 返修芯片: profile以外的slot 7已写过内容
+static int write_slot_7(int fd) {
+    uint8_t content[32];
+
+    memset(content, 0x3C, sizeof(content));
+    CHECK(atsha204_write_data(fd, 7, content) == SHA204_SUCCESS);
+    return 0;
+}
+
+
+static int test_provision_and_rerun(void) {
+    struct sha204_prov_slot slots[] = {{0, fixed, NULL, NULL}, {4, NULL, derive, (void *) 7}, {9, fixed, NULL, NULL}};
+    struct sha204_prov_profile profile;
+    struct sha204_prov_result results[SOCKETS];
+    uint8_t status;
+
+    profile_init(&profile, slots, 3);
+    CHECK(run(&profile, results, &status) == 0);
+    CHECK(status == SHA204_SUCCESS);
+    for (int i = 0; i < SOCKETS; ++i) {
+        CHECK(results[i].status == SHA204_SUCCESS);
+        CHECK(results[i].step == SHA204_PROV_STEP_DONE);
+        CHECK(results[i].provisioned);
+        CHECK(results[i].lock[2] == 0x00 && results[i].lock[3] == 0x00);
+        CHECK(results[i].finish_us >= results[i].start_us);
+        if (i > 0) CHECK(memcmp(results[i].sn, results[0].sn, 9) != 0);
+    }
+
+    // 已锁定且配置一致: 只读不写
+    struct sha204_prov_result again[SOCKETS];
+    CHECK(run(&profile, again, &status) == 0);
+    CHECK(status == SHA204_SUCCESS);
+    for (int i = 0; i < SOCKETS; ++i) {
+        CHECK(again[i].status == SHA204_SUCCESS);
+        CHECK(!again[i].provisioned);
+        CHECK(again[i].commands < results[i].commands);
+        CHECK(memcmp(again[i].sn, results[i].sn, 9) == 0);
+    }
+
+    // 已锁定的芯片与另一份配置不一致
+    profile.config[4] ^= 0x01;
+    CHECK(run(&profile, again, &status) == 0);
+    CHECK(status != SHA204_SUCCESS);
+    for (int i = 0; i < SOCKETS; ++i) {
+        CHECK(again[i].status != SHA204_SUCCESS);
+        CHECK(again[i].step != SHA204_PROV_STEP_DONE);
+        CHECK(!again[i].provisioned);
+    }
+
+    return 0;
+}
+
+
+static int test_data_crc(void) {
+    struct sha204_prov_slot slots[] = {{0, fixed, NULL, NULL}, {4, NULL, derive, (void *) 7}};
+    struct sha204_prov_profile profile;
+    struct sha204_prov_result results[SOCKETS];
+    uint8_t status;
+
+    for (int i = 0; i < SOCKETS; ++i) unlink(image_path[i]);
+    profile_init(&profile, slots, 2);
+    profile.lock = SHA204_PROV_LOCK_CONFIG;
+    CHECK(run(&profile, results, &status) == 0);
+    CHECK(status == SHA204_SUCCESS);
+
+    // 带CRC: slot 7不是出厂内容, Lock失败, data区保持未锁定
+    profile.lock = SHA204_PROV_LOCK_ALL;
+    CHECK(run_prepared(&profile, results, &status, write_slot_7) == 0);
+    CHECK(status != SHA204_SUCCESS);
+    for (int i = 0; i < SOCKETS; ++i) {
+        CHECK(results[i].step == SHA204_PROV_STEP_LOCK_DATA);
+        CHECK(results[i].lock[2] != 0x00);
+    }
+
+    // 不带CRC: 同atsha204_lock_data, 锁定成功
+    profile.data_crc = SHA204_PROV_CRC_NONE;
+    CHECK(run(&profile, results, &status) == 0);
+    CHECK(status == SHA204_SUCCESS);
+    for (int i = 0; i < SOCKETS; ++i) {
+        CHECK(results[i].step == SHA204_PROV_STEP_DONE);
+        CHECK(results[i].lock[2] == 0x00 && results[i].lock[3] == 0x00);
+    }
+
+    profile.data_crc = SHA204_PROV_CRC_BLANK + 1;
+    CHECK(sha204_provision_run(&profile, NULL, 0, results) == SHA204_BAD_PARAM);
+    return 0;
+}
+
+
+static int run_tests(void) {
+    RUN_TEST(test_provision_and_rerun);
+    RUN_TEST(test_data_crc);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+    for (int i = 0; i < SOCKETS; ++i)
+        snprintf(image_path[i], sizeof(image_path[i]), "/tmp/sha204_test_provision.%d.%d.img", (int) getpid(), i);
+
+    int ret = run_tests();
+
+    for (int i = 0; i < SOCKETS; ++i) unlink(image_path[i]);
+    return ret;
+}
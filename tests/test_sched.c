@@ -0,0 +1,211 @@
+/*
+ * test_sched.c
+ *
+ * 请求调度器(sha204_sched): 按优先级与截止时间派发, 取消, 赶不上截止时间的请求不占用器件,
+ * hold为owner保留器件以及被更高优先级打断, owner不再提交时保留按虚拟时间到期, 销毁时取消的请求收到完成回调.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_clock.h"
+
+#include <string.h>
+
+#define JOB_COST_MS     (10)
+
+static char order[16];
+static int n_order;
+
+
+// 命令序列: 记下执行顺序, 在器件上占用JOB_COST_MS
+static uint8_t record_job(int fd, void *arg) {
+    (void) fd;
+    order[n_order++] = *(const char *) arg;
+    sha204_clock_sleep_us(JOB_COST_MS * 1000);
+    return SHA204_SUCCESS;
+}
+
+
+static void job_init(struct sha204_sched_req *r, uint8_t prio, uint32_t timeout_ms, const char *name,
+                     const void *owner, uint8_t hold) {
+    sha204_sched_req_init(r, prio, timeout_ms);
+    r->job = record_job;
+    r->job_arg = (void *) name;
+    r->job_cost_ms = JOB_COST_MS;
+    r->owner = owner;
+    r->hold = hold;
+}
+
+
+static int test_priority_order(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+
+    // 第一条可能在其余请求入队前就开始执行, 用紧急优先级使它在任何情况下都排在最前
+    struct sha204_sched_req r[6];
+    job_init(&r[0], SHA204_PRIO_URGENT, 0, "F", NULL, 0);
+    job_init(&r[1], SHA204_PRIO_BACKGROUND, 0, "B", NULL, 0);
+    job_init(&r[2], SHA204_PRIO_BACKGROUND, 0, "C", NULL, 0);
+    job_init(&r[3], SHA204_PRIO_NORMAL, 0, "N", NULL, 0);
+    job_init(&r[4], SHA204_PRIO_URGENT, 0, "U", NULL, 0);
+    job_init(&r[5], SHA204_PRIO_URGENT, JOB_COST_MS / 2, "T", NULL, 0);
+
+    n_order = 0;
+    sha204_clock_join();
+    for (int i = 0; i < 6; ++i) CHECK(sha204_sched_submit(s, &r[i]) == SHA204_SUCCESS);
+    CHECK(sha204_sched_cancel(s, &r[2]) == SHA204_SUCCESS);
+    sha204_clock_leave();
+
+    CHECK(sha204_sched_wait(s, &r[0]) == SHA204_SUCCESS);
+    CHECK(sha204_sched_wait(s, &r[1]) == SHA204_SUCCESS);
+    CHECK(r[2].state == SHA204_REQ_CANCELLED);
+    CHECK(sha204_sched_wait(s, &r[3]) == SHA204_SUCCESS);
+    CHECK(sha204_sched_wait(s, &r[4]) == SHA204_SUCCESS);
+    // 截止时间短于执行时间, 不派发到器件
+    CHECK(sha204_sched_wait(s, &r[5]) == SHA204_TIMEOUT);
+
+    order[n_order] = 0;
+    CHECK(strcmp(order, "FUNB") == 0);
+    CHECK(r[4].finish_us <= r[3].start_us);
+
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static int test_hold(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    int owner_a, owner_b;
+    struct sha204_sched_req a1, a2, b1, a3, u, a4;
+
+    n_order = 0;
+    // owner作为虚拟时间的参与者, 两步之间时间不推进
+    sha204_clock_join();
+
+    // 保留期间其他owner的同级请求等待, owner的下一步先执行
+    job_init(&a1, SHA204_PRIO_NORMAL, 0, "a", &owner_a, 1);
+    CHECK(sha204_sched_execute(s, &a1) == SHA204_SUCCESS);
+    job_init(&b1, SHA204_PRIO_NORMAL, 0, "b", &owner_b, 0);
+    job_init(&a2, SHA204_PRIO_NORMAL, 0, "A", &owner_a, 0);
+    CHECK(sha204_sched_submit(s, &b1) == SHA204_SUCCESS);
+    CHECK(sha204_sched_submit(s, &a2) == SHA204_SUCCESS);
+    CHECK(sha204_sched_wait(s, &a2) == SHA204_SUCCESS);
+    CHECK(sha204_sched_wait(s, &b1) == SHA204_SUCCESS);
+
+    // 其他提交者的紧急请求打断保留
+    job_init(&a3, SHA204_PRIO_BACKGROUND, 0, "x", &owner_a, 1);
+    CHECK(sha204_sched_execute(s, &a3) == SHA204_SUCCESS);
+    job_init(&u, SHA204_PRIO_URGENT, 0, "u", &owner_b, 0);
+    CHECK(sha204_sched_execute(s, &u) == SHA204_SUCCESS);
+    job_init(&a4, SHA204_PRIO_BACKGROUND, 0, "X", &owner_a, 0);
+    CHECK(sha204_sched_execute(s, &a4) == SHA204_SUCCESS);
+    sha204_clock_leave();
+
+    order[n_order] = 0;
+    CHECK(strcmp(order, "aAbxuX") == 0);
+
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// owner没有下一步: 其他owner的请求等到SHA204_SCHED_HOLD_MS到期后执行, 按虚拟时间计而不是真实时间
+static int test_hold_expires(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    int owner_a, owner_b;
+    struct sha204_sched_req a1, b1, a2, b2;
+
+    n_order = 0;
+    sha204_clock_join();
+    job_init(&a1, SHA204_PRIO_NORMAL, 0, "a", &owner_a, 1);
+    CHECK(sha204_sched_execute(s, &a1) == SHA204_SUCCESS);
+    job_init(&b1, SHA204_PRIO_NORMAL, 0, "b", &owner_b, 0);
+    CHECK(sha204_sched_execute(s, &b1) == SHA204_SUCCESS);
+    CHECK(b1.start_us >= a1.finish_us + SHA204_SCHED_HOLD_MS * 1000ULL);
+    CHECK(b1.start_us < a1.finish_us + (SHA204_SCHED_HOLD_MS + JOB_COST_MS) * 1000ULL);
+
+    // 保留期间被sha204_sched_release提前结束
+    job_init(&a2, SHA204_PRIO_NORMAL, 0, "c", &owner_a, 1);
+    CHECK(sha204_sched_execute(s, &a2) == SHA204_SUCCESS);
+    job_init(&b2, SHA204_PRIO_NORMAL, 0, "d", &owner_b, 0);
+    CHECK(sha204_sched_submit(s, &b2) == SHA204_SUCCESS);
+    sha204_sched_release(s, &owner_a);
+    CHECK(sha204_sched_wait(s, &b2) == SHA204_SUCCESS);
+    CHECK(b2.start_us == a2.finish_us);
+    sha204_clock_leave();
+
+    order[n_order] = 0;
+    CHECK(strcmp(order, "abcd") == 0);
+
+    sha204_sched_destroy(s);
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static int n_callbacks;
+static uint8_t callback_status[8];
+
+static void on_complete(struct sha204_sched_req *r, void *arg) {
+    (void) arg;
+    callback_status[n_callbacks++] = r->req.status;
+}
+
+
+// 销毁时仍在排队的请求以SHA204_FUNC_FAIL完成, 使用回调的提交者也能得知
+static int test_destroy_completes_queued(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    struct sha204_sched *s = sha204_sched_create(sha204_sim_fd(sim));
+    CHECK(s);
+    struct sha204_sched_req r[5];
+
+    n_callbacks = 0;
+    n_order = 0;
+    sha204_clock_join();
+    for (int i = 0; i < 5; ++i) {
+        job_init(&r[i], SHA204_PRIO_NORMAL, 0, "d", NULL, 0);
+        r[i].on_complete = on_complete;
+        CHECK(sha204_sched_submit(s, &r[i]) == SHA204_SUCCESS);
+    }
+    sha204_clock_leave();
+    sha204_sched_destroy(s);
+
+    CHECK(n_callbacks == 5);
+    int executed = 0;
+    for (int i = 0; i < 5; ++i) {
+        if (r[i].state == SHA204_REQ_DONE) {
+            CHECK(callback_status[executed] == SHA204_SUCCESS);
+            executed++;
+        } else {
+            CHECK(r[i].state == SHA204_REQ_CANCELLED);
+            CHECK(r[i].req.status == SHA204_FUNC_FAIL);
+        }
+    }
+    CHECK(executed == n_order);
+    for (int i = executed; i < 5; ++i) CHECK(callback_status[i] == SHA204_FUNC_FAIL);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    RUN_TEST(test_priority_order);
+    RUN_TEST(test_hold);
+    RUN_TEST(test_hold_expires);
+    RUN_TEST(test_destroy_completes_queued);
+    return 0;
+}
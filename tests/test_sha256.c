@@ -0,0 +1,178 @@
+/*
+ * test_sha256.c
+ *
+ * SHA-256的各条快速路径与通用实现一致: 运行时选择的压缩函数后端(SHA-NI/ARMv8)与generic,
+ * sha256_many的各种lane数与不齐的批量, 定长kernel(sha256_fixed, sha256_resume_32/_88),
+ * sha256_updatev在每个分割位置上.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha256.h"
+
+#include <string.h>
+
+#define MSG_MAX         (1200)
+
+static uint8_t msg[MSG_MAX];
+
+
+// 通用实现的结果作为参照; 调用者恢复后端
+static void reference(const uint8_t *m, uint32_t len, uint8_t digest[32]) {
+    sha256_use_backend("generic");
+    sha256(m, len, digest);
+}
+
+
+// 各后端逐个长度一次性计算与分段update, 与generic比较
+static int test_backends(void) {
+    static const char *const backends[] = {"generic", "auto"};
+    static const uint32_t chunks[] = {1, 7, 63, 64, 65, 200};
+    uint8_t expected[32], digest[32];
+    sha256_ctx ctx;
+
+    CHECK(sha256_self_test() == 0);
+    sha256_use_backend(NULL);
+    fprintf(stderr, "sha256 backend %s\n", sha256_backend());
+
+    for (uint32_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+        for (uint32_t len = 0; len <= MSG_MAX; len += len < 300 ? 1 : 97) {
+            reference(msg, len, expected);
+            CHECK(sha256_use_backend(backends[b]) == 0);
+            sha256(msg, len, digest);
+            CHECK(memcmp(digest, expected, 32) == 0);
+
+            for (uint32_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+                sha256_init(&ctx);
+                for (uint32_t pos = 0; pos < len; pos += chunks[c])
+                    sha256_update(&ctx, msg + pos, len - pos < chunks[c] ? len - pos : chunks[c]);
+                sha256_final(&ctx, digest);
+                CHECK(memcmp(digest, expected, 32) == 0);
+            }
+        }
+    }
+    sha256_use_backend(NULL);
+    return 0;
+}
+
+
+// 每种可用的lane数, 批量大小跨过lane数的各个边界, 长度不齐(含0与跨块的填充边界), 消息可以重叠
+static int test_many(void) {
+    static const int lane_counts[] = {0, 4, 8, 16};
+    const uint8_t *msgs[40];
+    uint32_t lens[40];
+    uint8_t digests[40][32], expected[32];
+    uint8_t *outs[40];
+
+    for (int i = 0; i < 40; ++i) outs[i] = digests[i];
+
+    for (uint32_t l = 0; l < sizeof(lane_counts) / sizeof(lane_counts[0]); ++l) {
+        if (sha256_many_use_lanes(lane_counts[l]) != 0) {
+            fprintf(stderr, "sha256_many %d lanes not supported, skipped\n", lane_counts[l]);
+            continue;
+        }
+        CHECK(sha256_many_lanes() == lane_counts[l]);
+
+        for (size_t n = 0; n <= 40; ++n) {
+            for (size_t i = 0; i < n; ++i) {
+                static const uint32_t edge[] = {0, 1, 55, 56, 63, 64, 88, 119, 120, 128};
+                lens[i] = (i % 3 == 0) ? edge[(i / 3 + n) % 10] : (uint32_t) ((i * 37 + n * 11) % 300);
+                msgs[i] = msg + (i * 13) % 200;
+            }
+            memset(digests, 0, sizeof(digests));
+            sha256_many(msgs, lens, outs, n);
+            for (size_t i = 0; i < n; ++i) {
+                reference(msgs[i], lens[i], expected);
+                CHECK(memcmp(digests[i], expected, 32) == 0);
+            }
+            sha256_use_backend(NULL);
+        }
+    }
+    sha256_many_use_lanes(-1);
+    return 0;
+}
+
+
+// 定长kernel与从中间状态继续的kernel, 与sha256()比较
+static int test_fixed(void) {
+    static const uint32_t sizes[] = {39, 55, 88, 96, 152, 40, 0};
+    uint8_t expected[32], digest[32];
+    uint32_t state[8];
+
+    for (int b = 0; b < 2; ++b) {
+        for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            reference(msg + i, sizes[i], expected);
+            sha256_use_backend(b ? NULL : "generic");
+            sha256_fixed(msg + i, sizes[i], digest);
+            CHECK(memcmp(digest, expected, 32) == 0);
+        }
+
+        // 64字节的块之后接32或88字节
+        sha256_use_backend(b ? NULL : "generic");
+        sha256_midstate(msg, state);
+        sha256_resume_32(state, msg + 64, digest);
+        reference(msg, 64 + 32, expected);
+        CHECK(memcmp(digest, expected, 32) == 0);
+
+        sha256_use_backend(b ? NULL : "generic");
+        sha256_resume_88(state, msg + 64, digest);
+        reference(msg, 64 + 88, expected);
+        CHECK(memcmp(digest, expected, 32) == 0);
+    }
+    sha256_use_backend(NULL);
+    return 0;
+}
+
+
+// 2段的每个分割位置与3段的所有分割位置, 包括长度为0的段
+static int test_updatev(void) {
+    const uint32_t len = 150;
+    uint8_t expected[32], digest[32];
+    struct iovec iov[3];
+    sha256_ctx ctx;
+
+    reference(msg, len, expected);
+    sha256_use_backend(NULL);
+
+    for (uint32_t i = 0; i <= len; ++i) {
+        for (uint32_t j = i; j <= len; ++j) {
+            iov[0].iov_base = msg;
+            iov[0].iov_len = i;
+            iov[1].iov_base = msg + i;
+            iov[1].iov_len = j - i;
+            iov[2].iov_base = msg + j;
+            iov[2].iov_len = len - j;
+            sha256_init(&ctx);
+            sha256_updatev(&ctx, iov, 3);
+            sha256_final(&ctx, digest);
+            CHECK(memcmp(digest, expected, 32) == 0);
+        }
+
+        // 先update一部分, 其余经updatev
+        iov[0].iov_base = msg + i;
+        iov[0].iov_len = len - i;
+        sha256_init(&ctx);
+        sha256_update(&ctx, msg, i);
+        sha256_updatev(&ctx, iov, 1);
+        sha256_final(&ctx, digest);
+        CHECK(memcmp(digest, expected, 32) == 0);
+    }
+
+    sha256_init(&ctx);
+    sha256_updatev(&ctx, iov, 0);
+    sha256_final(&ctx, digest);
+    reference(msg, 0, expected);
+    CHECK(memcmp(digest, expected, 32) == 0);
+    sha256_use_backend(NULL);
+    return 0;
+}
+
+
+int main(void) {
+    for (uint32_t i = 0; i < MSG_MAX; ++i) msg[i] = (uint8_t) (i * 131 + (i >> 7) * 17 + 1);
+
+    RUN_TEST(test_backends);
+    RUN_TEST(test_many);
+    RUN_TEST(test_fixed);
+    RUN_TEST(test_updatev);
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * test_sim.c
+ *
+ * 器件模型(sha204_sim)与数据手册行为一致: 出厂状态, 锁定前后的访问规则, 与主机侧sha204h_xxx一致的摘要,
+ * TempKey在sleep与看门狗超时后失效, 执行期间读NACK, 映像文件跨重启保留.
+ * 各子测试按顺序在同一个映像上执行.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_comm.h"
+#include "../sha204/sha204_comm_marshaling.h"
+#include "../sha204/sha204_helper.h"
+#include "../sha204/atsha204_i2c.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static char image_path[64];
+static struct sha204_sim *sim;
+static int fd;
+
+static uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+static uint8_t key[32], key2[32], sn[9];
+static uint8_t num_in[20] = {1, 2, 3};
+static uint8_t challenge[32] = {9, 8, 7};
+
+
+static uint8_t execute(uint8_t op_code, uint8_t param_1, uint16_t param_2, uint8_t len_1, uint8_t *data_1,
+                       uint8_t len_2, uint8_t *data_2) {
+    struct sha204_command_parameters args;
+
+    memset(&args, 0, sizeof(args));
+    args.op_code = op_code;
+    args.param_1 = param_1;
+    args.param_2 = param_2;
+    args.data_len_1 = len_1;
+    args.data_1 = data_1;
+    args.data_len_2 = len_2;
+    args.data_2 = data_2;
+    args.tx_buffer = tx;
+    args.tx_size = sizeof(tx);
+    args.rx_buffer = rx;
+    args.rx_size = sizeof(rx);
+    return sha204m_execute(fd, &args);
+}
+
+
+// Nonce(随机模式)后在主机侧算出同样的TempKey
+static int nonce(struct sha204h_temp_key *temp_key) {
+    CHECK(execute(SHA204_NONCE, NONCE_MODE_SEED_UPDATE, 0, sizeof(num_in), num_in, 0, NULL) == SHA204_SUCCESS);
+    CHECK(rx[SHA204_BUFFER_POS_COUNT] == NONCE_RSP_SIZE_LONG);
+    struct sha204h_nonce_in_out param = {NONCE_MODE_SEED_UPDATE, num_in, &rx[SHA204_BUFFER_POS_DATA], temp_key};
+    CHECK(sha204h_nonce(param) == SHA204_SUCCESS);
+    return 0;
+}
+
+
+static int test_factory_state(void) {
+    uint8_t response[4], config[88];
+
+    sha204c_wakeup(fd, response);
+    CHECK(response[0] == 4 && response[1] == 0x11 && response[2] == 0x33 && response[3] == 0x43);
+
+    CHECK(execute(SHA204_DEVREV, 0, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(rx[SHA204_BUFFER_POS_COUNT] == DEVREV_RSP_SIZE);
+
+    CHECK(atsha204_read_config(fd, config) == SHA204_SUCCESS);
+    CHECK(config[0] == 0x01 && config[1] == 0x23 && config[12] == 0xEE);
+    CHECK(config[86] == 0x55 && config[87] == 0x55);
+
+    // config区未锁定时Random输出测试图样
+    CHECK(execute(SHA204_RANDOM, RANDOM_SEED_UPDATE, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(rx[1] == 0xFF && rx[2] == 0xFF && rx[3] == 0x00 && rx[4] == 0x00);
+
+    // 字0~3只读; 锁定config区之前不能读data区, 也不能锁定data区
+    uint8_t word[4] = {1, 2, 3, 4};
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_CONFIG, 0, 4, word, 0, NULL) == SHA204_CMD_FAIL);
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 8, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    CHECK(execute(SHA204_LOCK, LOCK_ZONE_NO_CRC | LOCK_ZONE_NO_CONFIG, 0, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    return 0;
+}
+
+
+static int test_lock_and_access(void) {
+    uint8_t config[88], crc[2] = {0, 0};
+
+    // slot0: IsSecret|EncryptRead, 加密写, WriteKey 0; slot1: 明文; slot2: CheckOnly
+    uint8_t slot01[4] = {0xC0, 0x40, 0x00, 0x00};
+    uint8_t slot23[4] = {0x10, 0x00, 0x00, 0x00};
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_CONFIG, 5, 4, slot01, 0, NULL) == SHA204_SUCCESS);
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_CONFIG, 6, 4, slot23, 0, NULL) == SHA204_SUCCESS);
+
+    // CRC不对时不锁定
+    CHECK(execute(SHA204_LOCK, 0, 0x1234, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    CHECK(atsha204_read_config(fd, config) == SHA204_SUCCESS);
+    sha204h_calculate_crc_chain(sizeof(config), config, crc);
+    CHECK(execute(SHA204_LOCK, 0, crc[0] | crc[1] << 8, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_CONFIG, 5, 4, slot01, 0, NULL) == SHA204_CMD_FAIL);
+
+    // data区锁定前明文写入
+    for (uint16_t slot = 0; slot < 16; ++slot)
+        CHECK(execute(SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, slot * 8, 32,
+                      slot == 1 ? key2 : key, 0, NULL) == SHA204_SUCCESS);
+    CHECK(execute(SHA204_LOCK, LOCK_ZONE_NO_CRC | LOCK_ZONE_NO_CONFIG, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+
+    CHECK(execute(SHA204_RANDOM, RANDOM_SEED_UPDATE, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(!(rx[1] == 0xFF && rx[2] == 0xFF && rx[3] == 0x00 && rx[4] == 0x00));
+
+    CHECK(atsha204_read_sn(fd, sn) == SHA204_SUCCESS);
+    CHECK(sn[0] == 0x01 && sn[8] == 0xEE);
+
+    // slot1可明文读, slot0为IsSecret
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 8, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(memcmp(&rx[SHA204_BUFFER_POS_DATA], key2, 32) == 0);
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    return 0;
+}
+
+
+static int test_digests_match_host(void) {
+    struct sha204h_temp_key temp_key;
+    uint8_t mac[32];
+
+    // Nonce + MAC(TempKey)
+    CHECK(nonce(&temp_key) == 0);
+    CHECK(execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY, 1, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    struct sha204h_mac_in_out mac_param = {MAC_MODE_BLOCK2_TEMPKEY, 1, NULL, key2, NULL, sn, mac, &temp_key};
+    CHECK(sha204h_mac(mac_param) == SHA204_SUCCESS);
+    CHECK(memcmp(mac, &rx[SHA204_BUFFER_POS_DATA], 32) == 0);
+
+    // MAC用掉了TempKey
+    CHECK(execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY, 1, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+
+    // MAC(挑战 + SN)
+    CHECK(execute(SHA204_MAC, MAC_MODE_INCLUDE_SN, 1, 32, challenge, 0, NULL) == SHA204_SUCCESS);
+    struct sha204h_mac_in_out sn_param = {MAC_MODE_INCLUDE_SN, 1, challenge, key2, NULL, sn, mac, &temp_key};
+    CHECK(sha204h_mac(sn_param) == SHA204_SUCCESS);
+    CHECK(memcmp(mac, &rx[SHA204_BUFFER_POS_DATA], 32) == 0);
+
+    // CheckOnly的slot不能用于MAC
+    CHECK(execute(SHA204_MAC, 0, 2, 32, challenge, 0, NULL) == SHA204_CMD_FAIL);
+
+    // Nonce + HMAC
+    CHECK(nonce(&temp_key) == 0);
+    CHECK(execute(SHA204_HMAC, HMAC_MODE_INCLUDE_SN, 1, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    struct sha204h_hmac_in_out hmac_param = {HMAC_MODE_INCLUDE_SN, 1, key2, NULL, sn, mac, &temp_key};
+    CHECK(sha204h_hmac(hmac_param) == SHA204_SUCCESS);
+    CHECK(memcmp(mac, &rx[SHA204_BUFFER_POS_DATA], 32) == 0);
+
+    // CheckMac: 主机为CheckOnly的slot2算出的MAC通过, 改一位不通过
+    uint8_t packet[CHECKMAC_CLIENT_CHALLENGE_SIZE + CHECKMAC_CLIENT_RESPONSE_SIZE + CHECKMAC_OTHER_DATA_SIZE];
+    uint8_t other[CHECKMAC_OTHER_DATA_SIZE] = {SHA204_MAC, 0, 2, 0};
+    struct sha204h_mac_in_out client = {0, 2, challenge, key, NULL, sn, mac, &temp_key};
+    CHECK(sha204h_mac(client) == SHA204_SUCCESS);
+    memcpy(packet, challenge, 32);
+    memcpy(packet + 32, mac, 32);
+    memcpy(packet + 64, other, sizeof(other));
+    CHECK(execute(SHA204_CHECKMAC, 0, 2, sizeof(packet), packet, 0, NULL) == SHA204_SUCCESS);
+    CHECK(rx[SHA204_BUFFER_POS_DATA] == 0x00);
+    packet[40] ^= 1;
+    CHECK(execute(SHA204_CHECKMAC, 0, 2, sizeof(packet), packet, 0, NULL) == SHA204_SUCCESS);
+    CHECK(rx[SHA204_BUFFER_POS_DATA] == 0x01);
+    return 0;
+}
+
+
+static int test_encrypted_write_read(void) {
+    struct sha204h_temp_key temp_key;
+    uint8_t secret[32], data[32], input_mac[32], response[4];
+
+    for (int i = 0; i < 32; ++i) secret[i] = (uint8_t) (i * 3);
+
+    // 以slot0(WriteKey 0)加密写入slot0
+    CHECK(nonce(&temp_key) == 0);
+    CHECK(execute(SHA204_GENDIG, GENDIG_ZONE_DATA, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    struct sha204h_gen_dig_in_out gen_dig = {GENDIG_ZONE_DATA, 0, key, &temp_key};
+    CHECK(sha204h_gen_dig(gen_dig) == SHA204_SUCCESS);
+    memcpy(data, secret, 32);
+    struct sha204h_encrypt_in_out encrypt = {SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, data, input_mac, &temp_key};
+    CHECK(sha204h_encrypt(encrypt) == SHA204_SUCCESS);
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, 32, data, 32, input_mac)
+          == SHA204_SUCCESS);
+    // 重放: TempKey已用掉
+    CHECK(execute(SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, 32, data, 32, input_mac)
+          == SHA204_CMD_FAIL);
+
+    // 以新内容作为ReadKey加密读回
+    CHECK(nonce(&temp_key) == 0);
+    CHECK(execute(SHA204_GENDIG, GENDIG_ZONE_DATA, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    struct sha204h_gen_dig_in_out gen_dig2 = {GENDIG_ZONE_DATA, 0, secret, &temp_key};
+    CHECK(sha204h_gen_dig(gen_dig2) == SHA204_SUCCESS);
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    memcpy(data, &rx[SHA204_BUFFER_POS_DATA], 32);
+    struct sha204h_decrypt_in_out decrypt = {data, &temp_key};
+    CHECK(sha204h_decrypt(decrypt) == SHA204_SUCCESS);
+    CHECK(memcmp(data, secret, 32) == 0);
+
+    // sleep清除TempKey
+    CHECK(nonce(&temp_key) == 0);
+    CHECK(execute(SHA204_GENDIG, GENDIG_ZONE_DATA, 0, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    sha204p_sleep(fd);
+    sha204c_wakeup(fd, response);
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    return 0;
+}
+
+
+// 看门狗超时后器件自行sleep, TempKey丢失
+static int test_watchdog(void) {
+    struct sha204h_temp_key temp_key;
+    uint8_t response[4];
+
+    sha204c_wakeup(fd, response);
+    CHECK(nonce(&temp_key) == 0);
+    sha204_clock_sleep_us((SHA204_SIM_WATCHDOG_MS + 100) * 1000ULL);
+    sha204c_wakeup(fd, response);
+    CHECK(execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY, 1, 0, NULL, 0, NULL) == SHA204_CMD_FAIL);
+    return 0;
+}
+
+
+// 开启执行时间: 命令执行期间读响应被NACK
+static int test_execution_time(void) {
+    struct sha204_command_parameters args;
+    struct sha204_send_and_receive_parameters comm;
+    uint8_t response[4];
+
+    sha204_sim_set_timing(sim, 1);
+    sha204c_wakeup(fd, response);
+
+    memset(&args, 0, sizeof(args));
+    args.op_code = SHA204_RANDOM;
+    args.tx_buffer = tx;
+    args.tx_size = sizeof(tx);
+    args.rx_buffer = rx;
+    args.rx_size = sizeof(rx);
+    sha204m_prepare(fd, &args, &comm);
+    CHECK(sha204c_send(fd, &comm) == SHA204_SUCCESS);
+    CHECK(sha204c_receive(fd, &comm) != SHA204_SUCCESS);
+    sha204_clock_sleep_us(RANDOM_EXEC_MAX * 1000ULL);
+    CHECK(sha204c_receive(fd, &comm) == SHA204_SUCCESS);
+    CHECK(rx[SHA204_BUFFER_POS_COUNT] == RANDOM_RSP_SIZE);
+    sha204_sim_set_timing(sim, 0);
+    return 0;
+}
+
+
+static int test_image_persistence(void) {
+    uint8_t config[88];
+
+    sha204_sim_destroy(sim);
+    sim = sha204_sim_create(image_path);
+    CHECK(sim);
+    fd = sha204_sim_fd(sim);
+
+    CHECK(atsha204_read_config(fd, config) == SHA204_SUCCESS);
+    CHECK(config[86] == 0x00 && config[87] == 0x00);
+    CHECK(execute(SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 8, 0, NULL, 0, NULL) == SHA204_SUCCESS);
+    CHECK(memcmp(&rx[SHA204_BUFFER_POS_DATA], key2, 32) == 0);
+    return 0;
+}
+
+
+static int run_tests(void) {
+    RUN_TEST(test_factory_state);
+    RUN_TEST(test_lock_and_access);
+    RUN_TEST(test_digests_match_host);
+    RUN_TEST(test_encrypted_write_read);
+    RUN_TEST(test_watchdog);
+    RUN_TEST(test_execution_time);
+    RUN_TEST(test_image_persistence);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+
+    memset(key, 0x55, sizeof(key));
+    memset(key2, 0xA7, sizeof(key2));
+    snprintf(image_path, sizeof(image_path), "/tmp/sha204_test_sim.%d.img", (int) getpid());
+    unlink(image_path);
+    sim = sha204_sim_create(image_path);
+    if (!sim) return 1;
+    fd = sha204_sim_fd(sim);
+
+    int ret = run_tests();
+
+    sha204_sim_destroy(sim);
+    unlink(image_path);
+    return ret;
+}
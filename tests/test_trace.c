@@ -0,0 +1,168 @@
+/*
+ * test_trace.c
+ *
+ * I2C会话轨迹(sha204_trace): 录制后读回, 对同一映像的器件模型重放结果一致, 以轨迹作为器件运行同样的主机代码,
+ * 写文件失败时由flush/stop报告错误, 轨迹文件只有所有者可读.
+ */
+
+#include "sha204_test.h"
+#include "../sha204/sha204_trace.h"
+#include "../sha204/sha204_clock.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char trace_path[64], image_path[64];
+
+
+// 同一个映像上的器件模型: 会话只读不写, 每次创建时状态相同
+static struct sha204_sim *image_sim(void) {
+    struct sha204_sim *sim = sha204_sim_create(image_path);
+
+    if (sim) sha204_sim_set_timing(sim, 1);
+    return sim;
+}
+
+
+// 录制与重放都执行的主机侧会话
+static int session(int fd, uint8_t sn[9], uint8_t config[88]) {
+    CHECK(atsha204_read_sn(fd, sn) == SHA204_SUCCESS);
+    CHECK(atsha204_read_config(fd, config) == SHA204_SUCCESS);
+    return 0;
+}
+
+
+static int test_record_and_load(void) {
+    struct sha204_sim *sim = image_sim();
+    CHECK(sim);
+    uint8_t sn[9], config[88];
+
+    struct sha204_trace_rec *rec = sha204_trace_record_start(sha204_sim_fd(sim), trace_path);
+    CHECK(rec);
+    CHECK(session(sha204_sim_fd(sim), sn, config) == 0);
+    CHECK(sha204_trace_record_flush(rec) == 0);
+    CHECK(sha204_trace_record_stop(rec) == 0);
+    sha204_sim_destroy(sim);
+
+    struct sha204_trace *trace = sha204_trace_load(trace_path);
+    CHECK(trace);
+    uint32_t writes = 0, reads = 0;
+    for (uint32_t i = 0; i < sha204_trace_count(trace); ++i) {
+        const struct sha204_trace_event *ev = sha204_trace_get(trace, i);
+        if (ev->kind == SHA204_TRACE_WRITE) writes++;
+        if (ev->kind == SHA204_TRACE_READ && ev->err == 0) {
+            CHECK(ev->data);
+            reads++;
+        }
+        if (i > 0) CHECK(ev->t_us >= sha204_trace_get(trace, i - 1)->t_us);
+    }
+    // 每条Read命令至少一次写与一次成功的读
+    CHECK(writes >= 1 + 8 && reads >= 1 + 8);
+
+    // 对同一映像的新器件模型重放, 结果一致
+    sim = image_sim();
+    CHECK(sim);
+    struct sha204_trace_stats stats;
+    sha204_trace_replay(trace, sha204_sim_fd(sim), &stats);
+    CHECK(stats.events == sha204_trace_count(trace));
+    CHECK(stats.mismatched == 0);
+    CHECK(stats.matched > 0);
+    sha204_sim_destroy(sim);
+    sha204_trace_free(trace);
+    return 0;
+}
+
+
+static int test_trace_as_device(void) {
+    uint8_t sn[9], config[88], sn2[9], config2[88];
+    struct sha204_sim *sim = image_sim();
+    CHECK(sim);
+    CHECK(session(sha204_sim_fd(sim), sn, config) == 0);
+    sha204_sim_destroy(sim);
+
+    struct sha204_trace_dev *dev = sha204_trace_dev_open(trace_path);
+    CHECK(dev);
+    CHECK(session(sha204_trace_dev_fd(dev), sn2, config2) == 0);
+    CHECK(memcmp(sn, sn2, sizeof(sn)) == 0);
+    CHECK(memcmp(config, config2, sizeof(config)) == 0);
+
+    struct sha204_trace_stats stats;
+    sha204_trace_dev_stats(dev, &stats);
+    CHECK(stats.mismatched == 0);
+    sha204_trace_dev_close(dev);
+    return 0;
+}
+
+
+// 写满的文件: 停止录制, flush与stop返回-1, errno为ENOSPC
+static int test_write_failure(void) {
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+    uint8_t sn[9];
+
+    struct sha204_trace_rec *rec = sha204_trace_record_start(sha204_sim_fd(sim), "/dev/full");
+    CHECK(rec);
+    for (int i = 0; i < 100; ++i) CHECK(atsha204_read_sn(sha204_sim_fd(sim), sn) == SHA204_SUCCESS);
+    errno = 0;
+    CHECK(sha204_trace_record_flush(rec) == -1);
+    CHECK(errno == ENOSPC);
+    errno = 0;
+    CHECK(sha204_trace_record_stop(rec) == -1);
+    CHECK(errno == ENOSPC);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+// 轨迹含明文密钥: 新建与覆盖的文件都是0600, 不跟随符号链接
+static int test_private_file(void) {
+    char link_path[80];
+    struct stat st;
+    struct sha204_sim *sim = test_sim_create(0);
+    CHECK(sim);
+
+    unlink(trace_path);
+    int fd = open(trace_path, O_WRONLY | O_CREAT, 0644);
+    CHECK(fd >= 0);
+    CHECK(fchmod(fd, 0644) == 0);
+    close(fd);
+    struct sha204_trace_rec *rec = sha204_trace_record_start(sha204_sim_fd(sim), trace_path);
+    CHECK(rec);
+    CHECK(sha204_trace_record_stop(rec) == 0);
+    CHECK(stat(trace_path, &st) == 0);
+    CHECK((st.st_mode & 0777) == 0600);
+
+    snprintf(link_path, sizeof(link_path), "%s.link", trace_path);
+    CHECK(symlink(trace_path, link_path) == 0);
+    CHECK(sha204_trace_record_start(sha204_sim_fd(sim), link_path) == NULL);
+    unlink(link_path);
+
+    sha204_sim_destroy(sim);
+    return 0;
+}
+
+
+static int run_tests(void) {
+    RUN_TEST(test_record_and_load);
+    RUN_TEST(test_trace_as_device);
+    RUN_TEST(test_write_failure);
+    RUN_TEST(test_private_file);
+    return 0;
+}
+
+
+int main(void) {
+    sha204_clock_set_virtual(1);
+    snprintf(trace_path, sizeof(trace_path), "/tmp/sha204_test_trace.%d.trc", (int) getpid());
+    snprintf(image_path, sizeof(image_path), "/tmp/sha204_test_trace.%d.img", (int) getpid());
+
+    int ret = run_tests();
+
+    unlink(trace_path);
+    unlink(image_path);
+    return ret;
+}
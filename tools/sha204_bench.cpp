@@ -0,0 +1,419 @@
+/*
+ * sha204_bench.cpp
+ *
+ * 主机侧热点的微基准: CRC, SHA-256, 命令组帧, sha204h_xxx辅助计算. 不访问芯片.
+ *
+ * 用法: sha204_bench [-f filter] [-t min_ms] [-c cpu] [-b sha256_backend]
+ *   -f 只运行名称包含filter的用例
+ *   -t 每个用例至少运行的时间, 缺省200ms
+ *   -c 绑定的CPU, 缺省为启动时所在的CPU
+ *   -b SHA-256后端: auto/generic/sha-ni/armv8-sha2
+ *
+ * 输出每个用例的ns/op与MB/s. 编译时找到Google Benchmark则改用其harness(参数按Google Benchmark的规则).
+ */
+
+extern "C" {
+#include "../sha204/sha204_comm.h"
+#include "../sha204/sha204_comm_marshaling.h"
+#include "../sha204/sha204_helper.h"
+#include "../sha204/sha204_lib_return_codes.h"
+}
+#include "../sha204/sha256.h"
+
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef SHA204_BENCH_GBENCH
+#include <benchmark/benchmark.h>
+#endif
+
+
+// 阻止编译器把被测结果当作无用计算删掉
+template <class T>
+static inline void keep(T *p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+
+struct bench_case {
+    std::string name;
+    size_t bytes;                                   //!< 每次操作处理的字节数, 0表示不统计吞吐
+    std::function<void(uint64_t iterations)> run;   //!< 循环放在函数内部, 避免每次调用的间接开销
+};
+
+
+// 测试数据: 固定内容, 每次运行结果可比
+struct bench_data {
+    uint8_t key[32];
+    uint8_t challenge[32];
+    uint8_t num_in[20];
+    uint8_t rand_out[32];
+    uint8_t otp[11];
+    uint8_t sn[9];
+    uint8_t block[32];
+    uint8_t message[152];
+    uint8_t frame[SHA204_CMD_SIZE_MAX];
+    uint8_t response[32];
+    uint8_t mac[32];
+
+    bench_data() {
+        uint8_t *fields[] = {key, challenge, num_in, rand_out, otp, sn, block, message, frame};
+        size_t sizes[] = {sizeof(key), sizeof(challenge), sizeof(num_in), sizeof(rand_out), sizeof(otp),
+                          sizeof(sn), sizeof(block), sizeof(message), sizeof(frame)};
+        uint32_t x = 0x20110901;
+
+        for (size_t f = 0; f < sizeof(sizes) / sizeof(sizes[0]); ++f) {
+            for (size_t i = 0; i < sizes[f]; ++i) {
+                x = x * 1103515245 + 12345;
+                fields[f][i] = (uint8_t) (x >> 16);
+            }
+        }
+        sn[0] = SHA204_SN_0;
+        sn[1] = SHA204_SN_1;
+        sn[8] = SHA204_SN_8;
+    }
+};
+
+static bench_data data;
+
+
+// TempKey处于helper要求的状态
+static void temp_key_nonce(struct sha204h_temp_key *tk) {
+    memcpy(tk->value, data.rand_out, 32);
+    tk->key_id = 0;
+    tk->source_flag = 0;
+    tk->gen_data = 0;
+    tk->check_flag = 0;
+    tk->valid = 1;
+}
+
+static void temp_key_gen_dig(struct sha204h_temp_key *tk) {
+    temp_key_nonce(tk);
+    tk->gen_data = 1;
+}
+
+
+static void add_crc_cases(std::vector<bench_case> &cases) {
+    static const uint8_t lengths[] = {5, SHA204_RSP_SIZE_MAX - 2, SHA204_CMD_SIZE_MAX - 2};
+
+    for (uint8_t len : lengths) {
+        cases.push_back({"crc/" + std::to_string(len), len, [len](uint64_t n) {
+            uint8_t crc[2];
+            for (uint64_t i = 0; i < n; ++i) {
+                sha204c_calculate_crc(len, data.frame, crc);
+                keep(crc);
+            }
+        }});
+        cases.push_back({"crc_chain/" + std::to_string(len), len, [len](uint64_t n) {
+            uint8_t crc[2];
+            for (uint64_t i = 0; i < n; ++i) {
+                crc[0] = crc[1] = 0;
+                sha204h_calculate_crc_chain(len, data.frame, crc);
+                keep(crc);
+            }
+        }});
+    }
+}
+
+
+static void add_sha256_cases(std::vector<bench_case> &cases) {
+    static const uint32_t lengths[] = {
+        SHA204_MSG_SIZE_DERIVE_KEY_MAC, SHA204_MSG_SIZE_NONCE, SHA204_MSG_SIZE_MAC,
+        SHA204_MSG_SIZE_GEN_DIG, SHA204_MSG_SIZE_HMAC_INNER,
+    };
+
+    for (uint32_t len : lengths) {
+        cases.push_back({"sha256/" + std::to_string(len), len, [len](uint64_t n) {
+            uint8_t digest[32];
+            for (uint64_t i = 0; i < n; ++i) {
+                sha256(data.message, len, digest);
+                keep(digest);
+            }
+        }});
+        cases.push_back({"sha256_fixed/" + std::to_string(len), len, [len](uint64_t n) {
+            uint8_t digest[32];
+            for (uint64_t i = 0; i < n; ++i) {
+                sha256_fixed(data.message, len, digest);
+                keep(digest);
+            }
+        }});
+    }
+
+    // 批量校验: 256条MAC消息一次哈希
+    cases.push_back({"sha256_many/88x256", 88 * 256, [](uint64_t n) {
+        static uint8_t digests[256][32];
+        static const uint8 *msgs[256];
+        static uint32 lens[256];
+        static uint8 *outs[256];
+        for (int j = 0; j < 256; ++j) {
+            msgs[j] = data.message;
+            lens[j] = SHA204_MSG_SIZE_MAC;
+            outs[j] = digests[j];
+        }
+        for (uint64_t i = 0; i < n; ++i) {
+            sha256_many(msgs, lens, outs, 256);
+            keep(digests);
+        }
+    }});
+
+    // 固件镜像等大块数据
+    cases.push_back({"sha256_update/1M", 1 << 20, [](uint64_t n) {
+        static std::vector<uint8_t> image(1 << 20, 0x5A);
+        uint8_t digest[32];
+        for (uint64_t i = 0; i < n; ++i) {
+            sha256_ctx ctx;
+            sha256_init(&ctx);
+            sha256_update(&ctx, image.data(), (uint32) image.size());
+            sha256_final(&ctx, digest);
+            keep(digest);
+        }
+    }});
+}
+
+
+// 组帧: 参数检查 + 填充命令包 + CRC, 即sha204m_execute在I/O之前做的全部工作
+static void add_frame_case(std::vector<bench_case> &cases, const char *name, uint8_t op_code, uint8_t param_1,
+                           uint16_t param_2, uint8_t len_1, uint8_t *data_1, uint8_t len_2, uint8_t *data_2) {
+    cases.push_back({std::string("frame/") + name, 0, [=](uint64_t n) {
+        uint8_t tx[SHA204_CMD_SIZE_MAX];
+        uint8_t rx[SHA204_RSP_SIZE_MAX];
+        struct sha204_command_parameters args;
+        struct sha204_send_and_receive_parameters comm;
+
+        memset(&args, 0, sizeof(args));
+        args.op_code = op_code;
+        args.param_1 = param_1;
+        args.param_2 = param_2;
+        args.data_len_1 = len_1;
+        args.data_1 = data_1;
+        args.data_len_2 = len_2;
+        args.data_2 = data_2;
+        args.tx_buffer = tx;
+        args.rx_buffer = rx;
+        args.tx_size = sizeof(tx);
+        args.rx_size = sizeof(rx);
+
+        for (uint64_t i = 0; i < n; ++i) {
+            if (sha204m_prepare(-1, &args, &comm) != SHA204_SUCCESS) abort();
+            sha204c_calculate_crc(tx[SHA204_COUNT_IDX] - SHA204_CRC_SIZE, tx, tx + tx[SHA204_COUNT_IDX] - SHA204_CRC_SIZE);
+            keep(tx);
+        }
+    }});
+}
+
+static void add_frame_cases(std::vector<bench_case> &cases) {
+    add_frame_case(cases, "read", SHA204_READ, SHA204_ZONE_COUNT_FLAG | SHA204_ZONE_DATA, 0, 0, nullptr, 0, nullptr);
+    add_frame_case(cases, "nonce", SHA204_NONCE, NONCE_MODE_SEED_UPDATE, 0, NONCE_NUMIN_SIZE, data.num_in, 0, nullptr);
+    add_frame_case(cases, "mac", SHA204_MAC, 0, 0, MAC_CHALLENGE_SIZE, data.challenge, 0, nullptr);
+    add_frame_case(cases, "write", SHA204_WRITE, SHA204_ZONE_COUNT_FLAG | SHA204_ZONE_DATA, 0,
+                   SHA204_ZONE_ACCESS_32, data.block, WRITE_MAC_SIZE, data.mac);
+}
+
+
+static void add_helper_cases(std::vector<bench_case> &cases) {
+    cases.push_back({"helper/nonce", SHA204_MSG_SIZE_NONCE, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        struct sha204h_nonce_in_out p = {NONCE_MODE_SEED_UPDATE, data.num_in, data.rand_out, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            sha204h_nonce(p);
+            keep(&tk);
+        }
+    }});
+
+    cases.push_back({"helper/mac", SHA204_MSG_SIZE_MAC, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        struct sha204h_mac_in_out p = {0, 0, data.challenge, data.key, data.otp, data.sn, data.response, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_nonce(&tk);
+            sha204h_mac(p);
+            keep(data.response);
+        }
+    }});
+
+    cases.push_back({"helper/hmac", SHA204_MSG_SIZE_HMAC_INNER + SHA204_MSG_SIZE_HMAC_OUTER, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        struct sha204h_hmac_in_out p = {0, 0, data.key, data.otp, data.sn, data.response, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_nonce(&tk);
+            sha204h_hmac(p);
+            keep(data.response);
+        }
+    }});
+
+    cases.push_back({"helper/gen_dig", SHA204_MSG_SIZE_GEN_DIG, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        struct sha204h_gen_dig_in_out p = {GENDIG_ZONE_DATA, 0, data.key, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_nonce(&tk);
+            sha204h_gen_dig(p);
+            keep(&tk);
+        }
+    }});
+
+    cases.push_back({"helper/derive_key", SHA204_MSG_SIZE_DERIVE_KEY, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        uint8_t target[32];
+        struct sha204h_derive_key_in_out p = {0, 1, data.key, target, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_nonce(&tk);
+            sha204h_derive_key(p);
+            keep(target);
+        }
+    }});
+
+    cases.push_back({"helper/derive_key_mac", SHA204_MSG_SIZE_DERIVE_KEY_MAC, [](uint64_t n) {
+        struct sha204h_derive_key_mac_in_out p = {0, 1, data.key, data.mac};
+        for (uint64_t i = 0; i < n; ++i) {
+            sha204h_derive_key_mac(p);
+            keep(data.mac);
+        }
+    }});
+
+    cases.push_back({"helper/encrypt", SHA204_MSG_SIZE_ENCRYPT_MAC, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        uint8_t block[32];
+        struct sha204h_encrypt_in_out p = {SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG, 0, block, data.mac, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_gen_dig(&tk);
+            memcpy(block, data.block, 32);
+            sha204h_encrypt(p);
+            keep(block);
+        }
+    }});
+
+    cases.push_back({"helper/decrypt", 32, [](uint64_t n) {
+        struct sha204h_temp_key tk;
+        uint8_t block[32];
+        struct sha204h_decrypt_in_out p = {block, &tk};
+        for (uint64_t i = 0; i < n; ++i) {
+            temp_key_gen_dig(&tk);
+            memcpy(block, data.block, 32);
+            sha204h_decrypt(p);
+            keep(block);
+        }
+    }});
+}
+
+
+static std::vector<bench_case> all_cases() {
+    std::vector<bench_case> cases;
+
+    add_crc_cases(cases);
+    add_sha256_cases(cases);
+    add_frame_cases(cases);
+    add_helper_cases(cases);
+
+    return cases;
+}
+
+
+#ifdef SHA204_BENCH_GBENCH
+
+int main(int argc, char *argv[]) {
+    for (auto &c : all_cases()) {
+        benchmark::RegisterBenchmark(c.name.c_str(), [c](benchmark::State &state) {
+            for (auto _ : state) c.run(1);
+            if (c.bytes) state.SetBytesProcessed((int64_t) (state.iterations() * c.bytes));
+        });
+    }
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
+
+#else
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// 倍增迭代次数直到单轮不少于min_ns, 取5轮中最快的一轮
+static void run_case(const bench_case &c, uint64_t min_ns) {
+    uint64_t n = 1, best_ns = UINT64_MAX, best_n = 1;
+
+    for (;;) {
+        uint64_t t0 = now_ns();
+        c.run(n);
+        uint64_t dt = now_ns() - t0;
+        if (dt >= min_ns / 5) break;
+        n *= 2;
+    }
+
+    for (int round = 0; round < 5; ++round) {
+        uint64_t t0 = now_ns();
+        c.run(n);
+        uint64_t dt = now_ns() - t0;
+        if (dt * best_n < best_ns * n) {
+            best_ns = dt;
+            best_n = n;
+        }
+    }
+
+    double ns_per_op = (double) best_ns / best_n;
+    if (c.bytes)
+        printf("%-24s %12.1f ns/op %10.1f MB/s\n", c.name.c_str(), ns_per_op, c.bytes * 1e3 / ns_per_op);
+    else
+        printf("%-24s %12.1f ns/op\n", c.name.c_str(), ns_per_op);
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *filter = nullptr;
+    const char *backend = nullptr;
+    uint64_t min_ms = 200;
+    int cpu = sched_getcpu();
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:c:b:")) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 't': min_ms = strtoull(optarg, nullptr, 0); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'b': backend = optarg; break;
+        default:
+            printf("usage: %s [-f filter] [-t min_ms] [-c cpu] [-b sha256_backend]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            printf("FAILED! pin to cpu %d\n", cpu);
+            return 1;
+        }
+    }
+
+    if (backend && sha256_use_backend(backend) < 0) {
+        printf("FAILED! sha256 backend %s not supported on this CPU\n", backend);
+        return 1;
+    }
+    if (sha256_self_test() != 0) return 1;
+
+    printf("cpu %d, sha256 %s, sha256_many %d lanes, min %llu ms per case\n",
+           cpu, sha256_backend(), sha256_many_lanes(), (unsigned long long) min_ms);
+
+    for (auto &c : all_cases()) {
+        if (filter && c.name.find(filter) == std::string::npos) continue;
+        run_case(c, min_ms * 1000000ULL);
+    }
+
+    return 0;
+}
+
+#endif
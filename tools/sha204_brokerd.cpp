@@ -0,0 +1,178 @@
+/*
+ * sha204_brokerd.cpp
+ *
+ * 加密芯片broker守护进程: 独占I2C总线上的芯片, 其他进程通过sha204_client_xxx访问.
+ *
+ * 用法: sha204_brokerd [-r ms_per_s] [-e writes_per_hour] [-q depth] [-T prefix] <socket> <i2c-dev>[:addr] ...
+ *   例如 sha204_brokerd /run/sha204.sock /dev/i2c-1:0x64 /dev/i2c-2
+ *   器件编号即命令行中的顺序, addr缺省为0x64
+ *   器件写成 sim:<映像文件> 时使用进程内的器件模型(sha204_sim), 按典型执行时间模拟芯片
+ *   -r 每客户端每秒可占用的芯片时间, -e 每客户端每小时EEPROM写次数, -q 每客户端在途请求数; 0表示不限
+ *   -T 把各器件的总线读写录制到<prefix>.<器件编号>(sha204_trace), 供sha204trace重放
+ */
+
+#include "../sha204/sha204_broker.h"
+#include "../sha204/sha204_sim.h"
+#include "../sha204/sha204_trace.h"
+
+#include <fcntl.h>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+
+#define ATSHA204_ADDR  0x64
+
+
+static struct sha204_broker *broker = nullptr;
+static std::vector<struct sha204_sim *> sims;
+static std::vector<struct sha204_trace_rec *> recs;
+
+
+static void on_signal(int) {
+    if (broker) sha204_broker_stop(broker);
+}
+
+
+// 打开 "/dev/i2c-N[:addr]" 并设置从机地址, 或创建 "sim:<映像文件>" 器件模型
+static int open_device(const char *spec) {
+    std::string path(spec);
+    long addr = ATSHA204_ADDR;
+
+    if (path.compare(0, 4, "sim:") == 0) {
+        struct sha204_sim *sim = sha204_sim_create(path.c_str() + 4);
+        if (!sim) return -1;
+        sha204_sim_set_timing(sim, 1);
+        sims.push_back(sim);
+        return sha204_sim_fd(sim);
+    }
+
+    size_t colon = path.rfind(':');
+    if (colon != std::string::npos) {
+        addr = strtol(path.c_str() + colon + 1, nullptr, 0);
+        path.resize(colon);
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        printf("Unable to open %s\n", path.c_str());
+        return -1;
+    }
+
+    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
+        printf("Set chip address 0x%02lx on %s failed\n", addr, path.c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void close_device(int fd) {
+    for (size_t i = 0; i < sims.size(); ++i) {
+        if (sha204_sim_fd(sims[i]) == fd) {
+            sha204_sim_destroy(sims[i]);
+            sims.erase(sims.begin() + i);
+            return;
+        }
+    }
+    close(fd);
+}
+
+
+// 录制包在器件外面, 须在器件关闭(器件模型销毁)之前结束
+static void stop_recording() {
+    for (struct sha204_trace_rec *rec : recs) {
+        if (sha204_trace_record_stop(rec) != 0)
+            fprintf(stderr, "FAILED! trace is incomplete: %s\n", strerror(errno));
+    }
+    recs.clear();
+}
+
+
+int main(int argc, char *argv[]) {
+    struct sha204_admit_policy policy;
+    const char *trace_prefix = nullptr;
+    int opt;
+
+    sha204_admit_default_policy(&policy);
+    while ((opt = getopt(argc, argv, "r:e:q:T:")) != -1) {
+        switch (opt) {
+        case 'r':
+            policy.client_ms_per_s = (uint32_t) strtoul(optarg, nullptr, 0);
+            policy.client_burst_ms = policy.client_ms_per_s * 2;
+            break;
+        case 'e':
+            policy.eeprom_per_hour = (uint32_t) strtoul(optarg, nullptr, 0);
+            break;
+        case 'q':
+            policy.max_queued = (uint32_t) strtoul(optarg, nullptr, 0);
+            break;
+        case 'T':
+            trace_prefix = optarg;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+
+    if (argc - optind < 2) {
+        printf("usage: %s [-r ms_per_s] [-e writes_per_hour] [-q depth] [-T prefix] <socket> <i2c-dev>[:addr] ...\n", argv[0]);
+        return 1;
+    }
+
+    const char *socket_path = argv[optind];
+    broker = sha204_broker_create(socket_path);
+    if (!broker) return 1;
+    sha204_broker_set_policy(broker, &policy);
+
+    std::vector<int> fds;
+    for (int i = optind + 1; i < argc; ++i) {
+        int fd = open_device(argv[i]);
+        if (fd >= 0 && trace_prefix) {
+            std::string trace_path = std::string(trace_prefix) + "." + std::to_string(fds.size());
+            struct sha204_trace_rec *rec = sha204_trace_record_start(fd, trace_path.c_str());
+            if (rec) recs.push_back(rec);
+            else {
+                close_device(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0 || sha204_broker_add_device(broker, fd) < 0) {
+            sha204_broker_destroy(broker);
+            stop_recording();
+            if (fd >= 0) close_device(fd);
+            for (int f : fds) close_device(f);
+            return 1;
+        }
+        printf("device %zu: %s\n", fds.size(), argv[i]);
+        fds.push_back(fd);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("listening on %s\n", socket_path);
+    sha204_broker_run(broker);
+
+    sha204_broker_destroy(broker);
+    broker = nullptr;
+    stop_recording();
+    for (int f : fds) close_device(f);
+
+    return 0;
+}
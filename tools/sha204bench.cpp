@@ -0,0 +1,755 @@
+/*
+ * sha204bench.cpp
+ *
+ * 端到端负载测试: 按给定的操作比例对芯片或器件模型施加负载, 输出各操作的吞吐与时延分位数(JSON), 用于网关容量规划.
+ * 每个器件一个sha204_sched, 与broker的执行路径一致.
+ *
+ * 用法: sha204bench [-m mix] [-c clients] [-R rate] [-n ops] [-t seconds] [-d count] [-V] [-s seed] [-o file] [-T prefix] [-v] [device ...]
+ *   device  /dev/i2c-N[:addr], sim(匿名器件模型)或sim:<映像文件>; 不指定时创建-d个匿名器件模型
+ *           trace:<轨迹文件> 以录制的会话作为器件(sha204_trace), 报告中附带主机行为与录制的差异;
+ *           须用录制时的参数(-m -c -n -s)运行, 多个器件时只有单客户端的顺序是确定的
+ *   -m 操作及权重, 例如 auth=70,random=20,eread=10, 缺省auth=1
+ *        auth         slot 0密钥的MAC挑战应答, 主机侧校验
+ *        random       Random, 不更新种子
+ *        read/write   slot 3明文读写32字节
+ *        eread/ewrite 以slot 1为密钥加密读写slot 2 (Nonce + GenDig + Read/Write)
+ *        config       读出整个config区
+ *   -c 闭环客户端数, 每个客户端完成一条才发下一条, 固定使用第(客户端号 % 器件数)个器件; 缺省为器件数
+ *   -R 开环到达率(ops/s), 按固定间隔到达并轮流分给各器件; 时延从计划到达时刻算起(coordinated omission校正)
+ *   -n 操作总数, 缺省1000
+ *   -t 最长运行时间(s), 缺省不限
+ *   -d 未指定device时创建的器件模型数, 缺省1
+ *   -V 使用虚拟时间(sha204_clock), 只能用于器件模型: 按模型的执行时间计时, 结果为器件时间, 远快于真实时间
+ *   -s 随机种子(挑战, 写入数据, 操作选择)
+ *   -o JSON输出文件, 缺省为标准输出
+ *   -T 把各器件的总线读写录制到<prefix>.<器件序号>, 个人化也在其中
+ *   -v 打开协议层的逐帧打印(sha204p_set_debug), 缺省关闭
+ *
+ * 未锁定的器件先按bench_config个人化, 耗时计入provision操作; 已锁定的器件必须是本工具个人化的.
+ * write/ewrite反复擦写EEPROM, 对真实芯片慎用.
+ */
+
+extern "C" {
+#include "../sha204/sha204_comm.h"
+#include "../sha204/sha204_comm_marshaling.h"
+#include "../sha204/sha204_helper.h"
+}
+#include "../sha204/atsha204_actions.h"
+#include "../sha204/atsha204_i2c.h"
+#include "../sha204/sha204_sched.h"
+#include "../sha204/sha204_sim.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_trace.h"
+#include "../sha204/sha204_encio.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+#define ATSHA204_ADDR       0x64
+
+#define BENCH_SLOT_AUTH     0           // MAC密钥, 不可读写
+#define BENCH_SLOT_KEY      1           // 加密读写的密钥, 不可读写
+#define BENCH_SLOT_SECRET   2           // 以slot 1加密读写
+#define BENCH_SLOT_PLAIN    3           // 明文读写
+
+
+// config区16~83字节
+static const uint8_t bench_config[68] = {
+        0xc8, 0x00, 0x55, 0x00,  //I2C_Addr  CheckMacConfig  OTP_Mode  SelectorMode
+        0x80, 0x80, 0x80, 0x80,  //SlotConfig  0  1: 密钥, 不可读写
+        0xc1, 0x41, 0x00, 0x00,  //SlotConfig  2  3: 2根据slot1加密读写, 3明文读写
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig  4  5
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig  6  7
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig  8  9
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 10 11
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 12 13
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 14 15
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 0 1
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 2 3
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 4 5
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 6 7
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  0 - 3
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  4 - 7
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  8 -11
+        0xff, 0xff, 0xff, 0xff   //LastKeyUse 12 -15
+};
+
+
+enum bench_op_kind {
+    OP_AUTH,
+    OP_RANDOM,
+    OP_READ,
+    OP_WRITE,
+    OP_EREAD,
+    OP_EWRITE,
+    OP_CONFIG,
+    OP_PROVISION,                       // 只在准备阶段执行, 不能出现在mix中
+    OP_COUNT
+};
+
+static const char *const op_names[OP_COUNT] = {
+        "auth", "random", "read", "write", "eread", "ewrite", "config", "provision"
+};
+
+
+struct bench_dev {
+    std::string spec;
+    int fd = -1;
+    struct sha204_sim *sim = nullptr;
+    struct sha204_trace_dev *trace = nullptr;
+    struct sha204_trace_rec *rec = nullptr;
+    struct sha204_sched *sched = nullptr;
+};
+
+struct bench_stats {
+    std::vector<uint64_t> latency_us;   // 成功的操作
+    uint64_t service_us = 0;            // 器件上的执行时间之和
+    uint64_t errors = 0;
+};
+
+struct bench;
+
+// 一次操作, 提交时分配, 完成回调中释放
+struct bench_op {
+    struct sha204_sched_req r;
+    struct bench *b;
+    uint8_t kind;
+    uint32_t client;
+    uint64_t arrival_us;                // 开环的计划到达时间, 闭环为提交时间
+    uint8_t challenge[32];              // auth的挑战, 写操作的明文
+    uint8_t num_in[NONCE_NUMIN_SIZE];
+};
+
+struct bench {
+    std::vector<bench_dev> devs;
+    uint32_t weights[OP_COUNT] = {0};
+    uint32_t weight_total = 0;
+    uint64_t n_ops = 1000;
+    uint64_t end_us = 0;                // 0: 不限时间
+    uint8_t open_loop = 0;
+
+    uint64_t rng;                       // splitmix64状态
+    uint64_t issued = 0;
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+    uint64_t outstanding = 0;
+    uint64_t last_finish_us = 0;
+    bench_stats stats[OP_COUNT];
+};
+
+
+static uint8_t bench_key(uint8_t slot, uint8_t i) {
+    return (uint8_t) (0xA5 ^ (slot * 0x11) ^ (i * 7));
+}
+
+
+static uint64_t bench_random(struct bench *b) {
+    uint64_t z = __atomic_add_fetch(&b->rng, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+static void bench_fill(struct bench *b, uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t x = bench_random(b);
+        memcpy(buf + i, &x, std::min<size_t>(8, len - i));
+    }
+}
+
+
+static uint64_t wall_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 器件上的命令序列, 在调度器的派发线程上执行
+
+// 以BENCH_SLOT_KEY为密钥加密读写BENCH_SLOT_SECRET, Nonce + GenDig + Read/Write在sha204_encio中一次唤醒完成.
+// 调度器刚唤醒了器件
+static uint8_t bench_encio(int fd, struct bench_op *op, uint8_t write) {
+    struct sha204_awake awake = {1, sha204_clock_now_us()};
+    struct sha204_encio_op eop;
+    uint8_t key[32];
+
+    for (uint8_t i = 0; i < sizeof(key); ++i) key[i] = bench_key(BENCH_SLOT_KEY, i);
+    memset(&eop, 0, sizeof(eop));
+    eop.write = write;
+    eop.slot = BENCH_SLOT_SECRET;
+    eop.key_id = BENCH_SLOT_KEY;
+    eop.key = key;
+    if (write) memcpy(eop.data, op->challenge, sizeof(eop.data));
+    uint8_t status = sha204_encio_run(fd, &awake, NONCE_MODE_NO_SEED_UPDATE, op->num_in, &eop, 1);
+    sha204_request_sleep(fd, &awake);
+    return status;
+}
+
+
+static uint8_t job_eread(int fd, void *arg) {
+    return bench_encio(fd, (struct bench_op *) arg, 0);
+}
+
+
+static uint8_t job_ewrite(int fd, void *arg) {
+    return bench_encio(fd, (struct bench_op *) arg, 1);
+}
+
+
+static uint8_t job_config(int fd, void *arg) {
+    uint8_t config[88];
+
+    uint8_t status = atsha204_read_config(fd, config);
+    sha204p_sleep(fd);
+    return status;
+}
+
+
+// 个人化未锁定的器件; 已锁定的只检查slot配置. 实际个人化了返回时arg指向的标志置1
+static uint8_t job_provision(int fd, void *arg) {
+    uint8_t *provisioned = (uint8_t *) arg;
+    struct atsha204_config config;
+    uint8_t status = atsha204_config_snapshot(fd, &config);
+    const uint8_t *lock = config.lock;
+
+    if (status == SHA204_SUCCESS && lock[3] != 0x00) {
+        status = atsha204_write_config(fd, (uint8_t *) bench_config);
+        if (status == SHA204_SUCCESS) status = atsha204_lock_conf(fd);
+        *provisioned = 1;
+    }
+    if (status == SHA204_SUCCESS && lock[2] != 0x00) {
+        uint8_t slot_content[32];
+        for (uint8_t slot = BENCH_SLOT_AUTH; slot <= BENCH_SLOT_PLAIN && status == SHA204_SUCCESS; ++slot) {
+            for (uint8_t i = 0; i < sizeof(slot_content); ++i) slot_content[i] = bench_key(slot, i);
+            status = atsha204_write_data(fd, slot, slot_content);
+        }
+        if (status == SHA204_SUCCESS) status = atsha204_lock_data(fd);
+        *provisioned = 1;
+    }
+    // 已锁定的器件沿用开头的快照
+    if (status == SHA204_SUCCESS && *provisioned) status = atsha204_config_snapshot(fd, &config);
+    sha204p_sleep(fd);
+
+    if (status == SHA204_SUCCESS && memcmp(config.raw + 20, bench_config + 4, 32) != 0) {
+        fprintf(stderr, "FAILED! device was not provisioned by sha204bench (SlotConfig differs)\n");
+        return SHA204_CMD_FAIL;
+    }
+    return status;
+}
+
+
+static uint16_t jobs_cost_ms(uint8_t kind) {
+    switch (kind) {
+    case OP_EREAD:
+        return sha204m_get_exec_max(SHA204_NONCE) + sha204m_get_exec_max(SHA204_GENDIG)
+               + sha204m_get_exec_max(SHA204_READ);
+    case OP_EWRITE:
+        return sha204m_get_exec_max(SHA204_NONCE) + sha204m_get_exec_max(SHA204_GENDIG)
+               + sha204m_get_exec_max(SHA204_WRITE);
+    case OP_CONFIG:
+        return 8 * (SHA204_WAKEUP_DELAY_MS + sha204m_get_exec_max(SHA204_READ));
+    default:
+        return 0;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 负载驱动
+
+static bool bench_issue(struct bench *b, uint32_t client, uint64_t arrival_us);
+
+
+// 主机侧计算期望的MAC, 与器件的响应比较
+static uint8_t bench_check_auth(struct bench_op *op) {
+    uint8_t key[32], expected[32];
+
+    for (uint8_t i = 0; i < sizeof(key); ++i) key[i] = bench_key(BENCH_SLOT_AUTH, i);
+
+    struct sha204h_mac_in_out mac;
+    mac.mode = MAC_MODE_NO_TEMPKEY;
+    mac.key_id = BENCH_SLOT_AUTH;
+    mac.challenge = op->challenge;
+    mac.key = key;
+    mac.otp = nullptr;
+    mac.sn = nullptr;
+    mac.response = expected;
+    mac.temp_key = nullptr;
+    if (sha204h_mac(mac) != SHA204_SUCCESS) return SHA204_FUNC_FAIL;
+
+    return memcmp(expected, &op->r.req.rsp[SHA204_BUFFER_POS_DATA], sizeof(expected)) ? SHA204_CMD_FAIL
+                                                                                       : SHA204_SUCCESS;
+}
+
+
+// 完成回调, 在派发线程上执行. 闭环时由这里提交同一客户端的下一条, 派发线程仍是虚拟时间的参与者
+static void bench_done(struct sha204_sched_req *r, void *arg) {
+    struct bench_op *op = (struct bench_op *) arg;
+    struct bench *b = op->b;
+    uint8_t status = r->req.status;
+
+    if (status == SHA204_SUCCESS && op->kind == OP_AUTH)
+        status = bench_check_auth(op);
+
+    pthread_mutex_lock(&b->lock);
+    bench_stats &st = b->stats[op->kind];
+    if (status == SHA204_SUCCESS) {
+        st.latency_us.push_back(r->finish_us - op->arrival_us);
+        st.service_us += r->finish_us - r->start_us;
+    } else {
+        st.errors++;
+    }
+    b->last_finish_us = std::max(b->last_finish_us, r->finish_us);
+    pthread_mutex_unlock(&b->lock);
+
+    if (!b->open_loop) bench_issue(b, op->client, 0);
+    delete op;
+
+    pthread_mutex_lock(&b->lock);
+    if (--b->outstanding == 0) pthread_cond_signal(&b->idle);
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+static uint8_t bench_pick(struct bench *b) {
+    uint32_t x = (uint32_t) (bench_random(b) % b->weight_total);
+    uint8_t kind = 0;
+    while (x >= b->weights[kind]) x -= b->weights[kind++];
+    return kind;
+}
+
+
+// 提交一条操作, 达到操作总数或运行时间后返回false. arrival_us为0表示以提交时间为到达时间
+static bool bench_issue(struct bench *b, uint32_t client, uint64_t arrival_us) {
+    uint64_t now = sha204_clock_now_us();
+    if (b->end_us && now >= b->end_us) return false;
+    if (__atomic_fetch_add(&b->issued, 1, __ATOMIC_RELAXED) >= b->n_ops) return false;
+
+    struct bench_op *op = new bench_op;
+    op->b = b;
+    op->kind = bench_pick(b);
+    op->client = client;
+    op->arrival_us = arrival_us ? arrival_us : now;
+    bench_fill(b, op->challenge, sizeof(op->challenge));
+    bench_fill(b, op->num_in, sizeof(op->num_in));
+
+    struct sha204_sched_req *r = &op->r;
+    memset(r, 0, sizeof(*r));
+    sha204_sched_req_init(r, SHA204_PRIO_NORMAL, 0);
+    r->on_complete = bench_done;
+    r->complete_arg = op;
+
+    switch (op->kind) {
+    case OP_AUTH:
+        sha204_request_init(&r->req, SHA204_MAC, MAC_MODE_NO_TEMPKEY, BENCH_SLOT_AUTH,
+                            op->challenge, sizeof(op->challenge));
+        break;
+    case OP_RANDOM:
+        sha204_request_init(&r->req, SHA204_RANDOM, RANDOM_NO_SEED_UPDATE, 0, nullptr, 0);
+        break;
+    case OP_READ:
+        sha204_request_init(&r->req, SHA204_READ, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG,
+                            BENCH_SLOT_PLAIN * 8, nullptr, 0);
+        break;
+    case OP_WRITE:
+        sha204_request_init(&r->req, SHA204_WRITE, SHA204_ZONE_DATA | SHA204_ZONE_COUNT_FLAG,
+                            BENCH_SLOT_PLAIN * 8, op->challenge, sizeof(op->challenge));
+        break;
+    case OP_EREAD:
+        r->job = job_eread;
+        break;
+    case OP_EWRITE:
+        r->job = job_ewrite;
+        break;
+    case OP_CONFIG:
+        r->job = job_config;
+        break;
+    }
+    if (r->job) {
+        r->job_arg = op;
+        r->job_cost_ms = jobs_cost_ms(op->kind);
+    }
+
+    pthread_mutex_lock(&b->lock);
+    b->outstanding++;
+    pthread_mutex_unlock(&b->lock);
+
+    struct sha204_sched *s = b->devs[client % b->devs.size()].sched;
+    if (sha204_sched_submit(s, r) != SHA204_SUCCESS) {
+        pthread_mutex_lock(&b->lock);
+        b->stats[op->kind].errors++;
+        b->outstanding--;
+        pthread_mutex_unlock(&b->lock);
+        delete op;
+    }
+    return true;
+}
+
+
+// 开环到达: 第k条的计划到达时间为start + k/rate, 落后时立即补发, 时延仍从计划时间算起
+struct bench_arrivals {
+    struct bench *b;
+    double rate;
+};
+
+static void *bench_arrival_thread(void *arg) {
+    struct bench_arrivals *a = (struct bench_arrivals *) arg;
+    uint64_t start_us = sha204_clock_now_us();
+
+    sha204_clock_join();
+    for (uint64_t k = 0;; ++k) {
+        uint64_t arrival_us = start_us + (uint64_t) llround((double) k * 1e6 / a->rate);
+        if (a->b->end_us && arrival_us >= a->b->end_us) break;
+        sha204_clock_sleep_until_us(arrival_us);
+        if (!bench_issue(a->b, (uint32_t) k, arrival_us)) break;
+    }
+    sha204_clock_leave();
+
+    return nullptr;
+}
+
+
+static void bench_wait_idle(struct bench *b) {
+    pthread_mutex_lock(&b->lock);
+    while (b->outstanding) pthread_cond_wait(&b->idle, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+// 各器件并行个人化, 时延计入provision
+static bool bench_provision(struct bench *b) {
+    std::vector<struct sha204_sched_req> reqs(b->devs.size());
+    std::vector<uint8_t> provisioned(b->devs.size(), 0);
+    std::vector<uint8_t> submitted(b->devs.size(), 0);
+    bool ok = true;
+
+    sha204_clock_join();
+    for (size_t i = 0; i < b->devs.size(); ++i) {
+        sha204_sched_req_init(&reqs[i], SHA204_PRIO_NORMAL, 0);
+        reqs[i].job = job_provision;
+        reqs[i].job_arg = &provisioned[i];
+        reqs[i].job_cost_ms = 1000;
+        uint8_t status = sha204_sched_submit(b->devs[i].sched, &reqs[i]);
+        if (status != SHA204_SUCCESS) {
+            // 未入队的请求不会完成, 不能wait
+            fprintf(stderr, "FAILED! provision %s: submit 0x%02x\n", b->devs[i].spec.c_str(), status);
+            ok = false;
+            continue;
+        }
+        submitted[i] = 1;
+    }
+    sha204_clock_leave();
+
+    for (size_t i = 0; i < b->devs.size(); ++i) {
+        if (!submitted[i]) continue;
+        uint8_t status = sha204_sched_wait(b->devs[i].sched, &reqs[i]);
+        if (status != SHA204_SUCCESS) {
+            fprintf(stderr, "FAILED! provision %s: 0x%02x\n", b->devs[i].spec.c_str(), status);
+            ok = false;
+            continue;
+        }
+        if (provisioned[i]) {
+            bench_stats &st = b->stats[OP_PROVISION];
+            st.latency_us.push_back(reqs[i].finish_us - reqs[i].submit_us);
+            st.service_us += reqs[i].finish_us - reqs[i].start_us;
+        }
+    }
+    return ok;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// 参数, 器件, 报告
+
+static bool parse_mix(struct bench *b, const char *mix) {
+    std::string s(mix);
+    size_t pos = 0;
+
+    while (pos < s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        std::string item = s.substr(pos, comma - pos);
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        uint32_t weight = eq == std::string::npos ? 1 : (uint32_t) strtoul(item.c_str() + eq + 1, nullptr, 0);
+
+        int kind = 0;
+        while (kind < OP_PROVISION && name != op_names[kind]) kind++;
+        if (kind == OP_PROVISION) {
+            fprintf(stderr, "FAILED! unknown operation %s in mix\n", name.c_str());
+            return false;
+        }
+        b->weights[kind] += weight;
+        b->weight_total += weight;
+        pos = comma + 1;
+    }
+
+    if (!b->weight_total) {
+        fprintf(stderr, "FAILED! empty mix\n");
+        return false;
+    }
+    return true;
+}
+
+
+// 打开 "/dev/i2c-N[:addr]" 并设置从机地址, 或创建 "sim" / "sim:<映像文件>" 器件模型, 或 "trace:<轨迹文件>"
+static bool open_device(struct bench_dev *dev) {
+    std::string path(dev->spec);
+    long addr = ATSHA204_ADDR;
+
+    if (path.compare(0, 6, "trace:") == 0) {
+        dev->trace = sha204_trace_dev_open(path.c_str() + 6);
+        if (!dev->trace) return false;
+        dev->fd = sha204_trace_dev_fd(dev->trace);
+        return true;
+    }
+
+    if (path == "sim" || path.compare(0, 4, "sim:") == 0) {
+        dev->sim = sha204_sim_create(path.size() > 4 ? path.c_str() + 4 : nullptr);
+        if (!dev->sim) return false;
+        sha204_sim_set_timing(dev->sim, 1);
+        dev->fd = sha204_sim_fd(dev->sim);
+        return true;
+    }
+
+    size_t colon = path.rfind(':');
+    if (colon != std::string::npos) {
+        addr = strtol(path.c_str() + colon + 1, nullptr, 0);
+        path.resize(colon);
+    }
+
+    dev->fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (dev->fd < 0) {
+        fprintf(stderr, "FAILED! unable to open %s\n", path.c_str());
+        return false;
+    }
+    if (ioctl(dev->fd, I2C_SLAVE, addr) < 0) {
+        fprintf(stderr, "FAILED! set chip address 0x%02lx on %s\n", addr, path.c_str());
+        close(dev->fd);
+        dev->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+
+static void close_device(struct bench_dev *dev) {
+    sha204_sched_destroy(dev->sched);
+    if (sha204_trace_record_stop(dev->rec) != 0)
+        fprintf(stderr, "FAILED! trace of %s is incomplete: %s\n", dev->spec.c_str(), strerror(errno));
+    if (dev->trace) sha204_trace_dev_close(dev->trace);
+    else if (dev->sim) sha204_sim_destroy(dev->sim);
+    else if (dev->fd >= 0) close(dev->fd);
+}
+
+
+// 最近秩分位数, v已排序
+static uint64_t percentile(const std::vector<uint64_t> &v, double p) {
+    if (v.empty()) return 0;
+    size_t rank = (size_t) std::ceil(p / 100.0 * v.size());
+    return v[rank ? rank - 1 : 0];
+}
+
+
+static void report_stats(FILE *out, const char *name, bench_stats &st, double duration_s, bool last) {
+    std::vector<uint64_t> &v = st.latency_us;
+    std::sort(v.begin(), v.end());
+
+    uint64_t sum = 0;
+    for (uint64_t x : v) sum += x;
+    double n = (double) v.size();
+
+    fprintf(out, "    \"%s\": {\"count\": %zu, \"errors\": %llu, \"throughput_ops\": %.2f, "
+                 "\"latency_us\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}, "
+                 "\"service_us_mean\": %.1f}%s\n",
+            name, v.size(), (unsigned long long) st.errors, duration_s > 0 ? n / duration_s : 0.0,
+            v.empty() ? 0.0 : sum / n,
+            (unsigned long long) percentile(v, 50), (unsigned long long) percentile(v, 90),
+            (unsigned long long) percentile(v, 99), (unsigned long long) percentile(v, 99.9),
+            (unsigned long long) (v.empty() ? 0 : v.back()),
+            v.empty() ? 0.0 : st.service_us / n, last ? "" : ",");
+}
+
+
+int main(int argc, char *argv[]) {
+    static struct bench b;
+    const char *mix = "auth=1";
+    const char *out_path = nullptr;
+    const char *trace_prefix = nullptr;
+    uint32_t clients = 0, n_sims = 1;
+    double rate = 0, seconds = 0;
+    uint8_t virtual_time = 0, verbose = 0;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:c:R:n:t:d:Vs:o:T:v")) != -1) {
+        switch (opt) {
+        case 'm': mix = optarg; break;
+        case 'c': clients = (uint32_t) strtoul(optarg, nullptr, 0); break;
+        case 'R': rate = atof(optarg); break;
+        case 'n': b.n_ops = strtoull(optarg, nullptr, 0); break;
+        case 't': seconds = atof(optarg); break;
+        case 'd': n_sims = (uint32_t) strtoul(optarg, nullptr, 0); break;
+        case 'V': virtual_time = 1; break;
+        case 's': seed = strtoull(optarg, nullptr, 0); break;
+        case 'o': out_path = optarg; break;
+        case 'T': trace_prefix = optarg; break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-m mix] [-c clients] [-R rate] [-n ops] [-t seconds] [-d count] [-V] "
+                            "[-s seed] [-o file] [-T prefix] [-v] [device ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!parse_mix(&b, mix)) return 1;
+    b.rng = seed;
+    b.open_loop = rate > 0;
+
+    for (int i = optind; i < argc; ++i) {
+        b.devs.emplace_back();
+        b.devs.back().spec = argv[i];
+    }
+    for (uint32_t i = 0; optind == argc && i < n_sims; ++i) {
+        b.devs.emplace_back();
+        b.devs.back().spec = "sim";
+    }
+    if (b.devs.empty()) {
+        fprintf(stderr, "FAILED! no device\n");
+        return 1;
+    }
+    if (!clients) clients = (uint32_t) b.devs.size();
+
+    if (virtual_time) {
+        for (auto &dev : b.devs) {
+            if (dev.spec.compare(0, 3, "sim") != 0 && dev.spec.compare(0, 6, "trace:") != 0) {
+                fprintf(stderr, "FAILED! -V requires simulated or traced devices, got %s\n", dev.spec.c_str());
+                return 1;
+            }
+        }
+        sha204_clock_set_virtual(1);
+    }
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            fprintf(stderr, "FAILED! open %s\n", out_path);
+            return 1;
+        }
+    }
+    sha204p_set_debug(verbose);
+
+    bool ok = true;
+    for (size_t i = 0; i < b.devs.size(); ++i) {
+        struct bench_dev &dev = b.devs[i];
+        ok = ok && open_device(&dev);
+        if (ok && trace_prefix) {
+            std::string trace_path = std::string(trace_prefix) + "." + std::to_string(i);
+            dev.rec = sha204_trace_record_start(dev.fd, trace_path.c_str());
+            ok = dev.rec != nullptr;
+        }
+        if (ok) dev.sched = sha204_sched_create(dev.fd);
+        ok = ok && dev.sched;
+    }
+    ok = ok && bench_provision(&b);
+
+    uint64_t wall_start = wall_us();
+    uint64_t start_us = sha204_clock_now_us();
+    if (seconds > 0) b.end_us = start_us + (uint64_t) (seconds * 1e6);
+
+    if (ok && b.open_loop) {
+        struct bench_arrivals arrivals = {&b, rate};
+        pthread_t thread;
+        pthread_create(&thread, nullptr, bench_arrival_thread, &arrivals);
+        pthread_join(thread, nullptr);
+        bench_wait_idle(&b);
+    } else if (ok) {
+        // 提交各客户端的第一条时参与虚拟时间, 避免先提交的器件在其余请求到达前推进时间
+        sha204_clock_join();
+        for (uint32_t c = 0; c < clients; ++c)
+            if (!bench_issue(&b, c, 0)) break;
+        sha204_clock_leave();
+        bench_wait_idle(&b);
+    }
+
+    uint64_t wall_elapsed = wall_us() - wall_start;
+    double duration_s = b.last_finish_us > start_us ? (b.last_finish_us - start_us) / 1e6 : 0;
+
+    std::vector<struct sha204_trace_stats> traced;
+    for (auto &dev : b.devs) {
+        if (ok && dev.trace) {
+            traced.emplace_back();
+            sha204_trace_dev_stats(dev.trace, &traced.back());
+        }
+        close_device(&dev);
+    }
+    if (!ok) return 1;
+
+    uint64_t total = 0, errors = 0;
+    for (int kind = 0; kind < OP_PROVISION; ++kind) {
+        total += b.stats[kind].latency_us.size();
+        errors += b.stats[kind].errors;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"devices\": %zu,\n", b.devs.size());
+    fprintf(out, "  \"backend\": \"%s\",\n", b.devs[0].trace ? "trace" : b.devs[0].sim ? "sim" : "i2c");
+    fprintf(out, "  \"clock\": \"%s\",\n", virtual_time ? "virtual" : "real");
+    fprintf(out, "  \"mode\": \"%s\",\n", b.open_loop ? "open" : "closed");
+    if (b.open_loop) fprintf(out, "  \"rate_ops\": %.2f,\n", rate);
+    else fprintf(out, "  \"clients\": %u,\n", clients);
+    fprintf(out, "  \"mix\": \"%s\",\n", mix);
+    fprintf(out, "  \"duration_s\": %.6f,\n", duration_s);
+    fprintf(out, "  \"wall_s\": %.6f,\n", wall_elapsed / 1e6);
+    fprintf(out, "  \"ops\": %llu,\n", (unsigned long long) total);
+    fprintf(out, "  \"errors\": %llu,\n", (unsigned long long) errors);
+    fprintf(out, "  \"throughput_ops\": %.2f,\n", duration_s > 0 ? total / duration_s : 0.0);
+    fprintf(out, "  \"operations\": {\n");
+
+    std::vector<int> kinds;
+    for (int kind = 0; kind < OP_COUNT; ++kind)
+        if (b.weights[kind] || b.stats[kind].latency_us.size() || b.stats[kind].errors) kinds.push_back(kind);
+    for (size_t i = 0; i < kinds.size(); ++i)
+        report_stats(out, op_names[kinds[i]], b.stats[kinds[i]], kinds[i] == OP_PROVISION ? 0 : duration_s,
+                     i + 1 == kinds.size());
+
+    fprintf(out, "  }%s\n", traced.empty() ? "" : ",");
+
+    // 主机行为与录制的差异, 每个trace器件一项
+    if (!traced.empty()) {
+        fprintf(out, "  \"trace\": [\n");
+        for (size_t i = 0; i < traced.size(); ++i) {
+            const struct sha204_trace_stats &ts = traced[i];
+            fprintf(out, "    {\"events\": %u, \"matched\": %u, \"mismatched\": %u, \"skipped\": %u, \"extra\": %u, "
+                         "\"recorded_us\": %llu, \"replayed_us\": %llu, \"max_skew_us\": %lld, \"mean_skew_us\": %lld}%s\n",
+                    ts.events, ts.matched, ts.mismatched, ts.skipped, ts.extra,
+                    (unsigned long long) ts.recorded_us, (unsigned long long) ts.replayed_us,
+                    (long long) ts.max_skew_us, (long long) ts.mean_skew_us, i + 1 == traced.size() ? "" : ",");
+        }
+        fprintf(out, "  ]\n");
+    }
+    fprintf(out, "}\n");
+    if (out != stdout) fclose(out);
+
+    return errors ? 2 : 0;
+}
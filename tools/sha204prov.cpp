@@ -0,0 +1,247 @@
+/*
+ * sha204prov.cpp
+ *
+ * 夹具上多颗芯片的个人化(sha204_provision), 输出每个插座的结果(JSON).
+ *
+ * 用法: sha204prov [-V] [-C] [-l none|config|all] [-k <主密钥文件>] [-o <报告文件>] <device>...
+ *   device为 /dev/i2c-N[:addr], sim 或 sim:<映像文件>; 同一个i2c-dev文件上的插座在同一条总线上,
+ *   器件模型全部算作一条总线
+ *   -l 锁定策略, 默认all
+ *   -C 以CRC锁定data区(SHA204_PROV_CRC_BLANK), 只用于出厂状态的芯片: 未写的slot与OTP区须为0xFF;
+ *      默认不带CRC
+ *   -k 32字节主密钥, 文件内容为64个十六进制字符(可带换行), "-"表示从标准输入读; 不经命令行传递,
+ *      避免ps与/proc/<pid>/cmdline泄露. slot 0 写入 SHA-256(主密钥 || SN || 0), 每颗芯片不同;
+ *      不给出时与main.cpp相同写固定内容
+ *   -V 使用虚拟时间, 只能用于器件模型
+ * 配置与main.cpp的atsha204_init相同. 全部成功返回0, 否则返回2.
+ */
+
+#include "../sha204/sha204_provision.h"
+#include "../sha204/sha204_sim.h"
+#include "../sha204/sha204_clock.h"
+#include "../sha204/sha204_lib_return_codes.h"
+#include "../sha204/sha256.h"
+
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+
+#define ATSHA204_ADDR  0x64
+
+
+static const uint8_t defconfig[68] = {
+        0xc8, 0x00, 0x55, 0x00,  //I2C_Addr  CheckMacConfig  OTP_Mode  SelectorMode
+        0x80, 0x80, 0xC0, 0xF0,  //SlotConfig  0  1
+        0x41, 0x40, 0x41, 0x00,  //SlotConfig  2  3
+        0x80, 0xA0, 0x80, 0xA0,  //SlotConfig  4  5
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig  6  7
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig  8  9
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 10 11
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 12 13
+        0x00, 0x00, 0x00, 0x00,  //SlotConfig 14 15
+
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 0 1
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 2 3
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 4 5
+        0xff, 0x00, 0xff, 0x00,  //UseFlag UpdateCount 6 7
+
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  0 - 3
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  4 - 7
+        0xff, 0xff, 0xff, 0xff,  //LastKeyUse  8 -11
+        0xff, 0xff, 0xff, 0xff   //LastKeyUse 12 -15
+};
+
+
+// 按芯片派生的密钥: SHA-256(主密钥 || SN || slot)
+static uint8_t derive_secret(void *ctx, const uint8_t sn[9], uint8_t slot, uint8_t out[32]) {
+    uint8_t msg[32 + 9 + 1];
+
+    memcpy(msg, ctx, 32);
+    memcpy(msg + 32, sn, 9);
+    msg[41] = slot;
+    sha256(msg, sizeof(msg), out);
+    explicit_bzero(msg, sizeof(msg));
+    return SHA204_SUCCESS;
+}
+
+
+// 从文件或标准输入("-")读取64个十六进制字符的主密钥. 直接read, 不经stdio缓冲留下副本
+static int read_key(const char *path, uint8_t key[32]) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    char hex[67];
+    size_t len = 0;
+    int ret = 0;
+
+    if (fd < 0) {
+        fprintf(stderr, "FAILED! unable to open %s\n", path);
+        return -1;
+    }
+    while (len < sizeof(hex)) {
+        ssize_t n = read(fd, hex + len, sizeof(hex) - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t) n;
+    }
+    if (fd != STDIN_FILENO) close(fd);
+
+    while (len > 0 && (hex[len - 1] == '\n' || hex[len - 1] == '\r')) len--;
+    if (len != 64) ret = -1;
+    for (int i = 0; i < 32 && ret == 0; ++i) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], 0};
+        char *end;
+        key[i] = (uint8_t) strtoul(byte, &end, 16);
+        if (*end) ret = -1;
+        explicit_bzero(byte, sizeof(byte));
+    }
+    explicit_bzero(hex, sizeof(hex));
+    if (ret != 0) {
+        explicit_bzero(key, 32);
+        fprintf(stderr, "FAILED! %s: master key must be 64 hex characters\n", path);
+    }
+    return ret;
+}
+
+
+// 打开 "/dev/i2c-N[:addr]" 并设置从机地址, 或创建 "sim" / "sim:<映像文件>" 器件模型; bus为所在总线的名字
+static int open_device(const std::string &spec, struct sha204_sim **sim, std::string &bus) {
+    std::string path(spec);
+    long addr = ATSHA204_ADDR;
+
+    if (path == "sim" || path.compare(0, 4, "sim:") == 0) {
+        *sim = sha204_sim_create(path.size() > 4 ? path.c_str() + 4 : nullptr);
+        if (!*sim) return -1;
+        sha204_sim_set_timing(*sim, 1);
+        bus = "sim";
+        return sha204_sim_fd(*sim);
+    }
+
+    size_t colon = path.rfind(':');
+    if (colon != std::string::npos) {
+        addr = strtol(path.c_str() + colon + 1, nullptr, 0);
+        path.resize(colon);
+    }
+    bus = path;
+
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "FAILED! unable to open %s\n", path.c_str());
+        return -1;
+    }
+    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
+        fprintf(stderr, "FAILED! set chip address 0x%02lx on %s\n", addr, path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int main(int argc, char *argv[]) {
+    uint8_t virtual_time = 0, lock = SHA204_PROV_LOCK_ALL, data_crc = SHA204_PROV_CRC_NONE, have_key = 0;
+    uint8_t master_key[32];
+    const char *report_path = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "VCl:k:o:")) != -1) {
+        if (opt == 'V') {
+            virtual_time = 1;
+        } else if (opt == 'C') {
+            data_crc = SHA204_PROV_CRC_BLANK;
+        } else if (opt == 'l' && strcmp(optarg, "none") == 0) {
+            lock = SHA204_PROV_LOCK_NONE;
+        } else if (opt == 'l' && strcmp(optarg, "config") == 0) {
+            lock = SHA204_PROV_LOCK_CONFIG;
+        } else if (opt == 'l' && strcmp(optarg, "all") == 0) {
+            lock = SHA204_PROV_LOCK_ALL;
+        } else if (opt == 'k' && read_key(optarg, master_key) == 0) {
+            have_key = 1;
+        } else if (opt == 'o') {
+            report_path = optarg;
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-V] [-C] [-l none|config|all] [-k <master key file|->] [-o <report>] <device>...\n",
+                argv[0]);
+        return 1;
+    }
+
+    uint32_t n = (uint32_t) (argc - optind);
+    std::vector<struct sha204_prov_socket> sockets(n);
+    std::vector<struct sha204_prov_result> results(n);
+    std::vector<struct sha204_sim *> sims(n, nullptr);
+    std::vector<std::string> buses;
+    int ret = 0;
+
+    for (uint32_t i = 0; i < n && ret == 0; ++i) {
+        std::string spec(argv[optind + i]), bus;
+        if (virtual_time && spec.compare(0, 3, "sim") != 0) {
+            fprintf(stderr, "FAILED! -V requires simulated devices, got %s\n", spec.c_str());
+            ret = 1;
+            break;
+        }
+        sockets[i].fd = open_device(spec, &sims[i], bus);
+        if (sockets[i].fd < 0) {
+            ret = 1;
+            break;
+        }
+        for (sockets[i].bus = 0; sockets[i].bus < buses.size() && buses[sockets[i].bus] != bus; ++sockets[i].bus);
+        if (sockets[i].bus == buses.size()) buses.push_back(bus);
+    }
+
+    if (ret == 0) {
+        uint8_t slot_content[3][32];
+        memset(slot_content, 0, sizeof(slot_content));
+        memcpy(slot_content[0], "3wlink.cn", 9);
+        memcpy(slot_content[1], "GgsDdu.2017", 11);
+        memcpy(slot_content[2], "Admin_123", 9);
+        const struct sha204_prov_slot slots[] = {
+                {0, have_key ? nullptr : slot_content[0], derive_secret, master_key},
+                {4, slot_content[1], nullptr, nullptr},
+                {5, slot_content[2], nullptr, nullptr},
+        };
+        struct sha204_prov_profile profile;
+        memcpy(profile.config, defconfig, sizeof(profile.config));
+        profile.slots = slots;
+        profile.n_slots = 3;
+        profile.lock = lock;
+        profile.data_crc = data_crc;
+
+        if (virtual_time) sha204_clock_set_virtual(1);
+        uint64_t start_us = sha204_clock_now_us();
+        uint8_t status = sha204_provision_run(&profile, sockets.data(), n, results.data());
+        uint64_t elapsed_us = sha204_clock_now_us() - start_us;
+
+        FILE *out = report_path ? fopen(report_path, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "FAILED! unable to open %s\n", report_path);
+            out = stdout;
+        }
+        sha204_provision_report(out, sockets.data(), results.data(), n);
+        if (out != stdout) fclose(out);
+
+        uint32_t ok = 0;
+        for (uint32_t i = 0; i < n; ++i) ok += results[i].status == SHA204_SUCCESS;
+        fprintf(stderr, "%u/%u sockets provisioned on %zu bus(es) in %.1f ms\n",
+                ok, n, buses.size(), (double) elapsed_us / 1000.0);
+        ret = status == SHA204_SUCCESS ? 0 : 2;
+    }
+    explicit_bzero(master_key, sizeof(master_key));
+
+    for (uint32_t i = 0; i < n; ++i) {
+        if (sims[i]) sha204_sim_destroy(sims[i]);
+        else if (sockets[i].fd > 0) close(sockets[i].fd);
+    }
+    return ret;
+}
@@ -0,0 +1,154 @@
+/*
+ * sha204trace.cpp
+ *
+ * I2C会话轨迹(sha204_trace)的查看与重放.
+ *
+ * 用法: sha204trace dump <轨迹文件>
+ *       sha204trace replay [-V] <轨迹文件> <device>
+ *   dump    逐条打印事件: 相对时间, 耗时, 类型(wake/sleep/idle/send/recv), 结果与数据
+ *   replay  按录制的时间把主机侧的读写发给device, 输出结果与时间的差异(JSON).
+ *           device为 /dev/i2c-N[:addr], sim 或 sim:<映像文件>; 器件状态须与录制开始时相同
+ *           (例如同一个映像的拷贝), 否则个人化, 计数器等步骤的结果不同.
+ *           Nonce/Random等含随机数的响应总是计为mismatched.
+ *   -V 使用虚拟时间, 只能用于器件模型
+ *
+ * 以当前主机代码对轨迹运行(器件侧重放)见 sha204bench 的 trace:<轨迹文件>.
+ */
+
+#include "../sha204/sha204_sim.h"
+#include "../sha204/sha204_trace.h"
+#include "../sha204/sha204_clock.h"
+
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+
+#define ATSHA204_ADDR  0x64
+
+
+static int dump(const char *path) {
+    struct sha204_trace *trace = sha204_trace_load(path);
+    if (!trace) return 1;
+
+    uint32_t count = sha204_trace_count(trace);
+    for (uint32_t i = 0; i < count; ++i) {
+        const struct sha204_trace_event *ev = sha204_trace_get(trace, i);
+        printf("%10llu.%06llu %6u us  %-5s %3u ",
+               (unsigned long long) (ev->t_us / 1000000), (unsigned long long) (ev->t_us % 1000000),
+               ev->dur_us, sha204_trace_kind_name(ev), ev->len);
+        if (ev->err) printf("%s", strerror(ev->err));
+        else printf("ok");
+        if (ev->data) {
+            printf(" [");
+            for (int j = 0; j < ev->len; ++j) printf(j ? " %02x" : "%02x", ev->data[j]);
+            printf("]");
+        }
+        printf("\n");
+    }
+
+    sha204_trace_free(trace);
+    return 0;
+}
+
+
+// 打开 "/dev/i2c-N[:addr]" 并设置从机地址, 或创建 "sim" / "sim:<映像文件>" 器件模型
+static int open_device(const std::string &spec, struct sha204_sim **sim) {
+    std::string path(spec);
+    long addr = ATSHA204_ADDR;
+
+    if (path == "sim" || path.compare(0, 4, "sim:") == 0) {
+        *sim = sha204_sim_create(path.size() > 4 ? path.c_str() + 4 : nullptr);
+        if (!*sim) return -1;
+        sha204_sim_set_timing(*sim, 1);
+        return sha204_sim_fd(*sim);
+    }
+
+    size_t colon = path.rfind(':');
+    if (colon != std::string::npos) {
+        addr = strtol(path.c_str() + colon + 1, nullptr, 0);
+        path.resize(colon);
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "FAILED! unable to open %s\n", path.c_str());
+        return -1;
+    }
+    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
+        fprintf(stderr, "FAILED! set chip address 0x%02lx on %s\n", addr, path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static int replay(int argc, char *argv[]) {
+    uint8_t virtual_time = 0;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "V")) != -1) {
+        if (opt != 'V') return -1;
+        virtual_time = 1;
+    }
+    if (argc - optind != 2) return -1;
+
+    std::string spec(argv[optind + 1]);
+    if (virtual_time) {
+        if (spec.compare(0, 3, "sim") != 0) {
+            fprintf(stderr, "FAILED! -V requires a simulated device, got %s\n", spec.c_str());
+            return 1;
+        }
+        sha204_clock_set_virtual(1);
+    }
+
+    struct sha204_trace *trace = sha204_trace_load(argv[optind]);
+    if (!trace) return 1;
+
+    struct sha204_sim *sim = nullptr;
+    int fd = open_device(spec, &sim);
+    if (fd < 0) {
+        sha204_trace_free(trace);
+        return 1;
+    }
+
+    struct sha204_trace_stats stats;
+    sha204_clock_join();
+    sha204_trace_replay(trace, fd, &stats);
+    sha204_clock_leave();
+
+    if (sim) sha204_sim_destroy(sim);
+    else close(fd);
+    sha204_trace_free(trace);
+
+    printf("{\"events\": %u, \"matched\": %u, \"mismatched\": %u, \"recorded_us\": %llu, \"replayed_us\": %llu, "
+           "\"max_skew_us\": %lld, \"mean_skew_us\": %lld}\n",
+           stats.events, stats.matched, stats.mismatched,
+           (unsigned long long) stats.recorded_us, (unsigned long long) stats.replayed_us,
+           (long long) stats.max_skew_us, (long long) stats.mean_skew_us);
+    return stats.mismatched ? 2 : 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    int ret = -1;
+
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) ret = dump(argv[2]);
+    else if (argc >= 2 && strcmp(argv[1], "replay") == 0) ret = replay(argc - 1, argv + 1);
+
+    if (ret < 0) {
+        fprintf(stderr, "usage: %s dump <trace>\n"
+                        "       %s replay [-V] <trace> <device>\n", argv[0], argv[0]);
+        return 1;
+    }
+    return ret;
+}